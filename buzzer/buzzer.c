@@ -16,79 +16,30 @@
  *    You should have received a copy of the GNU Lesser General Public License
  *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdint.h>
 #include <avr/io.h>
-#include <util/delay.h>
-
-enum t0_prescaler
-{
-    T0_PRESCALER_1 = _BV(CS00),
-    T0_PRESCALER_8 = _BV(CS01),
-    T0_PRESCALER_64 = _BV(CS00) | _BV(CS01),
-    T0_PRESCALER_256 = _BV(CS02),
-    T0_PRESCALER_1024 = _BV(CS02) | _BV(CS00),
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include "tone.h"
+
+static const struct tone_event melody[] PROGMEM = {
+    TONE_EVENT(TONE_NOTE(A, 4), 200, 0), /* 440Hz */
+    TONE_EVENT(TONE_NOTE(A, 5), 200, 0), /* 880Hz */
 };
 
-static void t0_set_prescaler(enum t0_prescaler ps)
-{
-    TCCR0B = ps;
-}
-
-static unsigned short t0_get_prescaler_rate(enum t0_prescaler ps)
-{
-    unsigned short rate;
-    switch(ps)
-    {
-        case T0_PRESCALER_1:
-            rate = 1;
-            break;
-        case T0_PRESCALER_8:
-            rate = 8;
-            break;
-        case T0_PRESCALER_64:
-            rate = 64;
-            break;
-        case T0_PRESCALER_256:
-            rate = 256;
-            break;
-        case T0_PRESCALER_1024:
-            rate = 1024;
-            break;
-        default:
-            rate = 0;
-            break;
-    }
-    return rate;
-}
-
-static unsigned long div_round(unsigned long d, unsigned long q)
-{
-    return (d + (q/2)) / q;
-}
-
-static void t0_set_ctc_a(unsigned long hz, unsigned long timer_freq)
-{
-    OCR0A = div_round(timer_freq, hz*2) - 1;
-    TCCR0A =
-          _BV(COM0A0) // toggle
-        | _BV(WGM01); // CTC
-}
-
 int main(void)
 {
-    unsigned long timer_freq;
-    enum t0_prescaler ps = T0_PRESCALER_256;
-
-    DDRD |= _BV(DDD6);
-    t0_set_prescaler(ps);
-    timer_freq = div_round(F_CPU, t0_get_prescaler_rate(ps));
+    tone_init();
+    sei();
 
     while(1)
     {
-        t0_set_ctc_a(440, timer_freq);
-        _delay_ms(200);
-        t0_set_ctc_a(880, timer_freq);
-        _delay_ms(200);
+        if (!tone_busy())
+        {
+            tone_play_P(melody, sizeof(melody)/sizeof(melody[0]));
+        }
+        sleep_mode(); /* woken up by the tone sequencer interrupt */
     }
     return 0;
 }
-
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "power.h"
+#include "timer_solver.h"
+#include "tone.h"
+
+#if (TONE_QUEUE_LEN & (TONE_QUEUE_LEN - 1)) != 0
+#  error "TONE_QUEUE_LEN must be a power of 2"
+#endif
+
+#ifndef TONE_TOLERANCE_PPM
+/* The 8-bit Timer0 gets coarse on the highest notes: ~25 cents */
+#define TONE_TOLERANCE_PPM 15000
+#endif
+
+/* Equal temperament in Hz * 100, from TONE_NOTE_MIN to TONE_NOTE_MAX */
+#define TONE_FREQS(X) \
+    X(6541) X(6930) X(7342) X(7778) \
+    X(8241) X(8731) X(9250) X(9800) \
+    X(10383) X(11000) X(11654) X(12347) \
+    X(13081) X(13859) X(14683) X(15556) \
+    X(16481) X(17461) X(18500) X(19600) \
+    X(20765) X(22000) X(23308) X(24694) \
+    X(26163) X(27718) X(29366) X(31113) \
+    X(32963) X(34923) X(36999) X(39200) \
+    X(41530) X(44000) X(46616) X(49388) \
+    X(52325) X(55437) X(58733) X(62225) \
+    X(65926) X(69846) X(73999) X(78399) \
+    X(83061) X(88000) X(93233) X(98777) \
+    X(104650) X(110873) X(117466) X(124451) \
+    X(131851) X(139691) X(147998) X(156798) \
+    X(166122) X(176000) X(186466) X(197553) \
+    X(209300) X(221746) X(234932) X(248902) \
+    X(263702) X(279383) X(295996) X(313596) \
+    X(332244) X(352000) X(372931) X(395107) \
+    X(418601)
+
+/* OC0A toggles twice per period */
+#define TONE_CYCLES(chz) TIMER_CHZ_CYCLES(2UL * (chz))
+
+#define TONE_ENTRY(chz) { \
+    TIMER01_TOP(TONE_CYCLES(chz), TIMER8_MAX), \
+    TIMER01_CS(TONE_CYCLES(chz), TIMER8_MAX) },
+#define TONE_CHECK(chz) \
+    TIMER01_CHECK(TONE_CYCLES(chz), TIMER8_MAX, TONE_TOLERANCE_PPM);
+
+struct tone_timer {
+    uint8_t ocr;
+    uint8_t cs;
+};
+
+TONE_FREQS(TONE_CHECK)
+
+static
+const struct tone_timer tone_table[] PROGMEM = {
+    TONE_FREQS(TONE_ENTRY)
+};
+
+/* sequence in program memory */
+static const struct tone_event *tone_seq;
+static uint8_t tone_seq_len;
+
+/* queue in RAM */
+static struct tone_event tone_queue[TONE_QUEUE_LEN];
+static volatile uint8_t tone_queue_head;
+static volatile uint8_t tone_queue_tail;
+
+static uint16_t tone_pending_rest;
+static volatile bool tone_playing;
+static bool tone_powered; /* holds Timer0 and Timer1 while playing */
+
+static
+void tone_power_on(void)
+{
+    if (!tone_powered)
+    {
+        power_get(POWER_TIMER0);
+        power_get(POWER_TIMER1);
+        tone_powered = true;
+    }
+}
+
+static
+void tone_power_off(void)
+{
+    if (tone_powered)
+    {
+        tone_powered = false;
+        power_put(POWER_TIMER1);
+        power_put(POWER_TIMER0);
+    }
+}
+
+static
+void tone_timer0_off(void)
+{
+    TCCR0B = 0;
+    TCCR0A = 0; /* disconnect OC0A */
+    PORTD &= ~_BV(PORTD6);
+}
+
+static
+void tone_timer0_on(uint8_t note)
+{
+    struct tone_timer t;
+
+    memcpy_P(&t, &tone_table[note - TONE_NOTE_MIN], sizeof(t));
+    TCCR0B = 0;
+    TCNT0 = 0; /* avoid wrapping around if the new OCR0A is lower */
+    OCR0A = t.ocr;
+    TCCR0A =
+          _BV(COM0A0) /* toggle */
+        | _BV(WGM01); /* CTC */
+    TCCR0B = t.cs;
+}
+
+/* Set the duration of the current step; Timer1 clears on match,
+ * so a period is OCR1A + 1 ticks
+ */
+static
+void tone_timer1_set(uint16_t ticks)
+{
+    if (ticks == 0)
+    {
+        ticks = 1;
+    }
+    OCR1A = ticks - 1;
+}
+
+static
+bool tone_next_event(struct tone_event *ev)
+{
+    if (tone_seq_len > 0)
+    {
+        memcpy_P(ev, tone_seq, sizeof(*ev));
+        tone_seq++;
+        tone_seq_len--;
+        return true;
+    }
+    if (tone_queue_tail != tone_queue_head)
+    {
+        uint8_t tail = tone_queue_tail;
+
+        *ev = tone_queue[tail];
+        tone_queue_tail = (tail + 1) & (TONE_QUEUE_LEN - 1);
+        return true;
+    }
+    return false;
+}
+
+/* Called at the end of every note and rest, with interrupts disabled */
+static
+void tone_step(void)
+{
+    struct tone_event ev;
+
+    if (tone_pending_rest > 0)
+    {
+        tone_timer0_off();
+        tone_timer1_set(tone_pending_rest);
+        tone_pending_rest = 0;
+        return;
+    }
+    if (!tone_next_event(&ev))
+    {
+        tone_timer0_off();
+        TCCR1B = 0; /* stop */
+        TIMSK1 &= ~_BV(OCIE1A);
+        tone_playing = false;
+        tone_power_off();
+        return;
+    }
+    if ((ev.note >= TONE_NOTE_MIN) && (ev.note <= TONE_NOTE_MAX))
+    {
+        tone_timer0_on(ev.note);
+    }
+    else
+    {
+        tone_timer0_off(); /* TONE_REST */
+    }
+    tone_timer1_set(ev.dur);
+    tone_pending_rest = ev.rest;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+    tone_step();
+}
+
+/* Start the sequencer if idle, with interrupts disabled */
+static
+void tone_kick(void)
+{
+    if (tone_playing)
+    {
+        return;
+    }
+    tone_playing = true;
+    tone_power_on();
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCNT1 = 0;
+    tone_pending_rest = 0;
+    tone_step();
+    if (tone_playing)
+    {
+        TIFR1 = _BV(OCF1A);
+        TIMSK1 |= _BV(OCIE1A);
+        TCCR1B = _BV(WGM12) | _BV(CS12) | _BV(CS10); /* CTC, F_CPU/1024 */
+    }
+}
+
+void tone_init(void)
+{
+    tone_stop();
+    DDRD |= _BV(DDD6);
+}
+
+void tone_play_P(const struct tone_event *seq, uint8_t len)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        tone_seq = seq;
+        tone_seq_len = len;
+        tone_kick();
+    }
+}
+
+bool tone_push(uint8_t note, uint16_t dur_ms, uint16_t rest_ms)
+{
+    uint8_t head;
+    uint8_t next;
+    struct tone_event *ev;
+
+    head = tone_queue_head;
+    next = (head + 1) & (TONE_QUEUE_LEN - 1);
+    if (next == tone_queue_tail)
+    {
+        return false;
+    }
+    ev = &tone_queue[head];
+    ev->note = note;
+    if (dur_ms > TONE_MAX_MS)
+    {
+        dur_ms = TONE_MAX_MS;
+    }
+    if (rest_ms > TONE_MAX_MS)
+    {
+        rest_ms = TONE_MAX_MS;
+    }
+    /* ms * 1000 / 64 = ms * 125 / 8, @ 16MHz: no division */
+    ev->dur = ((uint32_t)dur_ms * (F_CPU / 1000UL)) >> 10;
+    ev->rest = ((uint32_t)rest_ms * (F_CPU / 1000UL)) >> 10;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        tone_queue_head = next;
+        tone_kick();
+    }
+
+    return true;
+}
+
+bool tone_busy(void)
+{
+    return tone_playing;
+}
+
+void tone_stop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (tone_powered)
+        {
+            /* the timers are not ours otherwise */
+            TIMSK1 &= ~_BV(OCIE1A);
+            TCCR1B = 0;
+            tone_timer0_off();
+            tone_power_off();
+        }
+        tone_seq_len = 0;
+        tone_queue_tail = tone_queue_head;
+        tone_pending_rest = 0;
+        tone_playing = false;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TONE_H
+#define TONE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Background tone sequencer on the buzzer pin (OC0A, PD6).
+ *
+ * Timer0 toggles OC0A in CTC mode, with OCR0A and prescaler taken from
+ * a table in program memory computed at compile time for every note.
+ * Timer1 in CTC mode interrupts at the end of each note and rest, and
+ * the ISR loads the next event; it clears the counter on match, so
+ * durations do not drift.
+ * Events come from a sequence in program memory, then from a small
+ * queue in RAM.
+ */
+
+/* MIDI note numbers, C4 = 60, A4 = 69 (440Hz) */
+enum tone_name {
+    TONE_C, TONE_Cs, TONE_D, TONE_Ds, TONE_E, TONE_F,
+    TONE_Fs, TONE_G, TONE_Gs, TONE_A, TONE_As, TONE_B,
+};
+#define TONE_NOTE(name, octave) (TONE_##name + 12 * ((octave) + 1))
+#define TONE_NOTE_MIN TONE_NOTE(C, 2)
+#define TONE_NOTE_MAX TONE_NOTE(C, 8)
+#define TONE_REST 0
+
+/* Durations are in Timer1 ticks of 1024 cycles (64us @ 16MHz) */
+#define TONE_TICK_CYCLES 1024UL
+#define TONE_MS(ms) ((uint16_t)(((ms) * (F_CPU / 1000UL)) / TONE_TICK_CYCLES))
+#define TONE_MAX_MS ((0xFFFFUL * TONE_TICK_CYCLES) / (F_CPU / 1000UL))
+
+struct tone_event {
+    uint8_t note; /* TONE_NOTE() or TONE_REST */
+    uint16_t dur; /* TONE_MS() */
+    uint16_t rest; /* TONE_MS(), silence after the note */
+};
+
+#define TONE_EVENT(note, dur_ms, rest_ms) { (note), TONE_MS(dur_ms), TONE_MS(rest_ms) }
+
+#ifndef TONE_QUEUE_LEN
+#define TONE_QUEUE_LEN 8 /* power of 2 */
+#endif
+
+extern void tone_init(void);
+
+/* Play len events from program memory, then whatever is queued.
+ * Replaces any sequence in progress.
+ */
+extern void tone_play_P(const struct tone_event *seq, uint8_t len);
+
+/* Queue one event, durations in ms clamped to TONE_MAX_MS
+ * (~4.2s @ 16MHz). Returns false if the queue is full.
+ */
+extern bool tone_push(uint8_t note, uint16_t dur_ms, uint16_t rest_ms);
+
+/* True while something is playing or queued. */
+extern bool tone_busy(void);
+
+/* Stop immediately, discarding the sequence and the queue. */
+extern void tone_stop(void);
+
+#endif /* TONE_H */
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "adc.h"
+#include "power.h"
+
+#define BVV(bit, val) ((val)?_BV(bit):0)
+
+#if ADC_OVERSAMPLE_BITS > 3
+#  error "ADC_OVERSAMPLE_BITS > 3 overflows the 16-bit accumulator"
+#endif
+
+#if (ADC_RESULT_BITS + ADC_FILTER_SHIFT) > 16
+#  error "ADC_FILTER_SHIFT too big for the 16-bit filter state"
+#endif
+
+#if (ADC_BUF_LEN & (ADC_BUF_LEN - 1)) != 0
+#  error "ADC_BUF_LEN must be a power of 2"
+#endif
+
+#if (ADC_CLOCK_DIV_BITS < 1) || (ADC_CLOCK_DIV_BITS > 7)
+#  error "ADC_CLOCK_DIV_BITS must be in 1..7"
+#endif
+
+#define ADC_N_CONVERSIONS (1U << (2 * ADC_OVERSAMPLE_BITS))
+
+#define ADC_TRIGGER_FREE_RUNNING 0
+#define ADC_TRIGGER_T1_COMPB (_BV(ADTS2) | _BV(ADTS0))
+
+struct adc_channel {
+    struct adc_channel_cfg cfg;
+    uint8_t countdown; /* rounds until next burst */
+    uint8_t n_acc;
+    uint16_t acc;
+    uint16_t filter_state; /* filtered value << ADC_FILTER_SHIFT */
+    /* result slot, written only by the ISR */
+    volatile uint8_t seq;
+    volatile uint16_t latest;
+    volatile uint16_t filtered;
+};
+
+static struct adc_channel adc_channels[ADC_MAX_CHANNELS];
+static uint8_t adc_n_channels;
+static uint8_t adc_cur; /* channel selected in ADMUX */
+static uint8_t adc_discard; /* conversions still to be discarded */
+static uint8_t adc_discard_extra; /* 1 when free running */
+static bool adc_on; /* holds POWER_ADC */
+static bool adc_timer1_used;
+static bool adc_oneshot;
+static volatile bool adc_oneshot_done;
+
+static struct adc_sample adc_buf[ADC_BUF_LEN];
+static volatile uint8_t adc_buf_head;
+static volatile uint8_t adc_buf_tail;
+
+static
+void adc_publish(uint8_t i_ch, uint16_t sample)
+{
+    struct adc_channel *c;
+    uint8_t head;
+
+    c = &adc_channels[i_ch];
+
+    head = adc_buf_head;
+    adc_buf[head].ch = i_ch;
+    adc_buf[head].value = sample;
+    adc_buf_head = (head + 1) & (ADC_BUF_LEN - 1);
+
+    if (c->seq != 0)
+    {
+        c->filter_state += sample - (c->filter_state >> ADC_FILTER_SHIFT);
+    }
+    else
+    {
+        /* start from the first sample instead of ramping up from 0 */
+        c->filter_state = sample * (1U << ADC_FILTER_SHIFT);
+    }
+    c->latest = sample;
+    c->filtered = c->filter_state >> ADC_FILTER_SHIFT;
+    c->seq++;
+    if (c->seq == 0)
+    {
+        c->seq = 1; /* 0 means no sample yet */
+    }
+}
+
+static
+uint8_t adc_next_channel(uint8_t i_ch)
+{
+    /* visit channels round-robin until one is due */
+    while (1)
+    {
+        struct adc_channel *c;
+
+        i_ch++;
+        if (i_ch >= adc_n_channels)
+        {
+            i_ch = 0;
+        }
+        c = &adc_channels[i_ch];
+        c->countdown--;
+        if (c->countdown == 0)
+        {
+            c->countdown = c->cfg.rate_div;
+            return i_ch;
+        }
+    }
+}
+
+ISR(ADC_vect)
+{
+    uint16_t value;
+    struct adc_channel *c;
+    uint8_t next;
+
+    if (adc_oneshot)
+    {
+        adc_oneshot_done = true; /* result is read from ADC by the caller */
+        return;
+    }
+
+    value = ADC;
+    if (adc_timer1_used)
+    {
+        TIFR1 = _BV(OCF1B); /* re-arm the trigger: it fires on the flag edge */
+    }
+
+    if (adc_discard > 0)
+    {
+        adc_discard--;
+        return;
+    }
+
+    c = &adc_channels[adc_cur];
+    c->acc += value;
+    c->n_acc++;
+    if (c->n_acc < ADC_N_CONVERSIONS)
+    {
+        return;
+    }
+
+    /* decimate */
+    adc_publish(adc_cur, c->acc >> ADC_OVERSAMPLE_BITS);
+    c->acc = 0;
+    c->n_acc = 0;
+
+    next = adc_next_channel(adc_cur);
+    if (next != adc_cur)
+    {
+        /* takes effect at the next conversion start */
+        ADMUX = adc_channels[next].cfg.admux;
+        adc_discard = adc_channels[next].cfg.settle + adc_discard_extra;
+        adc_cur = next;
+    }
+}
+
+static
+void adc_trigger_start(uint16_t rate_hz)
+{
+    uint32_t top;
+    uint8_t cs;
+
+    top = F_CPU / 8 / rate_hz;
+    cs = _BV(CS11); /* F_CPU/8 */
+    if (top > 0x10000UL)
+    {
+        top = F_CPU / 64 / rate_hz;
+        cs = _BV(CS11) | _BV(CS10); /* F_CPU/64 */
+        if (top > 0x10000UL)
+        {
+            top = 0x10000UL;
+        }
+    }
+    power_get(POWER_TIMER1);
+    TCCR1B = 0; /* stop */
+    TCCR1A = 0;
+    TCNT1 = 0;
+    OCR1A = top - 1; /* CTC TOP */
+    OCR1B = top - 1; /* compare B triggers the ADC */
+    TIFR1 = _BV(OCF1B);
+    TCCR1B = _BV(WGM12) | cs; /* CTC mode on OCR1A */
+}
+
+void adc_scan_start(const struct adc_channel_cfg *cfg, uint8_t n_ch, uint16_t rate_hz)
+{
+    uint8_t i_ch;
+    uint8_t trigger;
+
+    adc_stop();
+
+    if (n_ch > ADC_MAX_CHANNELS)
+    {
+        n_ch = ADC_MAX_CHANNELS;
+    }
+    if (n_ch == 0)
+    {
+        return;
+    }
+    for (i_ch = 0; i_ch < n_ch; i_ch++)
+    {
+        struct adc_channel *c = &adc_channels[i_ch];
+
+        c->cfg = cfg[i_ch];
+        c->cfg.admux &= ~_BV(ADLAR); /* right adjusted */
+        if (c->cfg.rate_div == 0)
+        {
+            c->cfg.rate_div = 1;
+        }
+        c->countdown = c->cfg.rate_div;
+        c->n_acc = 0;
+        c->acc = 0;
+        c->seq = 0;
+        c->latest = 0;
+        c->filtered = 0;
+    }
+    adc_n_channels = n_ch;
+    adc_cur = 0;
+    adc_buf_head = 0;
+    adc_buf_tail = 0;
+    adc_discard_extra = (rate_hz == ADC_FREE_RUNNING) ? 1 : 0;
+    adc_discard = adc_channels[0].cfg.settle;
+
+    power_get(POWER_ADC);
+    adc_on = true;
+    ADMUX = adc_channels[0].cfg.admux;
+    if (rate_hz == ADC_FREE_RUNNING)
+    {
+        trigger = ADC_TRIGGER_FREE_RUNNING;
+    }
+    else
+    {
+        trigger = ADC_TRIGGER_T1_COMPB;
+        adc_trigger_start(rate_hz);
+        adc_timer1_used = true;
+    }
+    ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) | trigger;
+    ADCSRA =
+          (ADC_CLOCK_DIV_BITS & 0x07) /* ADPS2:0 */
+        | BVV(ADIE, 1) | BVV(ADIF, 1) /* Interrupt, clear pending flag */
+        | BVV(ADATE, 1) /* Auto trigger */
+        | BVV(ADSC, (rate_hz == ADC_FREE_RUNNING)) /* first conversion */
+        | BVV(ADEN, 1); /* Enable */
+}
+
+void adc_start(uint8_t admux, uint16_t rate_hz)
+{
+    struct adc_channel_cfg cfg;
+
+    cfg.admux = admux;
+    cfg.rate_div = 1;
+    cfg.settle = 1; /* first conversion after enabling is not accurate */
+    adc_scan_start(&cfg, 1, rate_hz);
+}
+
+void adc_stop(void)
+{
+    if (!adc_on)
+    {
+        return;
+    }
+    ADCSRA &= ~(_BV(ADATE) | _BV(ADIE));
+    loop_until_bit_is_clear(ADCSRA, ADSC); /* wait for last conversion */
+    ADCSRA = _BV(ADIF); /* clear flag, disable */
+    if (adc_timer1_used)
+    {
+        TCCR1B &= ~(_BV(CS12) | _BV(CS11) | _BV(CS10));
+        adc_timer1_used = false;
+        power_put(POWER_TIMER1);
+    }
+    adc_on = false;
+    power_put(POWER_ADC);
+}
+
+static
+void adc_convert_sleep(void)
+{
+    adc_oneshot_done = false;
+    set_sleep_mode(SLEEP_MODE_ADC);
+    do
+    {
+        cli();
+        if (!adc_oneshot_done)
+        {
+            /* entering the sleep mode starts the conversion;
+             * it is not restarted if another interrupt woke us up */
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
+    } while (!adc_oneshot_done);
+}
+
+uint16_t adc_read_sleep(uint8_t admux)
+{
+    uint16_t acc;
+    uint8_t i_conv;
+
+    adc_stop();
+
+    power_get(POWER_ADC);
+    adc_oneshot = true;
+    ADMUX = admux & ~_BV(ADLAR); /* right adjusted */
+    ADCSRA =
+          (ADC_CLOCK_DIV_BITS & 0x07) /* ADPS2:0 */
+        | BVV(ADIE, 1) | BVV(ADIF, 1) /* Interrupt, clear pending flag */
+        | BVV(ADEN, 1); /* Enable, single conversions */
+
+    adc_convert_sleep(); /* discarded: first after enabling the ADC */
+    acc = 0;
+    for (i_conv = 0; i_conv < ADC_N_CONVERSIONS; i_conv++)
+    {
+        adc_convert_sleep();
+        acc += ADC;
+    }
+
+    ADCSRA = _BV(ADIF); /* clear flag, disable */
+    adc_oneshot = false;
+    power_put(POWER_ADC);
+
+    return acc >> ADC_OVERSAMPLE_BITS;
+}
+
+/* The ISR cannot interrupt itself, so a reader that sees the same
+ * sequence number before and after reading has a consistent value.
+ */
+static
+uint16_t adc_slot_read(const volatile uint8_t *seq, const volatile uint16_t *value)
+{
+    uint8_t s;
+    uint16_t v;
+
+    do
+    {
+        s = *seq;
+        v = *value;
+    } while (s != *seq);
+
+    return v;
+}
+
+uint16_t adc_get_filtered(uint8_t ch)
+{
+    struct adc_channel *c = &adc_channels[ch];
+
+    return adc_slot_read(&c->seq, &c->filtered);
+}
+
+uint16_t adc_get_latest(uint8_t ch)
+{
+    struct adc_channel *c = &adc_channels[ch];
+
+    return adc_slot_read(&c->seq, &c->latest);
+}
+
+uint8_t adc_get_seq(uint8_t ch)
+{
+    return adc_channels[ch].seq;
+}
+
+uint8_t adc_read_samples(struct adc_sample *dst, uint8_t max_len)
+{
+    uint8_t n;
+    uint8_t tail;
+
+    n = 0;
+    tail = adc_buf_tail;
+    while ((n < max_len) && (tail != adc_buf_head))
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            dst[n] = adc_buf[tail];
+        }
+        tail = (tail + 1) & (ADC_BUF_LEN - 1);
+        n++;
+    }
+    adc_buf_tail = tail;
+
+    return n;
+}
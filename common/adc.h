@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADC_H
+#define ADC_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+/* Interrupt-driven ADC engine and scan scheduler.
+ *
+ * Conversions are auto-triggered (ADATE) by Timer1 compare match B,
+ * or free running, and handled entirely in the ADC ISR, which cycles
+ * ADMUX through a list of channels:
+ * - each channel is sampled once every rate_div scan rounds;
+ * - after a MUX switch the first "settle" conversions are discarded
+ *   (plus the one already started, when free running);
+ * - 4^ADC_OVERSAMPLE_BITS conversions are summed and decimated into one
+ *   sample of ADC_RESULT_BITS bits, which is fed to a first order IIR
+ *   low-pass filter and published in the channel result slot.
+ *
+ * Result slots are lock-free: readers never disable interrupts.
+ *
+ * Oversampling only adds resolution if there is at least 1 LSB of
+ * noise on the input, which is usually the case.
+ *
+ * Timer1 is used for the trigger when the sample rate is not 0.
+ */
+
+#ifndef ADC_OVERSAMPLE_BITS
+#define ADC_OVERSAMPLE_BITS 2 /* 16 conversions per sample */
+#endif
+
+#ifndef ADC_FILTER_SHIFT
+#define ADC_FILTER_SHIFT 3 /* y += (x - y) / 8 */
+#endif
+
+#ifndef ADC_BUF_LEN
+#define ADC_BUF_LEN 8 /* power of 2 */
+#endif
+
+#ifndef ADC_MAX_CHANNELS
+#define ADC_MAX_CHANNELS 4 /* up to 10: ADC0-7, temperature, bandgap */
+#endif
+
+/* ADC clock = F_CPU / 2^ADC_CLOCK_DIV_BITS; 125kHz @ 16MHz by default.
+ * Above 200kHz the resolution drops below 10 bits.
+ */
+#ifndef ADC_CLOCK_DIV_BITS
+#define ADC_CLOCK_DIV_BITS 7
+#endif
+
+#define ADC_RESULT_BITS (10 + ADC_OVERSAMPLE_BITS)
+#define ADC_RESULT_MAX ((1U << ADC_RESULT_BITS) - 1)
+
+#define ADC_FREE_RUNNING 0
+
+/* ADMUX reference selection */
+#define ADC_REF_AREF     0
+#define ADC_REF_AVCC     _BV(REFS0)
+#define ADC_REF_INTERNAL (_BV(REFS1) | _BV(REFS0))
+
+/* ADMUX input selection; the temperature sensor needs ADC_REF_INTERNAL */
+#define ADC_MUX_ADC(n)   (n)
+#define ADC_MUX_TEMP     0x08
+#define ADC_MUX_BANDGAP  0x0E
+#define ADC_MUX_GND      0x0F
+
+struct adc_channel_cfg {
+    uint8_t admux;    /* reference | input */
+    uint8_t rate_div; /* sampled every rate_div rounds, >= 1 */
+    uint8_t settle;   /* conversions discarded after switching to it */
+};
+
+struct adc_sample {
+    uint8_t ch;
+    uint16_t value;
+};
+
+/* Scan n_ch channels (at most ADC_MAX_CHANNELS) in order.
+ * rate_hz is the total number of conversions per second, or
+ * ADC_FREE_RUNNING for as fast as possible (~9.6kHz @ 125kHz ADC clock).
+ * For a steady throughput, at least one channel should have rate_div 1.
+ */
+extern void adc_scan_start(const struct adc_channel_cfg *cfg, uint8_t n_ch, uint16_t rate_hz);
+
+/* Sample a single input (channel 0). */
+extern void adc_start(uint8_t admux, uint16_t rate_hz);
+
+/* Stop sampling and switch the ADC off. */
+extern void adc_stop(void);
+
+/* Stop sampling and read one decimated sample of the input selected by
+ * admux, converting in ADC Noise Reduction sleep mode.
+ * Interrupts must be enabled. The CPU sleeps for about
+ * (4^ADC_OVERSAMPLE_BITS + 1) conversions, ~1.8ms at the default
+ * settings; clk_io is stopped meanwhile, so Timer0/1 and sysclock
+ * (synchronous Timer2) stop counting and their PWM outputs (OC0A/B,
+ * OC1A/B) freeze at the current level. Use the background engine
+ * (adc_start()) when a PWM output must keep running.
+ */
+extern uint16_t adc_read_sleep(uint8_t admux);
+
+/* Latest filtered sample of channel ch, 0..ADC_RESULT_MAX. */
+extern uint16_t adc_get_filtered(uint8_t ch);
+
+/* Latest decimated sample of channel ch, 0..ADC_RESULT_MAX. */
+extern uint16_t adc_get_latest(uint8_t ch);
+
+/* Incremented every time a new sample of ch is published. */
+extern uint8_t adc_get_seq(uint8_t ch);
+
+/* Copy up to max_len decimated samples, oldest first, out of the ring
+ * buffer shared by all channels. Returns the number of samples copied.
+ * Samples are lost if not read within ADC_BUF_LEN sample periods.
+ */
+extern uint8_t adc_read_samples(struct adc_sample *dst, uint8_t max_len);
+
+#endif /* ADC_H */
@@ -30,8 +30,10 @@ all:
 
 AVRDUDE=avrdude
 CC=avr-gcc
+CXX=avr-g++
 OBJCOPY=avr-objcopy
 OBJDUMP=avr-objdump
+SIZE=avr-size
 
 MCU=atmega328p
 F_CPU=16000000UL
@@ -44,22 +46,65 @@ PART=ATMEGA328P
 AVRDUDEFLAGS= -F -V -c ${PROTOCOL} -p ${PART} -P ${PORT} -b ${BAUD}
 CFLAGS += -g
 CPPFLAGS += -DF_CPU=${F_CPU}
+CPPFLAGS += -I../common
 TARGET_ARCH = -mmcu=${MCU}
 COPTFLAG = -Os
 CFLAGS += ${COPTFLAG}
 #LDFLAGS += -Xlinker -Map=$(PROG).map
 WFLAGS += -Wall -Wextra
 CFLAGS += ${WFLAGS}
+# C++ sources (.cpp) for the compile time helpers, like pin.hpp:
+# no exceptions, RTTI or library runtime, as with avr-libc.
+CXXFLAGS += -g ${COPTFLAG} ${WFLAGS}
+CXXFLAGS += -std=gnu++11 -fno-exceptions -fno-rtti -fno-threadsafe-statics
+CXXFLAGS += -D__STDC_LIMIT_MACROS
 LDFLAGS += ${WFLAGS}
 ASFLAGS += ${WFLAGS}
 
+# "make PROF=1" builds with the on-target profiler (see prof.h).
+ifeq (${PROF},1)
+CPPFLAGS += -DPROF_ENABLE=1 -DSYSCLOCK_PRESCALER=8
+PROF_SRC = ../common/prof.c ../common/sysclock.c ../common/stdio_usart0.c ../common/power.c
+SRC += $(filter-out ${SRC},${PROF_SRC})
+endif
+
+# "make HOST=1" builds ${PROG}_host for the Linux build machine, against
+# the simulated register file in ../host (see ../host/hw.h), adding the
+# device models and glue listed in HOST_SRC.
+ifeq (${HOST},1)
+ifeq (${PROF},1)
+$(error PROF=1 needs the AVR build)
+endif
+CC = gcc
+CXX = g++
+TARGET_ARCH =
+COPTFLAG = -O2
+CPPFLAGS += -I../host/include -I../host
+CFLAGS += -std=gnu99 -fno-strict-aliasing
+CXXFLAGS += -fno-strict-aliasing
+SRC += ../host/hw.c
+SRC += ${HOST_SRC}
+endif
+
+# "make bench" builds ${PROG}_bench with BENCH_ENABLE=1 (see bench.h),
+# runs it in simavr and writes the cycle counts to ${PROG}.bench.csv.
+# With BENCH_BASELINE=<older report>, the differences are printed too.
+SIMAVR = simavr
+BENCH_TIMEOUT = 60
+BENCH_SRC = ${SRC}
+BENCH_SRC += $(filter-out ${SRC},../common/bench.c ../common/stdio_usart0.c ../common/power.c)
+
 SRC_C = $(filter %.c,${SRC})
+SRC_CXX = $(filter %.cpp,${SRC})
 SRC_s = $(filter %.s,${SRC})
 SRC_S = $(filter %.S,${SRC})
 
-OBJ = $(SRC_C:.c=.o) $(SRC_s:.s=.o) $(SRC_S:.S=.o)
+OBJ = $(SRC_C:.c=.o) $(SRC_CXX:.cpp=.o) $(SRC_s:.s=.o) $(SRC_S:.S=.o)
+HOST_OBJ = $(SRC_C:.c=.host.o) $(SRC_CXX:.cpp=.host.o)
+BENCH_OBJ = $(patsubst %.c,%.bench.o,$(filter %.c,${BENCH_SRC})) \
+	$(SRC_CXX:.cpp=.bench.o) $(SRC_s:.s=.o) $(SRC_S:.S=.o)
 
-.PHONY: all clean upload download
+.PHONY: all clean upload download bench size
 
 %.hex: %
 	${OBJCOPY} -O ihex -R .eeprom $< $@
@@ -75,10 +120,57 @@ OBJ = $(SRC_C:.c=.o) $(SRC_s:.s=.o) $(SRC_S:.S=.o)
 
 ${PROG}: ${OBJ}
 
+%.host.o: %.c
+	${COMPILE.c} ${OUTPUT_OPTION} $<
+
+%.host.o: %.cpp
+	${COMPILE.cpp} ${OUTPUT_OPTION} $<
+
+${PROG}_host: ${HOST_OBJ}
+	${LINK.o} $^ ${LOADLIBES} ${LDLIBS} -o $@
+
+%.bench.o: %.c
+	${COMPILE.c} -DBENCH_ENABLE=1 ${OUTPUT_OPTION} $<
+
+%.bench.o: %.cpp
+	${COMPILE.cpp} -DBENCH_ENABLE=1 ${OUTPUT_OPTION} $<
+
+${PROG}_bench: ${BENCH_OBJ}
+	${LINK.o} $^ ${LOADLIBES} ${LDLIBS} -o $@
+
+# simavr prints each line written to the USART, with color codes
+${PROG}.bench.csv: ${PROG}_bench
+	timeout ${BENCH_TIMEOUT} ${SIMAVR} -m ${MCU} -f $(F_CPU:UL=) $< 2>&1 \
+		| sed -e 's/\x1b\[[0-9;]*m//g' -e 's/\r//g' >$@.log
+	grep -q 'bench,end' $@.log || { cat $@.log; false; }
+	{ echo 'prog,name,calls,min,max,total'; \
+	  sed -n -e '/bench,end/d' -e 's/^.*bench,/${PROG},/p' $@.log; } >$@
+	rm -f $@.log
+
+bench: ${PROG}.bench.csv
+	@cat $<
+ifneq (${BENCH_BASELINE},)
+	@awk -F, 'NR == FNR { if (FNR > 1) min[$$2] = $$4; next } \
+		FNR > 1 && ($$2 in min) && (min[$$2] + 0 > 0) { \
+			printf "%-32s %8s -> %8s %+7.1f%%\n", $$2, min[$$2], $$4, \
+				100 * ($$4 - min[$$2]) / min[$$2] }' \
+		${BENCH_BASELINE} $<
+endif
+
+# "make size" prints the flash (text + data) and RAM (data + bss) use,
+# to compare builds like the bench reports.
+size: ${PROG}
+	${SIZE} -C --mcu=${MCU} $<
+
+ifeq (${HOST},1)
+all: ${PROG}_host
+else
 all: ${PROG} ${PROG}.hex
+endif
 
 clean:
-	rm -f ${PROG} $(addprefix ${PROG}, .hex .map .code .lst .bin) ${OBJ}
+	rm -f ${PROG} $(addprefix ${PROG}, .hex .map .code .lst .bin _host _bench .bench.csv) \
+		${OBJ} ${HOST_OBJ} ${BENCH_OBJ}
 
 upload: ${PROG}.hex
 	${AVRDUDE} ${AVRDUDEFLAGS} -U flash:w:$<
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bench.h"
+
+#if BENCH_ENABLE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include "power.h"
+#include "stdio_usart0.h"
+
+static uint8_t bench_sreg;
+static uint16_t bench_overhead;
+
+void bench_start(void)
+{
+    bench_sreg = SREG;
+    cli();
+    power_get(POWER_TIMER1);
+    TCCR1B = 0; /* stopped, normal mode */
+    TCCR1A = 0;
+    TCNT1 = 0;
+    TIFR1 = _BV(TOV1);
+    TCCR1B = _BV(CS10); /* F_CPU/1 */
+}
+
+uint16_t bench_stop(void)
+{
+    uint16_t cycles;
+
+    TCCR1B = 0;
+    cycles = TCNT1;
+    if (bit_is_set(TIFR1, TOV1))
+    {
+        cycles = BENCH_OVERFLOW;
+    }
+    else
+    {
+        cycles -= bench_overhead;
+    }
+    power_put(POWER_TIMER1);
+    SREG = bench_sreg;
+
+    return cycles;
+}
+
+void bench_add(struct bench_stats *stats, uint16_t cycles)
+{
+    stats->calls++;
+    if (cycles < stats->min)
+    {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max)
+    {
+        stats->max = cycles;
+    }
+    if (cycles != BENCH_OVERFLOW)
+    {
+        stats->total += cycles;
+    }
+}
+
+void bench_report(const char *name, const struct bench_stats *stats)
+{
+    fputs_P(PSTR("bench,"), stdout);
+    fputs_P(name, stdout);
+    if (stats->max == BENCH_OVERFLOW)
+    {
+        printf_P(PSTR(",%u,overflow,overflow,overflow\n"), stats->calls);
+    }
+    else
+    {
+        printf_P(PSTR(",%u,%u,%u,%lu\n"),
+                stats->calls, stats->min, stats->max, (unsigned long)stats->total);
+    }
+    stdio_usart0_flush();
+}
+
+void bench_begin(void)
+{
+    uint16_t overhead;
+
+    /* an empty measurement is all overhead */
+    bench_overhead = 0;
+    bench_start();
+    overhead = bench_stop();
+    bench_overhead = overhead;
+    printf_P(PSTR("bench,overhead,1,%u,%u,%u\n"), overhead, overhead, overhead);
+}
+
+/* Sleeping with interrupts disabled ends the simulation. */
+void bench_end(void)
+{
+    puts_P(PSTR("bench,end"));
+    stdio_usart0_flush();
+    cli();
+    sleep_enable();
+    sleep_cpu();
+    while (1)
+    {
+    }
+}
+
+#endif /* BENCH_ENABLE */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/* Cycle-exact benchmarks, run in the simavr simulator by "make bench".
+ *
+ * "make bench" builds ${PROG}_bench with BENCH_ENABLE=1; otherwise
+ * every macro below expands to nothing.
+ *
+ * Usage:
+ *
+ *   #if BENCH_ENABLE
+ *   static void prog_bench(void)
+ *   {
+ *       BENCH("name", 100, f(x));   measures 100 calls of f(x)
+ *       BENCH_PREP("name", 100, g(), f(x));   same, calling g() before
+ *                                   each call, outside the measurement
+ *   }
+ *   #endif
+ *
+ *   int main(void)
+ *   {
+ *       BENCH_RUN(prog_bench);      runs the benchmarks and stops
+ *       ...
+ *   }
+ *
+ * Each call is timed by Timer1 running at F_CPU, with interrupts
+ * disabled; the measurement overhead is calibrated and subtracted, so
+ * an empty statement takes 0 cycles. A single call must take less than
+ * 65536 cycles. Timer1 is reconfigured by every measurement, so
+ * benchmarks must not rely on it.
+ *
+ * Results are printed on stdout as CSV lines:
+ *
+ *   bench,<name>,<calls>,<min>,<max>,<total>
+ *
+ * and collected by "make bench" into ${PROG}.bench.csv.
+ */
+
+#ifndef BENCH_ENABLE
+#define BENCH_ENABLE 0
+#endif
+
+#if BENCH_ENABLE
+
+#include <avr/pgmspace.h>
+
+#define BENCH_OVERFLOW UINT16_MAX
+
+struct bench_stats {
+    uint16_t calls;
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;
+};
+
+extern void bench_begin(void);
+extern void bench_end(void);
+
+/* Timer1 is started last in bench_start() and stopped first in
+ * bench_stop(), which returns the cycles in between, or BENCH_OVERFLOW.
+ */
+extern void bench_start(void);
+extern uint16_t bench_stop(void);
+
+extern void bench_add(struct bench_stats *stats, uint16_t cycles);
+extern void bench_report(const char *name, const struct bench_stats *stats);
+
+/* name is a string literal, stored in program memory;
+ * prep runs before every call, and is not measured.
+ */
+#define BENCH_PREP(name, n_calls, prep, stmt) \
+    do { \
+        struct bench_stats bench_stats_ = { 0, UINT16_MAX, 0, 0 }; \
+        uint16_t bench_i_; \
+        for (bench_i_ = 0; bench_i_ < (n_calls); bench_i_++) \
+        { \
+            prep; \
+            bench_start(); \
+            stmt; \
+            bench_add(&bench_stats_, bench_stop()); \
+        } \
+        bench_report(PSTR(name), &bench_stats_); \
+    } while (0)
+
+#define BENCH(name, n_calls, stmt) BENCH_PREP(name, n_calls, (void)0, stmt)
+
+#define BENCH_RUN(fn) \
+    do { \
+        bench_begin(); \
+        fn(); \
+        bench_end(); \
+    } while (0)
+
+#else /* !BENCH_ENABLE */
+
+#define BENCH_PREP(name, n_calls, prep, stmt) do {} while (0)
+#define BENCH(name, n_calls, stmt) do {} while (0)
+#define BENCH_RUN(fn) do {} while (0)
+
+#endif /* BENCH_ENABLE */
+
+#endif /* BENCH_H */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <avr/io.h>
+
+/* Pins of the Arduino Uno with the Ethernet shield used by the C
+ * drivers, checked for conflicts at build time (pin.hpp does the same
+ * for C++ code).
+ *
+ * BOARD_PIN(D, 4) numbers PD4 so that #if can compare pins and test
+ * sets of them made with BOARD_MASK(); BOARD_PORT(), BOARD_DDR() and
+ * BOARD_BIT() give back its registers and bit.
+ */
+
+#define BOARD_PORT_B 0
+#define BOARD_PORT_C 1
+#define BOARD_PORT_D 2
+
+#define BOARD_PIN(port, bit) ((BOARD_PORT_##port << 3) | (bit))
+#define BOARD_MASK(pin) (1UL << (pin))
+#define BOARD_BIT(pin) ((pin) & 0x07)
+#define BOARD_PORT(pin) _SFR_IO8(0x05 + (3 * ((pin) >> 3))) /* PORTB, C, D */
+#define BOARD_DDR(pin) _SFR_IO8(0x04 + (3 * ((pin) >> 3)))
+
+/* SPI bus; SS is the Wiznet chip select, kept high */
+#define BOARD_SPI_SS BOARD_PIN(B, 2)
+#define BOARD_SPI_PINS ( \
+      BOARD_MASK(BOARD_SPI_SS) \
+    | BOARD_MASK(BOARD_PIN(B, 3)) /* MOSI */ \
+    | BOARD_MASK(BOARD_PIN(B, 4)) /* MISO */ \
+    | BOARD_MASK(BOARD_PIN(B, 5))) /* SCK */
+
+/* USART0, also the SPI master of uspi.h */
+#define BOARD_USART0_PINS ( \
+      BOARD_MASK(BOARD_PIN(D, 0)) /* RXD */ \
+    | BOARD_MASK(BOARD_PIN(D, 1)) /* TXD */ \
+    | BOARD_MASK(BOARD_PIN(D, 4))) /* XCK0 */
+
+/* SD card chip select, on the SPI bus */
+#ifndef SD_CS_PIN
+#define SD_CS_PIN BOARD_PIN(D, 4)
+#endif
+
+/* SD card chip select with SD_USPI, the card on USART0 */
+#ifndef SD_USPI_CS_PIN
+#define SD_USPI_CS_PIN BOARD_PIN(D, 5)
+#endif
+
+#ifdef SD_USPI
+#  if (BOARD_MASK(SD_USPI_CS_PIN) & BOARD_USART0_PINS) != 0
+#    error "SD_USPI_CS_PIN is a USART0 pin"
+#  endif
+#else
+#  if (BOARD_MASK(SD_CS_PIN) & BOARD_SPI_PINS) != 0
+#    error "SD_CS_PIN is an SPI bus pin, Wiznet SS included"
+#  endif
+#endif
+
+#endif /* BOARD_H */
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "cmd.h"
+#include "power.h"
+#include "sysclock.h"
+
+#define BAUD CMD_BAUD
+#include <util/setbaud.h>
+
+enum cmd_rx_state {
+    CMD_RX_SYNC,
+    CMD_RX_ID,
+    CMD_RX_SEQ,
+    CMD_RX_LEN,
+    CMD_RX_DATA,
+    CMD_RX_CRC,
+};
+
+struct cmd_frame {
+    volatile bool ready; /* complete, owned by cmd_poll() */
+    uint8_t id;
+    uint8_t seq;
+    uint8_t len;
+    uint32_t t_rx; /* sysclock cycles at the CRC byte */
+    uint8_t data[CMD_RX_MAX];
+};
+
+static const struct cmd_handler *cmd_table;
+static uint8_t cmd_n_handlers;
+static void (*cmd_notify)(void);
+static bool cmd_powered;
+
+/* written by the ISR */
+static struct cmd_frame cmd_rx[2];
+static uint8_t cmd_rx_w; /* buffer being received */
+static uint8_t cmd_rx_state;
+static uint8_t cmd_rx_id;
+static uint8_t cmd_rx_seq;
+static uint8_t cmd_rx_len;
+static uint8_t cmd_rx_pos;
+static uint8_t cmd_rx_crc;
+static bool cmd_rx_drop; /* no free buffer */
+
+static uint8_t cmd_rd; /* next buffer to dispatch */
+static struct cmd_stats cmd_stats;
+
+/* reply in progress */
+static uint8_t cmd_cur_id;
+static uint8_t cmd_cur_seq;
+static uint8_t cmd_tx_crc;
+static bool cmd_replied;
+
+static inline
+uint8_t cmd_crc8(uint8_t crc, uint8_t c)
+{
+    uint8_t bit;
+
+    crc ^= c;
+    for (bit = 0; bit < 8; bit++)
+    {
+        crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+    }
+    return crc;
+}
+
+ISR(USART_RX_vect)
+{
+    struct cmd_frame *f;
+    uint8_t status;
+    uint8_t c;
+
+    status = UCSR0A;
+    c = UDR0;
+    if (status & _BV(FE0))
+    {
+        cmd_rx_state = CMD_RX_SYNC; /* line break or wrong baud rate */
+        return;
+    }
+    if (cmd_rx_state != CMD_RX_CRC)
+    {
+        cmd_rx_crc = cmd_crc8(cmd_rx_crc, c);
+    }
+    f = &cmd_rx[cmd_rx_w];
+    switch (cmd_rx_state)
+    {
+        case CMD_RX_SYNC:
+            if (c == CMD_SYNC)
+            {
+                cmd_rx_crc = 0;
+                cmd_rx_state = CMD_RX_ID;
+            }
+            break;
+        case CMD_RX_ID:
+            cmd_rx_id = c;
+            cmd_rx_state = CMD_RX_SEQ;
+            break;
+        case CMD_RX_SEQ:
+            cmd_rx_seq = c;
+            cmd_rx_state = CMD_RX_LEN;
+            break;
+        case CMD_RX_LEN:
+            if (c > CMD_RX_MAX)
+            {
+                cmd_stats.overruns++;
+                cmd_rx_state = CMD_RX_SYNC;
+                break;
+            }
+            cmd_rx_len = c;
+            cmd_rx_pos = 0;
+            cmd_rx_drop = f->ready;
+            cmd_rx_state = (c > 0) ? CMD_RX_DATA : CMD_RX_CRC;
+            break;
+        case CMD_RX_DATA:
+            if (!cmd_rx_drop)
+            {
+                f->data[cmd_rx_pos] = c;
+            }
+            cmd_rx_pos++;
+            if (cmd_rx_pos == cmd_rx_len)
+            {
+                cmd_rx_state = CMD_RX_CRC;
+            }
+            break;
+        default: /* CMD_RX_CRC */
+            cmd_rx_state = CMD_RX_SYNC;
+            if (c != cmd_rx_crc)
+            {
+                cmd_stats.crc_errors++;
+            }
+            else if (cmd_rx_drop)
+            {
+                cmd_stats.overruns++;
+            }
+            else
+            {
+                f->id = cmd_rx_id;
+                f->seq = cmd_rx_seq;
+                f->len = cmd_rx_len;
+                f->t_rx = sysclock_now_cycles();
+                f->ready = true;
+                cmd_rx_w ^= 1;
+                if (cmd_notify != NULL)
+                {
+                    cmd_notify();
+                }
+            }
+            break;
+    }
+}
+
+void cmd_init(const struct cmd_handler *table, uint8_t n, void (*notify)(void))
+{
+    if (!cmd_powered)
+    {
+        power_get(POWER_USART0); /* never released */
+        cmd_powered = true;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        cmd_table = table;
+        cmd_n_handlers = n;
+        cmd_notify = notify;
+        cmd_rx[0].ready = false;
+        cmd_rx[1].ready = false;
+        cmd_rx_w = 0;
+        cmd_rd = 0;
+        cmd_rx_state = CMD_RX_SYNC;
+    }
+    cmd_stats_reset();
+    UBRR0H = UBRRH_VALUE;
+    UBRR0L = UBRRL_VALUE;
+#if USE_2X
+    UCSR0A |= _BV(U2X0);
+#else
+    UCSR0A &= ~_BV(U2X0);
+#endif
+    UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+}
+
+static
+void cmd_tx(uint8_t c)
+{
+    loop_until_bit_is_set(UCSR0A, UDRE0);
+    UDR0 = c;
+    cmd_tx_crc = cmd_crc8(cmd_tx_crc, c);
+}
+
+void cmd_reply_begin(uint8_t status, uint16_t len)
+{
+    cmd_replied = true;
+    cmd_tx(CMD_SYNC);
+    cmd_tx_crc = 0;
+    cmd_tx(cmd_cur_id);
+    cmd_tx(cmd_cur_seq);
+    cmd_tx(status);
+    cmd_tx(len & 0xFF);
+    cmd_tx(len >> 8);
+}
+
+void cmd_reply_data(const void *data, uint16_t len)
+{
+    const uint8_t *p;
+
+    p = data;
+    while (len > 0)
+    {
+        cmd_tx(*p++);
+        len--;
+    }
+}
+
+void cmd_reply_end(void)
+{
+    cmd_tx(cmd_tx_crc);
+}
+
+void cmd_reply(uint8_t status, const void *data, uint16_t len)
+{
+    cmd_reply_begin(status, len);
+    cmd_reply_data(data, len);
+    cmd_reply_end();
+}
+
+static
+uint8_t *cmd_put_le(uint8_t *p, uint32_t v, uint8_t n)
+{
+    while (n > 0)
+    {
+        *p++ = v & 0xFF;
+        v >>= 8;
+        n--;
+    }
+    return p;
+}
+
+static
+void cmd_stats_reply(void)
+{
+    struct cmd_stats s;
+    uint8_t buf[16];
+    uint8_t *p;
+
+    cmd_get_stats(&s);
+    p = cmd_put_le(buf, s.requests, 2);
+    p = cmd_put_le(p, s.crc_errors, 2);
+    p = cmd_put_le(p, s.overruns, 2);
+    p = cmd_put_le(p, s.unknown, 2);
+    p = cmd_put_le(p, s.latency_max, 4);
+    (void)cmd_put_le(p, s.handler_max, 4);
+    cmd_reply(CMD_OK, buf, sizeof(buf));
+}
+
+static
+void cmd_dispatch(const struct cmd_frame *f)
+{
+    uint8_t i;
+
+    if (f->id == CMD_ID_PING)
+    {
+        cmd_reply(CMD_OK, f->data, f->len);
+        return;
+    }
+    if (f->id == CMD_ID_STATS)
+    {
+        cmd_stats_reply();
+        return;
+    }
+    for (i = 0; i < cmd_n_handlers; i++)
+    {
+        if (cmd_table[i].id == f->id)
+        {
+            cmd_table[i].fn(f->data, f->len);
+            return;
+        }
+    }
+    cmd_stats.unknown++;
+    cmd_reply(CMD_ERR_UNKNOWN, NULL, 0);
+}
+
+bool cmd_poll(void)
+{
+    struct cmd_frame *f;
+    uint32_t t_start;
+    uint32_t latency;
+    uint32_t busy;
+
+    f = &cmd_rx[cmd_rd];
+    if (!f->ready)
+    {
+        return false;
+    }
+    t_start = sysclock_now_cycles();
+    latency = t_start - f->t_rx;
+
+    cmd_cur_id = f->id;
+    cmd_cur_seq = f->seq;
+    cmd_replied = false;
+    cmd_dispatch(f);
+    if (!cmd_replied)
+    {
+        cmd_reply(CMD_OK, NULL, 0);
+    }
+    f->ready = false; /* back to the ISR */
+    cmd_rd ^= 1;
+
+    busy = sysclock_now_cycles() - t_start;
+    cmd_stats.requests++;
+    if (latency > cmd_stats.latency_max)
+    {
+        cmd_stats.latency_max = latency;
+    }
+    if (busy > cmd_stats.handler_max)
+    {
+        cmd_stats.handler_max = busy;
+    }
+    return true;
+}
+
+void cmd_get_stats(struct cmd_stats *stats)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *stats = cmd_stats;
+    }
+}
+
+void cmd_stats_reset(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        cmd_stats.requests = 0;
+        cmd_stats.crc_errors = 0;
+        cmd_stats.overruns = 0;
+        cmd_stats.unknown = 0;
+        cmd_stats.latency_max = 0;
+        cmd_stats.handler_max = 0;
+    }
+}
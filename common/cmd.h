@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CMD_H
+#define CMD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Binary command channel on USART0.
+ *
+ * Request:  0xA5 id seq len data[len] crc
+ * Reply:    0xA5 id seq status len_lo len_hi data[len] crc
+ *
+ * The CRC-8 (polynomial 0x07, from 0) covers everything after the
+ * sync byte. seq is chosen by the client and echoed in the reply.
+ * Requests carry at most CMD_RX_MAX bytes of data, replies up to 64kB.
+ *
+ * The RX interrupt frames requests straight into one of two fixed
+ * buffers and checks their CRC on the fly. The handler then runs from
+ * cmd_poll() on that buffer, without copying, while the next request
+ * is received in the other one. A request arriving while both are
+ * taken is dropped and counted as an overrun; one with a wrong CRC or
+ * too long is dropped too, without reply: the client retries after a
+ * timeout.
+ *
+ * A handler replies with cmd_reply(), or with cmd_reply_begin(), the
+ * exact number of bytes in cmd_reply_data() calls and cmd_reply_end(),
+ * when the data is produced piecewise. Replies are transmitted by
+ * polling UDRE0, like stdio_usart0. A handler that does not reply gets
+ * an empty CMD_OK reply.
+ *
+ * Latency, from the CRC byte to the handler, is bounded by the
+ * longest code run between cmd_poll() calls: calling it from a sched
+ * task posted by the notify callback bounds it by the longest task.
+ * It is measured with sysclock, along with the handler time, and
+ * reported by the CMD_ID_STATS command, as are the error counters.
+ *
+ * host/cmdtool.c is the client for Linux.
+ */
+
+#ifndef CMD_RX_MAX
+#define CMD_RX_MAX 32
+#endif
+
+#ifndef CMD_BAUD
+#define CMD_BAUD 57600
+#endif
+
+#define CMD_SYNC 0xA5
+
+/* Built in commands */
+#define CMD_ID_PING 0x00 /* replies with the request data */
+#define CMD_ID_STATS 0x01 /* struct cmd_stats, little endian */
+#define CMD_ID_USER 0x10 /* first id for the application */
+
+/* Reply status */
+#define CMD_OK 0
+#define CMD_ERR_UNKNOWN 1 /* no handler for the id */
+#define CMD_ERR_ARGS 2 /* wrong request data */
+#define CMD_ERR_FAILED 3 /* the handler could not do it */
+
+struct cmd_stats {
+    uint16_t requests; /* dispatched */
+    uint16_t crc_errors;
+    uint16_t overruns; /* too long, or no free buffer */
+    uint16_t unknown; /* no handler */
+    uint32_t latency_max; /* cycles, end of request to handler */
+    uint32_t handler_max; /* cycles spent in a handler */
+};
+
+/* Called with the request data, still in the RX buffer */
+typedef void (*cmd_fn)(const uint8_t *data, uint8_t len);
+
+struct cmd_handler {
+    uint8_t id;
+    cmd_fn fn;
+};
+
+/* Set up USART0 at CMD_BAUD and enable the RX interrupt; table is
+ * used in place. notify, if not NULL, is called from the ISR when a
+ * request is ready, for example to sched_post() the task calling
+ * cmd_poll().
+ */
+extern void cmd_init(const struct cmd_handler *table, uint8_t n, void (*notify)(void));
+
+/* Run the handler of the oldest request received, if any; returns
+ * true if one was run.
+ */
+extern bool cmd_poll(void);
+
+/* From handlers only */
+extern void cmd_reply(uint8_t status, const void *data, uint16_t len);
+extern void cmd_reply_begin(uint8_t status, uint16_t len);
+extern void cmd_reply_data(const void *data, uint16_t len);
+extern void cmd_reply_end(void);
+
+extern void cmd_get_stats(struct cmd_stats *stats);
+extern void cmd_stats_reset(void);
+
+#endif /* CMD_H */
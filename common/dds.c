@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "dds.h"
+#include "power.h"
+
+#if (DDS_N_VOICES < 1) || (DDS_N_VOICES > 4)
+#  error "DDS_N_VOICES must be in 1..4"
+#endif
+
+#define DDS_SILENCE 128
+#define DDS_STREAM_MASK (2 * DDS_STREAM_BLOCK - 1)
+
+struct dds_voice {
+    uint16_t phase;
+    uint16_t inc;
+    const int8_t *wave;
+    uint8_t vol;
+};
+
+static struct dds_voice dds_voices[DDS_N_VOICES];
+static uint16_t dds_rate_hz;
+static uint8_t dds_next_sample = DDS_SILENCE;
+
+/* stream state */
+static uint8_t *dds_stream_buf;
+static volatile bool dds_stream_on;
+static uint16_t dds_stream_pos; /* in the double buffer */
+static volatile uint8_t dds_stream_full; /* bit per block */
+static uint8_t dds_stream_vol;
+static volatile uint16_t dds_stream_n_underruns;
+static dds_fill_fn dds_stream_fill;
+static void *dds_stream_ctx;
+static bool dds_powered; /* holds Timer0 and Timer1 */
+static bool dds_stream_ended;
+
+ISR(TIMER1_COMPA_vect)
+{
+    int16_t mix;
+    uint8_t v;
+
+    OCR0A = dds_next_sample; /* computed in the previous period: no jitter */
+
+    mix = 0;
+    for (v = 0; v < DDS_N_VOICES; v++)
+    {
+        struct dds_voice *p = &dds_voices[v];
+        int8_t s;
+
+        p->phase += p->inc;
+        s = pgm_read_byte(p->wave + (p->phase >> 8));
+        mix += (s * p->vol) >> 8;
+    }
+
+    if (dds_stream_on)
+    {
+        uint8_t *buf = dds_stream_buf;
+        uint16_t pos = dds_stream_pos;
+        uint8_t block_bit = (pos < DDS_STREAM_BLOCK) ? 0x01 : 0x02;
+
+        if (dds_stream_full & block_bit)
+        {
+            mix += ((int16_t)(buf[pos] - DDS_SILENCE) * dds_stream_vol) >> 8;
+            pos = (pos + 1) & DDS_STREAM_MASK;
+            if ((pos & (DDS_STREAM_BLOCK - 1)) == 0)
+            {
+                dds_stream_full &= ~block_bit; /* give it back for refill */
+            }
+            dds_stream_pos = pos;
+        }
+        else
+        {
+            dds_stream_n_underruns++;
+        }
+    }
+
+    mix = (mix >> DDS_MIX_SHIFT) + DDS_SILENCE;
+    if (mix < 0)
+    {
+        mix = 0;
+    }
+    else if (mix > 0xFF)
+    {
+        mix = 0xFF;
+    }
+    dds_next_sample = mix;
+}
+
+void dds_init(uint16_t rate_hz)
+{
+    uint8_t v;
+
+    dds_stop();
+    for (v = 0; v < DDS_N_VOICES; v++)
+    {
+        dds_voice_off(v);
+    }
+    if (rate_hz < DDS_RATE_MIN_HZ)
+    {
+        rate_hz = DDS_RATE_MIN_HZ; /* also 0 */
+    }
+    else if (rate_hz > DDS_RATE_MAX_HZ)
+    {
+        rate_hz = DDS_RATE_MAX_HZ;
+    }
+    dds_rate_hz = rate_hz;
+    power_get(POWER_TIMER0);
+    power_get(POWER_TIMER1);
+    dds_powered = true;
+
+    /* carrier: fast PWM, non-inverting OC0A, F_CPU/256 */
+    DDRD |= _BV(DDD6);
+    OCR0A = DDS_SILENCE;
+    TCCR0A = _BV(COM0A1) | _BV(WGM01) | _BV(WGM00);
+    TCCR0B = _BV(CS00);
+
+    /* sample clock: CTC on OCR1A, F_CPU/1 */
+    TCCR1A = 0;
+    TCNT1 = 0;
+    OCR1A = (F_CPU / rate_hz) - 1;
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
+    TCCR1B = _BV(WGM12) | _BV(CS10);
+}
+
+void dds_stop(void)
+{
+    dds_stream_on = false;
+    if (!dds_powered)
+    {
+        return; /* the timers are not ours */
+    }
+    TIMSK1 &= ~_BV(OCIE1A);
+    TCCR1B = 0;
+    TCCR0B = 0;
+    TCCR0A = 0;
+    PORTD &= ~_BV(PORTD6);
+    dds_powered = false;
+    power_put(POWER_TIMER1);
+    power_put(POWER_TIMER0);
+}
+
+void dds_voice_set(uint8_t v, const int8_t *wave, uint16_t inc, uint8_t vol)
+{
+    struct dds_voice *p = &dds_voices[v];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        p->wave = wave;
+        p->inc = inc;
+        p->vol = vol;
+    }
+}
+
+void dds_voice_set_freq(uint8_t v, const int8_t *wave, uint16_t hz, uint8_t vol)
+{
+    /* one division per note, never in the ISR */
+    dds_voice_set(v, wave, DDS_INC(hz, dds_rate_hz), vol);
+}
+
+void dds_voice_off(uint8_t v)
+{
+    /* keep stepping through silence, so the ISR time is constant */
+    dds_voice_set(v, dds_wave_sine, 0, 0);
+    dds_voices[v].phase = 0;
+}
+
+void dds_stream_start(uint8_t *buf, dds_fill_fn fill, void *ctx, uint8_t vol)
+{
+    dds_stream_on = false;
+    dds_stream_buf = buf;
+    dds_stream_fill = fill;
+    dds_stream_ctx = ctx;
+    dds_stream_vol = vol;
+    dds_stream_ended = false;
+    dds_stream_pos = 0;
+    dds_stream_full = 0;
+    dds_stream_n_underruns = 0;
+    (void)dds_stream_poll(); /* prefill both blocks before starting */
+    dds_stream_on = true;
+}
+
+bool dds_stream_poll(void)
+{
+    uint8_t block;
+
+    for (block = 0; block < 2; block++)
+    {
+        uint8_t block_bit = _BV(block);
+
+        if (dds_stream_ended || (dds_stream_full & block_bit))
+        {
+            continue;
+        }
+        /* the ISR only reads full blocks, so this one is ours */
+        if (dds_stream_fill(dds_stream_buf + (block * DDS_STREAM_BLOCK), dds_stream_ctx))
+        {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                dds_stream_full |= block_bit;
+            }
+        }
+        else
+        {
+            dds_stream_ended = true;
+        }
+    }
+
+    if (dds_stream_ended && (dds_stream_full == 0))
+    {
+        dds_stream_on = false;
+        return false;
+    }
+
+    return true;
+}
+
+uint16_t dds_stream_underruns(void)
+{
+    uint16_t n;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        n = dds_stream_n_underruns;
+    }
+
+    return n;
+}
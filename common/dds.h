@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DDS_H
+#define DDS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Direct digital synthesis on the buzzer pin (OC0A, PD6).
+ *
+ * Timer0 generates a 62.5kHz fast PWM carrier (F_CPU/256) whose duty
+ * cycle is the audio sample; Timer1 in CTC mode interrupts at the
+ * sample rate. Each voice steps a 16-bit phase accumulator through a
+ * wavetable in program memory, with the upper 8 bits as index.
+ * An 8-bit unsigned PCM stream can be mixed in, double-buffered in
+ * blocks of DDS_STREAM_BLOCK bytes that the main loop refills, for
+ * example from SD card sectors.
+ *
+ * The ISR only does a 16-bit add, a flash read and an 8x8 multiply per
+ * voice, to sustain 16-32kHz sample rates @ 16MHz; the output sample
+ * is computed one period in advance so that it is written without
+ * jitter.
+ */
+
+#ifndef DDS_N_VOICES
+#define DDS_N_VOICES 4
+#endif
+
+/* Sum of voices is divided by 2^DDS_MIX_SHIFT to avoid clipping */
+#ifndef DDS_MIX_SHIFT
+#define DDS_MIX_SHIFT 2
+#endif
+
+#define DDS_WAVE_LEN 256
+#define DDS_STREAM_BLOCK 512
+
+/* Sample rates dds_init() accepts: OCR1A is 16-bit, and samples
+ * faster than the carrier would not be output.
+ */
+#define DDS_RATE_MIN_HZ ((uint16_t)(F_CPU / 65536UL + 1))
+#define DDS_RATE_MAX_HZ ((uint16_t)(F_CPU / 256UL))
+
+/* Phase increment for a frequency, constant-folded when possible */
+#define DDS_INC(hz, rate_hz) \
+    ((uint16_t)((((uint32_t)(hz) << 16) + ((rate_hz) / 2)) / (rate_hz)))
+
+/* Wavetables in program memory, DDS_WAVE_LEN signed samples each */
+extern const int8_t dds_wave_sine[DDS_WAVE_LEN];
+extern const int8_t dds_wave_triangle[DDS_WAVE_LEN];
+extern const int8_t dds_wave_saw[DDS_WAVE_LEN];
+extern const int8_t dds_wave_square[DDS_WAVE_LEN];
+
+/* Refill one stream block; return false at the end of the stream. */
+typedef bool (*dds_fill_fn)(uint8_t *dst, void *ctx);
+
+/* Start output at rate_hz samples per second, all voices silent.
+ * rate_hz is clamped to DDS_RATE_MIN_HZ..DDS_RATE_MAX_HZ
+ * (245..62500 @ 16MHz).
+ */
+extern void dds_init(uint16_t rate_hz);
+
+extern void dds_stop(void);
+
+/* Play wave on voice v with phase increment inc (see DDS_INC),
+ * at volume vol (255 is full scale).
+ */
+extern void dds_voice_set(uint8_t v, const int8_t *wave, uint16_t inc, uint8_t vol);
+
+/* Same as dds_voice_set(), computing the increment at runtime. */
+extern void dds_voice_set_freq(uint8_t v, const int8_t *wave, uint16_t hz, uint8_t vol);
+
+extern void dds_voice_off(uint8_t v);
+
+/* Start mixing in a PCM stream; buf must hold 2 * DDS_STREAM_BLOCK
+ * bytes, and fill is called from dds_stream_poll() to refill it.
+ */
+extern void dds_stream_start(uint8_t *buf, dds_fill_fn fill, void *ctx, uint8_t vol);
+
+/* Refill empty blocks; call it often enough to refill a block every
+ * DDS_STREAM_BLOCK samples. Returns false when the stream has ended
+ * and has been completely played.
+ */
+extern bool dds_stream_poll(void);
+
+/* Number of samples played as silence because no block was ready. */
+extern uint16_t dds_stream_underruns(void);
+
+#endif /* DDS_H */
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "eestore.h"
+
+/* header offsets, after the data */
+#define OFS_VERSION 0
+#define OFS_CRC 1
+#define OFS_SEQ 2
+
+#define EEPM_ERASE_WRITE 0
+#define EEPM_ERASE_ONLY _BV(EEPM0)
+#define EEPM_WRITE_ONLY _BV(EEPM1)
+
+/* stores with records to write, the head one being written */
+static struct eestore *volatile eestore_head;
+static struct eestore *eestore_tail;
+
+/* CRC-8, polynomial x^8 + x^2 + x + 1 */
+static
+uint8_t crc8_update(uint8_t crc, const uint8_t *p, uint8_t len)
+{
+    uint8_t i;
+
+    while (len-- > 0)
+    {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* all the record but the CRC itself */
+static
+uint8_t record_crc(const struct eestore *s, const uint8_t *rec)
+{
+    uint8_t crc;
+
+    crc = crc8_update(0, rec, s->size + OFS_VERSION + 1);
+    return crc8_update(crc, &rec[s->size + OFS_SEQ], 2);
+}
+
+static
+uint16_t slot_addr(const struct eestore *s, uint8_t slot)
+{
+    return s->addr + (uint16_t)slot * EESTORE_SLOT_SIZE(s->size);
+}
+
+static
+uint8_t next_slot(const struct eestore *s, uint8_t slot)
+{
+    slot++;
+    return (slot < s->n_slots) ? slot : 0;
+}
+
+/* With EEPE clear */
+static
+uint8_t ee_read(uint16_t addr)
+{
+    EEAR = addr;
+    EECR |= _BV(EERE);
+    return EEDR;
+}
+
+/* From the main program, while the ISR may be programming a byte */
+static
+uint8_t ee_read_atomic(uint16_t addr)
+{
+    uint8_t v;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        loop_until_bit_is_clear(EECR, EEPE);
+        v = ee_read(addr);
+    }
+    return v;
+}
+
+static
+uint16_t read_seq(const struct eestore *s, uint8_t slot)
+{
+    uint16_t addr;
+
+    addr = slot_addr(s, slot) + s->size + OFS_SEQ;
+    return ee_read_atomic(addr) | ((uint16_t)ee_read_atomic(addr + 1) << 8);
+}
+
+static
+bool read_record(const struct eestore *s, uint8_t slot, uint8_t *rec)
+{
+    uint16_t addr;
+    uint8_t i;
+
+    addr = slot_addr(s, slot);
+    for (i = 0; i < EESTORE_SLOT_SIZE(s->size); i++)
+    {
+        rec[i] = ee_read_atomic(addr + i);
+    }
+    return (rec[s->size + OFS_VERSION] == s->version)
+        && (rec[s->size + OFS_CRC] == record_crc(s, rec));
+}
+
+static
+void compose(const struct eestore *s, uint8_t *rec, const void *data, uint16_t seq)
+{
+    memcpy(rec, data, s->size);
+    rec[s->size + OFS_VERSION] = s->version;
+    rec[s->size + OFS_SEQ] = seq & 0xFF;
+    rec[s->size + OFS_SEQ + 1] = seq >> 8;
+    rec[s->size + OFS_CRC] = record_crc(s, rec);
+}
+
+/* Programs the next byte that differs from the record, in the order of
+ * the record: the sequence number goes last.
+ */
+ISR(EE_READY_vect)
+{
+    struct eestore *s;
+
+    while ((s = eestore_head) != NULL)
+    {
+        const uint8_t *rec;
+        uint16_t addr;
+
+        rec = s->rec[s->w_buf];
+        addr = slot_addr(s, s->w_slot);
+        while (s->pos < EESTORE_SLOT_SIZE(s->size))
+        {
+            uint8_t i;
+            uint8_t old;
+            uint8_t v;
+
+            i = s->pos++;
+            old = ee_read(addr + i);
+            v = rec[i];
+            if (old != v)
+            {
+                uint8_t mode;
+
+                /* no erase when only zeros are programmed, and no
+                 * write for 0xFF: half the time of both */
+                if ((old & v) == v)
+                {
+                    mode = EEPM_WRITE_ONLY;
+                }
+                else if (v == 0xFF)
+                {
+                    mode = EEPM_ERASE_ONLY;
+                }
+                else
+                {
+                    mode = EEPM_ERASE_WRITE;
+                }
+                EECR = _BV(EERIE) | mode;
+                EEDR = v; /* EEAR set by ee_read() */
+                EECR |= _BV(EEMPE);
+                EECR |= _BV(EEPE); /* within 4 cycles of EEMPE */
+                return;
+            }
+        }
+
+        /* record complete */
+        s->newest = s->w_slot;
+        s->seq++;
+        if (s->pending)
+        {
+            s->pending = false;
+            s->w_buf ^= 1;
+            s->w_slot = next_slot(s, s->w_slot);
+            s->pos = 0;
+        }
+        else
+        {
+            s->writing = false;
+            eestore_head = s->next;
+        }
+    }
+    EECR &= ~_BV(EERIE);
+}
+
+bool eestore_open(struct eestore *s, uint16_t addr, uint8_t n_slots,
+        uint8_t size, uint8_t version, void *data)
+{
+    uint8_t rec[EESTORE_SLOT_SIZE(EESTORE_DATA_MAX)];
+    uint16_t seq0;
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t slot;
+    uint8_t n;
+
+    s->addr = addr;
+    s->n_slots = n_slots;
+    s->size = (size < EESTORE_DATA_MAX) ? size : EESTORE_DATA_MAX;
+    s->version = version;
+    s->writing = false;
+    s->pending = false;
+    s->next = NULL;
+    /* when empty, the first record goes to slot 0 with sequence 0 */
+    s->newest = n_slots - 1;
+    s->seq = 0xFFFF;
+
+    /* last slot written in the same round as slot 0 */
+    seq0 = read_seq(s, 0);
+    lo = 0;
+    hi = n_slots - 1;
+    while (lo < hi)
+    {
+        uint8_t mid;
+
+        mid = lo + (hi - lo + 1) / 2;
+        if (read_seq(s, mid) == (uint16_t)(seq0 + mid))
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    /* the newest record, or the one before if it was cut by a reset:
+     * its slot is then overwritten by the next save */
+    slot = lo;
+    for (n = 0; n < n_slots; n++)
+    {
+        if (read_record(s, slot, rec))
+        {
+            s->newest = slot;
+            s->seq = rec[s->size + OFS_SEQ] | ((uint16_t)rec[s->size + OFS_SEQ + 1] << 8);
+            memcpy(data, rec, s->size);
+            return true;
+        }
+        slot = (slot > 0) ? (slot - 1) : (n_slots - 1);
+    }
+    return false;
+}
+
+void eestore_save(struct eestore *s, const void *data)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (s->writing)
+        {
+            /* replaces the one already pending, if any */
+            compose(s, s->rec[s->w_buf ^ 1], data, s->seq + 2);
+            s->pending = true;
+        }
+        else
+        {
+            compose(s, s->rec[s->w_buf], data, s->seq + 1);
+            s->w_slot = next_slot(s, s->newest);
+            s->pos = 0;
+            s->writing = true;
+            s->next = NULL;
+            if (eestore_head == NULL)
+            {
+                eestore_head = s;
+                EECR |= _BV(EERIE); /* pending when EEPE is clear */
+            }
+            else
+            {
+                eestore_tail->next = s;
+            }
+            eestore_tail = s;
+        }
+    }
+}
+
+bool eestore_busy(void)
+{
+    return eestore_head != NULL;
+}
+
+void eestore_flush(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (eestore_busy())
+    {
+        cli();
+        if (eestore_busy())
+        {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
+    }
+}
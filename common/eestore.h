@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EESTORE_H
+#define EESTORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Wear-leveled storage of a small struct (settings, counters) in the
+ * EEPROM.
+ *
+ * Every save writes a new record to the next slot of a ring, so each
+ * cell is programmed once every n_slots saves: with 100000 cycles per
+ * cell, a 32-slot ring survives 3.2 million saves. A record holds the
+ * data, the format version, a CRC-8 and a sequence number, written
+ * last: a record cut by a reset has a wrong CRC or the old sequence
+ * number, and the previous one is used.
+ *
+ * Slots are written in order, so the sequence numbers grow by one
+ * from slot 0 up to the newest record: eestore_open() finds it with a
+ * binary search, reading the sequence numbers of log2(n_slots) slots.
+ *
+ * A byte takes up to 3.4ms to program, a record tens of ms:
+ * eestore_save() only copies the data, the EE_READY interrupt writes
+ * it in the background, skipping the bytes that already hold the
+ * right value, and erasing or writing only when that is enough.
+ * Saves that arrive while a record is written are merged into a
+ * single record, written next.
+ *
+ * EE_READY wakes the CPU from Idle and ADC Noise Reduction only: call
+ * eestore_flush() before Power-down.
+ */
+
+#define EESTORE_DATA_MAX 16
+
+/* version, CRC, sequence number (LSB first) */
+#define EESTORE_HEADER 4
+
+#define EESTORE_SLOT_SIZE(data_size) ((data_size) + EESTORE_HEADER)
+
+struct eestore {
+    uint16_t addr; /* of slot 0 */
+    uint8_t n_slots;
+    uint8_t size; /* of the data */
+    uint8_t version;
+    /* newest complete record */
+    volatile uint8_t newest;
+    volatile uint16_t seq;
+    /* written by the ISR: rec[w_buf] to slot w_slot, from byte pos */
+    uint8_t rec[2][EESTORE_SLOT_SIZE(EESTORE_DATA_MAX)];
+    volatile uint8_t w_buf;
+    volatile uint8_t w_slot;
+    volatile uint8_t pos;
+    volatile bool writing;
+    volatile bool pending; /* rec[!w_buf] is written next */
+    struct eestore *volatile next; /* private */
+};
+
+/* Ring of n_slots records of size bytes (at most EESTORE_DATA_MAX) at
+ * EEPROM address addr, taking n_slots * EESTORE_SLOT_SIZE(size) bytes.
+ * The newest record with the same version (not 0xFF, as erased cells)
+ * is copied to data; returns false, leaving data untouched, when there
+ * is none. Not while the store is being written.
+ */
+extern bool eestore_open(struct eestore *s, uint16_t addr, uint8_t n_slots,
+        uint8_t size, uint8_t version, void *data);
+
+/* Queue a copy of data for writing, without waiting. */
+extern void eestore_save(struct eestore *s, const void *data);
+
+/* Records still to be written, of all the stores. */
+extern bool eestore_busy(void);
+
+/* Wait in Idle sleep for all the records to be written. */
+extern void eestore_flush(void);
+
+#endif /* EESTORE_H */
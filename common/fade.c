@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "fade.h"
+#include "power.h"
+
+#define CS_MASK (_BV(CS02) | _BV(CS01) | _BV(CS00))
+
+/* Progress is a 8.24 fixed point fraction of the fade */
+#define FADE_PHASE_BITS 24
+#define FADE_PHASE_END (1UL << FADE_PHASE_BITS)
+
+struct fade_state {
+    uint32_t phase;
+    uint32_t inc; /* per tick */
+    uint8_t from;
+    uint8_t to;
+    uint8_t level;
+    uint8_t curve;
+};
+
+static struct fade_state fade_states[PWM_N_CHANNELS];
+static volatile uint8_t fade_active; /* one bit per channel */
+static bool fade_powered;
+
+/* Generated: round(65535 * (i / 255) ^ 2.2), 0.16 duty for pwm_set_frac() */
+static
+const uint16_t fade_gamma[FADE_LEVEL_MAX + 1] PROGMEM = {
+        0,     0,     2,     4,     7,    11,    17,    24,
+       32,    42,    53,    65,    79,    94,   111,   129,
+      148,   169,   192,   216,   242,   270,   299,   330,
+      362,   396,   432,   469,   508,   549,   591,   635,
+      681,   729,   779,   830,   883,   938,   995,  1053,
+     1113,  1175,  1239,  1305,  1373,  1443,  1514,  1587,
+     1663,  1740,  1819,  1900,  1983,  2068,  2155,  2243,
+     2334,  2427,  2521,  2618,  2717,  2817,  2920,  3024,
+     3131,  3240,  3350,  3463,  3578,  3694,  3813,  3934,
+     4057,  4182,  4309,  4438,  4570,  4703,  4838,  4976,
+     5115,  5257,  5401,  5547,  5695,  5845,  5998,  6152,
+     6309,  6468,  6629,  6792,  6957,  7124,  7294,  7466,
+     7640,  7816,  7994,  8175,  8358,  8543,  8730,  8919,
+     9111,  9305,  9501,  9699,  9900, 10102, 10307, 10515,
+    10724, 10936, 11150, 11366, 11585, 11806, 12029, 12254,
+    12482, 12712, 12944, 13179, 13416, 13655, 13896, 14140,
+    14386, 14635, 14885, 15138, 15394, 15652, 15912, 16174,
+    16439, 16706, 16975, 17247, 17521, 17798, 18077, 18358,
+    18642, 18928, 19216, 19507, 19800, 20095, 20393, 20694,
+    20996, 21301, 21609, 21919, 22231, 22546, 22863, 23182,
+    23504, 23829, 24156, 24485, 24817, 25151, 25487, 25826,
+    26168, 26512, 26858, 27207, 27558, 27912, 28268, 28627,
+    28988, 29351, 29717, 30086, 30457, 30830, 31206, 31585,
+    31966, 32349, 32735, 33124, 33514, 33908, 34304, 34702,
+    35103, 35507, 35913, 36321, 36732, 37146, 37562, 37981,
+    38402, 38825, 39252, 39680, 40112, 40546, 40982, 41421,
+    41862, 42306, 42753, 43202, 43654, 44108, 44565, 45025,
+    45487, 45951, 46418, 46888, 47360, 47835, 48313, 48793,
+    49275, 49761, 50249, 50739, 51232, 51728, 52226, 52727,
+    53230, 53736, 54245, 54756, 55270, 55787, 56306, 56828,
+    57352, 57879, 58409, 58941, 59476, 60014, 60554, 61097,
+    61642, 62190, 62741, 63295, 63851, 64410, 64971, 65535,
+};
+
+static
+void fade_output(enum pwm_channel ch, uint8_t level)
+{
+    pwm_set_frac(ch, pgm_read_word(&fade_gamma[level]));
+}
+
+/* Easing of progress u/256, with 8x8 bit multiplications only */
+static
+uint8_t fade_ease(uint8_t curve, uint8_t u)
+{
+    uint8_t v;
+
+    switch (curve)
+    {
+        case FADE_EASE_IN:
+            return ((uint16_t)u * u) >> 8;
+        case FADE_EASE_OUT:
+            v = 255 - u;
+            return 255 - (((uint16_t)v * v) >> 8);
+        case FADE_EASE_IN_OUT:
+            if (u < 128)
+            {
+                v = u << 1;
+                return ((uint16_t)v * v) >> 9;
+            }
+            v = 255 - ((u - 128) << 1);
+            return 255 - (((uint16_t)v * v) >> 9);
+        default:
+            return u;
+    }
+}
+
+static
+uint8_t fade_interpolate(const struct fade_state *s, uint8_t e)
+{
+    if (s->to >= s->from)
+    {
+        return s->from + (((uint16_t)(s->to - s->from) * e + 128) >> 8);
+    }
+    else
+    {
+        return s->from - (((uint16_t)(s->from - s->to) * e + 128) >> 8);
+    }
+}
+
+ISR(TIMER0_OVF_vect)
+{
+    uint8_t active;
+    uint8_t ch;
+    uint8_t mask;
+
+    active = fade_active;
+    for (ch = 0, mask = 1; active != 0; ch++, mask <<= 1)
+    {
+        struct fade_state *s;
+        uint8_t level;
+
+        if ((active & mask) == 0)
+        {
+            continue;
+        }
+        active &= ~mask;
+        s = &fade_states[ch];
+        s->phase += s->inc;
+        if (s->phase >= FADE_PHASE_END)
+        {
+            level = s->to;
+            fade_active &= ~mask;
+        }
+        else
+        {
+            uint8_t u = s->phase >> (FADE_PHASE_BITS - 8);
+
+            level = fade_interpolate(s, fade_ease(s->curve, u));
+        }
+        if (level != s->level)
+        {
+            s->level = level;
+            fade_output(ch, level);
+        }
+    }
+}
+
+void fade_init(void)
+{
+    uint8_t ch;
+
+    for (ch = 0; ch < PWM_N_CHANNELS; ch++)
+    {
+        fade_states[ch].level = 0;
+    }
+    fade_active = 0;
+    if (!fade_powered)
+    {
+        power_get(POWER_TIMER0); /* the tick is never stopped */
+        fade_powered = true;
+    }
+    if ((TCCR0B & CS_MASK) == 0)
+    {
+        /* same as pwm_init() for Timer0: Fast PWM, TOP=0xFF, F_CPU/64 */
+        TCCR0A |= _BV(WGM01) | _BV(WGM00);
+        TCCR0B = (TCCR0B & ~_BV(WGM02)) | _BV(CS01) | _BV(CS00);
+    }
+    TIFR0 = _BV(TOV0);
+    TIMSK0 |= _BV(TOIE0);
+}
+
+void fade_to(enum pwm_channel ch, uint8_t level, uint16_t ms, enum fade_curve curve)
+{
+    struct fade_state *s;
+    uint32_t ticks;
+
+    if (ch >= PWM_N_CHANNELS)
+    {
+        return;
+    }
+    if (ms == 0)
+    {
+        fade_set(ch, level);
+        return;
+    }
+    /* ms * 1000 / FADE_TICK_US, at least one tick */
+    ticks = ((uint32_t)ms * 1000UL + (FADE_TICK_US / 2)) / FADE_TICK_US;
+    if (ticks == 0)
+    {
+        ticks = 1;
+    }
+    s = &fade_states[ch];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        s->from = s->level;
+        s->to = level;
+        s->curve = curve;
+        s->phase = 0;
+        s->inc = (FADE_PHASE_END + ticks - 1) / ticks;
+        fade_active |= _BV(ch);
+    }
+}
+
+void fade_set(enum pwm_channel ch, uint8_t level)
+{
+    if (ch >= PWM_N_CHANNELS)
+    {
+        return;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        fade_active &= ~_BV(ch);
+        fade_states[ch].level = level;
+        fade_output(ch, level);
+    }
+}
+
+void fade_stop(enum pwm_channel ch)
+{
+    if (ch >= PWM_N_CHANNELS)
+    {
+        return;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        fade_active &= ~_BV(ch);
+    }
+}
+
+uint8_t fade_get(enum pwm_channel ch)
+{
+    return (ch < PWM_N_CHANNELS) ? fade_states[ch].level : 0;
+}
+
+bool fade_busy(enum pwm_channel ch)
+{
+    return (ch < PWM_N_CHANNELS) && ((fade_active & _BV(ch)) != 0);
+}
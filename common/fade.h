@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FADE_H
+#define FADE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pwm.h"
+
+/* Background fades of the PWM channels.
+ *
+ * Each channel moves from its current level to a target level over a
+ * given time, following an easing curve. Levels are perceptual
+ * (0..FADE_LEVEL_MAX) and mapped to the duty cycle through a gamma
+ * table, so that equal steps look equally bright.
+ *
+ * All active fades are advanced from the Timer0 overflow interrupt,
+ * every FADE_TICK_US (1.024ms @ 16MHz): Timer0 must stay in PWM mode,
+ * which fade_init() sets up if it is stopped.
+ * Channels must be set up with pwm_init() first.
+ */
+
+#define FADE_LEVEL_MAX 255
+#define FADE_TICK_US ((256UL * 64UL) / (F_CPU / 1000000UL))
+
+enum fade_curve {
+    FADE_LINEAR,
+    FADE_EASE_IN, /* slow start */
+    FADE_EASE_OUT, /* slow end */
+    FADE_EASE_IN_OUT,
+};
+
+extern void fade_init(void);
+
+/* Start a fade from the current level; ms = 0 sets it immediately. */
+extern void fade_to(enum pwm_channel ch, uint8_t level, uint16_t ms, enum fade_curve curve);
+
+/* Set the level immediately, cancelling any fade. */
+extern void fade_set(enum pwm_channel ch, uint8_t level);
+
+/* Stop the fade at the current level. */
+extern void fade_stop(enum pwm_channel ch);
+
+extern uint8_t fade_get(enum pwm_channel ch);
+
+extern bool fade_busy(enum pwm_channel ch);
+
+#endif /* FADE_H */
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIN_HPP
+#define PIN_HPP
+
+#include <stdint.h>
+#include <avr/io.h>
+
+/* Pins described at compile time, for the C++ drivers.
+ *
+ *   typedef pin::pins<pin::pb5, pin::pd7, pin::pd2> rows;
+ *
+ *   rows::output();     DDRB |= 0x20; DDRD |= 0x84;
+ *   rows::write(dots);  bit i of dots to the i-th pin of the list
+ *   rows::direction(d); same, for DDRx
+ *
+ * Registers are accessed at constant addresses, so single pin updates
+ * compile to SBI/CBI, and the pins of a group on the same port are
+ * updated with one store per port, with their masks computed by the
+ * compiler. A group with the same pin twice does not build, and
+ * static_assert(pin::disjoint<a, b>::value, ...) checks that two
+ * users of the pins stay apart (board.h checks those of the C
+ * drivers, like the SD card and Wiznet chip selects).
+ *
+ * Needs C++11, without the standard library (none with avr-libc).
+ */
+
+namespace pin {
+
+/* I/O port, by the data memory address of PINx; DDRx and PORTx follow */
+template <uint8_t PinAddr>
+struct port {
+    static constexpr uint8_t pin_addr = PinAddr;
+    static constexpr uint8_t ddr_addr = PinAddr + 1;
+    static constexpr uint8_t port_addr = PinAddr + 2;
+};
+
+typedef port<0x23> port_b;
+typedef port<0x26> port_c;
+typedef port<0x29> port_d;
+
+template <class Port, uint8_t Bit>
+struct io {
+    static_assert(Bit < 8, "no such pin");
+
+    typedef Port port;
+    static constexpr uint8_t bit = Bit;
+    static constexpr uint8_t mask = 1U << Bit;
+};
+
+typedef io<port_b, 0> pb0;
+typedef io<port_b, 1> pb1;
+typedef io<port_b, 2> pb2;
+typedef io<port_b, 3> pb3;
+typedef io<port_b, 4> pb4;
+typedef io<port_b, 5> pb5;
+typedef io<port_c, 0> pc0;
+typedef io<port_c, 1> pc1;
+typedef io<port_c, 2> pc2;
+typedef io<port_c, 3> pc3;
+typedef io<port_c, 4> pc4;
+typedef io<port_c, 5> pc5;
+typedef io<port_d, 0> pd0;
+typedef io<port_d, 1> pd1;
+typedef io<port_d, 2> pd2;
+typedef io<port_d, 3> pd3;
+typedef io<port_d, 4> pd4;
+typedef io<port_d, 5> pd5;
+typedef io<port_d, 6> pd6;
+typedef io<port_d, 7> pd7;
+
+/* Register field of Width bits from Shift, at data memory address Addr */
+template <uint8_t Addr, uint8_t Shift, uint8_t Width>
+struct field {
+    static_assert((Shift + Width) <= 8, "field out of the register");
+
+    static constexpr uint8_t mask = ((1U << Width) - 1) << Shift;
+
+    static constexpr uint8_t bits(uint8_t v)
+    {
+        return (v << Shift) & mask;
+    }
+    static void write(uint8_t v)
+    {
+        _SFR_MEM8(Addr) = (_SFR_MEM8(Addr) & ~mask) | bits(v);
+    }
+    static uint8_t read(void)
+    {
+        return (_SFR_MEM8(Addr) & mask) >> Shift;
+    }
+};
+
+namespace detail {
+
+template <class A, class B>
+struct same {
+    static constexpr bool value = false;
+};
+
+template <class A>
+struct same<A, A> {
+    static constexpr bool value = true;
+};
+
+/* Mask of the pins on Port */
+template <class Port, class... Pins>
+struct port_mask;
+
+template <class Port>
+struct port_mask<Port> {
+    static constexpr uint8_t value = 0;
+};
+
+template <class Port, class P, class... Rest>
+struct port_mask<Port, P, Rest...> {
+    static constexpr uint8_t value =
+        (same<typename P::port, Port>::value ? P::mask : 0)
+        | port_mask<Port, Rest...>::value;
+};
+
+/* Pins of the group at the bit of the value with their index: the
+ * compiler merges them into one AND, the others take a bit test each.
+ */
+template <class Port, uint8_t Index, class... Pins>
+struct in_place;
+
+template <class Port, uint8_t Index>
+struct in_place<Port, Index> {
+    static constexpr uint8_t value = 0;
+};
+
+template <class Port, uint8_t Index, class P, class... Rest>
+struct in_place<Port, Index, P, Rest...> {
+    static constexpr uint8_t value =
+        ((same<typename P::port, Port>::value && (P::bit == Index)) ? P::mask : 0)
+        | in_place<Port, Index + 1, Rest...>::value;
+};
+
+template <class Port, uint8_t Index, class... Pins>
+struct moved;
+
+template <class Port, uint8_t Index>
+struct moved<Port, Index> {
+    static uint8_t to_port(uint8_t) { return 0; }
+    static uint8_t from_port(uint8_t) { return 0; }
+};
+
+template <class Port, uint8_t Index, class P, class... Rest>
+struct moved<Port, Index, P, Rest...> {
+    static constexpr bool active = same<typename P::port, Port>::value && (P::bit != Index);
+    static constexpr uint8_t value_mask = 1U << Index;
+
+    static uint8_t to_port(uint8_t v)
+    {
+        return ((active && (v & value_mask)) ? P::mask : 0)
+            | moved<Port, Index + 1, Rest...>::to_port(v);
+    }
+    static uint8_t from_port(uint8_t r)
+    {
+        return ((active && (r & P::mask)) ? value_mask : 0)
+            | moved<Port, Index + 1, Rest...>::from_port(r);
+    }
+};
+
+template <uint8_t Mask>
+struct single_bit {
+    static constexpr bool value = (Mask != 0) && ((Mask & (Mask - 1)) == 0);
+};
+
+/* The operations of a pin group, restricted to one port */
+template <class Port, class... Pins>
+struct on_port {
+    static constexpr uint8_t mask = port_mask<Port, Pins...>::value;
+    static constexpr uint8_t direct = in_place<Port, 0, Pins...>::value;
+
+    static uint8_t to_port(uint8_t v)
+    {
+        return (v & direct) | moved<Port, 0, Pins...>::to_port(v);
+    }
+    static uint8_t from_port(uint8_t r)
+    {
+        return (r & direct) | moved<Port, 0, Pins...>::from_port(r);
+    }
+    static void output(void)
+    {
+        if (mask != 0)
+        {
+            _SFR_MEM8(Port::ddr_addr) |= mask;
+        }
+    }
+    static void input(void)
+    {
+        if (mask != 0)
+        {
+            _SFR_MEM8(Port::ddr_addr) &= ~mask;
+        }
+    }
+    static void set(void)
+    {
+        if (mask != 0)
+        {
+            _SFR_MEM8(Port::port_addr) |= mask;
+        }
+    }
+    static void clear(void)
+    {
+        if (mask != 0)
+        {
+            _SFR_MEM8(Port::port_addr) &= ~mask;
+        }
+    }
+    /* pins of the group at the bits of v, others unchanged */
+    template <uint8_t Addr>
+    static void store(uint8_t v)
+    {
+        if (single_bit<mask>::value)
+        {
+            /* SBI or CBI */
+            if (to_port(v) != 0)
+            {
+                _SFR_MEM8(Addr) |= mask;
+            }
+            else
+            {
+                _SFR_MEM8(Addr) &= ~mask;
+            }
+        }
+        else if (mask != 0)
+        {
+            _SFR_MEM8(Addr) = (_SFR_MEM8(Addr) & ~mask) | to_port(v);
+        }
+    }
+    static void write(uint8_t v)
+    {
+        store<Port::port_addr>(v);
+    }
+    static void direction(uint8_t v)
+    {
+        store<Port::ddr_addr>(v);
+    }
+    static uint8_t read(void)
+    {
+        return (mask != 0) ? from_port(_SFR_MEM8(Port::pin_addr)) : 0;
+    }
+};
+
+template <class... Pins>
+struct distinct;
+
+template <>
+struct distinct<> {
+    static constexpr bool value = true;
+};
+
+template <class P, class... Rest>
+struct distinct<P, Rest...> {
+    static constexpr bool value =
+        ((port_mask<typename P::port, Rest...>::value & P::mask) == 0)
+        && distinct<Rest...>::value;
+};
+
+} /* namespace detail */
+
+/* Pins handled together; bit i of values is the i-th pin */
+template <class... Pins>
+struct pins {
+    static_assert(sizeof...(Pins) <= 8, "more pins than bits in a value");
+    static_assert(detail::distinct<Pins...>::value, "pin listed twice");
+
+    template <class Port>
+    struct on : detail::on_port<Port, Pins...> {
+    };
+
+    static constexpr uint8_t mask_b = on<port_b>::mask;
+    static constexpr uint8_t mask_c = on<port_c>::mask;
+    static constexpr uint8_t mask_d = on<port_d>::mask;
+
+    static void output(void)
+    {
+        on<port_b>::output();
+        on<port_c>::output();
+        on<port_d>::output();
+    }
+    static void input(void)
+    {
+        on<port_b>::input();
+        on<port_c>::input();
+        on<port_d>::input();
+    }
+    /* PORTx bits: high outputs, or pull-ups of inputs */
+    static void set(void)
+    {
+        on<port_b>::set();
+        on<port_c>::set();
+        on<port_d>::set();
+    }
+    static void clear(void)
+    {
+        on<port_b>::clear();
+        on<port_c>::clear();
+        on<port_d>::clear();
+    }
+    static void write(uint8_t v)
+    {
+        on<port_b>::write(v);
+        on<port_c>::write(v);
+        on<port_d>::write(v);
+    }
+    /* 1 for output */
+    static void direction(uint8_t v)
+    {
+        on<port_b>::direction(v);
+        on<port_c>::direction(v);
+        on<port_d>::direction(v);
+    }
+    static uint8_t read(void)
+    {
+        return on<port_b>::read() | on<port_c>::read() | on<port_d>::read();
+    }
+};
+
+/* No pin in common between two groups */
+template <class A, class B>
+struct disjoint {
+    static constexpr bool value =
+           ((A::mask_b & B::mask_b) == 0)
+        && ((A::mask_c & B::mask_c) == 0)
+        && ((A::mask_d & B::mask_d) == 0);
+};
+
+} /* namespace pin */
+
+#endif /* PIN_HPP */
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "power.h"
+
+#define CS_MASK (_BV(CS02) | _BV(CS01) | _BV(CS00)) /* same for all timers */
+#define ISC_MASK(n) (3 << (2 * (n))) /* 00 is the low level interrupt */
+
+/* Typical supply current at 5V 16MHz, in uA: the datasheet tables at
+ * 8MHz doubled, for the peripherals.
+ */
+#define POWER_ACTIVE_UA 7500
+#define POWER_IDLE_UA 1500
+#define POWER_ADC_NR_UA 700 /* oscillator and clk_adc running */
+#define POWER_STANDBY_UA 300 /* oscillator running */
+#define POWER_DOWN_UA 20 /* brown-out detector, as fused on the Uno */
+#define POWER_T2_ASYNC_UA 10 /* Timer2 on the 32kHz crystal */
+
+static const uint8_t power_prr_bits[POWER_N_PERIPHS] = {
+    _BV(PRADC),
+    _BV(PRUSART0),
+    _BV(PRSPI),
+    _BV(PRTIM1),
+    _BV(PRTIM0),
+    _BV(PRTIM2),
+    _BV(PRTWI),
+};
+
+static const uint16_t power_periph_ua[POWER_N_PERIPHS] = {
+    270, /* ADC */
+    200, /* USART0 */
+    210, /* SPI */
+    200, /* Timer1 */
+    70, /* Timer0 */
+    230, /* Timer2 */
+    200, /* TWI */
+};
+
+static uint8_t power_refs[POWER_N_PERIPHS];
+static bool power_fast;
+
+void power_init(void)
+{
+    uint8_t p;
+    uint8_t prr;
+
+    ACSR &= ~_BV(ACIE); /* before changing ACD */
+    ACSR |= _BV(ACD); /* analog comparator off */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        prr = 0;
+        for (p = 0; p < POWER_N_PERIPHS; p++)
+        {
+            if (power_refs[p] == 0)
+            {
+                prr |= power_prr_bits[p];
+            }
+        }
+        PRR = prr;
+    }
+}
+
+void power_get(enum power_periph p)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (power_refs[p] == 0)
+        {
+            PRR &= ~power_prr_bits[p];
+        }
+        power_refs[p]++;
+    }
+}
+
+void power_put(enum power_periph p)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (power_refs[p] > 0)
+        {
+            power_refs[p]--;
+            if (power_refs[p] == 0)
+            {
+                PRR |= power_prr_bits[p];
+            }
+        }
+    }
+}
+
+/* Registers of gated peripherals can't be read: check PRR first */
+enum power_sleep power_sleep_mode(void)
+{
+    uint8_t prr;
+    enum power_sleep mode;
+
+    prr = PRR;
+    if ((EIMSK & _BV(INT0)) && (EICRA & ISC_MASK(0)))
+    {
+        return POWER_SLEEP_IDLE; /* edges are detected with clk_io */
+    }
+    if ((EIMSK & _BV(INT1)) && (EICRA & ISC_MASK(1)))
+    {
+        return POWER_SLEEP_IDLE;
+    }
+    if (!(prr & _BV(PRUSART0)) && (UCSR0B & (_BV(RXCIE0) | _BV(TXCIE0) | _BV(UDRIE0))))
+    {
+        return POWER_SLEEP_IDLE;
+    }
+    if (!(prr & _BV(PRSPI)) && (SPCR & _BV(SPIE)))
+    {
+        return POWER_SLEEP_IDLE;
+    }
+    if (!(prr & _BV(PRTWI)) && (TWCR & _BV(TWIE)))
+    {
+        return POWER_SLEEP_IDLE;
+    }
+    if (!(prr & _BV(PRTIM0)) && (TIMSK0 != 0) && (TCCR0B & CS_MASK))
+    {
+        return POWER_SLEEP_IDLE;
+    }
+    if (!(prr & _BV(PRTIM1)) && (TIMSK1 != 0) && (TCCR1B & CS_MASK))
+    {
+        return POWER_SLEEP_IDLE;
+    }
+    mode = POWER_SLEEP_POWER_DOWN;
+    if (!(prr & _BV(PRTIM2)) && (TIMSK2 != 0) && (ASSR & _BV(AS2)))
+    {
+        mode = POWER_SLEEP_POWER_SAVE;
+    }
+    if (!(prr & _BV(PRADC))
+            && ((ADCSRA & (_BV(ADEN) | _BV(ADIE))) == (_BV(ADEN) | _BV(ADIE))))
+    {
+        if ((ADCSRA & _BV(ADATE)) && (ADCSRB & (_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))))
+        {
+            return POWER_SLEEP_IDLE; /* triggered by a timer (or by INT0, AC) */
+        }
+        mode = POWER_SLEEP_ADC;
+    }
+    if (EECR & _BV(EERIE))
+    {
+        mode = POWER_SLEEP_ADC;
+    }
+
+    return mode;
+}
+
+uint8_t power_sleep_smcr(enum power_sleep mode)
+{
+    switch (mode)
+    {
+        case POWER_SLEEP_IDLE:
+            return SLEEP_MODE_IDLE;
+        case POWER_SLEEP_ADC:
+            return SLEEP_MODE_ADC;
+        case POWER_SLEEP_POWER_SAVE:
+            return power_fast ? SLEEP_MODE_EXT_STANDBY : SLEEP_MODE_PWR_SAVE;
+        default:
+            return power_fast ? SLEEP_MODE_STANDBY : SLEEP_MODE_PWR_DOWN;
+    }
+}
+
+void power_fast_wake(bool on)
+{
+    power_fast = on;
+}
+
+/* Peripherals in the mask that are powered */
+static
+uint16_t power_periphs_ua(uint8_t prr_mask)
+{
+    uint8_t prr;
+    uint8_t p;
+    uint16_t ua;
+
+    prr = PRR;
+    ua = 0;
+    for (p = 0; p < POWER_N_PERIPHS; p++)
+    {
+        if ((prr_mask & power_prr_bits[p]) && !(prr & power_prr_bits[p]))
+        {
+            ua += power_periph_ua[p];
+        }
+    }
+    return ua;
+}
+
+uint16_t power_active_ua(void)
+{
+    return POWER_ACTIVE_UA + power_periphs_ua(0xFF);
+}
+
+uint16_t power_sleep_ua(enum power_sleep mode)
+{
+    uint16_t ua;
+
+    if (mode == POWER_SLEEP_IDLE)
+    {
+        return POWER_IDLE_UA + power_periphs_ua(0xFF);
+    }
+    if (mode == POWER_SLEEP_ADC)
+    {
+        ua = POWER_ADC_NR_UA + power_periphs_ua(_BV(PRADC));
+    }
+    else
+    {
+        ua = power_fast ? POWER_STANDBY_UA : POWER_DOWN_UA;
+    }
+    if ((mode != POWER_SLEEP_POWER_DOWN) && !(PRR & _BV(PRTIM2)) && (ASSR & _BV(AS2)))
+    {
+        ua += POWER_T2_ASYNC_UA;
+    }
+    return ua;
+}
+
+uint16_t power_budget_ua(enum power_sleep mode, uint8_t idle_percent)
+{
+    uint32_t active;
+    uint32_t sleep;
+
+    if (idle_percent > 100)
+    {
+        idle_percent = 100;
+    }
+    active = (uint32_t)power_active_ua() * (100 - idle_percent);
+    sleep = (uint32_t)power_sleep_ua(mode) * idle_percent;
+    return (active + sleep + 50) / 100;
+}
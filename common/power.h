@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Peripheral power gating and sleep mode selection.
+ *
+ * Each driver calls power_get() before touching the registers of a
+ * peripheral and power_put() when it is done with it: the first get
+ * clears the bit of the peripheral in PRR, the last put sets it again,
+ * stopping its clock. Registers of a gated peripheral can be neither
+ * read nor written. At reset PRR is 0: power_init() gates every
+ * peripheral nobody holds, and turns off the analog comparator.
+ *
+ * power_sleep_mode() returns the deepest sleep mode that keeps every
+ * enabled interrupt source of the powered peripherals able to wake the
+ * CPU:
+ * - Idle for the USART, SPI and TWI interrupts, the Timer0 and Timer1
+ *   interrupts while their clock runs, and edge triggered INT0/INT1;
+ * - ADC Noise Reduction for the ADC and EE_READY;
+ * - Power-save for the Timer2 interrupts when it runs from its
+ *   asynchronous 32kHz crystal (AS2);
+ * - otherwise Power-down: pin change, INT0/INT1 low level, watchdog.
+ * Synchronous Timer2 is sysclock, which is expected to stop in the
+ * deep modes (see sched.h): who needs its interrupts stays in Idle.
+ * PWM outputs need clk_io too, but are not wake sources: stop them or
+ * stay in Idle.
+ *
+ * Wake-up latency, from the wake-up event to the first instruction of
+ * the ISR, with the Arduino fuses (16MHz crystal, 16K CK start-up):
+ *   Idle, ADC Noise Reduction        4 + 4 cycles           0.5us
+ *   Standby, Extended Standby        6 + 4 + 4 cycles       0.9us
+ *   Power-down, Power-save      16384 + 4 + 4 cycles        1.0ms
+ * The CPU is halted 4 cycles after the start-up time, then takes 4
+ * cycles to jump to the vector. sysclock does not count the start-up
+ * time; host/test_power.c measures these with the host model.
+ * power_fast_wake() trades the oscillator current for the short wake-up
+ * of the Standby modes.
+ *
+ * The current budget is estimated from the typical figures of the
+ * datasheet at 5V 16MHz, for the MCU alone: the board (regulator, USB
+ * bridge, LEDs) usually draws more.
+ */
+
+enum power_periph {
+    POWER_ADC,
+    POWER_USART0,
+    POWER_SPI,
+    POWER_TIMER1,
+    POWER_TIMER0,
+    POWER_TIMER2,
+    POWER_TWI,
+    POWER_N_PERIPHS
+};
+
+/* From the shallowest, each keeping fewer wake-up sources */
+enum power_sleep {
+    POWER_SLEEP_IDLE, /* CPU stopped, all peripherals running */
+    POWER_SLEEP_ADC, /* ADC Noise Reduction: clk_io stopped */
+    POWER_SLEEP_POWER_SAVE, /* Power-down, asynchronous Timer2 running */
+    POWER_SLEEP_POWER_DOWN, /* all clocks stopped */
+    POWER_N_SLEEPS
+};
+
+/* Gate the peripherals that nobody holds. */
+extern void power_init(void);
+
+/* Take and release a reference to the peripheral; calls nest. Safe
+ * from ISRs.
+ */
+extern void power_get(enum power_periph p);
+extern void power_put(enum power_periph p);
+
+/* Deepest mode allowed by the enabled interrupt sources. */
+extern enum power_sleep power_sleep_mode(void);
+
+/* The mode for set_sleep_mode(): the Standby variants of Power-down
+ * and Power-save when fast wake-up is on.
+ */
+extern uint8_t power_sleep_smcr(enum power_sleep mode);
+extern void power_fast_wake(bool on);
+
+/* Estimated supply current, in uA, running and sleeping, with the
+ * peripherals powered at the moment.
+ */
+extern uint16_t power_active_ua(void);
+extern uint16_t power_sleep_ua(enum power_sleep mode);
+
+/* Average over time, sleeping idle_percent of it in the given mode. */
+extern uint16_t power_budget_ua(enum power_sleep mode, uint8_t idle_percent);
+
+#endif /* POWER_H */
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "prof.h"
+
+#if PROF_ENABLE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "sysclock.h"
+
+#define PROF_STACK_CANARY 0xC5
+
+volatile uint32_t prof_isr_cycles;
+
+static
+struct prof_probe *prof_probes;
+
+#ifdef __AVR__ /* no RAM to paint in the host build */
+
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+/* Paint all the RAM above .bss before .data/.bss are initialized
+ * and before anything uses the stack.
+ * Written in assembly because C code is not safe in naked functions.
+ */
+__attribute__((naked, used, section(".init3")))
+static
+void prof_stack_paint(void)
+{
+    __asm__ volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %[canary]\n"
+        "    ldi r25, hi8(%[top])\n"
+        "1:  st Z+, r24\n"
+        "    cpi r30, lo8(%[top])\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        :
+        : [canary] "i" (PROF_STACK_CANARY), [top] "i" (RAMEND + 1)
+    );
+}
+
+#endif /* __AVR__ */
+
+static
+uint32_t prof_elapsed(const struct prof_scope *scope)
+{
+    uint32_t t_end;
+    uint32_t isr_end;
+
+    t_end = sysclock_now_cycles();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        isr_end = prof_isr_cycles;
+    }
+
+    /* exclude time spent in instrumented ISRs */
+    return (t_end - scope->t_start) - (isr_end - scope->isr_start);
+}
+
+void prof_probe_add(struct prof_probe *probe, uint32_t cycles)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (probe->count == 0)
+        {
+            struct prof_probe *p;
+
+            /* register on first use, unless it is there since before a reset */
+            for (p = prof_probes; p != NULL; p = p->next)
+            {
+                if (p == probe)
+                {
+                    break;
+                }
+            }
+            if (p == NULL)
+            {
+                probe->next = prof_probes;
+                prof_probes = probe;
+            }
+        }
+        probe->count++;
+        probe->total += cycles;
+        if (cycles < probe->min)
+        {
+            probe->min = cycles;
+        }
+        if (cycles > probe->max)
+        {
+            probe->max = cycles;
+        }
+    }
+}
+
+void prof_scope_end(struct prof_scope *scope)
+{
+    prof_probe_add(scope->probe, prof_elapsed(scope));
+}
+
+void prof_isr_end(struct prof_scope *scope)
+{
+    uint32_t cycles;
+
+    cycles = prof_elapsed(scope);
+    prof_probe_add(scope->probe, cycles);
+    /* nested instrumented ISRs already added their own time */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        prof_isr_cycles += cycles;
+    }
+}
+
+void prof_reset(void)
+{
+    struct prof_probe *p;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (p = prof_probes; p != NULL; p = p->next)
+        {
+            p->count = 0;
+            p->min = UINT32_MAX;
+            p->max = 0;
+            p->total = 0;
+        }
+        prof_isr_cycles = 0;
+    }
+}
+
+uint16_t prof_stack_unused(void)
+{
+#ifdef __AVR__
+    const uint8_t *p;
+    uint16_t unused;
+
+    /* the heap grows up from __heap_start, the stack down from RAMEND */
+    p = (__brkval != NULL) ? (const uint8_t *)__brkval : &__heap_start;
+    unused = 0;
+    while ((p <= (const uint8_t *)RAMEND) && (*p == PROF_STACK_CANARY))
+    {
+        unused++;
+        p++;
+    }
+
+    return unused;
+#else
+    return 0;
+#endif
+}
+
+static
+uint32_t prof_overhead(void)
+{
+    struct prof_scope scope;
+
+    /* same work as an empty PROF_SCOPE, without any ISR in between */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        scope.probe = NULL;
+        scope.t_start = sysclock_now_cycles();
+        scope.isr_start = prof_isr_cycles;
+        return prof_elapsed(&scope);
+    }
+    return 0;
+}
+
+static
+uint32_t prof_sub_sat(uint32_t a, uint32_t b)
+{
+    return (a > b) ? (a - b) : 0;
+}
+
+bool prof_get(uint8_t index, struct prof_probe *dst)
+{
+    struct prof_probe *p;
+    uint32_t overhead;
+
+    overhead = prof_overhead();
+    for (p = prof_probes; (p != NULL) && (index > 0); p = p->next)
+    {
+        index--;
+    }
+    if (p == NULL)
+    {
+        return false;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *dst = *p;
+    }
+    dst->min = prof_sub_sat(dst->min, overhead);
+    dst->max = prof_sub_sat(dst->max, overhead);
+    dst->total = prof_sub_sat(dst->total, overhead * dst->count);
+    return true;
+}
+
+void prof_dump(void)
+{
+    struct prof_probe *p;
+    uint32_t overhead;
+    uint32_t isr_cycles;
+
+    overhead = prof_overhead();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        isr_cycles = prof_isr_cycles;
+    }
+
+    printf_P(PSTR("%-20s %10s %10s %10s %10s\n"), "probe", "count", "min", "max", "avg");
+    for (p = prof_probes; p != NULL; p = p->next)
+    {
+        struct prof_probe snap;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            snap = *p;
+        }
+        if (snap.count == 0)
+        {
+            /* not run since prof_reset() */
+            printf_P(PSTR("%-20S %10lu %10s %10s %10s\n"), snap.name, 0UL, "-", "-", "-");
+            continue;
+        }
+        printf_P(PSTR("%-20S %10lu %10lu %10lu %10lu\n"),
+                snap.name,
+                (unsigned long)snap.count,
+                (unsigned long)prof_sub_sat(snap.min, overhead),
+                (unsigned long)prof_sub_sat(snap.max, overhead),
+                (unsigned long)prof_sub_sat(snap.total / snap.count, overhead));
+    }
+    printf_P(PSTR("isr cycles: %lu of %lu\n"),
+            (unsigned long)isr_cycles,
+            (unsigned long)sysclock_now_cycles());
+    printf_P(PSTR("probe overhead: %lu cycles\n"), (unsigned long)overhead);
+    printf_P(PSTR("stack unused: %u bytes\n"), prof_stack_unused());
+}
+
+void prof_poll(void)
+{
+    if (bit_is_set(UCSR0A, RXC0))
+    {
+        (void)UDR0; /* any character triggers a dump */
+        prof_dump();
+    }
+}
+
+#endif /* PROF_ENABLE */
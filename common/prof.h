@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* On-target profiler.
+ *
+ * Build with "make PROF=1" to enable; otherwise every macro below
+ * expands to nothing and the functions are empty inlines.
+ *
+ * Usage:
+ *
+ *   PROF_PROBE(draw);            at file scope
+ *
+ *   void f(void)
+ *   {
+ *       PROF_SCOPE(draw);        measures until the end of the block
+ *       ...
+ *   }
+ *
+ *   ISR(..._vect)
+ *   {
+ *       PROF_ISR(isr_probe);     also accounted as ISR time
+ *       ...
+ *   }
+ *
+ * Times are in CPU cycles, taken from sysclock; PROF=1 builds run
+ * sysclock with prescaler 8, so the resolution is 8 cycles.
+ * Time spent in instrumented ISRs is subtracted from the probes
+ * they interrupt. The probe overhead is calibrated and subtracted.
+ */
+
+#ifndef PROF_ENABLE
+#define PROF_ENABLE 0
+#endif
+
+#if PROF_ENABLE
+
+#include <avr/pgmspace.h>
+#include "sysclock.h"
+
+struct prof_probe {
+    const char *name; /* in program memory */
+    struct prof_probe *next;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+};
+
+struct prof_scope {
+    struct prof_probe *probe;
+    uint32_t t_start;
+    uint32_t isr_start;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Cycles spent in instrumented ISRs, since startup. */
+extern volatile uint32_t prof_isr_cycles;
+
+extern void prof_probe_add(struct prof_probe *probe, uint32_t cycles);
+extern void prof_scope_end(struct prof_scope *scope);
+extern void prof_isr_end(struct prof_scope *scope);
+
+extern void prof_reset(void);
+extern uint16_t prof_stack_unused(void);
+extern void prof_dump(void);
+extern void prof_poll(void);
+
+/* Copy of the index-th probe, in the prof_dump() order, with the
+ * probe overhead subtracted; false past the last one.
+ */
+extern bool prof_get(uint8_t index, struct prof_probe *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define PROF_PROBE(var) \
+    static const char var##_name_[] PROGMEM = #var; \
+    static struct prof_probe var = { var##_name_, 0, 0, UINT32_MAX, 0, 0 }
+
+#define PROF_SCOPE(var) \
+    struct prof_scope var##_scope_ __attribute__((cleanup(prof_scope_end))) = \
+        { &(var), sysclock_now_cycles(), prof_isr_cycles }
+
+#define PROF_ISR(var) \
+    struct prof_scope var##_scope_ __attribute__((cleanup(prof_isr_end))) = \
+        { &(var), sysclock_now_cycles(), prof_isr_cycles }
+
+#define PROF_BEGIN(var) \
+    struct prof_scope var##_scope_ = \
+        { &(var), sysclock_now_cycles(), prof_isr_cycles }
+
+#define PROF_END(var) prof_scope_end(&var##_scope_)
+
+#else /* !PROF_ENABLE */
+
+#define PROF_PROBE(var) struct prof_probe_unused_
+#define PROF_SCOPE(var) do {} while (0)
+#define PROF_ISR(var) do {} while (0)
+#define PROF_BEGIN(var) do {} while (0)
+#define PROF_END(var) do {} while (0)
+
+static inline void prof_reset(void) {}
+static inline uint16_t prof_stack_unused(void) { return 0; }
+static inline void prof_dump(void) {}
+static inline void prof_poll(void) {}
+
+struct prof_probe;
+static inline bool prof_get(uint8_t index, struct prof_probe *dst)
+{
+    (void)index;
+    (void)dst;
+    return false;
+}
+
+#endif /* PROF_ENABLE */
+
+#endif /* PROF_H */
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "power.h"
+#include "pwm.h"
+
+#define BVV(bit, val) ((val)?_BV(bit):0)
+
+#define CS_MASK (_BV(CS02) | _BV(CS01) | _BV(CS00)) /* same for all timers */
+
+static
+uint16_t pwm_top[PWM_N_CHANNELS] = {
+    0xFF, 0xFF, /* Timer0 */
+    0xFFFF, 0xFFFF, /* Timer1, set by init */
+    0xFF, 0xFF, /* Timer2 */
+};
+
+static
+const uint8_t pwm_timers[PWM_N_CHANNELS] = {
+    POWER_TIMER0, POWER_TIMER0,
+    POWER_TIMER1, POWER_TIMER1,
+    POWER_TIMER2, POWER_TIMER2,
+};
+
+static
+bool pwm_powered[PWM_N_CHANNELS]; /* the channel holds its timer */
+
+static
+void pwm_pin_output(enum pwm_channel ch)
+{
+    switch (ch)
+    {
+        case PWM_OC0A:
+            DDRD |= _BV(DDD6);
+            break;
+        case PWM_OC0B:
+            DDRD |= _BV(DDD5);
+            break;
+        case PWM_OC1A:
+            DDRB |= _BV(DDB1);
+            break;
+        case PWM_OC1B:
+            DDRB |= _BV(DDB2);
+            break;
+        case PWM_OC2A:
+            DDRB |= _BV(DDB3);
+            break;
+        case PWM_OC2B:
+            DDRD |= _BV(DDD3);
+            break;
+        default:
+            break;
+    }
+}
+
+static
+void pwm_timer0_init(void)
+{
+    TCCR0A |= BVV(WGM00, 1) | BVV(WGM01, 1); /* Fast PWM, TOP=0xFF */
+    TCCR0B &= ~_BV(WGM02);
+    if ((TCCR0B & CS_MASK) == 0)
+    {
+        TCCR0B |= BVV(CS00, 1) | BVV(CS01, 1) | BVV(CS02, 0); /* F_CPU/64 */
+    }
+}
+
+static
+void pwm_timer2_init(void)
+{
+    TCCR2A |= BVV(WGM20, 1) | BVV(WGM21, 1); /* Fast PWM, TOP=0xFF */
+    TCCR2B &= ~_BV(WGM22);
+    if ((TCCR2B & CS_MASK) == 0)
+    {
+        TCCR2B |= BVV(CS20, 0) | BVV(CS21, 0) | BVV(CS22, 1); /* F_CPU/64 */
+    }
+}
+
+static
+void pwm_timer1_init(uint16_t top)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ICR1 = top;
+    }
+    pwm_top[PWM_OC1A] = top;
+    pwm_top[PWM_OC1B] = top;
+    TCCR1A = (TCCR1A & ~(_BV(WGM10))) | BVV(WGM11, 1); /* Fast PWM, TOP=ICR1 */
+    TCCR1B |= BVV(WGM12, 1) | BVV(WGM13, 1);
+    if ((TCCR1B & CS_MASK) == 0)
+    {
+        TCCR1B |= BVV(CS10, 1) | BVV(CS11, 0) | BVV(CS12, 0); /* F_CPU/1 */
+    }
+}
+
+static
+void pwm_connect(enum pwm_channel ch)
+{
+    /* inverting mode: set on compare match, clear at BOTTOM */
+    switch (ch)
+    {
+        case PWM_OC0A:
+            TCCR0A |= _BV(COM0A1) | _BV(COM0A0);
+            break;
+        case PWM_OC0B:
+            TCCR0A |= _BV(COM0B1) | _BV(COM0B0);
+            break;
+        case PWM_OC1A:
+            TCCR1A |= _BV(COM1A1) | _BV(COM1A0);
+            break;
+        case PWM_OC1B:
+            TCCR1A |= _BV(COM1B1) | _BV(COM1B0);
+            break;
+        case PWM_OC2A:
+            TCCR2A |= _BV(COM2A1) | _BV(COM2A0);
+            break;
+        case PWM_OC2B:
+            TCCR2A |= _BV(COM2B1) | _BV(COM2B0);
+            break;
+        default:
+            break;
+    }
+}
+
+static
+void pwm_set_ocr(enum pwm_channel ch, uint16_t ocr)
+{
+    switch (ch)
+    {
+        case PWM_OC0A:
+            OCR0A = ocr;
+            break;
+        case PWM_OC0B:
+            OCR0B = ocr;
+            break;
+        case PWM_OC1A:
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) /* shared TEMP register */
+            {
+                OCR1A = ocr;
+            }
+            break;
+        case PWM_OC1B:
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) /* shared TEMP register */
+            {
+                OCR1B = ocr;
+            }
+            break;
+        case PWM_OC2A:
+            OCR2A = ocr;
+            break;
+        case PWM_OC2B:
+            OCR2B = ocr;
+            break;
+        default:
+            break;
+    }
+}
+
+void pwm_init_top(enum pwm_channel ch, uint16_t top)
+{
+    if (ch >= PWM_N_CHANNELS)
+    {
+        return;
+    }
+    if (!pwm_powered[ch])
+    {
+        power_get(pwm_timers[ch]);
+        pwm_powered[ch] = true;
+    }
+    switch (ch)
+    {
+        case PWM_OC0A:
+        case PWM_OC0B:
+            pwm_timer0_init();
+            break;
+        case PWM_OC1A:
+        case PWM_OC1B:
+            pwm_timer1_init(top);
+            break;
+        default:
+            pwm_timer2_init();
+            break;
+    }
+    pwm_set(ch, 0); /* before connecting, so that it starts low */
+    pwm_connect(ch);
+    pwm_pin_output(ch);
+}
+
+void pwm_init(enum pwm_channel ch, uint8_t bits)
+{
+    if (bits < 2)
+    {
+        bits = 2;
+    }
+    else if (bits > 16)
+    {
+        bits = 16;
+    }
+    pwm_init_top(ch, (uint16_t)((1UL << bits) - 1));
+}
+
+uint16_t pwm_get_top(enum pwm_channel ch)
+{
+    return pwm_top[ch];
+}
+
+void pwm_set(enum pwm_channel ch, uint16_t counts)
+{
+    uint16_t top;
+
+    top = pwm_top[ch];
+    if (counts > top)
+    {
+        counts = top;
+    }
+    pwm_set_ocr(ch, top - counts); /* inverted output */
+}
+
+void pwm_set_frac(enum pwm_channel ch, uint16_t frac)
+{
+    uint16_t top;
+
+    /* frac * (TOP+1) / 65536, with a 16x16 bit multiply */
+    top = pwm_top[ch];
+    pwm_set(ch, (uint16_t)((((uint32_t)frac * top) + frac) >> 16));
+}
+
+void pwm_set_percent(enum pwm_channel ch, uint8_t percent)
+{
+    uint16_t frac;
+
+    if (percent >= 100)
+    {
+        frac = PWM_FRAC_MAX;
+    }
+    else
+    {
+        /* percent * 655.36, without 32-bit arithmetic */
+        frac = (percent * 655U) + ((percent * 23U) >> 6);
+    }
+    pwm_set_frac(ch, frac);
+}
+
+void pwm_stop(enum pwm_channel ch)
+{
+    switch (ch)
+    {
+        case PWM_OC0A:
+            TCCR0A &= ~(_BV(COM0A1) | _BV(COM0A0));
+            PORTD &= ~_BV(PORTD6);
+            break;
+        case PWM_OC0B:
+            TCCR0A &= ~(_BV(COM0B1) | _BV(COM0B0));
+            PORTD &= ~_BV(PORTD5);
+            break;
+        case PWM_OC1A:
+            TCCR1A &= ~(_BV(COM1A1) | _BV(COM1A0));
+            PORTB &= ~_BV(PORTB1);
+            break;
+        case PWM_OC1B:
+            TCCR1A &= ~(_BV(COM1B1) | _BV(COM1B0));
+            PORTB &= ~_BV(PORTB2);
+            break;
+        case PWM_OC2A:
+            TCCR2A &= ~(_BV(COM2A1) | _BV(COM2A0));
+            PORTB &= ~_BV(PORTB3);
+            break;
+        case PWM_OC2B:
+            TCCR2A &= ~(_BV(COM2B1) | _BV(COM2B0));
+            PORTD &= ~_BV(PORTD3);
+            break;
+        default:
+            return;
+    }
+    if (pwm_powered[ch])
+    {
+        pwm_powered[ch] = false;
+        power_put(pwm_timers[ch]); /* gated if nobody else holds it */
+    }
+}
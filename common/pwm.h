@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PWM_H
+#define PWM_H
+
+#include <stdint.h>
+
+/* Hardware PWM on the six output compare pins.
+ *
+ * All channels run in fast PWM mode with inverted output, so that the
+ * duty cycle is exactly counts/(TOP+1): 0 is constantly low without
+ * disconnecting the pin, and the maximum is TOP/(TOP+1).
+ * OCRnx are double-buffered by hardware in fast PWM mode and updated at
+ * BOTTOM, so duty changes never produce a truncated or extra pulse.
+ *
+ * Timer0 and Timer2 are 8-bit (TOP=0xFF), clocked at F_CPU/64
+ * (976Hz @ 16MHz); Timer2 keeps the prescaler already set by sysclock.
+ * Timer1 uses ICR1 as TOP, from 2 to 16 bits, clocked at F_CPU
+ * (244Hz @ 16 bits, 15.6kHz @ 10 bits); OC1A and OC1B share the TOP.
+ */
+
+enum pwm_channel {
+    PWM_OC0A, /* PD6 */
+    PWM_OC0B, /* PD5 */
+    PWM_OC1A, /* PB1 */
+    PWM_OC1B, /* PB2 */
+    PWM_OC2A, /* PB3 */
+    PWM_OC2B, /* PD3 */
+    PWM_N_CHANNELS
+};
+
+/* Duty cycle as a 0.16 fixed point fraction of the period. */
+#define PWM_FRAC_MAX 0xFFFFU
+#define PWM_FRAC(num, den) ((uint16_t)(((uint32_t)(num) * PWM_FRAC_MAX) / (den)))
+
+/* Set up the channel, with duty 0, and its timer if not running.
+ * bits is the resolution for Timer1 channels, ignored for the others.
+ */
+extern void pwm_init(enum pwm_channel ch, uint8_t bits);
+
+/* Same as pwm_init() for Timer1 channels, with an arbitrary TOP. */
+extern void pwm_init_top(enum pwm_channel ch, uint16_t top);
+
+extern uint16_t pwm_get_top(enum pwm_channel ch);
+
+/* Duty cycle of counts/(TOP+1), counts in 0..TOP. */
+extern void pwm_set(enum pwm_channel ch, uint16_t counts);
+
+/* Duty cycle of frac/65536, scaled to TOP with a multiply and a shift. */
+extern void pwm_set_frac(enum pwm_channel ch, uint16_t frac);
+
+/* Duty cycle in percent, 100 or more meaning TOP/(TOP+1). */
+extern void pwm_set_percent(enum pwm_channel ch, uint8_t percent);
+
+/* Disconnect the pin from the timer and drive it low. */
+extern void pwm_stop(enum pwm_channel ch);
+
+#endif /* PWM_H */
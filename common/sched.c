@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "power.h"
+#include "sched.h"
+#include "sysclock.h"
+
+#if SCHED_MAX_TASKS > 8
+#  error "SCHED_MAX_TASKS > 8 does not fit the pending bitmask"
+#endif
+
+#define SCHED_MS_CYCLES(ms) ((uint32_t)(ms) * (F_CPU / 1000UL))
+
+struct sched_task {
+    sched_fn fn;
+    uint8_t prio;
+    uint32_t period; /* cycles, 0 if not periodic */
+    uint32_t deadline; /* next periodic post */
+    uint32_t posted; /* first post since the last run */
+    uint32_t latency_max;
+};
+
+static struct sched_task sched_tasks[SCHED_MAX_TASKS];
+static uint8_t sched_n_tasks;
+static uint8_t sched_last; /* last task run, for round-robin */
+static volatile uint8_t sched_pending; /* one bit per task */
+static uint8_t sched_periodic; /* one bit per task */
+static volatile uint8_t sched_blocks[SCHED_N_SLEEPS];
+
+static const uint8_t sched_sleep_modes[SCHED_N_SLEEPS] = {
+    POWER_SLEEP_IDLE,
+    POWER_SLEEP_ADC,
+    POWER_SLEEP_POWER_DOWN,
+};
+
+static uint32_t sched_window_start;
+static uint32_t sched_window_idle; /* cycles */
+static uint8_t sched_idle;
+
+void sched_init(void)
+{
+    uint8_t level;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        sched_n_tasks = 0;
+        sched_last = SCHED_MAX_TASKS - 1; /* task 0 first */
+        sched_pending = 0;
+        sched_periodic = 0;
+        for (level = 0; level < SCHED_N_SLEEPS; level++)
+        {
+            sched_blocks[level] = 0;
+        }
+    }
+    sched_stats_reset();
+}
+
+uint8_t sched_add(sched_fn fn, enum sched_prio prio)
+{
+    struct sched_task *t;
+    uint8_t task;
+
+    if (sched_n_tasks >= SCHED_MAX_TASKS)
+    {
+        return SCHED_NO_TASK;
+    }
+    task = sched_n_tasks;
+    t = &sched_tasks[task];
+    t->fn = fn;
+    t->prio = (prio < SCHED_N_PRIOS) ? prio : SCHED_PRIO_LOW;
+    t->period = 0;
+    t->latency_max = 0;
+    sched_n_tasks++;
+
+    return task;
+}
+
+static
+void sched_post_at(uint8_t task, uint32_t t_post)
+{
+    uint8_t mask;
+
+    mask = _BV(task);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if ((sched_pending & mask) == 0)
+        {
+            sched_tasks[task].posted = t_post;
+            sched_pending |= mask;
+        }
+    }
+}
+
+void sched_post(uint8_t task)
+{
+    if (task < sched_n_tasks)
+    {
+        sched_post_at(task, sysclock_now_cycles());
+    }
+}
+
+void sched_every(uint8_t task, uint16_t period_ms)
+{
+    struct sched_task *t;
+
+    if (task >= sched_n_tasks)
+    {
+        return;
+    }
+    t = &sched_tasks[task];
+    t->period = SCHED_MS_CYCLES(period_ms);
+    if (period_ms != 0)
+    {
+        t->deadline = sysclock_now_cycles() + t->period;
+        sched_periodic |= _BV(task);
+    }
+    else
+    {
+        sched_periodic &= ~_BV(task);
+    }
+}
+
+void sched_sleep_block(enum sched_sleep deepest)
+{
+    if (deepest < SCHED_N_SLEEPS)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            sched_blocks[deepest]++;
+        }
+    }
+}
+
+void sched_sleep_unblock(enum sched_sleep deepest)
+{
+    if (deepest < SCHED_N_SLEEPS)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (sched_blocks[deepest] > 0)
+            {
+                sched_blocks[deepest]--;
+            }
+        }
+    }
+}
+
+/* Post the periodic tasks that are due, at their deadline */
+static
+void sched_post_due(uint32_t now)
+{
+    uint8_t task;
+
+    for (task = 0; task < sched_n_tasks; task++)
+    {
+        struct sched_task *t = &sched_tasks[task];
+
+        if (((sched_periodic & _BV(task)) != 0) && ((int32_t)(now - t->deadline) >= 0))
+        {
+            sched_post_at(task, t->deadline);
+            t->deadline += t->period;
+            if ((int32_t)(now - t->deadline) >= 0)
+            {
+                t->deadline = now + t->period; /* overrun: skip the lost periods */
+            }
+        }
+    }
+}
+
+/* Highest priority pending task, round-robin from the last one run */
+static
+uint8_t sched_pick(uint8_t pending)
+{
+    uint8_t best;
+    uint8_t best_prio;
+    uint8_t task;
+    uint8_t n;
+
+    best = SCHED_NO_TASK;
+    best_prio = SCHED_N_PRIOS;
+    task = sched_last;
+    for (n = 0; n < sched_n_tasks; n++)
+    {
+        task++;
+        if (task >= sched_n_tasks)
+        {
+            task = 0;
+        }
+        if (((pending & _BV(task)) != 0) && (sched_tasks[task].prio < best_prio))
+        {
+            best = task;
+            best_prio = sched_tasks[task].prio;
+        }
+    }
+
+    return best;
+}
+
+static
+uint8_t sched_sleep_mode(void)
+{
+    uint8_t level;
+    enum power_sleep mode;
+
+    if (sched_periodic != 0)
+    {
+        return SLEEP_MODE_IDLE;
+    }
+    for (level = 0; level < SCHED_N_SLEEPS - 1; level++)
+    {
+        if (sched_blocks[level] != 0)
+        {
+            break;
+        }
+    }
+    mode = power_sleep_mode(); /* the interrupts enabled by the drivers */
+    if (sched_sleep_modes[level] < mode)
+    {
+        mode = sched_sleep_modes[level];
+    }
+
+    return power_sleep_smcr(mode);
+}
+
+/* Called with interrupts disabled, returns with them enabled */
+static
+void sched_sleep(void)
+{
+    uint32_t t_sleep;
+
+    set_sleep_mode(sched_sleep_mode());
+    t_sleep = sysclock_now_cycles();
+    sleep_enable();
+    sei(); /* the next instruction is executed before any interrupt */
+    sleep_cpu();
+    sleep_disable();
+    sched_window_idle += sysclock_now_cycles() - t_sleep;
+}
+
+static
+void sched_stats_update(uint32_t now)
+{
+    uint32_t elapsed;
+
+    elapsed = now - sched_window_start;
+    if (elapsed >= SCHED_MS_CYCLES(SCHED_STATS_WINDOW_MS))
+    {
+        sched_idle = sched_window_idle / (elapsed / 100);
+        sched_window_start = now;
+        sched_window_idle = 0;
+    }
+}
+
+bool sched_step(void)
+{
+    uint32_t now;
+    uint8_t task;
+    uint32_t posted;
+    uint32_t latency;
+    struct sched_task *t;
+
+    now = sysclock_now_cycles();
+    sched_stats_update(now);
+    sched_post_due(now);
+
+    cli();
+    task = sched_pick(sched_pending);
+    if (task == SCHED_NO_TASK)
+    {
+        /* pending tasks posted by ISRs from now on wake us up */
+        sched_sleep();
+        return false;
+    }
+    sched_pending &= ~_BV(task);
+    t = &sched_tasks[task];
+    posted = t->posted; /* before an ISR can post again */
+    sei();
+
+    latency = sysclock_now_cycles() - posted;
+    if (latency > t->latency_max)
+    {
+        t->latency_max = latency;
+    }
+    sched_last = task;
+    t->fn();
+
+    return true;
+}
+
+void sched_run(void)
+{
+    while (1)
+    {
+        (void)sched_step();
+    }
+}
+
+uint8_t sched_idle_percent(void)
+{
+    return sched_idle;
+}
+
+uint32_t sched_latency_max(uint8_t task)
+{
+    return (task < sched_n_tasks) ? sched_tasks[task].latency_max : 0;
+}
+
+uint32_t sched_latency_max_all(void)
+{
+    uint32_t latency;
+    uint8_t task;
+
+    latency = 0;
+    for (task = 0; task < sched_n_tasks; task++)
+    {
+        if (sched_tasks[task].latency_max > latency)
+        {
+            latency = sched_tasks[task].latency_max;
+        }
+    }
+
+    return latency;
+}
+
+void sched_stats_reset(void)
+{
+    uint8_t task;
+
+    for (task = 0; task < sched_n_tasks; task++)
+    {
+        sched_tasks[task].latency_max = 0;
+    }
+    sched_window_start = sysclock_now_cycles();
+    sched_window_idle = 0;
+    sched_idle = 0;
+}
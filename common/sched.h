@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Cooperative run-to-completion scheduler.
+ *
+ * Tasks are functions registered with sched_add(), run from sched_run()
+ * when posted, highest priority first (round-robin within the same
+ * priority). A task runs once per post, however many posts arrived
+ * since it last ran, and must return quickly: there is no preemption,
+ * only ISRs interrupt it.
+ *
+ * sched_post() can be called from ISRs; periodic tasks are posted by
+ * the scheduler itself, with sysclock resolution (1.024ms @ 16MHz).
+ *
+ * When no task is pending the CPU sleeps, in the deepest mode allowed:
+ * - Idle while periodic tasks exist, since sysclock (Timer2) stops in
+ *   the other modes;
+ * - otherwise the shallowest mode requested with sched_sleep_block()
+ *   by the code using peripherals clocked by clk_io (timers, USART,
+ *   SPI), or by the ADC, and the one needed by the interrupts enabled
+ *   at the moment (see power_sleep_mode() in power.h);
+ * - otherwise Power-down (Power-save with an asynchronous Timer2),
+ *   woken only by external and pin change interrupts (or the watchdog).
+ *
+ * Statistics are measured with sysclock, so they exclude the time
+ * spent in Power-down and ADC Noise Reduction, where it stops.
+ * ISRs that run while sleeping count as idle time.
+ */
+
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS 8 /* up to 8 */
+#endif
+
+#define SCHED_NO_TASK 0xFF
+
+/* Idle percentage is updated at the end of every window */
+#define SCHED_STATS_WINDOW_MS 1000UL
+
+enum sched_prio {
+    SCHED_PRIO_HIGH,
+    SCHED_PRIO_NORMAL,
+    SCHED_PRIO_LOW,
+    SCHED_N_PRIOS
+};
+
+enum sched_sleep {
+    SCHED_SLEEP_IDLE, /* CPU stopped, all peripherals running */
+    SCHED_SLEEP_ADC, /* ADC Noise Reduction: clk_io stopped */
+    SCHED_SLEEP_POWER_DOWN, /* all clocks stopped */
+    SCHED_N_SLEEPS
+};
+
+typedef void (*sched_fn)(void);
+
+/* Remove all tasks and sleep blocks, and reset the statistics. */
+extern void sched_init(void);
+
+/* Returns the task id, or SCHED_NO_TASK if the table is full. */
+extern uint8_t sched_add(sched_fn fn, enum sched_prio prio);
+
+/* Mark the task as pending; safe from ISRs. */
+extern void sched_post(uint8_t task);
+
+/* Post the task every period_ms, starting period_ms from now;
+ * 0 stops the periodic posts.
+ */
+extern void sched_every(uint8_t task, uint16_t period_ms);
+
+/* Forbid sleep modes deeper than the given one, until the matching
+ * sched_sleep_unblock(); calls nest. Safe from ISRs.
+ */
+extern void sched_sleep_block(enum sched_sleep deepest);
+extern void sched_sleep_unblock(enum sched_sleep deepest);
+
+/* Run a pending task, or sleep until an interrupt if none is pending.
+ * Returns true if a task was run.
+ */
+extern bool sched_step(void);
+
+/* Run forever; interrupts must be enabled. */
+extern void sched_run(void) __attribute__((noreturn));
+
+/* Percentage of the last statistics window spent sleeping */
+extern uint8_t sched_idle_percent(void);
+
+/* Worst-case cycles from post (or periodic deadline) to start of the
+ * task, and of any task, since the last sched_stats_reset().
+ */
+extern uint32_t sched_latency_max(uint8_t task);
+extern uint32_t sched_latency_max_all(void);
+
+extern void sched_stats_reset(void);
+
+#endif /* SCHED_H */
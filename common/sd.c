@@ -0,0 +1,682 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <util/delay.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "bench.h"
+#include "board.h"
+#include "prof.h"
+#include "sd.h"
+#include "spi.h"
+#include "uspi.h"
+
+#define SD_INIT_RETRIES 1000
+#define SD_BUSY_POLLS_MAX 400000UL /* > 500ms at the fast clock */
+#define SD_NCR_MAX 16 /* R1 comes within 8 bytes (NCR) */
+
+#define SD_TOKEN_START_BLOCK 0xFE
+#define SD_TOKEN_START_MULTI 0xFC
+#define SD_TOKEN_STOP_TRAN 0xFD
+#define SD_DATA_ACCEPTED 0x05
+
+#define SD_AU_BLOCKS_DEFAULT 8192UL /* 4MB, the largest for SDHC */
+
+PROF_PROBE(sd_cmd17);
+
+static
+bool sd_high_capacity;
+
+#ifdef SD_USPI
+#  define SD_USPI_CS_PORT BOARD_PORT(SD_USPI_CS_PIN)
+#  define SD_USPI_CS_DDR BOARD_DDR(SD_USPI_CS_PIN)
+#  define SD_USPI_CS_BIT BOARD_BIT(SD_USPI_CS_PIN)
+#  define sd_bus_xfer uspi_xfer
+#  define sd_bus_transfer uspi_transfer
+#else
+#  define sd_bus_xfer spi_xfer
+#  define sd_bus_transfer spi_transfer
+
+static
+struct spi_device sd_spi;
+#endif
+
+#if defined(SD_TRACE) && !BENCH_ENABLE
+static
+bool sd_trace = true;
+#endif
+
+static
+void sd_select(void)
+{
+    _delay_us(100);
+#ifdef SD_USPI
+    SD_USPI_CS_PORT &= ~_BV(SD_USPI_CS_BIT);
+#else
+    spi_begin(&sd_spi); /* SD_CS low */
+#endif
+    _delay_us(100);
+}
+
+static
+void sd_deselect(void)
+{
+    _delay_us(100);
+#ifdef SD_USPI
+    SD_USPI_CS_PORT |= _BV(SD_USPI_CS_BIT);
+#else
+    spi_end(&sd_spi); /* SD_CS high */
+#endif
+    _delay_us(100);
+}
+
+static
+uint8_t sd_xfer(uint8_t tx)
+{
+    uint8_t rx;
+
+    rx = sd_bus_xfer(tx);
+
+#if defined(SD_TRACE) && !BENCH_ENABLE
+    if (sd_trace)
+    {
+        printf("tx:%02x rx:%02x\n", tx, rx); 
+    }
+#endif
+
+    return rx;
+}
+
+static
+void sd_read_bytes(uint8_t *dst, uint16_t len)
+{
+#if defined(SD_TRACE) && !BENCH_ENABLE
+    uint16_t i_byte;
+
+    if (sd_trace)
+    {
+        for (i_byte = 0; i_byte < len; i_byte++)
+        {
+            dst[i_byte] = sd_xfer(0xFF);
+        }
+        return;
+    }
+#endif
+    sd_bus_transfer(NULL, dst, len);
+}
+
+static
+void sd_write_bytes(const uint8_t *src, uint16_t len)
+{
+#if defined(SD_TRACE) && !BENCH_ENABLE
+    uint16_t i_byte;
+
+    if (sd_trace)
+    {
+        for (i_byte = 0; i_byte < len; i_byte++)
+        {
+            (void)sd_xfer(src[i_byte]);
+        }
+        return;
+    }
+#endif
+    sd_bus_transfer(src, NULL, len);
+}
+
+static
+uint8_t crc7_get(uint8_t cmd, uint32_t arg)
+{
+    uint8_t crc7;
+
+    (void)arg;
+    cmd &= 0x3F;
+    if (cmd == 0)
+    {
+        /* arg should be 0 */
+        crc7 = 0x94;
+    }
+    else if (cmd == 8)
+    {
+        /* arg should be 0x1AA */
+        crc7 = 0x86;
+    }
+    else
+    {
+        /* don't care */
+        crc7 = 0xFF;
+    }
+    crc7 |= 0x01; /* end bit */
+    return crc7;
+}
+
+static
+void send_cmd(uint8_t cmd, uint32_t arg)
+{
+    uint8_t crc7;
+
+    crc7 = crc7_get(cmd, arg);
+
+    cmd |= 0x40;
+    (void)sd_xfer(cmd);
+    (void)sd_xfer((arg>>24) & 0xFF);
+    (void)sd_xfer((arg>>16) & 0xFF);
+    (void)sd_xfer((arg>> 8) & 0xFF);
+    (void)sd_xfer((arg>> 0) & 0xFF);
+    (void)sd_xfer(crc7);
+}
+
+/* Returns 0xFF if no card answers */
+static
+uint8_t recv_r1(void)
+{
+    uint8_t r1;
+    uint8_t polls;
+
+    polls = 0;
+    do
+    {
+        r1 = sd_xfer(0xFF);
+    } while ((r1 & 0x80) && (++polls < SD_NCR_MAX));
+
+    return r1;
+}
+
+/* Data block: start token, 512 bytes and a dummy CRC.
+ * Returns 0 when accepted, the data response token otherwise.
+ */
+static
+uint8_t send_data_block(uint8_t token, const void *src)
+{
+    uint8_t data_resp;
+
+    (void)sd_xfer(0xFF); /* at least one byte before the token */
+    (void)sd_xfer(token);
+    sd_write_bytes(src, 512);
+    (void)sd_xfer(0xFF); /* CRC16, ignored in SPI mode */
+    (void)sd_xfer(0xFF);
+
+    data_resp = sd_xfer(0xFF) & 0x1F;
+
+    return (data_resp == SD_DATA_ACCEPTED) ? 0x00 : data_resp;
+}
+
+/* Data block: wait for the start token, read len bytes and the CRC.
+ * Returns 0 on success, the error token otherwise, or 0xFF if the
+ * token does not come within SD_BUSY_POLLS_MAX bytes.
+ */
+static
+uint8_t recv_data(void *dst, uint16_t len)
+{
+    uint8_t data_ctrl;
+    uint32_t polls;
+
+    polls = 0;
+    do
+    {
+        data_ctrl = sd_xfer(0xFF);
+    } while ((data_ctrl == 0xFF) && (++polls < SD_BUSY_POLLS_MAX));
+    if (data_ctrl == SD_TOKEN_START_BLOCK)
+    {
+        uint8_t crc16_hi;
+        uint8_t crc16_lo;
+
+        data_ctrl = 0x00;
+        sd_read_bytes(dst, len);
+        crc16_hi = sd_xfer(0xFF);
+        crc16_lo = sd_xfer(0xFF);
+        (void)crc16_hi;
+        (void)crc16_lo;
+    }
+
+    return data_ctrl;
+}
+
+static
+uint32_t sd_address(uint32_t lba)
+{
+    /* standard capacity cards are byte addressed */
+    return sd_high_capacity ? lba : (lba << 9);
+}
+
+void sd_send_command(uint8_t cmd, uint32_t arg, void *resp, size_t len)
+{
+    uint8_t *resp_bytes;
+    size_t i_byte;
+
+    sd_select();
+    send_cmd(cmd, arg);
+    resp_bytes = resp;
+
+    for (i_byte = 0; i_byte < len; i_byte++)
+    {
+        resp_bytes[i_byte] = (i_byte == 0) ? recv_r1() : sd_xfer(0xFF);
+    }
+
+    sd_deselect();
+    (void)sd_xfer(0xFF);
+}
+
+uint8_t sd_send_command_r1(uint8_t cmd, uint32_t arg)
+{
+    uint8_t r1;
+
+    sd_send_command(cmd, arg, &r1, 1);
+
+    return r1;
+}
+
+uint8_t sd_read_single_block(uint32_t address, void *dst)
+{
+    uint8_t data_ctrl;
+
+    PROF_SCOPE(sd_cmd17);
+
+    sd_select();
+    send_cmd(17, address);
+    data_ctrl = recv_r1();
+    if (data_ctrl == 0x00)
+    {
+        data_ctrl = recv_data(dst, 512);
+    }
+    sd_deselect();
+    (void)sd_xfer(0xFF);
+
+    return data_ctrl;
+}
+
+bool sd_busy_wait(void)
+{
+    uint32_t polls;
+
+    for (polls = 0; polls < SD_BUSY_POLLS_MAX; polls++)
+    {
+        if (sd_xfer(0xFF) == 0xFF)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t sd_write_single_block(uint32_t address, const void *src)
+{
+    uint8_t r1;
+    uint8_t data_resp;
+
+    sd_select();
+    send_cmd(24, address);
+    r1 = recv_r1();
+    if (r1 != 0x00)
+    {
+        data_resp = r1;
+    }
+    else
+    {
+        data_resp = send_data_block(SD_TOKEN_START_BLOCK, src);
+        if ((data_resp == 0x00) && !sd_busy_wait())
+        {
+            data_resp = 0xFF;
+        }
+    }
+    sd_deselect();
+    (void)sd_xfer(0xFF);
+
+    return data_resp;
+}
+
+uint8_t sd_read_multi_start(uint32_t lba)
+{
+    uint8_t r1;
+
+    sd_select();
+    send_cmd(18, sd_address(lba));
+    r1 = recv_r1();
+    if (r1 != 0x00)
+    {
+        sd_deselect();
+        (void)sd_xfer(0xFF);
+    }
+
+    return r1;
+}
+
+uint8_t sd_read_multi_block(void *dst)
+{
+    return recv_data(dst, 512);
+}
+
+uint8_t sd_read_multi_stop(void)
+{
+    uint8_t r1;
+
+    send_cmd(12, 0);
+    (void)sd_xfer(0xFF); /* stuff byte */
+    r1 = recv_r1();
+    if (!sd_busy_wait())
+    {
+        r1 |= 0x80;
+    }
+    sd_deselect();
+    (void)sd_xfer(0xFF);
+
+    return r1;
+}
+
+uint8_t sd_write_multi_start(uint32_t lba)
+{
+    uint8_t r1;
+
+    sd_select();
+    send_cmd(25, sd_address(lba));
+    r1 = recv_r1();
+    if (r1 != 0x00)
+    {
+        sd_deselect();
+        (void)sd_xfer(0xFF);
+    }
+
+    return r1;
+}
+
+uint8_t sd_write_multi_block(const void *src)
+{
+    if (!sd_busy_wait()) /* programming of the previous block */
+    {
+        return 0xFF;
+    }
+    return send_data_block(SD_TOKEN_START_MULTI, src);
+}
+
+uint8_t sd_write_multi_stop(void)
+{
+    uint8_t err;
+
+    err = 0x00;
+    if (!sd_busy_wait())
+    {
+        err = 0xFF;
+    }
+    (void)sd_xfer(SD_TOKEN_STOP_TRAN);
+    (void)sd_xfer(0xFF); /* busy starts one byte after the token */
+    if (!sd_busy_wait())
+    {
+        err = 0xFF;
+    }
+    sd_deselect();
+    (void)sd_xfer(0xFF);
+
+    return err;
+}
+
+/* Register sent as a data block after the command response */
+static
+uint8_t read_register(uint8_t cmd, uint8_t resp_len, void *dst, uint8_t len)
+{
+    uint8_t r1;
+
+    sd_select();
+    send_cmd(cmd, 0);
+    r1 = recv_r1();
+    while (--resp_len > 0)
+    {
+        (void)sd_xfer(0xFF); /* rest of R2 */
+    }
+    if (r1 == 0x00)
+    {
+        r1 = recv_data(dst, len);
+    }
+    sd_deselect();
+    (void)sd_xfer(0xFF);
+
+    return r1;
+}
+
+uint8_t sd_read_csd(uint8_t csd[16])
+{
+    return read_register(9, 1, csd, 16);
+}
+
+uint8_t sd_read_status(uint8_t status[64])
+{
+    (void)sd_send_command_r1(55, 0);
+    return read_register(13, 2, status, 64); /* ACMD13, R2 */
+}
+
+uint32_t sd_bits(const uint8_t *reg, uint8_t len, uint16_t msb, uint16_t lsb)
+{
+    uint32_t v;
+    uint16_t bit;
+
+    /* bit 0 is the LSB of the last byte */
+    v = 0;
+    for (bit = msb + 1; bit-- > lsb; )
+    {
+        v = (v << 1) | ((reg[len - 1 - (bit >> 3)] >> (bit & 7)) & 0x01);
+    }
+    return v;
+}
+
+static
+uint32_t sd_au_blocks(uint8_t au_size)
+{
+    static const uint8_t au_large_mb[] = { 12, 16, 24, 32, 64 };
+
+    if (au_size == 0)
+    {
+        return SD_AU_BLOCKS_DEFAULT; /* not defined */
+    }
+    else if (au_size <= 0x0A)
+    {
+        return 32UL << (au_size - 1); /* 16kB .. 8MB */
+    }
+    return (uint32_t)au_large_mb[au_size - 0x0B] << 11;
+}
+
+int sd_get_info(struct sd_info *info)
+{
+    uint8_t reg[64];
+
+    if (sd_read_csd(reg) != 0)
+    {
+        return SD_ERR_REGISTER;
+    }
+    if (sd_bits(reg, 16, 127, 126) == 0)
+    {
+        /* CSD 1.0: (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 2^READ_BL_LEN bytes */
+        info->n_blocks = (sd_bits(reg, 16, 73, 62) + 1)
+            << (sd_bits(reg, 16, 49, 47) + 2 + sd_bits(reg, 16, 83, 80) - 9);
+        info->high_capacity = false;
+    }
+    else
+    {
+        /* CSD 2.0: (C_SIZE + 1) * 512kB */
+        info->n_blocks = (sd_bits(reg, 16, 69, 48) + 1) << 10;
+        info->high_capacity = true;
+    }
+    sd_high_capacity = info->high_capacity;
+
+    if (sd_read_status(reg) != 0)
+    {
+        return SD_ERR_REGISTER;
+    }
+    info->au_blocks = sd_au_blocks(sd_bits(reg, 64, 431, 428));
+    info->erase_aus = sd_bits(reg, 64, 423, 408);
+    info->erase_timeout_s = sd_bits(reg, 64, 407, 402);
+    info->erase_offset_s = sd_bits(reg, 64, 401, 400);
+
+    return SD_OK;
+}
+
+uint8_t sd_erase(uint32_t first_lba, uint32_t last_lba, uint8_t timeout_s)
+{
+    uint8_t r1;
+    uint16_t waits;
+
+    r1 = sd_send_command_r1(32, sd_address(first_lba));
+    if (r1 == 0x00)
+    {
+        r1 = sd_send_command_r1(33, sd_address(last_lba));
+    }
+    if (r1 != 0x00)
+    {
+        return r1;
+    }
+
+    sd_select();
+    send_cmd(38, 0);
+    r1 = recv_r1();
+    if (r1 == 0x00)
+    {
+        /* each wait is at least 400ms at the fast clock */
+        waits = 3 * ((uint16_t)timeout_s + 1);
+        while (!sd_busy_wait())
+        {
+            if (--waits == 0)
+            {
+                r1 = 0xFF;
+                break;
+            }
+        }
+    }
+    sd_deselect();
+    (void)sd_xfer(0xFF);
+
+    return r1;
+}
+
+void sd_init(void)
+{
+    int i_dummy;
+
+#ifdef SD_USPI
+    SD_USPI_CS_PORT |= _BV(SD_USPI_CS_BIT);
+    SD_USPI_CS_DDR |= _BV(SD_USPI_CS_BIT);
+    uspi_init(SPI_MODE0, 125000UL);
+#else
+    spi_bus_init(); /* Wiznet SS high */
+    spi_device_init(&sd_spi, &BOARD_PORT(SD_CS_PIN), BOARD_BIT(SD_CS_PIN), SPI_MODE0, 125000UL);
+    spi_configure(&sd_spi); /* clock pulses with SD_CS high */
+#endif
+
+    _delay_ms(1);
+    for (i_dummy = 0; i_dummy < 80; i_dummy++)
+    {
+        (void)sd_xfer(0xFF);
+    }
+}
+
+void sd_set_clock(uint32_t max_hz)
+{
+#ifdef SD_USPI
+    uspi_set_clock(max_hz);
+#else
+    spi_set_clock(&sd_spi, max_hz);
+#endif
+}
+
+void sd_set_fast_clock(void)
+{
+    sd_set_clock(F_CPU / 2); /* 16MHz / 2 -> 8MHz */
+}
+
+void sd_set_trace(bool on)
+{
+#if defined(SD_TRACE) && !BENCH_ENABLE
+    sd_trace = on;
+#else
+    (void)on;
+#endif
+}
+
+int sd_card_init(void)
+{
+    uint8_t r1;
+    uint8_t r7[5];
+    uint8_t r3[5];
+    uint16_t retries;
+
+    sd_high_capacity = false;
+    sd_init();
+
+    r1 = sd_send_command_r1(0, 0);
+    if (r1 != 0x01)
+    {
+        return SD_ERR_IDLE;
+    }
+
+    sd_send_command(8, 0x1AA, r7, sizeof(r7));
+    if (r7[0] != 0x01)
+    {
+        return SD_ERR_IDLE;
+    }
+    else if ((r7[3]&0x0F) != 0x01)
+    {
+        return SD_ERR_VOLTAGE;
+    }
+    else if (r7[4] != 0xAA)
+    {
+        return SD_ERR_PATTERN;
+    }
+
+    retries = 0;
+    do
+    {
+        if (retries++ == SD_INIT_RETRIES)
+        {
+            return SD_ERR_TIMEOUT;
+        }
+        (void)sd_send_command_r1(55, 0);
+        r1 = sd_send_command_r1(41, 0x40000000); /* HCS */
+    } while (r1 & 0x01);
+
+    sd_send_command(58, 0, r3, sizeof(r3));
+    sd_high_capacity = ((r3[1] & 0x40) != 0);
+
+    sd_set_fast_clock();
+
+    return SD_OK;
+}
+
+bool sd_is_high_capacity(void)
+{
+    return sd_high_capacity;
+}
+
+uint8_t sd_read_block(uint32_t lba, void *dst)
+{
+    return sd_read_single_block(sd_address(lba), dst);
+}
+
+uint8_t sd_write_block(uint32_t lba, const void *src)
+{
+    return sd_write_single_block(sd_address(lba), src);
+}
+
+#if BENCH_ENABLE
+void sd_bench(void)
+{
+    static uint8_t block[512];
+
+    sd_init();
+    sd_set_fast_clock();
+    BENCH("spi_xfer", 16, (void)sd_bus_xfer(0xFF));
+    BENCH("sd_read_512", 4, sd_read_bytes(block, sizeof(block)));
+}
+#endif
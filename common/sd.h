@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SD_H
+#define SD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* SD card in SPI mode, on the Arduino Ethernet shield:
+ * SD_CS on SD_CS_PIN (PD4 by default, see board.h), Wiznet SS on PB2
+ * kept high.
+ *
+ * Define SD_USPI to use USART0 in master SPI mode instead (uspi.h),
+ * for gapless transfers and the SPI bus left to other devices: the
+ * card on XCK0 (PD4), TXD (PD1) and RXD (PD0), SD_CS on
+ * SD_USPI_CS_PIN (PD5 by default, see board.h), and no stdio.
+ *
+ * Define SD_TRACE to print every SPI transfer on stdout
+ * (ignored by "make bench" builds), sd_set_trace() pauses it.
+ *
+ * Unless noted, functions returning uint8_t return 0 on success, or
+ * the R1 error bits, the data error token or data response token of
+ * the card, 0xFF if it stayed busy for too long.
+ */
+
+enum sd_err {
+    SD_OK = 0,
+    SD_ERR_IDLE, /* no idle state after CMD0/CMD8 */
+    SD_ERR_VOLTAGE, /* voltage range not supported */
+    SD_ERR_PATTERN, /* CMD8 check pattern error */
+    SD_ERR_TIMEOUT, /* ACMD41 initialization did not complete */
+    SD_ERR_REGISTER, /* CSD or SD Status could not be read */
+    SD_ERR_FULL, /* no space left in the area */
+    SD_ERR_WRITE, /* block not written */
+    SD_ERR_ERASE, /* erase failed or timed out */
+};
+
+/* Card geometry, from the CSD and SD Status registers */
+struct sd_info {
+    uint32_t n_blocks;
+    uint32_t au_blocks; /* allocation unit */
+    uint16_t erase_aus; /* AUs erased within erase_timeout_s, 0 if unknown */
+    uint8_t erase_timeout_s;
+    uint8_t erase_offset_s;
+    bool high_capacity; /* block addressed (SDHC/SDXC), byte addressed (SDSC) */
+};
+
+/* Set up pins and SPI at 125kHz, and send the initial clock pulses. */
+extern void sd_init(void);
+
+/* Switch SPI to F_CPU/2, allowed after card initialization. */
+extern void sd_set_fast_clock(void);
+
+/* Fastest SPI clock up to max_hz, F_CPU/2 .. F_CPU/128. */
+extern void sd_set_clock(uint32_t max_hz);
+
+/* Turn SD_TRACE output on and off, no effect without SD_TRACE. */
+extern void sd_set_trace(bool on);
+
+extern void sd_send_command(uint8_t cmd, uint32_t arg, void *resp, size_t len);
+
+extern uint8_t sd_send_command_r1(uint8_t cmd, uint32_t arg);
+
+/* CMD17 at the card address: bytes for SDSC, blocks for SDHC.
+ * Returns 0 on success, the R1 or data error token otherwise, 0xFF
+ * when no card answers.
+ */
+extern uint8_t sd_read_single_block(uint32_t address, void *dst);
+
+/* Complete initialization sequence, ending with the fast clock.
+ * Returns SD_OK or one of enum sd_err.
+ */
+extern int sd_card_init(void);
+
+/* CMD24 at the card address, waiting for the end of programming. */
+extern uint8_t sd_write_single_block(uint32_t address, const void *src);
+
+extern bool sd_is_high_capacity(void);
+
+/* CMD9 and ACMD13, 16 and 64 bytes with the MSB first */
+extern uint8_t sd_read_csd(uint8_t csd[16]);
+extern uint8_t sd_read_status(uint8_t status[64]);
+
+/* Bits msb..lsb of a register of len bytes, numbered as in the spec */
+extern uint32_t sd_bits(const uint8_t *reg, uint8_t len, uint16_t msb, uint16_t lsb);
+
+/* Read the registers into info, after sd_card_init().
+ * Returns SD_OK or SD_ERR_REGISTER.
+ */
+extern int sd_get_info(struct sd_info *info);
+
+/* CMD32, CMD33 and CMD38 for blocks first_lba..last_lba, waiting up to
+ * about timeout_s seconds for the end of the erase.
+ */
+extern uint8_t sd_erase(uint32_t first_lba, uint32_t last_lba, uint8_t timeout_s);
+
+/* Read 512-byte block number lba, for any card capacity. */
+extern uint8_t sd_read_block(uint32_t lba, void *dst);
+
+/* Write 512-byte block number lba, for any card capacity. */
+extern uint8_t sd_write_block(uint32_t lba, const void *src);
+
+/* Multiple block transfers keep the card selected from start to stop:
+ * no other device can use the SPI bus in between.
+ *
+ * CMD18 from block lba, then one block per sd_read_multi_block() call,
+ * until CMD12.
+ */
+extern uint8_t sd_read_multi_start(uint32_t lba);
+extern uint8_t sd_read_multi_block(void *dst);
+extern uint8_t sd_read_multi_stop(void);
+
+/* CMD25 from block lba, then one block per sd_write_multi_block() call,
+ * until the stop token. Each block is sent after the programming of the
+ * previous one, so the caller can work while the card is busy, or wait
+ * for it with sd_busy_wait().
+ */
+extern uint8_t sd_write_multi_start(uint32_t lba);
+extern uint8_t sd_write_multi_block(const void *src);
+extern uint8_t sd_write_multi_stop(void);
+
+/* Poll the selected card until it is not busy; false on timeout. */
+extern bool sd_busy_wait(void);
+
+#if BENCH_ENABLE
+/* spi_xfer() and the data block loop at the fast clock, without a card */
+extern void sd_bench(void);
+#endif
+
+#endif /* SD_H */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include "sd.h"
+#include "sdlog.h"
+
+int sdlog_open(struct sdlog *l, uint32_t first_lba, uint32_t n_blocks)
+{
+    uint32_t au;
+    uint16_t erase_aus;
+    int err;
+
+    err = sd_get_info(&l->info);
+    if (err != SD_OK)
+    {
+        return err;
+    }
+    au = l->info.au_blocks;
+    if (first_lba >= l->info.n_blocks)
+    {
+        l->lba = l->info.n_blocks;
+        l->end = l->info.n_blocks;
+        return SD_ERR_FULL;
+    }
+    if (n_blocks > l->info.n_blocks - first_lba) /* without overflowing */
+    {
+        n_blocks = l->info.n_blocks - first_lba;
+    }
+    l->end = ((first_lba + n_blocks) / au) * au;
+    l->lba = ((first_lba + au - 1) / au) * au;
+    if (l->lba >= l->end)
+    {
+        l->lba = l->end;
+        return SD_ERR_FULL;
+    }
+    l->erased_end = l->lba;
+    erase_aus = l->info.erase_aus;
+    if ((erase_aus == 0) || (erase_aus > SDLOG_ERASE_AUS))
+    {
+        erase_aus = SDLOG_ERASE_AUS;
+    }
+    l->erase_blocks = au * erase_aus;
+    l->writing = false;
+
+    return sdlog_erase_ahead(l);
+}
+
+/* Erase whole AUs up to target, at most erase_blocks at a time */
+static
+int sdlog_erase_to(struct sdlog *l, uint32_t target)
+{
+    uint32_t au = l->info.au_blocks;
+
+    target = ((target + au - 1) / au) * au;
+    if (target > l->end)
+    {
+        target = l->end;
+    }
+    while (l->erased_end < target)
+    {
+        uint32_t last;
+
+        last = l->erased_end + l->erase_blocks;
+        if (last > target)
+        {
+            last = target;
+        }
+        if (sd_erase(l->erased_end, last - 1,
+                    l->info.erase_timeout_s + l->info.erase_offset_s) != 0)
+        {
+            return SD_ERR_ERASE;
+        }
+        l->erased_end = last;
+    }
+    return SD_OK;
+}
+
+int sdlog_erase_ahead(struct sdlog *l)
+{
+    if (l->writing)
+    {
+        return SD_OK; /* no erase during a transfer */
+    }
+    return sdlog_erase_to(l, l->lba + l->erase_blocks);
+}
+
+int sdlog_write(struct sdlog *l, const void *block)
+{
+    if (l->lba >= l->end)
+    {
+        return SD_ERR_FULL;
+    }
+    if (!l->writing)
+    {
+        int err;
+
+        /* only the AU of the next block, if sdlog_erase_ahead() fell behind */
+        err = sdlog_erase_to(l, l->lba + 1);
+        if (err != SD_OK)
+        {
+            return err;
+        }
+        if (sd_write_multi_start(l->lba) != 0)
+        {
+            return SD_ERR_WRITE;
+        }
+        l->writing = true;
+    }
+    if (sd_write_multi_block(block) != 0)
+    {
+        (void)sdlog_flush(l);
+        return SD_ERR_WRITE;
+    }
+    l->lba++;
+    if ((l->lba % l->info.au_blocks) == 0)
+    {
+        return sdlog_flush(l); /* one transfer per AU */
+    }
+    return SD_OK;
+}
+
+int sdlog_flush(struct sdlog *l)
+{
+    if (!l->writing)
+    {
+        return SD_OK;
+    }
+    l->writing = false;
+    return (sd_write_multi_stop() == 0) ? SD_OK : SD_ERR_WRITE;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SDLOG_H
+#define SDLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sd.h"
+
+/* Sustained sequential writes to an SD card area, for data logging.
+ *
+ * Cards program flash in allocation units (AU, 16kB to 64MB, 4MB on
+ * most SDHC cards). Writing into an AU that still holds data makes the
+ * card copy it first, stalling some writes for hundreds of ms. So the
+ * log area is shrunk to whole AUs, each AU is written by one multiple
+ * block transfer, and erased before, SDLOG_ERASE_AUS AUs at a time
+ * (at most the erase unit of the card).
+ *
+ * An erase takes up to erase_timeout_s + erase_offset_s seconds, and
+ * can't run during a transfer. sdlog_open() erases the first AUs, then
+ * the application calls sdlog_erase_ahead() when it has time: in idle
+ * time, or after sdlog_flush() or a write that ended an AU. If it
+ * falls behind, the sdlog_write() call that starts a not erased AU
+ * erases that AU, and takes longer.
+ */
+
+#ifndef SDLOG_ERASE_AUS
+#  define SDLOG_ERASE_AUS 4
+#endif
+
+struct sdlog {
+    struct sd_info info;
+    uint32_t lba; /* next block */
+    uint32_t end; /* first block after the log area */
+    uint32_t erased_end; /* first block not erased yet */
+    uint32_t erase_blocks; /* erased at once */
+    bool writing; /* CMD25 in progress */
+};
+
+/* Log area: the whole AUs between first_lba and first_lba + n_blocks.
+ * Needs sd_card_init(); returns SD_OK or one of enum sd_err.
+ */
+extern int sdlog_open(struct sdlog *l, uint32_t first_lba, uint32_t n_blocks);
+
+/* Append one 512-byte block; returns SD_OK or one of enum sd_err. */
+extern int sdlog_write(struct sdlog *l, const void *block);
+
+/* Erase the SDLOG_ERASE_AUS AUs from the next block on, if not done
+ * yet; nothing during a transfer. Returns SD_OK or SD_ERR_ERASE.
+ */
+extern int sdlog_erase_ahead(struct sdlog *l);
+
+/* Finish the transfer in progress; the log can be appended to later. */
+extern int sdlog_flush(struct sdlog *l);
+
+#endif /* SDLOG_H */
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "board.h"
+#include "power.h"
+#include "spi.h"
+
+#define SPI_FLAGS_MASK (_BV(CPOL) | _BV(CPHA) | _BV(DORD))
+
+static struct spi_device *spi_current; /* settings in SPCR/SPSR */
+static struct spi_xact *spi_head;
+static struct spi_xact *spi_tail;
+static bool spi_powered;
+
+void spi_bus_init(void)
+{
+    if (!spi_powered)
+    {
+        power_get(POWER_SPI); /* the bus is never released */
+        spi_powered = true;
+    }
+    DDRB |=  _BV(DDB5); /* SCK */
+    DDRB &= ~_BV(DDB4); /* MISO */
+    DDRB |=  _BV(DDB3); /* MOSI */
+    PORTB &= ~_BV(PORTB4); /* MISO pull-up disable */
+    /* SS (Wiznet chip select) high, before it becomes an output */
+    BOARD_PORT(BOARD_SPI_SS) |= _BV(BOARD_BIT(BOARD_SPI_SS));
+    BOARD_DDR(BOARD_SPI_SS) |= _BV(BOARD_BIT(BOARD_SPI_SS));
+    spi_current = NULL;
+}
+
+void spi_device_init(struct spi_device *dev,
+        volatile uint8_t *cs_port, uint8_t cs_bit,
+        uint8_t flags, uint32_t max_hz)
+{
+    dev->cs_port = cs_port;
+    dev->cs_mask = _BV(cs_bit);
+    dev->spcr = _BV(SPE) | _BV(MSTR) | (flags & SPI_FLAGS_MASK);
+    *cs_port |= dev->cs_mask; /* deselected */
+    *(cs_port - 1) |= dev->cs_mask; /* DDRx is right below PORTx */
+    spi_set_clock(dev, max_hz);
+}
+
+void spi_set_clock(struct spi_device *dev, uint32_t max_hz)
+{
+    uint8_t shift;
+
+    /* F_CPU >> shift, shift 1..7 */
+    for (shift = 1; shift < 7; shift++)
+    {
+        if ((F_CPU >> shift) <= max_hz)
+        {
+            break;
+        }
+    }
+    dev->spcr &= ~(_BV(SPR1) | _BV(SPR0));
+    if (shift == 7)
+    {
+        dev->spcr |= _BV(SPR1) | _BV(SPR0); /* F_CPU/128 */
+        dev->spsr = 0;
+    }
+    else
+    {
+        /* F_CPU/4/(4^SPR) doubled by SPI2X for odd shifts */
+        dev->spcr |= (shift - 1) >> 1;
+        dev->spsr = (shift & 1) ? _BV(SPI2X) : 0;
+    }
+    if (dev == spi_current)
+    {
+        spi_current = NULL;
+        spi_configure(dev); /* takes effect now */
+    }
+}
+
+void spi_configure(struct spi_device *dev)
+{
+    if (dev != spi_current)
+    {
+        SPCR = dev->spcr;
+        SPSR = dev->spsr; /* only SPI2X is writable */
+        spi_current = dev;
+    }
+}
+
+void spi_begin(struct spi_device *dev)
+{
+    spi_configure(dev);
+    *dev->cs_port &= ~dev->cs_mask;
+}
+
+void spi_end(struct spi_device *dev)
+{
+    *dev->cs_port |= dev->cs_mask;
+}
+
+uint8_t spi_xfer(uint8_t tx)
+{
+    /* SPIF is cleared by the SPDR read of the previous transfer */
+    SPDR = tx;
+    loop_until_bit_is_set(SPSR, SPIF);
+    return SPDR;
+}
+
+void spi_transfer(const void *tx, void *rx, uint16_t len)
+{
+    const uint8_t *tx_bytes;
+    uint8_t *rx_bytes;
+    uint16_t i_byte;
+
+    tx_bytes = tx;
+    rx_bytes = rx;
+    for (i_byte = 0; i_byte < len; i_byte++)
+    {
+        uint8_t r;
+
+        r = spi_xfer((tx_bytes != NULL) ? tx_bytes[i_byte] : 0xFF);
+        if (rx_bytes != NULL)
+        {
+            rx_bytes[i_byte] = r;
+        }
+    }
+}
+
+void spi_submit(struct spi_xact *x)
+{
+    x->next = NULL;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (spi_tail != NULL)
+        {
+            spi_tail->next = x;
+        }
+        else
+        {
+            spi_head = x;
+        }
+        spi_tail = x;
+    }
+}
+
+/* First queued transaction of the current device, or the head */
+static
+struct spi_xact *spi_dequeue(void)
+{
+    struct spi_xact *x;
+    struct spi_xact *prev;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        prev = NULL;
+        for (x = spi_head; x != NULL; x = x->next)
+        {
+            if (x->dev == spi_current)
+            {
+                break;
+            }
+            prev = x;
+        }
+        if (x == NULL)
+        {
+            prev = NULL;
+            x = spi_head;
+        }
+        if (x != NULL)
+        {
+            if (prev != NULL)
+            {
+                prev->next = x->next;
+            }
+            else
+            {
+                spi_head = x->next;
+            }
+            if (spi_tail == x)
+            {
+                spi_tail = prev;
+            }
+        }
+    }
+
+    return x;
+}
+
+uint8_t spi_run(void)
+{
+    struct spi_xact *x;
+    uint8_t n;
+
+    n = 0;
+    while ((x = spi_dequeue()) != NULL)
+    {
+        spi_begin(x->dev);
+        spi_transfer(x->tx, x->rx, x->len);
+        spi_end(x->dev);
+        if (x->done != NULL)
+        {
+            x->done(x);
+        }
+        n++;
+    }
+
+    return n;
+}
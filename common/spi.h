@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SPI_H
+#define SPI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+
+/* SPI master bus shared by several devices, each with its own
+ * chip select (active low), mode, bit order and clock.
+ *
+ * A transaction is framed by spi_begin()/spi_end(): SPCR and SPSR are
+ * written only when the device differs from the one of the previous
+ * transaction, or its settings changed.
+ *
+ * Transactions can also be queued with spi_submit(), from ISRs too, and
+ * run later from the main program by spi_run(); the ones for the
+ * device already configured go first, so that devices are switched as
+ * rarely as possible. Transactions of the same device keep their order.
+ *
+ * The hardware SS pin (PB2) must stay an output for master mode; on
+ * the Ethernet shield it is the Wiznet chip select, kept high by
+ * spi_bus_init() until a device is set up on it.
+ */
+
+/* flags */
+#define SPI_MODE0 0
+#define SPI_MODE1 _BV(CPHA)
+#define SPI_MODE2 _BV(CPOL)
+#define SPI_MODE3 (_BV(CPOL) | _BV(CPHA))
+#define SPI_LSB_FIRST _BV(DORD)
+
+struct spi_device {
+    volatile uint8_t *cs_port; /* PORTx of the chip select */
+    uint8_t cs_mask;
+    uint8_t spcr;
+    uint8_t spsr;
+};
+
+struct spi_xact;
+typedef void (*spi_done_fn)(struct spi_xact *x);
+
+struct spi_xact {
+    struct spi_device *dev;
+    const void *tx; /* NULL sends 0xFF */
+    void *rx; /* NULL discards */
+    uint16_t len;
+    spi_done_fn done; /* called after spi_end(), can be NULL */
+    struct spi_xact *next; /* private */
+};
+
+/* SCK, MOSI, SS as outputs (SS high), MISO input. */
+extern void spi_bus_init(void);
+
+/* cs_port is PORTx of the chip select pin, e.g. &PORTD; the pin is made
+ * an output and set high. The clock is the fastest not above max_hz,
+ * F_CPU/128 at least.
+ */
+extern void spi_device_init(struct spi_device *dev,
+        volatile uint8_t *cs_port, uint8_t cs_bit,
+        uint8_t flags, uint32_t max_hz);
+
+extern void spi_set_clock(struct spi_device *dev, uint32_t max_hz);
+
+/* Apply the settings of dev, without selecting it. */
+extern void spi_configure(struct spi_device *dev);
+
+extern void spi_begin(struct spi_device *dev);
+extern void spi_end(struct spi_device *dev);
+
+extern uint8_t spi_xfer(uint8_t tx);
+extern void spi_transfer(const void *tx, void *rx, uint16_t len);
+
+/* Queue a transaction, run by spi_run(); safe from ISRs. */
+extern void spi_submit(struct spi_xact *x);
+
+/* Run the queued transactions, returns how many. */
+extern uint8_t spi_run(void);
+
+#endif /* SPI_H */
@@ -17,7 +17,11 @@
  *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdio.h>
+#include <stdbool.h>
 #include <avr/io.h>
+#include "bench.h"
+#include "power.h"
+#include "stdio_usart0.h"
 
 #define BAUD 57600
 #include <util/setbaud.h>
@@ -25,6 +29,12 @@
 static
 FILE *stdio_usart0_file;
 
+static
+volatile bool stdio_usart0_tx_used;
+
+static
+bool stdio_usart0_powered;
+
 static
 int stdio_usart0_put(char c, FILE *f)
 {
@@ -41,7 +51,10 @@ int stdio_usart0_put(char c, FILE *f)
         }
     }
     loop_until_bit_is_set(UCSR0A, UDRE0);
+    /* clear TX complete flag; other flags must be written as 0 */
+    UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
     UDR0 = c;
+    stdio_usart0_tx_used = true;
 
     return 0;
 }
@@ -62,6 +75,11 @@ int stdio_usart0_get(FILE *f)
 __attribute__((constructor))
 void stdio_usart0_init(void)
 {
+    if (!stdio_usart0_powered)
+    {
+        power_get(POWER_USART0); /* stdout is never closed */
+        stdio_usart0_powered = true;
+    }
     UBRR0H = UBRRH_VALUE;
     UBRR0L = UBRRL_VALUE;
 #if USE_2X
@@ -76,3 +94,21 @@ void stdio_usart0_init(void)
             stdio_usart0_get);
 }
 
+void stdio_usart0_flush(void)
+{
+    if (stdio_usart0_tx_used)
+    {
+        loop_until_bit_is_set(UCSR0A, TXC0);
+    }
+}
+
+#if BENCH_ENABLE
+void stdio_usart0_bench(void)
+{
+    /* characters that do not break the CSV lines */
+    BENCH_PREP("stdio_usart0_put", 8,
+            stdio_usart0_flush(), (void)stdio_usart0_put('\r', NULL));
+    BENCH_PREP("stdio_usart0_put_newline", 8,
+            stdio_usart0_flush(), (void)stdio_usart0_put('\n', NULL));
+}
+#endif
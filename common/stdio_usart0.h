@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STDIO_USART0_H
+#define STDIO_USART0_H
+
+/* stdin/stdout/stderr on USART0, set up automatically at startup
+ * when stdio_usart0.c is linked.
+ */
+
+extern void stdio_usart0_init(void);
+
+/* Wait until the last character has been shifted out, for example
+ * before entering a sleep mode that stops the USART clock.
+ */
+extern void stdio_usart0_flush(void);
+
+#if BENCH_ENABLE
+/* stdio_usart0_put() with an idle transmitter */
+extern void stdio_usart0_bench(void);
+#endif
+
+#endif /* STDIO_USART0_H */
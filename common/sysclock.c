@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "power.h"
+#include "sysclock.h"
+
+#if (SYSCLOCK_CYCLES_PER_OVF % SYSCLOCK_CYCLES_PER_US) != 0
+#  error "Timer2 overflow period is not an integer number of microseconds"
+#endif
+
+#if SYSCLOCK_PRESCALER == 1
+#  define SYSCLOCK_CS (_BV(CS20))
+#elif SYSCLOCK_PRESCALER == 8
+#  define SYSCLOCK_CS (_BV(CS21))
+#elif SYSCLOCK_PRESCALER == 32
+#  define SYSCLOCK_CS (_BV(CS21) | _BV(CS20))
+#elif SYSCLOCK_PRESCALER == 64
+#  define SYSCLOCK_CS (_BV(CS22))
+#elif SYSCLOCK_PRESCALER == 128
+#  define SYSCLOCK_CS (_BV(CS22) | _BV(CS20))
+#elif SYSCLOCK_PRESCALER == 256
+#  define SYSCLOCK_CS (_BV(CS22) | _BV(CS21))
+#else
+#  define SYSCLOCK_CS (_BV(CS22) | _BV(CS21) | _BV(CS20))
+#endif
+
+static volatile uint32_t sysclock_ovf;
+static volatile uint32_t sysclock_ms;
+static volatile uint16_t sysclock_ms_frac_us;
+static bool sysclock_powered;
+
+ISR(TIMER2_OVF_vect)
+{
+    uint16_t frac_us;
+    uint32_t ms;
+
+    /* work on local copies: volatile accesses are expensive */
+    frac_us = sysclock_ms_frac_us + SYSCLOCK_US_PER_OVF;
+    ms = sysclock_ms;
+    while (frac_us >= 1000)
+    {
+        frac_us -= 1000;
+        ms++;
+    }
+    sysclock_ms = ms;
+    sysclock_ms_frac_us = frac_us;
+    sysclock_ovf++;
+}
+
+__attribute__((constructor))
+void sysclock_init(void)
+{
+    if (!sysclock_powered)
+    {
+        power_get(POWER_TIMER2); /* never released */
+        sysclock_powered = true;
+    }
+    TCCR2B = 0; /* stop while configuring */
+    TCNT2 = 0;
+    TCCR2A = _BV(WGM21) | _BV(WGM20); /* fast PWM, TOP=0xFF, OC2A/OC2B disconnected */
+    TIFR2 = _BV(TOV2); /* clear pending overflow */
+    TIMSK2 |= _BV(TOIE2);
+    TCCR2B = SYSCLOCK_CS;
+}
+
+/* Overflow count and TCNT2, counting a pending overflow */
+static
+uint8_t sysclock_read(uint32_t *ovf)
+{
+    uint32_t n;
+    uint8_t cnt;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        n = sysclock_ovf;
+        cnt = TCNT2;
+        if (bit_is_set(TIFR2, TOV2) && (cnt != 0xFF))
+        {
+            /* counter wrapped but the ISR did not run yet
+             * (interrupts disabled, or we are in another ISR) */
+            n++;
+        }
+    }
+    *ovf = n;
+
+    return cnt;
+}
+
+uint32_t sysclock_now_ticks(void)
+{
+    uint32_t ovf;
+    uint8_t cnt;
+
+    cnt = sysclock_read(&ovf);
+
+    return (ovf << 8) | cnt;
+}
+
+uint32_t sysclock_now_cycles(void)
+{
+    return sysclock_now_ticks() << SYSCLOCK_PRESCALER_SHIFT;
+}
+
+/* Overflows and ticks are scaled apart, so that the result wraps at
+ * 2^32us like the overflow count, whatever the prescaler.
+ */
+uint32_t sysclock_now_us(void)
+{
+    uint32_t ovf;
+    uint8_t cnt;
+
+    cnt = sysclock_read(&ovf);
+#if (SYSCLOCK_CYCLES_PER_TICK % SYSCLOCK_CYCLES_PER_US) == 0
+    return (ovf * SYSCLOCK_US_PER_OVF) + (cnt * (SYSCLOCK_CYCLES_PER_TICK / SYSCLOCK_CYCLES_PER_US));
+#else
+    return (ovf * SYSCLOCK_US_PER_OVF) + (((uint32_t)cnt << SYSCLOCK_PRESCALER_SHIFT) / SYSCLOCK_CYCLES_PER_US);
+#endif
+}
+
+uint32_t sysclock_now_ms(void)
+{
+    uint32_t ms;
+    uint16_t frac_us;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ms = sysclock_ms;
+        frac_us = sysclock_ms_frac_us;
+        if (bit_is_set(TIFR2, TOV2))
+        {
+            /* overflow not counted by the ISR yet */
+            frac_us += SYSCLOCK_US_PER_OVF;
+        }
+    }
+    while (frac_us >= 1000)
+    {
+        frac_us -= 1000;
+        ms++;
+    }
+
+    return ms;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYSCLOCK_H
+#define SYSCLOCK_H
+
+#include <stdint.h>
+
+/* Monotonic system clock on Timer2.
+ *
+ * Timer2 runs in fast PWM mode with TOP=0xFF, so OC2A/OC2B are still
+ * usable as PWM outputs, and overflows every 256*SYSCLOCK_PRESCALER
+ * cycles (1.024ms @ 16MHz with the default prescaler).
+ * The overflow count is extended in software to 32 bits.
+ *
+ * All readers are safe to call from ISRs.
+ * Counters wrap around: always compare timestamps by subtraction.
+ */
+
+#ifndef SYSCLOCK_PRESCALER
+#define SYSCLOCK_PRESCALER 64
+#endif
+
+#if SYSCLOCK_PRESCALER == 1
+#  define SYSCLOCK_PRESCALER_SHIFT 0
+#elif SYSCLOCK_PRESCALER == 8
+#  define SYSCLOCK_PRESCALER_SHIFT 3
+#elif SYSCLOCK_PRESCALER == 32
+#  define SYSCLOCK_PRESCALER_SHIFT 5
+#elif SYSCLOCK_PRESCALER == 64
+#  define SYSCLOCK_PRESCALER_SHIFT 6
+#elif SYSCLOCK_PRESCALER == 128
+#  define SYSCLOCK_PRESCALER_SHIFT 7
+#elif SYSCLOCK_PRESCALER == 256
+#  define SYSCLOCK_PRESCALER_SHIFT 8
+#elif SYSCLOCK_PRESCALER == 1024
+#  define SYSCLOCK_PRESCALER_SHIFT 10
+#else
+#  error "SYSCLOCK_PRESCALER must be one of the Timer2 prescalers"
+#endif
+
+#define SYSCLOCK_CYCLES_PER_US (F_CPU / 1000000UL)
+#define SYSCLOCK_CYCLES_PER_TICK (1UL << SYSCLOCK_PRESCALER_SHIFT)
+#define SYSCLOCK_CYCLES_PER_OVF (SYSCLOCK_CYCLES_PER_TICK << 8)
+#define SYSCLOCK_US_PER_OVF (SYSCLOCK_CYCLES_PER_OVF / SYSCLOCK_CYCLES_PER_US)
+
+/* Conversion of (small) cycle differences, constant-folded when possible */
+#define SYSCLOCK_CYCLES_TO_US(c) ((c) / SYSCLOCK_CYCLES_PER_US)
+#define SYSCLOCK_US_TO_CYCLES(us) ((us) * SYSCLOCK_CYCLES_PER_US)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Called automatically at startup; global interrupts must be enabled
+ * with sei() for the clock to advance past one Timer2 overflow.
+ */
+extern void sysclock_init(void);
+
+/* Timer2 ticks since startup (SYSCLOCK_CYCLES_PER_TICK cycles each). */
+extern uint32_t sysclock_now_ticks(void);
+
+/* CPU cycles since startup, with a resolution of one tick.
+ * Wraps every 2^32 cycles (~268s @ 16MHz).
+ */
+extern uint32_t sysclock_now_cycles(void);
+
+/* Microseconds since startup; wraps every ~71 minutes. */
+extern uint32_t sysclock_now_us(void);
+
+/* Milliseconds since startup; wraps every ~49 days. */
+extern uint32_t sysclock_now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SYSCLOCK_H */
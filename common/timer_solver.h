@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMER_SOLVER_H
+#define TIMER_SOLVER_H
+
+/* Compile-time timer configuration.
+ *
+ * Given a period in CPU cycles, pick the smallest prescaler for which
+ * the count fits the timer, giving the best resolution, and the
+ * matching TOP/OCR value for CTC mode (period = PS * (TOP + 1)).
+ * All arguments must be constant expressions, so that everything is
+ * folded by the compiler and runtime setup is just register stores.
+ *
+ * TIMER01_CHECK() and TIMER2_CHECK() fail the build when the period
+ * does not fit the timer, or the achieved one is farther than the
+ * tolerance (in ppm) from the requested one.
+ *
+ * Timer0 and Timer1 share the prescaler list {1, 8, 64, 256, 1024};
+ * Timer2 also has 32 and 128. In all three timers the clock select
+ * bits CSn2:0 are the low bits of TCCRnB and count up the list from 1.
+ */
+
+#define TIMER8_MAX 0xFFUL
+#define TIMER16_MAX 0xFFFFUL
+
+/* Periods in CPU cycles, rounded */
+#define TIMER_HZ_CYCLES(hz) ((F_CPU + (hz) / 2) / (hz))
+#define TIMER_CHZ_CYCLES(chz) (((F_CPU * 100UL) + (chz) / 2) / (chz)) /* Hz * 100 */
+#define TIMER_US_CYCLES(us) ((us) * (F_CPU / 1000000UL))
+#define TIMER_MS_CYCLES(ms) ((ms) * (F_CPU / 1000UL))
+
+/* Counts of a prescaled period, and whether it fits a timer */
+#define TIMER_COUNTS(cycles, ps) (((cycles) + (ps) / 2) / (ps))
+#define TIMER_FITS(cycles, ps, max) \
+    ((TIMER_COUNTS(cycles, ps) >= 1) && (TIMER_COUNTS(cycles, ps) <= (max) + 1))
+
+/* Timer0 and Timer1: max is TIMER8_MAX or TIMER16_MAX */
+#define TIMER01_PS(cycles, max) \
+    (TIMER_FITS(cycles, 1UL, max) ? 1UL : \
+     TIMER_FITS(cycles, 8UL, max) ? 8UL : \
+     TIMER_FITS(cycles, 64UL, max) ? 64UL : \
+     TIMER_FITS(cycles, 256UL, max) ? 256UL : 1024UL)
+
+#define TIMER01_CS(cycles, max) \
+    (TIMER_FITS(cycles, 1UL, max) ? 1 : \
+     TIMER_FITS(cycles, 8UL, max) ? 2 : \
+     TIMER_FITS(cycles, 64UL, max) ? 3 : \
+     TIMER_FITS(cycles, 256UL, max) ? 4 : 5)
+
+/* Timer2 */
+#define TIMER2_PS(cycles) \
+    (TIMER_FITS(cycles, 1UL, TIMER8_MAX) ? 1UL : \
+     TIMER_FITS(cycles, 8UL, TIMER8_MAX) ? 8UL : \
+     TIMER_FITS(cycles, 32UL, TIMER8_MAX) ? 32UL : \
+     TIMER_FITS(cycles, 64UL, TIMER8_MAX) ? 64UL : \
+     TIMER_FITS(cycles, 128UL, TIMER8_MAX) ? 128UL : \
+     TIMER_FITS(cycles, 256UL, TIMER8_MAX) ? 256UL : 1024UL)
+
+#define TIMER2_CS(cycles) \
+    (TIMER_FITS(cycles, 1UL, TIMER8_MAX) ? 1 : \
+     TIMER_FITS(cycles, 8UL, TIMER8_MAX) ? 2 : \
+     TIMER_FITS(cycles, 32UL, TIMER8_MAX) ? 3 : \
+     TIMER_FITS(cycles, 64UL, TIMER8_MAX) ? 4 : \
+     TIMER_FITS(cycles, 128UL, TIMER8_MAX) ? 5 : \
+     TIMER_FITS(cycles, 256UL, TIMER8_MAX) ? 6 : 7)
+
+/* CTC TOP (OCRnA or ICR1) for the chosen prescaler */
+#define TIMER_TOP(cycles, ps) (TIMER_COUNTS(cycles, ps) - 1)
+#define TIMER01_TOP(cycles, max) TIMER_TOP(cycles, TIMER01_PS(cycles, max))
+#define TIMER2_TOP(cycles) TIMER_TOP(cycles, TIMER2_PS(cycles))
+
+/* Achieved period in cycles, and its error in parts per million */
+#define TIMER_ACHIEVED(cycles, ps) ((ps) * TIMER_COUNTS(cycles, ps))
+#define TIMER_ERROR_PPM(cycles, ps) \
+    ((TIMER_ACHIEVED(cycles, ps) > (cycles) ? \
+        (TIMER_ACHIEVED(cycles, ps) - (cycles)) : \
+        ((cycles) - TIMER_ACHIEVED(cycles, ps))) * 1000000ULL / (cycles))
+
+#define TIMER01_ERROR_PPM(cycles, max) TIMER_ERROR_PPM(cycles, TIMER01_PS(cycles, max))
+#define TIMER2_ERROR_PPM(cycles) TIMER_ERROR_PPM(cycles, TIMER2_PS(cycles))
+
+/* Build-time checks, usable at file or block scope */
+#define TIMER01_CHECK(cycles, max, ppm) \
+    _Static_assert(TIMER_FITS(cycles, TIMER01_PS(cycles, max), max) \
+            && (TIMER01_ERROR_PPM(cycles, max) <= (ppm)), \
+            "timer period " #cycles " out of range or tolerance")
+
+#define TIMER2_CHECK(cycles, ppm) \
+    _Static_assert(TIMER_FITS(cycles, TIMER2_PS(cycles), TIMER8_MAX) \
+            && (TIMER2_ERROR_PPM(cycles) <= (ppm)), \
+            "timer period " #cycles " out of range or tolerance")
+
+#endif /* TIMER_SOLVER_H */
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include "bench.h"
+#include "power.h"
+#include "spi.h"
+#include "uspi.h"
+
+#define UMSEL_MSPIM (_BV(UMSEL01) | _BV(UMSEL00))
+#define UBRR_MAX 0x0FFF
+
+/* USART settings before uspi_init() */
+static uint16_t uspi_saved_ubrr;
+static uint8_t uspi_saved_a; /* U2X0 only */
+static uint8_t uspi_saved_b;
+static uint8_t uspi_saved_c;
+static uint8_t uspi_saved_ddr; /* XCK0 only */
+static bool uspi_on; /* holds POWER_USART0 */
+
+void uspi_init(uint8_t flags, uint32_t max_hz)
+{
+    uint8_t c;
+
+    if (!uspi_on)
+    {
+        /* not again when called twice: those are ours now */
+        uspi_saved_ubrr = UBRR0;
+        uspi_saved_a = UCSR0A & _BV(U2X0);
+        uspi_saved_b = UCSR0B;
+        uspi_saved_c = UCSR0C;
+        uspi_saved_ddr = DDRD & _BV(DDD4);
+        power_get(POWER_USART0);
+        uspi_on = true;
+    }
+
+    c = UMSEL_MSPIM;
+    if (flags & _BV(CPOL))
+    {
+        c |= _BV(UCPOL0);
+    }
+    if (flags & _BV(CPHA))
+    {
+        c |= _BV(UCPHA0);
+    }
+    if (flags & SPI_LSB_FIRST)
+    {
+        c |= _BV(UDORD0);
+    }
+
+    UCSR0B = 0;
+    UBRR0 = 0;
+    DDRD |= _BV(DDD4); /* XCK0 output: master */
+    UCSR0A = 0; /* U2X0 unused */
+    UCSR0C = c;
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+    uspi_set_clock(max_hz); /* after enabling the transmitter */
+}
+
+void uspi_set_clock(uint32_t max_hz)
+{
+    uint32_t div;
+
+    if (max_hz == 0)
+    {
+        max_hz = 1; /* the slowest */
+    }
+    /* F_CPU / (2 * (UBRR0 + 1)) */
+    div = (F_CPU / 2 + max_hz - 1) / max_hz;
+    if (div == 0)
+    {
+        div = 1;
+    }
+    else if (div > UBRR_MAX + 1UL)
+    {
+        div = UBRR_MAX + 1UL;
+    }
+    UBRR0 = div - 1;
+}
+
+void uspi_stop(void)
+{
+    if (!uspi_on)
+    {
+        return; /* nothing saved */
+    }
+    UCSR0B = 0;
+    DDRD = (DDRD & ~_BV(DDD4)) | uspi_saved_ddr;
+    UCSR0C = uspi_saved_c;
+    UBRR0 = uspi_saved_ubrr;
+    UCSR0A = uspi_saved_a;
+    UCSR0B = uspi_saved_b;
+    uspi_on = false;
+    power_put(POWER_USART0); /* still held by stdio_usart0, if linked */
+}
+
+uint8_t uspi_xfer(uint8_t tx)
+{
+    loop_until_bit_is_set(UCSR0A, UDRE0);
+    UDR0 = tx;
+    loop_until_bit_is_set(UCSR0A, RXC0);
+    return UDR0;
+}
+
+void uspi_transfer(const void *tx, void *rx, uint16_t len)
+{
+    const uint8_t *tx_bytes;
+    uint8_t *rx_bytes;
+    uint16_t n_tx;
+    uint16_t n_rx;
+
+    tx_bytes = tx;
+    rx_bytes = rx;
+    n_tx = 0;
+    n_rx = 0;
+    /* At most 2 bytes in flight, one in UDR0 and one shifted: enough to
+     * send without gaps, and the 2-byte receive buffer never overruns.
+     */
+    while (n_rx < len)
+    {
+        uint8_t status;
+
+        status = UCSR0A;
+        if ((n_tx < len) && ((uint16_t)(n_tx - n_rx) < 2) && (status & _BV(UDRE0)))
+        {
+            UDR0 = (tx_bytes != NULL) ? tx_bytes[n_tx] : 0xFF;
+            n_tx++;
+        }
+        if (status & _BV(RXC0))
+        {
+            uint8_t r;
+
+            r = UDR0;
+            if (rx_bytes != NULL)
+            {
+                rx_bytes[n_rx] = r;
+            }
+            n_rx++;
+        }
+    }
+}
+
+void uspi_write(const void *src, uint16_t len)
+{
+    const uint8_t *src_bytes;
+    uint16_t i_byte;
+
+    src_bytes = src;
+    UCSR0B &= ~_BV(RXEN0); /* nothing to read back */
+    UCSR0A = _BV(TXC0); /* clear it, set again after the last byte */
+    for (i_byte = 0; i_byte < len; i_byte++)
+    {
+        loop_until_bit_is_set(UCSR0A, UDRE0);
+        UDR0 = src_bytes[i_byte];
+    }
+    if (len > 0)
+    {
+        loop_until_bit_is_set(UCSR0A, TXC0);
+    }
+    UCSR0B |= _BV(RXEN0);
+}
+
+#if BENCH_ENABLE
+#include <avr/pgmspace.h>
+#include "stdio_usart0.h"
+
+void uspi_bench(void)
+{
+    static uint8_t block[512];
+    struct bench_stats read_stats = { 0, UINT16_MAX, 0, 0 };
+    struct bench_stats write_stats = { 0, UINT16_MAX, 0, 0 };
+    uint8_t i;
+
+    /* stdout is on the same USART: report after uspi_stop() */
+    stdio_usart0_flush();
+    uspi_init(SPI_MODE0, F_CPU / 2);
+    for (i = 0; i < 4; i++)
+    {
+        bench_start();
+        uspi_transfer(NULL, block, sizeof(block));
+        bench_add(&read_stats, bench_stop());
+    }
+    for (i = 0; i < 4; i++)
+    {
+        bench_start();
+        uspi_write(block, sizeof(block));
+        bench_add(&write_stats, bench_stop());
+    }
+    uspi_stop();
+    bench_report(PSTR("uspi_read_512"), &read_stats);
+    bench_report(PSTR("uspi_write_512"), &write_stats);
+}
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef USPI_H
+#define USPI_H
+
+#include <stdint.h>
+#include "bench.h"
+#include "spi.h"
+
+/* USART0 in master SPI mode (MSPIM), a second SPI bus:
+ * SCK on XCK0 (PD4), MOSI on TXD (PD1), MISO on RXD (PD0).
+ *
+ * Unlike SPDR, the transmitter is double buffered: uspi_transfer()
+ * keeps the next byte in UDR0 while one is shifted out, so bytes can
+ * follow each other without gaps, where spi_transfer() adds its loop
+ * between bytes; the SPI bus stays free for the other devices.
+ * At F_CPU/2 a byte lasts 16 cycles, and the loop only keeps up if
+ * one pass takes less than that. This was checked with the host
+ * model, which does not count the cycles of the loop itself, not yet
+ * on the AVR (uspi_bench(), "make -C sdcard bench").
+ *
+ * The pins are those of the serial port: stdio_usart0 cannot be used
+ * while the bus is on; uspi_stop() gives the USART back to it, with
+ * its settings.
+ */
+
+/* flags are those of spi.h (mode, bit order); the clock is the fastest
+ * not above max_hz, F_CPU/2 .. F_CPU/8192 (for max_hz 0 too). Chip
+ * selects are up to the caller. Calling it again before uspi_stop()
+ * only changes the mode and clock.
+ */
+extern void uspi_init(uint8_t flags, uint32_t max_hz);
+extern void uspi_set_clock(uint32_t max_hz);
+
+/* Restore the USART settings found by the first uspi_init(). */
+extern void uspi_stop(void);
+
+extern uint8_t uspi_xfer(uint8_t tx);
+
+/* tx NULL sends 0xFF, rx NULL discards */
+extern void uspi_transfer(const void *tx, void *rx, uint16_t len);
+
+/* Send only, e.g. to shift registers: the receiver is off meanwhile. */
+extern void uspi_write(const void *src, uint16_t len);
+
+#if BENCH_ENABLE
+/* uspi_transfer() and uspi_write() of 512 bytes at F_CPU/2 */
+extern void uspi_bench(void);
+#endif
+
+#endif /* USPI_H */
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "hw.h"
+#include "sd_model.h"
+#include "adc.h"
+#include "fade.h"
+#include "ledmatrix.h"
+#include "pwm.h"
+#include "sd.h"
+#include "spi.h"
+#include "stdio_usart0.h"
+#include "uspi.h"
+
+/* Micro-benchmarks of the driver logic, compiled for the host.
+ *
+ * Each benchmark runs its operation in batches until at least
+ * BENCH_MIN_NS of wall time has passed, and reports the host time per
+ * operation and the simulated cycles per operation: one per register
+ * access (host_access_cycles) plus the time spent waiting for the
+ * peripheral models. Host times measure the C logic only, not AVR code
+ * generation; use them to compare versions of the same driver.
+ */
+
+#define BENCH_MIN_NS 200000000ULL
+#define BENCH_BATCH 1000
+
+struct bench {
+    const char *name;
+    void (*setup)(void);
+    void (*op)(uint32_t i);
+};
+
+#define N_SD_BLOCKS 64
+
+static uint8_t sd_image[N_SD_BLOCKS * SD_MODEL_BLOCK];
+static struct sd_model sd_card;
+static uint8_t sd_buf[SD_MODEL_BLOCK];
+
+static const struct ledmatrix_frame bench_frame = LEDMATRIX_FRAME_INIT(
+        01110,
+        10001,
+        10001,
+        11111,
+        10001,
+        10001,
+        10001);
+
+extern void TIMER0_OVF_vect(void);
+
+static
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static
+void pwm_setup(void)
+{
+    pwm_init(PWM_OC0A, 8);
+    pwm_init(PWM_OC1A, 16);
+}
+
+static
+void pwm_frac_op(uint32_t i)
+{
+    pwm_set_frac((i & 1) ? PWM_OC1A : PWM_OC0A, (uint16_t)(i * 40503U));
+}
+
+static
+void pwm_percent_op(uint32_t i)
+{
+    pwm_set_percent(PWM_OC1A, i % 101);
+}
+
+static
+void sd_setup(void)
+{
+    sd_model_attach(&sd_card, sd_image, N_SD_BLOCKS, true);
+    sd_card_init();
+}
+
+static
+void sd_read_op(uint32_t i)
+{
+    sd_read_block(i % N_SD_BLOCKS, sd_buf);
+}
+
+static
+void spi_setup(void)
+{
+    static struct spi_device dev;
+
+    spi_bus_init();
+    spi_device_init(&dev, &PORTD, PORTD5, SPI_MODE0, F_CPU / 2);
+    spi_configure(&dev);
+}
+
+static
+void spi_transfer_op(uint32_t i)
+{
+    (void)i;
+    spi_transfer(NULL, sd_buf, sizeof(sd_buf));
+}
+
+static
+void uspi_setup(void)
+{
+    uspi_init(SPI_MODE0, F_CPU / 2);
+}
+
+static
+void uspi_transfer_op(uint32_t i)
+{
+    (void)i;
+    uspi_transfer(NULL, sd_buf, sizeof(sd_buf));
+}
+
+static
+void uspi_write_op(uint32_t i)
+{
+    (void)i;
+    uspi_write(sd_buf, sizeof(sd_buf));
+}
+
+static
+void usart_setup(void)
+{
+    stdio_usart0_init();
+}
+
+static
+void usart_put_op(uint32_t i)
+{
+    fputc('a' + (i & 0x0F), host_last_fdev);
+    if ((i % BENCH_BATCH) == BENCH_BATCH - 1)
+    {
+        host_usart_tx_take(NULL, SIZE_MAX); /* discard */
+    }
+}
+
+static
+void usart_printf_op(uint32_t i)
+{
+    fprintf(host_last_fdev, "%lu\n", (unsigned long)i);
+    if ((i % BENCH_BATCH) == BENCH_BATCH - 1)
+    {
+        host_usart_tx_take(NULL, SIZE_MAX);
+    }
+}
+
+static
+void adc_setup(void)
+{
+    host_adc_input[0] = 300;
+    sei();
+    adc_start(ADC_REF_AVCC | ADC_MUX_ADC(0), ADC_FREE_RUNNING);
+}
+
+static
+void adc_op(uint32_t i)
+{
+    uint32_t n;
+
+    /* one free running conversion, serviced by the ISR */
+    (void)i;
+    n = host_adc_conversions();
+    while (host_adc_conversions() == n)
+    {
+        host_advance(13 * 128);
+    }
+}
+
+static
+void fade_setup(void)
+{
+    enum pwm_channel ch;
+
+    for (ch = 0; ch < PWM_N_CHANNELS; ch++)
+    {
+        pwm_init(ch, 8);
+    }
+    fade_init();
+}
+
+static
+void fade_isr_op(uint32_t i)
+{
+    enum pwm_channel ch;
+
+    if ((i % 256) == 0)
+    {
+        for (ch = 0; ch < PWM_N_CHANNELS; ch++)
+        {
+            fade_to(ch, (i & 256) ? 0 : FADE_LEVEL_MAX, 300, FADE_EASE_IN_OUT);
+        }
+    }
+    TIMER0_OVF_vect(); /* all six channels fading */
+}
+
+static
+void ledmatrix_op(uint32_t i)
+{
+    (void)i;
+    ledmatrix_draw_next_subframe(&bench_frame);
+}
+
+static const struct bench benches[] = {
+    { "pwm_set_frac", pwm_setup, pwm_frac_op },
+    { "pwm_set_percent", pwm_setup, pwm_percent_op },
+    { "sd_read_block", sd_setup, sd_read_op },
+    { "spi_transfer 512 bytes", spi_setup, spi_transfer_op },
+    { "uspi_transfer 512 bytes", uspi_setup, uspi_transfer_op },
+    { "uspi_write 512 bytes", uspi_setup, uspi_write_op },
+    { "stdio_usart0 putc", usart_setup, usart_put_op },
+    { "stdio_usart0 printf %lu", usart_setup, usart_printf_op },
+    { "adc free running ISR", adc_setup, adc_op },
+    { "fade ISR, 6 channels", fade_setup, fade_isr_op },
+    { "ledmatrix_draw_next_subframe", ledmatrix_setup, ledmatrix_op },
+};
+
+int main(void)
+{
+    size_t i_bench;
+
+    printf("%-32s %12s %14s\n", "benchmark", "ns/op", "sim cycles/op");
+    for (i_bench = 0; i_bench < sizeof(benches) / sizeof(benches[0]); i_bench++)
+    {
+        const struct bench *b = &benches[i_bench];
+        uint64_t t_start;
+        uint64_t t_elapsed;
+        uint64_t cycles_start;
+        uint32_t n;
+
+        host_reset();
+        b->setup();
+        n = 0;
+        cycles_start = host_cycles;
+        t_start = now_ns();
+        do
+        {
+            uint32_t end;
+
+            for (end = n + BENCH_BATCH; n < end; n++)
+            {
+                b->op(n);
+            }
+            t_elapsed = now_ns() - t_start;
+        } while (t_elapsed < BENCH_MIN_NS);
+        printf("%-32s %12.1f %14.1f\n", b->name,
+                (double)t_elapsed / n,
+                (double)(host_cycles - cycles_start) / n);
+    }
+
+    return 0;
+}
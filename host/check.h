@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+#include <stdio.h>
+#include "hw.h"
+
+/* Minimal unit test support: each test program runs its test functions
+ * with RUN(), starting from a reset register file, and returns
+ * check_result() from main().
+ */
+
+static unsigned check_failures;
+static unsigned check_tests;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        long long check_a_ = (long long)(actual); \
+        long long check_e_ = (long long)(expected); \
+        if (check_a_ != check_e_) \
+        { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %s (%lld)\n", \
+                    __FILE__, __LINE__, #actual, check_a_, #expected, check_e_); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define RUN(test) \
+    do { \
+        unsigned check_before_ = check_failures; \
+        host_reset(); \
+        test(); \
+        check_tests++; \
+        printf("%-40s %s\n", #test, (check_failures == check_before_) ? "ok" : "FAILED"); \
+    } while (0)
+
+static __attribute__((unused))
+int check_result(void)
+{
+    printf("%u tests, %u failed checks\n", check_tests, check_failures);
+    return (check_failures == 0) ? 0 : 1;
+}
+
+#endif /* HOST_CHECK_H */
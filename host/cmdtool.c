@@ -0,0 +1,808 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "cmd.h"
+
+/* Client of the command channel (see cmd.h) for Linux:
+ *
+ *   cmdtool [-d DEVICE] [-w MS] [-t MS] [-r N] [COMMAND ARG...]
+ *
+ * Without COMMAND, runs one command per line from stdin, on the same
+ * connection: opening the port of an Arduino Uno resets it, and the
+ * bootloader then needs the -w wait (2000ms by default).
+ *
+ *   ping [TEXT]              echo
+ *   stats                    counters and latencies of the board
+ *   raw ID [BYTE...]         any request, hex bytes, prints the reply
+ *   frame ROW0 ... ROW6      ledmatrix: 7 rows of 5 '0'/'1' dots
+ *   prof                     ledmatrix: probes, with PROF=1
+ *   fade CH LEVEL MS         pwm: fade channel CH (0 = OC0A, 2 = OC1A)
+ *   breathe CH               pwm: back to breathing
+ *   read LBA COUNT           sdcard: blocks to stdout
+ *
+ * A request without a valid reply within the timeout (-t, 500ms by
+ * default, plus the reply transmission time) is sent again, up to
+ * -r times (3 by default), with the same sequence number.
+ */
+
+#define CMDTOOL_DEVICE "/dev/ttyACM0"
+#define CMDTOOL_F_CPU 16000000UL /* unit of the board cycle counts */
+#define CMDTOOL_ARGS_MAX 16
+
+/* ids of the examples */
+#define LEDMATRIX_CMD_FRAME (CMD_ID_USER + 0)
+#define LEDMATRIX_CMD_PROF (CMD_ID_USER + 1)
+#define PWM_CMD_FADE (CMD_ID_USER + 0)
+#define PWM_CMD_BREATHE (CMD_ID_USER + 1)
+#define SDCARD_CMD_READ (CMD_ID_USER + 0)
+#define SDCARD_READ_MAX 64
+#define SDCARD_BLOCK 512
+
+static int fd = -1;
+static int timeout_ms = 500;
+static int retries = 3;
+static uint8_t seq;
+
+static uint8_t rx_buf[2 * (6 + 0x10000 + 1)];
+static size_t rx_len;
+static uint8_t reply[0x10000];
+static uint16_t reply_len;
+static uint8_t reply_status;
+
+static
+uint8_t crc8(uint8_t crc, const uint8_t *p, size_t len)
+{
+    uint8_t bit;
+
+    while (len-- > 0)
+    {
+        crc ^= *p++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static
+long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000L) + (ts.tv_nsec / 1000000L);
+}
+
+/* 10 bits per character */
+static
+long line_ms(size_t n_bytes)
+{
+    return (long)((n_bytes * 10 * 1000) / CMD_BAUD) + 1;
+}
+
+static
+int port_open(const char *dev, int wait_ms)
+{
+    struct termios tio;
+
+    fd = open(dev, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", dev, strerror(errno));
+        return -1;
+    }
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", dev, strerror(errno));
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, B57600);
+    cfsetospeed(&tio, B57600);
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", dev, strerror(errno));
+        return -1;
+    }
+    if (wait_ms > 0)
+    {
+        usleep(wait_ms * 1000);
+    }
+    tcflush(fd, TCIOFLUSH); /* boot messages */
+    return 0;
+}
+
+static
+int port_write(const uint8_t *p, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n;
+
+        n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "write: %s\n", strerror(errno));
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* More bytes before the deadline: 1, 0 on timeout, -1 on error */
+static
+int port_read(long deadline)
+{
+    while (true)
+    {
+        struct pollfd pfd;
+        long left;
+        ssize_t n;
+
+        left = deadline - now_ms();
+        if (left <= 0)
+        {
+            return 0;
+        }
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, (int)left) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            return -1;
+        }
+        n = read(fd, &rx_buf[rx_len], sizeof(rx_buf) - rx_len);
+        if (n > 0)
+        {
+            rx_len += n;
+            return 1;
+        }
+        if ((n < 0) && (errno != EINTR) && (errno != EAGAIN))
+        {
+            fprintf(stderr, "read: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+static
+void rx_consume(size_t n)
+{
+    memmove(rx_buf, &rx_buf[n], rx_len - n);
+    rx_len -= n;
+}
+
+/* Look for a frame in rx_buf: 1 with it in reply[], 0 if more bytes
+ * are needed, with *need the length to wait for. Anything else is
+ * dropped: text, broken frames, and a sync byte followed by garbage,
+ * resuming from the next sync byte. When final, the frame being
+ * received is taken for garbage.
+ */
+static
+int rx_parse(uint8_t *id, uint8_t *rx_seq, bool final, size_t *need)
+{
+    size_t pos;
+
+    pos = 0;
+    while (true)
+    {
+        const uint8_t *f;
+        uint16_t len;
+
+        while ((pos < rx_len) && (rx_buf[pos] != CMD_SYNC))
+        {
+            pos++;
+        }
+        rx_consume(pos);
+        pos = 0;
+        if (rx_len == 0)
+        {
+            *need = 1;
+            return 0;
+        }
+        /* sync id seq status len_lo len_hi data crc */
+        f = rx_buf;
+        len = (rx_len >= 6) ? (f[4] | (f[5] << 8)) : 0;
+        if ((rx_len < 6) || (rx_len < (size_t)(6 + len + 1)))
+        {
+            if (!final)
+            {
+                *need = (rx_len < 6) ? 6 + 1 : 6 + len + 1;
+                return 0;
+            }
+            pos = 1;
+            continue;
+        }
+        if (f[6 + len] != crc8(0, &f[1], 5 + len))
+        {
+            pos = 1;
+            continue;
+        }
+        *id = f[1];
+        *rx_seq = f[2];
+        reply_status = f[3];
+        reply_len = len;
+        memcpy(reply, &f[6], len);
+        rx_consume(6 + len + 1);
+        return 1;
+    }
+}
+
+/* Wait for the reply to id/seq, skipping anything else, stale replies
+ * included. 1 when received, 0 on timeout, -1 on error.
+ */
+static
+int recv_reply(uint8_t id, long deadline)
+{
+    bool final;
+
+    final = false;
+    while (true)
+    {
+        uint8_t rx_id;
+        uint8_t rx_seq;
+        size_t need;
+        int r;
+
+        r = rx_parse(&rx_id, &rx_seq, final, &need);
+        if (r > 0)
+        {
+            if ((rx_id == id) && (rx_seq == seq))
+            {
+                return 1;
+            }
+            continue;
+        }
+        if (final)
+        {
+            return 0;
+        }
+        /* the reply may have started just before the deadline */
+        r = port_read(deadline + line_ms(need));
+        if (r < 0)
+        {
+            return -1;
+        }
+        if (r == 0)
+        {
+            final = true;
+        }
+    }
+}
+
+/* Request and wait for its reply in reply[], with retries;
+ * returns the reply status, or -1.
+ */
+static
+int transact(uint8_t id, const uint8_t *data, uint8_t len)
+{
+    uint8_t frame[4 + 255 + 1];
+    int attempt;
+
+    if (len > CMD_RX_MAX)
+    {
+        fprintf(stderr, "request too long: %u > %u bytes\n", len, CMD_RX_MAX);
+        return -1;
+    }
+    seq++;
+    frame[0] = CMD_SYNC;
+    frame[1] = id;
+    frame[2] = seq;
+    frame[3] = len;
+    if (len > 0)
+    {
+        memcpy(&frame[4], data, len);
+    }
+    frame[4 + len] = crc8(0, &frame[1], 3 + len);
+
+    for (attempt = 0; attempt <= retries; attempt++)
+    {
+        int r;
+
+        if (port_write(frame, 4 + len + 1) != 0)
+        {
+            return -1;
+        }
+        r = recv_reply(id, now_ms() + line_ms(4 + len + 1) + timeout_ms);
+        if (r < 0)
+        {
+            return -1;
+        }
+        if (r > 0)
+        {
+            return reply_status;
+        }
+    }
+    fprintf(stderr, "no reply to id 0x%02X\n", id);
+    return -1;
+}
+
+static
+const char *status_name(int status)
+{
+    switch (status)
+    {
+        case CMD_OK:
+            return "ok";
+        case CMD_ERR_UNKNOWN:
+            return "unknown command";
+        case CMD_ERR_ARGS:
+            return "bad arguments";
+        case CMD_ERR_FAILED:
+            return "failed";
+        default:
+            return "?";
+    }
+}
+
+/* Reply status to exit code */
+static
+int check_status(int status)
+{
+    if (status < 0)
+    {
+        return 1;
+    }
+    if (status != CMD_OK)
+    {
+        fprintf(stderr, "status %d: %s\n", status, status_name(status));
+        return 1;
+    }
+    return 0;
+}
+
+static
+uint32_t get_le(const uint8_t *p, int n)
+{
+    uint32_t v;
+
+    v = 0;
+    while (n-- > 0)
+    {
+        v = (v << 8) | p[n];
+    }
+    return v;
+}
+
+static
+void put_le(uint8_t *p, uint32_t v, int n)
+{
+    while (n-- > 0)
+    {
+        *p++ = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+static
+bool parse_num(const char *s, unsigned long max, unsigned long *v)
+{
+    char *end;
+
+    errno = 0;
+    *v = strtoul(s, &end, 0);
+    if ((errno != 0) || (*s == '\0') || (*end != '\0') || (*v > max))
+    {
+        fprintf(stderr, "bad number: %s\n", s);
+        return false;
+    }
+    return true;
+}
+
+static
+int run_ping(int argc, char **argv)
+{
+    const char *text;
+    size_t len;
+    int status;
+
+    text = (argc > 1) ? argv[1] : "ping";
+    len = strlen(text);
+    if (len > CMD_RX_MAX)
+    {
+        len = CMD_RX_MAX;
+    }
+    status = transact(CMD_ID_PING, (const uint8_t *)text, len);
+    if (check_status(status) != 0)
+    {
+        return 1;
+    }
+    if ((reply_len != len) || (memcmp(reply, text, len) != 0))
+    {
+        fprintf(stderr, "ping: echo mismatch\n");
+        return 1;
+    }
+    printf("%.*s\n", (int)reply_len, (const char *)reply);
+    return 0;
+}
+
+static
+int run_stats(int argc, char **argv)
+{
+    uint32_t latency;
+    uint32_t handler;
+
+    (void)argc;
+    (void)argv;
+    if (check_status(transact(CMD_ID_STATS, NULL, 0)) != 0)
+    {
+        return 1;
+    }
+    if (reply_len < 16)
+    {
+        fprintf(stderr, "stats: short reply\n");
+        return 1;
+    }
+    latency = get_le(&reply[8], 4);
+    handler = get_le(&reply[12], 4);
+    printf("requests %u\n", (unsigned)get_le(&reply[0], 2));
+    printf("crc_errors %u\n", (unsigned)get_le(&reply[2], 2));
+    printf("overruns %u\n", (unsigned)get_le(&reply[4], 2));
+    printf("unknown %u\n", (unsigned)get_le(&reply[6], 2));
+    printf("latency_max %lu cycles (%lu us)\n", (unsigned long)latency,
+            (unsigned long)(latency / (CMDTOOL_F_CPU / 1000000UL)));
+    printf("handler_max %lu cycles (%lu us)\n", (unsigned long)handler,
+            (unsigned long)(handler / (CMDTOOL_F_CPU / 1000000UL)));
+    return 0;
+}
+
+static
+int run_raw(int argc, char **argv)
+{
+    uint8_t data[CMD_RX_MAX];
+    unsigned long v;
+    int status;
+    int i;
+
+    if ((argc < 2) || (argc - 2 > CMD_RX_MAX))
+    {
+        fprintf(stderr, "usage: raw ID [BYTE...]\n");
+        return 1;
+    }
+    if (!parse_num(argv[1], 0xFF, &v))
+    {
+        return 1;
+    }
+    for (i = 2; i < argc; i++)
+    {
+        unsigned long b;
+
+        if (!parse_num(argv[i], 0xFF, &b))
+        {
+            return 1;
+        }
+        data[i - 2] = b;
+    }
+    status = transact(v, data, argc - 2);
+    if (status < 0)
+    {
+        return 1;
+    }
+    printf("status %d (%s), %u bytes\n", status, status_name(status), reply_len);
+    for (i = 0; i < reply_len; i++)
+    {
+        printf("%02X%c", reply[i], (((i % 16) == 15) || (i == reply_len - 1)) ? '\n' : ' ');
+    }
+    return 0;
+}
+
+/* Same layout as LEDMATRIX_FRAME_INIT: bit r of column c is the dot
+ * of row r, leftmost column first.
+ */
+static
+int run_frame(int argc, char **argv)
+{
+    uint8_t cols[5];
+    int r;
+    int c;
+
+    if (argc != 1 + 7)
+    {
+        fprintf(stderr, "usage: frame ROW0 ... ROW6\n");
+        return 1;
+    }
+    memset(cols, 0, sizeof(cols));
+    for (r = 0; r < 7; r++)
+    {
+        const char *row;
+
+        row = argv[1 + r];
+        if (strlen(row) != 5)
+        {
+            fprintf(stderr, "frame: row %s is not 5 dots\n", row);
+            return 1;
+        }
+        for (c = 0; c < 5; c++)
+        {
+            if (row[c] == '1')
+            {
+                cols[c] |= 1 << r;
+            }
+            else if (row[c] != '0')
+            {
+                fprintf(stderr, "frame: row %s is not 0/1\n", row);
+                return 1;
+            }
+        }
+    }
+    return check_status(transact(LEDMATRIX_CMD_FRAME, cols, sizeof(cols)));
+}
+
+static
+int run_prof(int argc, char **argv)
+{
+    uint8_t index;
+
+    (void)argc;
+    (void)argv;
+    printf("%-20s %10s %10s %10s %10s\n", "probe", "count", "min", "max", "avg");
+    for (index = 0; index < 0xFF; index++)
+    {
+        uint32_t count;
+
+        if (check_status(transact(LEDMATRIX_CMD_PROF, &index, 1)) != 0)
+        {
+            return 1;
+        }
+        if (reply_len < 16)
+        {
+            break; /* past the last probe */
+        }
+        count = get_le(&reply[0], 4);
+        printf("%-20.*s %10lu %10lu %10lu %10lu\n",
+                reply_len - 16, (const char *)&reply[16],
+                (unsigned long)count,
+                (unsigned long)get_le(&reply[4], 4),
+                (unsigned long)get_le(&reply[8], 4),
+                (unsigned long)((count > 0) ? get_le(&reply[12], 4) / count : 0));
+    }
+    return 0;
+}
+
+static
+int run_fade(int argc, char **argv)
+{
+    unsigned long ch;
+    unsigned long level;
+    unsigned long ms;
+    uint8_t data[4];
+
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: fade CH LEVEL MS\n");
+        return 1;
+    }
+    if (!parse_num(argv[1], 0xFF, &ch) || !parse_num(argv[2], 0xFF, &level)
+            || !parse_num(argv[3], 0xFFFF, &ms))
+    {
+        return 1;
+    }
+    data[0] = ch;
+    data[1] = level;
+    put_le(&data[2], ms, 2);
+    return check_status(transact(PWM_CMD_FADE, data, sizeof(data)));
+}
+
+static
+int run_breathe(int argc, char **argv)
+{
+    unsigned long ch;
+    uint8_t data;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: breathe CH\n");
+        return 1;
+    }
+    if (!parse_num(argv[1], 0xFF, &ch))
+    {
+        return 1;
+    }
+    data = ch;
+    return check_status(transact(PWM_CMD_BREATHE, &data, 1));
+}
+
+static
+int run_read(int argc, char **argv)
+{
+    unsigned long lba;
+    unsigned long count;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: read LBA COUNT\n");
+        return 1;
+    }
+    if (!parse_num(argv[1], 0xFFFFFFFFUL, &lba) || !parse_num(argv[2], 0xFFFFFFFFUL, &count))
+    {
+        return 1;
+    }
+    while (count > 0)
+    {
+        uint8_t data[5];
+        uint8_t n;
+
+        n = (count > SDCARD_READ_MAX) ? SDCARD_READ_MAX : count;
+        put_le(data, lba, 4);
+        data[4] = n;
+        if (check_status(transact(SDCARD_CMD_READ, data, sizeof(data))) != 0)
+        {
+            return 1;
+        }
+        if (reply_len != (n * SDCARD_BLOCK) + 1)
+        {
+            fprintf(stderr, "read: %u bytes for %u blocks\n", reply_len, n);
+            return 1;
+        }
+        if (reply[reply_len - 1] != n)
+        {
+            fprintf(stderr, "read: error at block %lu\n", lba + reply[reply_len - 1]);
+            fwrite(reply, SDCARD_BLOCK, reply[reply_len - 1], stdout);
+            return 1;
+        }
+        if (fwrite(reply, SDCARD_BLOCK, n, stdout) != n)
+        {
+            fprintf(stderr, "read: %s\n", strerror(errno));
+            return 1;
+        }
+        lba += n;
+        count -= n;
+    }
+    return 0;
+}
+
+struct command {
+    const char *name;
+    int (*run)(int argc, char **argv);
+};
+
+static const struct command commands[] = {
+    {"ping", run_ping},
+    {"stats", run_stats},
+    {"raw", run_raw},
+    {"frame", run_frame},
+    {"prof", run_prof},
+    {"fade", run_fade},
+    {"breathe", run_breathe},
+    {"read", run_read},
+};
+
+static
+int run(int argc, char **argv)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if (strcmp(argv[0], commands[i].name) == 0)
+        {
+            return commands[i].run(argc, argv);
+        }
+    }
+    fprintf(stderr, "unknown command: %s\n", argv[0]);
+    return 1;
+}
+
+/* One command per line, # starts a comment */
+static
+int run_script(FILE *f)
+{
+    char line[512];
+    int result;
+
+    result = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char *argv[CMDTOOL_ARGS_MAX];
+        char *tok;
+        int argc;
+
+        line[strcspn(line, "#\n")] = '\0';
+        argc = 0;
+        for (tok = strtok(line, " \t\r"); (tok != NULL) && (argc < CMDTOOL_ARGS_MAX);
+                tok = strtok(NULL, " \t\r"))
+        {
+            argv[argc++] = tok;
+        }
+        if (argc == 0)
+        {
+            continue;
+        }
+        if (run(argc, argv) != 0)
+        {
+            result = 1;
+        }
+        fflush(stdout);
+    }
+    return result;
+}
+
+static
+void usage(void)
+{
+    fprintf(stderr,
+            "usage: cmdtool [-d DEVICE] [-w MS] [-t MS] [-r N] [COMMAND ARG...]\n"
+            "commands: ping [TEXT], stats, raw ID [BYTE...],\n"
+            "  frame ROW0 ... ROW6, prof, fade CH LEVEL MS, breathe CH, read LBA COUNT\n"
+            "without COMMAND, one command per line from stdin\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *dev;
+    int wait_ms;
+    int opt;
+
+    dev = CMDTOOL_DEVICE;
+    wait_ms = 2000;
+    while ((opt = getopt(argc, argv, "+d:w:t:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                dev = optarg;
+                break;
+            case 'w':
+                wait_ms = atoi(optarg);
+                break;
+            case 't':
+                timeout_ms = atoi(optarg);
+                break;
+            case 'r':
+                retries = atoi(optarg);
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+    if (port_open(dev, wait_ms) != 0)
+    {
+        return 1;
+    }
+    if (optind < argc)
+    {
+        return run(argc - optind, &argv[optind]);
+    }
+    return run_script(stdin);
+}
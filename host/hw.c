@@ -0,0 +1,1519 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE /* fopencookie */
+#define HOST_HW_INTERNAL
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "hw.h"
+
+#define ADDR(reg) ((uint8_t)((uint8_t *)&(reg) - host_io))
+#define REG16(addr) (*(uint16_t *)&host_io[(addr)])
+
+/* Reserved bit, always set in flag registers: a write clears it, which
+ * tells writes (one clears the flag) from reads.
+ */
+#define W1C_CANARY 0x80
+
+#define N_VECTORS _VECTORS_SIZE
+
+#define SLEEP_TIMEOUT_CYCLES (100ULL * F_CPU) /* 100s of simulated time */
+#define SLEEP_STEP_CYCLES (F_CPU / 1000UL)
+
+uint8_t host_io[HOST_IO_SIZE] __attribute__((aligned(2)));
+uint64_t host_cycles;
+uint32_t host_access_cycles = 1;
+void (*host_sleep_hook)(void);
+uint32_t host_startup_cycles;
+bool host_usart_tx_echo;
+uint16_t host_adc_input[16];
+uint16_t (*host_adc_read)(uint8_t mux);
+FILE *host_last_fdev;
+
+static host_hook_fn host_hooks[HOST_IO_SIZE];
+
+/* last register accessed, committed at the next access */
+static int host_last_addr = -1;
+static uint8_t host_last_value;
+
+static bool host_clk_io_stopped; /* in sleep modes other than idle */
+static uint32_t host_irq_counts[N_VECTORS];
+static uint32_t host_irq_total;
+
+/*
+ * Interrupt vectors: weak, NULL when the program has no handler.
+ */
+
+#define WEAK_VECTOR(n) extern void __vector_##n(void) __attribute__((weak))
+WEAK_VECTOR(1); WEAK_VECTOR(2); WEAK_VECTOR(3); WEAK_VECTOR(4); WEAK_VECTOR(5);
+WEAK_VECTOR(6); WEAK_VECTOR(7); WEAK_VECTOR(8); WEAK_VECTOR(9); WEAK_VECTOR(10);
+WEAK_VECTOR(11); WEAK_VECTOR(12); WEAK_VECTOR(13); WEAK_VECTOR(14); WEAK_VECTOR(15);
+WEAK_VECTOR(16); WEAK_VECTOR(17); WEAK_VECTOR(18); WEAK_VECTOR(19); WEAK_VECTOR(20);
+WEAK_VECTOR(21); WEAK_VECTOR(22); WEAK_VECTOR(23); WEAK_VECTOR(24); WEAK_VECTOR(25);
+
+static
+void (* const host_vectors[N_VECTORS])(void) = {
+    NULL, __vector_1, __vector_2, __vector_3, __vector_4, __vector_5,
+    __vector_6, __vector_7, __vector_8, __vector_9, __vector_10,
+    __vector_11, __vector_12, __vector_13, __vector_14, __vector_15,
+    __vector_16, __vector_17, __vector_18, __vector_19, __vector_20,
+    __vector_21, __vector_22, __vector_23, __vector_24, __vector_25,
+};
+
+struct host_irq_source {
+    uint8_t flag_reg; /* 0: level triggered on the enable bit only */
+    uint8_t flag;
+    uint8_t mask_reg;
+    uint8_t mask;
+    bool auto_clear; /* flag cleared by hardware when serviced */
+    bool flag_clear; /* pending while the flag is clear */
+};
+
+/* indexed by vector number, in priority order */
+static struct host_irq_source host_irq_sources[N_VECTORS];
+
+void host_fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "host: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(2);
+}
+
+/*
+ * Flags
+ */
+
+static void adc_trigger(uint8_t flag_reg, uint8_t flag);
+
+static
+void flag_set(uint8_t reg, uint8_t flag)
+{
+    uint8_t before;
+
+    before = host_io[reg];
+    host_io[reg] |= flag;
+    if ((before & flag) == 0)
+    {
+        adc_trigger(reg, flag);
+    }
+}
+
+static
+bool is_w1c_reg(uint8_t addr)
+{
+    return (addr == ADDR(TIFR0)) || (addr == ADDR(TIFR1)) || (addr == ADDR(TIFR2))
+        || (addr == ADDR(PCIFR)) || (addr == ADDR(EIFR));
+}
+
+/*
+ * Timers
+ */
+
+struct host_timer {
+    uint8_t tccra;
+    uint8_t tccrb;
+    uint8_t tcnt;
+    uint8_t ocra;
+    uint8_t ocrb;
+    uint8_t tifr;
+    bool wide;
+    bool timer2; /* different prescalers */
+    uint8_t prr; /* PRTIMn */
+    uint16_t rem; /* prescaler count */
+};
+
+static struct host_timer host_timers[3];
+
+static
+uint32_t timer_prescaler(const struct host_timer *t)
+{
+    static const uint16_t ps01[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    static const uint16_t ps2[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+    uint8_t cs;
+
+    cs = host_io[t->tccrb] & 0x07;
+    return t->timer2 ? ps2[cs] : ps01[cs]; /* external clock: stopped */
+}
+
+static
+uint16_t timer_get(const struct host_timer *t, uint8_t addr)
+{
+    return t->wide ? REG16(addr) : host_io[addr];
+}
+
+static
+void timer_put(const struct host_timer *t, uint8_t addr, uint16_t v)
+{
+    if (t->wide)
+    {
+        REG16(addr) = v;
+    }
+    else
+    {
+        host_io[addr] = v;
+    }
+}
+
+/* Phase correct modes are approximated by counting up only */
+static
+uint16_t timer_top(const struct host_timer *t, bool *ctc)
+{
+    uint8_t wgm;
+
+    *ctc = false;
+    if (!t->wide)
+    {
+        wgm = (host_io[t->tccra] & 0x03) | ((host_io[t->tccrb] >> 1) & 0x04);
+        switch (wgm)
+        {
+            case 2:
+                *ctc = true;
+                return host_io[t->ocra];
+            case 5:
+            case 7:
+                return host_io[t->ocra];
+            default:
+                return 0xFF;
+        }
+    }
+    wgm = (host_io[t->tccra] & 0x03) | ((host_io[t->tccrb] >> 1) & 0x0C);
+    switch (wgm)
+    {
+        case 1:
+        case 5:
+            return 0xFF;
+        case 2:
+        case 6:
+            return 0x1FF;
+        case 3:
+        case 7:
+            return 0x3FF;
+        case 4:
+        case 9:
+        case 11:
+        case 15:
+            *ctc = (wgm == 4);
+            return OCR1A;
+        case 8:
+        case 10:
+        case 12:
+        case 14:
+            *ctc = (wgm == 12);
+            return ICR1;
+        default:
+            return 0xFFFF;
+    }
+}
+
+static
+uint16_t timer_wrap_at(const struct host_timer *t, uint16_t cnt, bool *ctc)
+{
+    uint16_t top;
+
+    top = timer_top(t, ctc);
+    if (cnt > top)
+    {
+        top = t->wide ? 0xFFFF : 0xFF; /* missed TOP, count to MAX */
+    }
+    return top;
+}
+
+static
+uint64_t timer_cycles_to_event(const struct host_timer *t)
+{
+    uint32_t ps;
+    uint16_t cnt;
+    uint16_t wrap_at;
+    uint32_t ticks;
+    uint16_t ocr;
+    bool ctc;
+
+    ps = timer_prescaler(t);
+    if ((ps == 0) || (PRR & t->prr))
+    {
+        return UINT64_MAX;
+    }
+    cnt = timer_get(t, t->tcnt);
+    wrap_at = timer_wrap_at(t, cnt, &ctc);
+    ticks = (uint32_t)wrap_at - cnt + 1;
+    ocr = timer_get(t, t->ocra);
+    if ((ocr > cnt) && (ocr <= wrap_at) && ((uint32_t)(ocr - cnt) < ticks))
+    {
+        ticks = ocr - cnt;
+    }
+    ocr = timer_get(t, t->ocrb);
+    if ((ocr > cnt) && (ocr <= wrap_at) && ((uint32_t)(ocr - cnt) < ticks))
+    {
+        ticks = ocr - cnt;
+    }
+    return (uint64_t)ticks * ps - t->rem;
+}
+
+/* dt never goes past the next event */
+static
+void timer_step(struct host_timer *t, uint64_t dt)
+{
+    uint32_t ps;
+    uint64_t ticks;
+    uint32_t cnt;
+    uint16_t wrap_at;
+    bool ctc;
+
+    ps = timer_prescaler(t);
+    if ((ps == 0) || (PRR & t->prr))
+    {
+        return;
+    }
+    ticks = (t->rem + dt) / ps;
+    t->rem = (t->rem + dt) % ps;
+    if (ticks == 0)
+    {
+        return;
+    }
+    cnt = timer_get(t, t->tcnt);
+    wrap_at = timer_wrap_at(t, cnt, &ctc);
+    cnt += ticks;
+    if (cnt > wrap_at)
+    {
+        cnt = 0;
+        if (!ctc || (wrap_at == (t->wide ? 0xFFFF : 0xFF)))
+        {
+            flag_set(t->tifr, _BV(TOV0)); /* same bit for all timers */
+        }
+    }
+    timer_put(t, t->tcnt, cnt);
+    if (cnt == timer_get(t, t->ocra))
+    {
+        flag_set(t->tifr, _BV(OCF0A));
+    }
+    if (cnt == timer_get(t, t->ocrb))
+    {
+        flag_set(t->tifr, _BV(OCF0B));
+    }
+}
+
+/*
+ * ADC
+ */
+
+static bool adc_converting;
+static bool adc_first; /* next conversion is the first after enabling */
+static uint64_t adc_done_at;
+static uint8_t adc_mux;
+static uint32_t adc_count;
+
+static
+void adc_start(void)
+{
+    static const uint8_t div[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+    uint32_t clocks;
+
+    clocks = adc_first ? 25 : 13;
+    adc_first = false;
+    adc_converting = true;
+    adc_mux = ADMUX & 0x0F;
+    adc_done_at = host_cycles + clocks * div[ADCSRA & 0x07];
+    ADCSRA |= _BV(ADSC);
+}
+
+static
+void adc_step(void)
+{
+    uint16_t value;
+
+    if (!adc_converting || (host_cycles < adc_done_at))
+    {
+        return;
+    }
+    value = host_adc_read ? host_adc_read(adc_mux) : host_adc_input[adc_mux];
+    value &= 0x3FF;
+    if (ADMUX & _BV(ADLAR))
+    {
+        value <<= 6;
+    }
+    ADC = value;
+    adc_converting = false;
+    adc_count++;
+    ADCSRA = (ADCSRA & ~_BV(ADSC)) | _BV(ADIF);
+    if ((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADATE)) && ((ADCSRB & 0x07) == 0))
+    {
+        adc_start(); /* free running */
+    }
+}
+
+/* Rising edge of a flag that can auto-trigger the ADC */
+static
+void adc_trigger(uint8_t flag_reg, uint8_t flag)
+{
+    static const struct {
+        uint8_t reg;
+        uint8_t flag;
+    } sources[8] = {
+        [3] = { 0x35, _BV(OCF0A) },
+        [4] = { 0x35, _BV(TOV0) },
+        [5] = { 0x36, _BV(OCF1B) },
+        [6] = { 0x36, _BV(TOV1) },
+        [7] = { 0x36, _BV(ICF1) },
+    };
+    uint8_t adts;
+
+    if (!(ADCSRA & _BV(ADEN)) || !(ADCSRA & _BV(ADATE)) || adc_converting)
+    {
+        return;
+    }
+    adts = ADCSRB & 0x07;
+    if ((sources[adts].reg == flag_reg) && (sources[adts].flag == flag))
+    {
+        adc_start();
+    }
+}
+
+/* ADCSRA changed from before to the value written */
+static
+void adc_write(uint8_t before, uint8_t written)
+{
+    uint8_t v;
+    bool start;
+
+    v = written & ~(_BV(ADIF) | _BV(ADSC));
+    if ((before & _BV(ADIF)) && !(written & _BV(ADIF)))
+    {
+        v |= _BV(ADIF); /* writing one clears it */
+    }
+    start = false;
+    if ((written & _BV(ADEN)) && (PRR & _BV(PRADC)))
+    {
+        host_fatal("ADC enabled while gated by PRR");
+    }
+    if (!(written & _BV(ADEN)))
+    {
+        adc_converting = false;
+    }
+    else
+    {
+        if (!(before & _BV(ADEN)))
+        {
+            adc_first = true;
+        }
+        start = (written & _BV(ADSC)) && !adc_converting;
+    }
+    if (adc_converting)
+    {
+        v |= _BV(ADSC);
+    }
+    ADCSRA = v;
+    if (start)
+    {
+        adc_start();
+    }
+}
+
+uint32_t host_adc_conversions(void)
+{
+    return adc_count;
+}
+
+/*
+ * SPI
+ */
+
+static host_spi_xfer_fn spi_dev;
+static void *spi_dev_ctx;
+static bool spi_busy;
+static bool spi_unread; /* completed, SPDR not accessed yet */
+static uint64_t spi_done_at;
+static uint32_t spi_count;
+
+static
+void spi_step(void)
+{
+    uint8_t miso;
+
+    if (!spi_busy || (host_cycles < spi_done_at))
+    {
+        return;
+    }
+    miso = spi_dev ? spi_dev(spi_dev_ctx, SPDR) : 0xFF;
+    SPDR = miso;
+    SPSR |= _BV(SPIF);
+    spi_busy = false;
+    spi_unread = true;
+    spi_count++;
+}
+
+static
+void spi_access(uint8_t addr)
+{
+    static const uint8_t div[4] = { 4, 16, 64, 128 };
+
+    if (addr == ADDR(SPDR))
+    {
+        if (spi_unread)
+        {
+            /* reading the result, SPIF cleared */
+            spi_unread = false;
+            SPSR &= ~_BV(SPIF);
+        }
+        else if ((SPCR & _BV(SPE)) && (SPCR & _BV(MSTR)))
+        {
+            uint32_t cycles;
+
+            if (PRR & _BV(PRSPI))
+            {
+                host_fatal("SPI transfer while gated by PRR");
+            }
+            cycles = 8 * div[SPCR & 0x03];
+            if (SPSR & _BV(SPI2X))
+            {
+                cycles /= 2;
+            }
+            spi_busy = true;
+            spi_done_at = host_cycles + cycles;
+        }
+    }
+    else if ((addr == ADDR(SPSR)) && spi_busy)
+    {
+        host_advance(spi_done_at - host_cycles); /* polling SPIF */
+    }
+}
+
+void host_spi_attach(host_spi_xfer_fn xfer, void *ctx)
+{
+    spi_dev = xfer;
+    spi_dev_ctx = ctx;
+}
+
+uint32_t host_spi_count(void)
+{
+    return spi_count;
+}
+
+/*
+ * USART0
+ */
+
+#define USART_RX_SIZE 4096
+
+static uint8_t usart_rx[USART_RX_SIZE];
+static size_t usart_rx_head;
+static size_t usart_rx_tail;
+static uint8_t *usart_tx;
+static size_t usart_tx_len;
+static size_t usart_tx_cap;
+static uint64_t usart_rx_at; /* when the byte at the tail is complete */
+static bool usart_rx_armed; /* UDR0 accessed with RXC0 set */
+
+/* 8N1 frame at the baud rate set by UBRR0 and U2X0 */
+static
+uint32_t usart_char_cycles(void)
+{
+    return 10 * ((UCSR0A & _BV(U2X0)) ? 8 : 16) * ((UBRR0 & 0x0FFF) + 1UL);
+}
+
+static
+bool usart_rx_waiting(void)
+{
+    return (UCSR0B & _BV(RXEN0)) && !(UCSR0A & _BV(RXC0)) && (usart_rx_head != usart_rx_tail);
+}
+
+static
+void usart_tx_emit(uint8_t c)
+{
+    if (usart_tx_len == usart_tx_cap)
+    {
+        usart_tx_cap = usart_tx_cap ? (2 * usart_tx_cap) : 256;
+        usart_tx = realloc(usart_tx, usart_tx_cap);
+        if (usart_tx == NULL)
+        {
+            host_fatal("out of memory");
+        }
+    }
+    usart_tx[usart_tx_len++] = c;
+    if (host_usart_tx_echo)
+    {
+        putchar(c);
+    }
+}
+
+/* UDR0 was accessed: a read if it still holds the received byte */
+static
+void usart_commit(uint8_t before)
+{
+    if (usart_rx_armed && (UDR0 == before))
+    {
+        UCSR0A &= ~_BV(RXC0);
+    }
+    else if (UCSR0B & _BV(TXEN0))
+    {
+        usart_tx_emit(UDR0);
+        if (usart_rx_armed)
+        {
+            UDR0 = before; /* RX and TX buffers are separate */
+        }
+    }
+    usart_rx_armed = false;
+}
+
+/* Master SPI mode (MSPIM): a byte in UDR0 waits for the one being
+ * shifted out, received bytes queue in a 2-byte buffer.
+ */
+static host_spi_xfer_fn mspim_dev;
+static void *mspim_dev_ctx;
+static bool mspim_shifting;
+static uint8_t mspim_shift;
+static uint64_t mspim_done_at;
+static bool mspim_tx_full;
+static uint8_t mspim_tx;
+static uint8_t mspim_rx[2];
+static uint8_t mspim_rx_n;
+static uint32_t mspim_count;
+
+static
+bool usart_mspim(void)
+{
+    const uint8_t umsel = _BV(UMSEL01) | _BV(UMSEL00);
+
+    return (UCSR0C & umsel) == umsel;
+}
+
+static
+uint32_t mspim_byte_cycles(void)
+{
+    return 16 * ((UBRR0 & 0x0FFF) + 1UL); /* 8 bits at F_CPU/(2*(UBRR0+1)) */
+}
+
+static
+void mspim_step(void)
+{
+    if (!(UCSR0B & _BV(RXEN0)))
+    {
+        mspim_rx_n = 0;
+        UCSR0A &= ~(_BV(RXC0) | _BV(DOR0));
+    }
+    while (mspim_shifting && (host_cycles >= mspim_done_at))
+    {
+        uint8_t miso;
+
+        miso = mspim_dev ? mspim_dev(mspim_dev_ctx, mspim_shift) : 0xFF;
+        mspim_count++;
+        if (!(UCSR0B & _BV(RXEN0)))
+        {
+            /* receiver disabled */
+        }
+        else if (mspim_rx_n < sizeof(mspim_rx))
+        {
+            mspim_rx[mspim_rx_n++] = miso;
+            UDR0 = mspim_rx[0];
+            UCSR0A |= _BV(RXC0);
+        }
+        else
+        {
+            UCSR0A |= _BV(DOR0); /* overrun, byte lost */
+        }
+        if (mspim_tx_full)
+        {
+            /* no gap: starts when the previous one ends */
+            mspim_shift = mspim_tx;
+            mspim_tx_full = false;
+            mspim_done_at += mspim_byte_cycles();
+            UCSR0A |= _BV(UDRE0);
+        }
+        else
+        {
+            mspim_shifting = false;
+            UCSR0A |= _BV(TXC0);
+        }
+    }
+}
+
+static
+void mspim_write(uint8_t v)
+{
+    if (!(UCSR0B & _BV(TXEN0)))
+    {
+        return;
+    }
+    if (!(DDRD & _BV(DDD4)))
+    {
+        host_fatal("USART0 master SPI mode needs XCK0 (PD4) as output");
+    }
+    if (!mspim_shifting)
+    {
+        mspim_shift = v;
+        mspim_shifting = true;
+        mspim_done_at = host_cycles + mspim_byte_cycles();
+    }
+    else if (!mspim_tx_full)
+    {
+        mspim_tx = v;
+        mspim_tx_full = true;
+        UCSR0A &= ~_BV(UDRE0);
+    }
+    /* ignored with UDRE0 clear */
+}
+
+/* UDR0 was accessed: a read if it still holds the received byte.
+ * A write of the same value as the received byte counts as a read.
+ */
+static
+void mspim_commit(uint8_t before)
+{
+    if ((mspim_rx_n > 0) && (UDR0 == before))
+    {
+        mspim_rx[0] = mspim_rx[1];
+        mspim_rx_n--;
+        UDR0 = mspim_rx[0];
+        UCSR0A &= ~_BV(DOR0);
+        if (mspim_rx_n == 0)
+        {
+            UCSR0A &= ~_BV(RXC0);
+        }
+    }
+    else
+    {
+        uint8_t v;
+
+        v = UDR0;
+        UDR0 = before; /* RX and TX buffers are separate */
+        mspim_write(v);
+    }
+}
+
+void host_usart_spi_attach(host_spi_xfer_fn xfer, void *ctx)
+{
+    mspim_dev = xfer;
+    mspim_dev_ctx = ctx;
+}
+
+uint32_t host_usart_spi_count(void)
+{
+    return mspim_count;
+}
+
+static
+void usart_step(void)
+{
+    if (usart_mspim())
+    {
+        mspim_step();
+        return;
+    }
+    UCSR0A |= _BV(UDRE0) | _BV(TXC0); /* transmission is instantaneous */
+    if (usart_rx_waiting() && (host_cycles >= usart_rx_at))
+    {
+        UDR0 = usart_rx[usart_rx_tail];
+        usart_rx_tail = (usart_rx_tail + 1) % USART_RX_SIZE;
+        UCSR0A |= _BV(RXC0);
+        usart_rx_at = host_cycles + usart_char_cycles(); /* the next one */
+    }
+}
+
+static
+void usart_access(uint8_t addr)
+{
+    if (addr == ADDR(UDR0))
+    {
+        usart_rx_armed = (UCSR0A & _BV(RXC0)) != 0;
+    }
+}
+
+void host_usart_rx_push(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+
+    if (usart_rx_head == usart_rx_tail)
+    {
+        usart_rx_at = host_cycles + usart_char_cycles();
+    }
+    while (len-- > 0)
+    {
+        size_t next = (usart_rx_head + 1) % USART_RX_SIZE;
+
+        if (next == usart_rx_tail)
+        {
+            host_fatal("USART RX queue full");
+        }
+        usart_rx[usart_rx_head] = *bytes++;
+        usart_rx_head = next;
+    }
+    usart_step();
+}
+
+size_t host_usart_tx_take(void *dst, size_t max_len)
+{
+    size_t len;
+
+    host_commit();
+    len = (usart_tx_len < max_len) ? usart_tx_len : max_len;
+    if (dst != NULL)
+    {
+        memcpy(dst, usart_tx, len);
+    }
+    memmove(usart_tx, usart_tx + len, usart_tx_len - len);
+    usart_tx_len -= len;
+    return len;
+}
+
+/*
+ * EEPROM
+ */
+
+#define EEPROM_SIZE (E2END + 1)
+#define EEPROM_EEPM (_BV(EEPM1) | _BV(EEPM0))
+#define EEPROM_EEMPE_CYCLES 4
+
+uint8_t host_eeprom[EEPROM_SIZE];
+
+static uint32_t eeprom_wear[EEPROM_SIZE];
+static uint32_t eeprom_reads;
+static bool eeprom_busy;
+static uint64_t eeprom_done_at;
+static uint64_t eeprom_eempe_until;
+static uint16_t eeprom_addr; /* latched when programming starts */
+static uint8_t eeprom_data;
+static uint8_t eeprom_mode; /* EEPM1:0 */
+
+static
+void eeprom_step(void)
+{
+    if ((EECR & _BV(EEMPE)) && (host_cycles > eeprom_eempe_until))
+    {
+        EECR &= ~_BV(EEMPE);
+    }
+    if (!eeprom_busy || (host_cycles < eeprom_done_at))
+    {
+        return;
+    }
+    switch (eeprom_mode)
+    {
+        case 0: /* erase and write */
+            host_eeprom[eeprom_addr] = eeprom_data;
+            break;
+        case 1: /* erase only */
+            host_eeprom[eeprom_addr] = 0xFF;
+            break;
+        default: /* write only: programs zeros */
+            host_eeprom[eeprom_addr] &= eeprom_data;
+            break;
+    }
+    eeprom_wear[eeprom_addr]++;
+    eeprom_busy = false;
+    EECR &= ~_BV(EEPE);
+}
+
+static
+void eeprom_program(uint8_t eecr)
+{
+    /* 3.4ms for erase and write, 1.8ms for erase or write only */
+    static const uint16_t time_10us[4] = { 340, 180, 180, 340 };
+
+    eeprom_mode = (eecr & EEPROM_EEPM) >> EEPM0;
+    eeprom_addr = EEAR & E2END;
+    eeprom_data = EEDR;
+    eeprom_busy = true;
+    eeprom_done_at = host_cycles + (uint64_t)time_10us[eeprom_mode] * (F_CPU / 100000UL);
+}
+
+/* EECR changed from before to the value written */
+static
+void eeprom_write(uint8_t before, uint8_t written)
+{
+    uint8_t v;
+
+    v = written & (EEPROM_EEPM | _BV(EERIE));
+    if (eeprom_busy)
+    {
+        v = (v & ~EEPROM_EEPM) | (before & EEPROM_EEPM) | _BV(EEPE);
+    }
+    if ((written & _BV(EEMPE)) && !(before & _BV(EEMPE)))
+    {
+        eeprom_eempe_until = host_cycles + EEPROM_EEMPE_CYCLES;
+        v |= _BV(EEMPE);
+    }
+    if ((written & _BV(EERE)) && !eeprom_busy)
+    {
+        EEDR = host_eeprom[EEAR & E2END];
+        eeprom_reads++;
+    }
+    else if (written & _BV(EERE))
+    {
+        host_fatal("EEPROM read while programming");
+    }
+    if ((written & _BV(EEPE)) && !eeprom_busy && (before & _BV(EEMPE))
+            && (host_cycles <= eeprom_eempe_until))
+    {
+        eeprom_program(v);
+        v |= _BV(EEPE);
+    }
+    EECR = v; /* EEPE without EEMPE is ignored */
+}
+
+void host_eeprom_erase(void)
+{
+    memset(host_eeprom, 0xFF, sizeof(host_eeprom));
+    memset(eeprom_wear, 0, sizeof(eeprom_wear));
+}
+
+uint32_t host_eeprom_wear(uint16_t addr)
+{
+    return eeprom_wear[addr & E2END];
+}
+
+uint32_t host_eeprom_reads(void)
+{
+    return eeprom_reads;
+}
+
+/*
+ * GPIO
+ */
+
+struct host_port {
+    uint8_t pin;
+    uint8_t ddr;
+    uint8_t port;
+    uint8_t pcmsk;
+    uint8_t pcif;
+    uint8_t drive_mask; /* driven from outside */
+    uint8_t drive_level;
+    uint8_t last;
+};
+
+static struct host_port host_ports[3];
+
+static
+struct host_port *gpio_port(char port)
+{
+    if ((port < 'B') || (port > 'D'))
+    {
+        host_fatal("no port %c", port);
+    }
+    return &host_ports[port - 'B'];
+}
+
+static
+void gpio_step(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < 3; i++)
+    {
+        struct host_port *p = &host_ports[i];
+        uint8_t ddr;
+        uint8_t in;
+        uint8_t pins;
+
+        ddr = host_io[p->ddr];
+        in = (p->drive_mask & p->drive_level);
+        if (!(MCUCR & _BV(PUD)))
+        {
+            in |= ~p->drive_mask & host_io[p->port]; /* pull-ups */
+        }
+        pins = (host_io[p->port] & ddr) | (in & ~ddr);
+        host_io[p->pin] = pins;
+        if ((pins ^ p->last) & host_io[p->pcmsk])
+        {
+            flag_set(ADDR(PCIFR), p->pcif);
+        }
+        p->last = pins;
+    }
+}
+
+void host_gpio_drive(char port, uint8_t bit, bool level)
+{
+    struct host_port *p = gpio_port(port);
+
+    host_commit();
+    p->drive_mask |= _BV(bit);
+    if (level)
+    {
+        p->drive_level |= _BV(bit);
+    }
+    else
+    {
+        p->drive_level &= ~_BV(bit);
+    }
+    gpio_step();
+}
+
+void host_gpio_release(char port, uint8_t bit)
+{
+    struct host_port *p = gpio_port(port);
+
+    host_commit();
+    p->drive_mask &= ~_BV(bit);
+    gpio_step();
+}
+
+bool host_gpio_out(char port, uint8_t bit)
+{
+    struct host_port *p = gpio_port(port);
+
+    return (host_io[p->port] & _BV(bit)) != 0;
+}
+
+/*
+ * Core
+ */
+
+static
+void irq_source(uint8_t vector, uint8_t flag_reg, uint8_t flag,
+        uint8_t mask_reg, uint8_t mask, bool auto_clear)
+{
+    struct host_irq_source *s = &host_irq_sources[vector];
+
+    s->flag_reg = flag_reg;
+    s->flag = flag;
+    s->mask_reg = mask_reg;
+    s->mask = mask;
+    s->auto_clear = auto_clear;
+}
+
+/* Highest priority pending interrupt, 0 if none */
+static
+uint8_t irq_pending(void)
+{
+    uint8_t v;
+
+    for (v = 1; v < N_VECTORS; v++)
+    {
+        const struct host_irq_source *s = &host_irq_sources[v];
+
+        if ((s->mask == 0) || !(host_io[s->mask_reg] & s->mask))
+        {
+            continue;
+        }
+        if ((s->flag_reg != 0)
+                && (((host_io[s->flag_reg] & s->flag) != 0) == s->flag_clear))
+        {
+            continue;
+        }
+        return v;
+    }
+    return 0;
+}
+
+static
+void service_interrupts(void)
+{
+    uint8_t v;
+
+    if (!(SREG & _BV(SREG_I)))
+    {
+        return;
+    }
+    v = irq_pending();
+    if (v != 0)
+    {
+        const struct host_irq_source *s = &host_irq_sources[v];
+
+        if (host_vectors[v] == NULL)
+        {
+            host_fatal("interrupt %u enabled without a handler", v);
+        }
+        if (s->auto_clear)
+        {
+            host_io[s->flag_reg] &= ~s->flag;
+        }
+        host_irq_counts[v]++;
+        host_irq_total++;
+        SREG &= ~_BV(SREG_I);
+        host_vectors[v]();
+        host_commit();
+        SREG |= _BV(SREG_I); /* reti */
+        /* one main program instruction runs before the next one */
+    }
+}
+
+static
+uint64_t next_event(uint64_t max)
+{
+    uint64_t dt;
+    uint8_t i;
+
+    dt = max;
+    if (!host_clk_io_stopped)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            uint64_t d = timer_cycles_to_event(&host_timers[i]);
+
+            if (d < dt)
+            {
+                dt = d;
+            }
+        }
+    }
+    if (adc_converting && ((adc_done_at - host_cycles) < dt))
+    {
+        dt = adc_done_at - host_cycles;
+    }
+    if (spi_busy && ((spi_done_at - host_cycles) < dt))
+    {
+        dt = spi_done_at - host_cycles;
+    }
+    if (mspim_shifting && ((mspim_done_at - host_cycles) < dt))
+    {
+        dt = mspim_done_at - host_cycles;
+    }
+    if (eeprom_busy && ((eeprom_done_at - host_cycles) < dt))
+    {
+        dt = eeprom_done_at - host_cycles;
+    }
+    if (!usart_mspim() && usart_rx_waiting() && (usart_rx_at > host_cycles)
+            && ((usart_rx_at - host_cycles) < dt))
+    {
+        dt = usart_rx_at - host_cycles;
+    }
+    return dt;
+}
+
+static
+void step(uint64_t dt)
+{
+    uint8_t i;
+
+    host_cycles += dt;
+    if (!host_clk_io_stopped)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            timer_step(&host_timers[i], dt);
+        }
+    }
+    adc_step();
+    spi_step();
+    eeprom_step();
+    usart_step();
+    gpio_step();
+}
+
+void host_advance(uint64_t cycles)
+{
+    host_commit();
+    do
+    {
+        uint64_t dt;
+
+        dt = next_event(cycles);
+        step(dt);
+        cycles -= dt;
+        service_interrupts();
+    } while (cycles > 0);
+}
+
+void host_delay_cycles(double cycles)
+{
+    host_advance((uint64_t)(cycles + 0.5));
+}
+
+/* Let time pass without servicing interrupts */
+static
+void halt(uint64_t cycles)
+{
+    while (cycles > 0)
+    {
+        uint64_t dt;
+
+        dt = next_event(cycles);
+        step(dt);
+        cycles -= dt;
+    }
+}
+
+void host_sleep(void)
+{
+    uint64_t timeout;
+    uint8_t mode;
+
+    host_commit();
+    if (!(SMCR & _BV(SE)))
+    {
+        return;
+    }
+    if (!(SREG & _BV(SREG_I)))
+    {
+        host_fatal("sleeping with interrupts disabled");
+    }
+    mode = (SMCR >> SM0) & 0x07;
+    if ((mode == 1) && (ADCSRA & _BV(ADEN)) && !adc_converting)
+    {
+        adc_start(); /* ADC Noise Reduction starts a conversion */
+    }
+    host_clk_io_stopped = (mode != 0);
+    timeout = host_cycles + SLEEP_TIMEOUT_CYCLES;
+    while (irq_pending() == 0)
+    {
+        if (host_sleep_hook)
+        {
+            host_sleep_hook();
+        }
+        if (irq_pending() != 0)
+        {
+            break;
+        }
+        step(next_event(SLEEP_STEP_CYCLES));
+        if (host_cycles > timeout)
+        {
+            host_fatal("sleeping forever (mode %u)", mode);
+        }
+    }
+    if ((mode == 2) || (mode == 3))
+    {
+        halt(host_startup_cycles); /* Power-down, Power-save */
+    }
+    else if ((mode == 6) || (mode == 7))
+    {
+        halt(6); /* Standby: the oscillator keeps running */
+    }
+    host_clk_io_stopped = false;
+    halt(4);
+    service_interrupts();
+}
+
+/* Side effects of the last access that depend on the value written */
+void host_commit(void)
+{
+    uint8_t addr;
+
+    if (host_last_addr < 0)
+    {
+        return;
+    }
+    addr = host_last_addr;
+    host_last_addr = -1;
+    if (is_w1c_reg(addr))
+    {
+        if (!(host_io[addr] & W1C_CANARY))
+        {
+            host_io[addr] = (host_last_value & ~host_io[addr]) | W1C_CANARY;
+        }
+    }
+    else if (addr == ADDR(ADCSRA))
+    {
+        if (ADCSRA != host_last_value)
+        {
+            adc_write(host_last_value, ADCSRA);
+        }
+    }
+    else if ((addr == ADDR(UDR0)) && (PRR & _BV(PRUSART0)))
+    {
+        host_fatal("USART0 accessed while gated by PRR");
+    }
+    else if ((addr == ADDR(UDR0)) && usart_mspim())
+    {
+        mspim_commit(host_last_value);
+    }
+    else if (addr == ADDR(UDR0))
+    {
+        usart_commit(host_last_value);
+    }
+    else if ((addr == ADDR(UCSR0A)) && usart_mspim())
+    {
+        uint8_t v;
+
+        /* status bits are read-only, TXC0 is cleared by writing one */
+        v = host_last_value;
+        if ((UCSR0A != host_last_value) && (UCSR0A & _BV(TXC0)))
+        {
+            v &= ~_BV(TXC0);
+        }
+        UCSR0A = v;
+    }
+    else if (addr == ADDR(UCSR0A))
+    {
+        const uint8_t rw = _BV(U2X0) | _BV(MPCM0);
+
+        /* status bits are read-only, TXC0 is always set */
+        UCSR0A = (UCSR0A & rw) | (host_last_value & ~rw);
+    }
+    else if (addr == ADDR(SPSR))
+    {
+        SPSR = (SPSR & _BV(SPI2X)) | (host_last_value & ~_BV(SPI2X));
+    }
+    else if (addr == ADDR(EECR))
+    {
+        if (EECR != host_last_value)
+        {
+            eeprom_write(host_last_value, EECR);
+        }
+    }
+}
+
+static
+void model_access(uint8_t addr)
+{
+    if ((addr == ADDR(SPDR)) || (addr == ADDR(SPSR)))
+    {
+        spi_access(addr);
+    }
+    else if ((addr == ADDR(UDR0)) || (addr == ADDR(UCSR0A)))
+    {
+        usart_access(addr);
+    }
+    else if ((addr == ADDR(ADCSRA)) && adc_converting && !(ADCSRA & _BV(ADATE)))
+    {
+        host_advance(adc_done_at - host_cycles); /* polling ADSC */
+    }
+    else if ((addr == ADDR(EECR)) && eeprom_busy)
+    {
+        host_advance(eeprom_done_at - host_cycles); /* polling EEPE */
+    }
+}
+
+volatile uint8_t *host_reg8(uint8_t addr)
+{
+    host_commit();
+    host_advance(host_access_cycles);
+    model_access(addr);
+    if (host_hooks[addr])
+    {
+        host_hooks[addr](addr);
+    }
+    host_commit(); /* accesses of the ISRs run meanwhile */
+    host_last_addr = addr;
+    host_last_value = host_io[addr];
+    return &host_io[addr];
+}
+
+volatile uint16_t *host_reg16(uint8_t addr)
+{
+    return (volatile uint16_t *)host_reg8(addr);
+}
+
+void host_hook_set(uint8_t addr, host_hook_fn hook)
+{
+    host_hooks[addr] = hook;
+}
+
+uint32_t host_irq_count(uint8_t vector)
+{
+    return (vector < N_VECTORS) ? host_irq_counts[vector] : 0;
+}
+
+void host_reset(void)
+{
+    static const struct host_timer timers[3] = {
+        { 0x44, 0x45, 0x46, 0x47, 0x48, 0x35, false, false, _BV(PRTIM0), 0 },
+        { 0x80, 0x81, 0x84, 0x88, 0x8A, 0x36, true, false, _BV(PRTIM1), 0 },
+        { 0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0x37, false, true, _BV(PRTIM2), 0 },
+    };
+    static const struct host_port ports[3] = {
+        { 0x23, 0x24, 0x25, 0x6B, _BV(PCIF0), 0, 0, 0 },
+        { 0x26, 0x27, 0x28, 0x6C, _BV(PCIF1), 0, 0, 0 },
+        { 0x29, 0x2A, 0x2B, 0x6D, _BV(PCIF2), 0, 0, 0 },
+    };
+
+    memset(host_io, 0, sizeof(host_io));
+    TIFR0 = W1C_CANARY;
+    TIFR1 = W1C_CANARY;
+    TIFR2 = W1C_CANARY;
+    PCIFR = W1C_CANARY;
+    EIFR = W1C_CANARY;
+    SP = RAMEND;
+    UCSR0A = _BV(UDRE0);
+    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+
+    host_cycles = 0;
+    host_last_addr = -1;
+    host_clk_io_stopped = false;
+    memset(host_irq_counts, 0, sizeof(host_irq_counts));
+    host_irq_total = 0;
+    memset(host_hooks, 0, sizeof(host_hooks));
+    host_sleep_hook = NULL;
+    host_startup_cycles = 16384;
+    memcpy(host_timers, timers, sizeof(host_timers));
+    memcpy(host_ports, ports, sizeof(host_ports));
+
+    adc_converting = false;
+    adc_first = false;
+    adc_count = 0;
+    host_adc_read = NULL;
+    memset(host_adc_input, 0, sizeof(host_adc_input));
+
+    spi_busy = false;
+    spi_unread = false;
+    spi_count = 0;
+
+    usart_rx_head = 0;
+    usart_rx_tail = 0;
+    usart_tx_len = 0;
+    usart_rx_armed = false;
+    mspim_shifting = false;
+    mspim_tx_full = false;
+    mspim_rx_n = 0;
+    mspim_count = 0;
+
+    eeprom_busy = false; /* a write in progress is lost */
+    eeprom_reads = 0;
+
+    memset(host_irq_sources, 0, sizeof(host_irq_sources));
+    irq_source(1, ADDR(EIFR), _BV(INTF0), ADDR(EIMSK), _BV(INT0), true);
+    irq_source(2, ADDR(EIFR), _BV(INTF1), ADDR(EIMSK), _BV(INT1), true);
+    irq_source(3, ADDR(PCIFR), _BV(PCIF0), ADDR(PCICR), _BV(PCIE0), true);
+    irq_source(4, ADDR(PCIFR), _BV(PCIF1), ADDR(PCICR), _BV(PCIE1), true);
+    irq_source(5, ADDR(PCIFR), _BV(PCIF2), ADDR(PCICR), _BV(PCIE2), true);
+    irq_source(7, ADDR(TIFR2), _BV(OCF2A), ADDR(TIMSK2), _BV(OCIE2A), true);
+    irq_source(8, ADDR(TIFR2), _BV(OCF2B), ADDR(TIMSK2), _BV(OCIE2B), true);
+    irq_source(9, ADDR(TIFR2), _BV(TOV2), ADDR(TIMSK2), _BV(TOIE2), true);
+    irq_source(10, ADDR(TIFR1), _BV(ICF1), ADDR(TIMSK1), _BV(ICIE1), true);
+    irq_source(11, ADDR(TIFR1), _BV(OCF1A), ADDR(TIMSK1), _BV(OCIE1A), true);
+    irq_source(12, ADDR(TIFR1), _BV(OCF1B), ADDR(TIMSK1), _BV(OCIE1B), true);
+    irq_source(13, ADDR(TIFR1), _BV(TOV1), ADDR(TIMSK1), _BV(TOIE1), true);
+    irq_source(14, ADDR(TIFR0), _BV(OCF0A), ADDR(TIMSK0), _BV(OCIE0A), true);
+    irq_source(15, ADDR(TIFR0), _BV(OCF0B), ADDR(TIMSK0), _BV(OCIE0B), true);
+    irq_source(16, ADDR(TIFR0), _BV(TOV0), ADDR(TIMSK0), _BV(TOIE0), true);
+    irq_source(17, ADDR(SPSR), _BV(SPIF), ADDR(SPCR), _BV(SPIE), false);
+    irq_source(18, ADDR(UCSR0A), _BV(RXC0), ADDR(UCSR0B), _BV(RXCIE0), false);
+    irq_source(19, ADDR(UCSR0A), _BV(UDRE0), ADDR(UCSR0B), _BV(UDRIE0), false);
+    irq_source(20, ADDR(UCSR0A), _BV(TXC0), ADDR(UCSR0B), _BV(TXCIE0), true);
+    irq_source(21, ADDR(ADCSRA), _BV(ADIF), ADDR(ADCSRA), _BV(ADIE), true);
+    irq_source(22, ADDR(EECR), _BV(EEPE), ADDR(EECR), _BV(EERIE), false);
+    host_irq_sources[22].flag_clear = true; /* EEPROM ready */
+}
+
+/*
+ * avr-libc stdio streams
+ */
+
+struct host_dev {
+    int (*put)(char, FILE *);
+    int (*get)(FILE *);
+    FILE *stream;
+};
+
+static
+ssize_t host_dev_write(void *cookie, const char *buf, size_t size)
+{
+    struct host_dev *dev = cookie;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        if (dev->put(buf[i], dev->stream) != 0)
+        {
+            return (i > 0) ? (ssize_t)i : -1;
+        }
+    }
+    return size;
+}
+
+static
+ssize_t host_dev_read(void *cookie, char *buf, size_t size)
+{
+    struct host_dev *dev = cookie;
+    int c;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    c = dev->get(dev->stream);
+    if (c < 0)
+    {
+        return 0; /* EOF */
+    }
+    buf[0] = c;
+    return 1;
+}
+
+FILE *fdevopen(int (*put)(char, FILE *), int (*get)(FILE *))
+{
+    struct host_dev *dev;
+    cookie_io_functions_t funcs = {
+        .read = get ? host_dev_read : NULL,
+        .write = put ? host_dev_write : NULL,
+        .seek = NULL,
+        .close = NULL,
+    };
+
+    dev = calloc(1, sizeof(*dev));
+    if (dev == NULL)
+    {
+        return NULL;
+    }
+    dev->put = put;
+    dev->get = get;
+    dev->stream = fopencookie(dev, (put && get) ? "r+" : (put ? "w" : "r"), funcs);
+    if (dev->stream != NULL)
+    {
+        setvbuf(dev->stream, NULL, _IONBF, 0); /* unbuffered, like avr-libc */
+    }
+    host_last_fdev = dev->stream;
+    return dev->stream;
+}
+
+/* avr-libc %S prints a string in program memory: %s on the host */
+int host_printf_P(const char *fmt, ...)
+{
+    char conv[256];
+    size_t i;
+    va_list ap;
+    int n;
+
+    for (i = 0; (fmt[i] != '\0') && (i < sizeof(conv) - 1); i++)
+    {
+        conv[i] = fmt[i];
+        if (fmt[i] == '%')
+        {
+            /* flags and width, then the conversion */
+            while ((fmt[i + 1] != '\0') && (i < sizeof(conv) - 2)
+                    && (strchr("-+ #0123456789.", fmt[i + 1]) != NULL))
+            {
+                i++;
+                conv[i] = fmt[i];
+            }
+            if (fmt[i + 1] == 'S')
+            {
+                i++;
+                conv[i] = 's';
+            }
+            else if (fmt[i + 1] == '%')
+            {
+                i++;
+                conv[i] = '%';
+            }
+        }
+    }
+    conv[i] = '\0';
+    va_start(ap, fmt);
+    n = vprintf(conv, ap);
+    va_end(ap);
+    return n;
+}
+
+/* Before the drivers' constructors. The attribute is ignored on a
+ * definition following a declaration, hence the wrapper.
+ */
+__attribute__((constructor(101)))
+static
+void host_init(void)
+{
+    host_eeprom_erase(); /* as shipped */
+    host_reset();
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_HW_H
+#define HOST_HW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Simulated ATmega328P peripherals for the host build.
+ *
+ * Registers live in host_io[] at their data memory addresses. Every
+ * access from driver code first calls host_reg8()/host_reg16(), which:
+ * - advances the simulated clock by host_access_cycles,
+ * - runs the access hook of the register, if any,
+ * - services pending interrupts, if enabled in SREG.
+ * A hook cannot tell reads from writes, so the models resolve side
+ * effects lazily, at the next access of a related register:
+ *
+ * SPI: a write to SPDR starts a transfer, completed at the next SPSR
+ *   access, which sets SPIF; the byte read back from SPDR is the one
+ *   returned by the attached device (0xFF if none).
+ * USART0: transmission is instantaneous (UDRE0 and TXC0 always set),
+ *   bytes go to a TX log. Queued RX bytes appear in UDR0 with RXC0,
+ *   one per 8N1 frame time at the baud rate set by UBRR0 and U2X0.
+ *   In master SPI mode the attached device gets the bytes instead,
+ *   each taking 16 * (UBRR0 + 1) cycles; UDR0 holds the next byte
+ *   while one is shifted, and up to 2 received bytes. With RXC0 set, an
+ *   access leaving UDR0 unchanged is taken as a read.
+ * ADC: a conversion takes 13 ADC clocks (25 for the first after
+ *   enabling), started by ADSC, auto-triggered by free running or a
+ *   timer flag selected by ADTS, or by ADC Noise Reduction sleep. Input
+ *   values come from host_adc_input[] or a callback. Polling ADCSRA
+ *   during a single conversion waits for its end.
+ * Timers: Timer0/1/2 count in normal, CTC and fast PWM modes (phase
+ *   correct modes count as fast PWM) and set their TIFR flags.
+ * EEPROM: EERE reads EEDR at once; EEPE within 4 cycles of EEMPE
+ *   programs a byte in 3.4ms (1.8ms for erase or write only modes),
+ *   with EEPE set meanwhile. EE_READY is pending while EEPE is clear.
+ *   Polling EECR during programming waits for its
+ *   end. Contents and wear survive host_reset(), like a power cycle.
+ * GPIO: PINx reflects PORTx on outputs, and driven levels or pull-ups
+ *   on inputs. Pin changes set PCIFR according to PCMSKx.
+ * Sleep: sleep_cpu() lets time pass until an interrupt is pending;
+ *   timers stop in modes other than Idle. The CPU then waits for the
+ *   oscillator start-up, host_startup_cycles in Power-down and
+ *   Power-save, 6 in Standby, and 4 more halted cycles, before the
+ *   interrupt is serviced.
+ * PRR: gated timers stop counting; enabling the ADC, or starting an
+ *   SPI or USART0 transfer, while gated is fatal.
+ *
+ * Interrupt flags in TIFRx, PCIFR, EIFR and ADCSRA are cleared by
+ * writing one, or on interrupt dispatch. Status bits of UCSR0A and
+ * SPSR are read-only.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Simulated CPU cycles since host_reset() */
+extern uint64_t host_cycles;
+
+/* Cycles added by every register access (default 1). */
+extern uint32_t host_access_cycles;
+
+/* Clear the register file and all model state. */
+extern void host_reset(void);
+
+/* Apply the side effects of the last register access; called by all
+ * the functions below, needed only when peeking at host_io[] directly.
+ */
+extern void host_commit(void);
+
+/* Let simulated time pass, servicing interrupts on the way. */
+extern void host_advance(uint64_t cycles);
+
+/* Number of times an interrupt vector was serviced since reset. */
+extern uint32_t host_irq_count(uint8_t vector);
+
+/* Called before every access to the register at addr */
+typedef void (*host_hook_fn)(uint8_t addr);
+extern void host_hook_set(uint8_t addr, host_hook_fn hook);
+
+/* Called while sleeping, before checking for interrupts; it can drive
+ * pins or queue RX bytes to wake up the CPU.
+ */
+extern void (*host_sleep_hook)(void);
+
+/* Start-up time from Power-down and Power-save, as set by the fuses
+ * (default 16K CK, as on the Arduino Uno).
+ */
+extern uint32_t host_startup_cycles;
+
+/* SPI device: gets MOSI, returns MISO */
+typedef uint8_t (*host_spi_xfer_fn)(void *ctx, uint8_t mosi);
+extern void host_spi_attach(host_spi_xfer_fn xfer, void *ctx);
+extern uint32_t host_spi_count(void);
+
+/* USART0 */
+extern void host_usart_rx_push(const void *data, size_t len);
+extern size_t host_usart_tx_take(void *dst, size_t max_len); /* dst NULL discards */
+extern bool host_usart_tx_echo; /* also copy TX bytes to stdout */
+extern void host_usart_spi_attach(host_spi_xfer_fn xfer, void *ctx);
+extern uint32_t host_usart_spi_count(void); /* bytes in master SPI mode */
+
+/* ADC inputs, 0..1023, indexed by MUX3:0 */
+extern uint16_t host_adc_input[16];
+extern uint16_t (*host_adc_read)(uint8_t mux);
+extern uint32_t host_adc_conversions(void);
+
+/* EEPROM contents, erased (0xFF) at start-up */
+extern uint8_t host_eeprom[1024]; /* E2END + 1 */
+extern void host_eeprom_erase(void); /* also clears the wear counts */
+extern uint32_t host_eeprom_wear(uint16_t addr); /* bytes programmed there */
+extern uint32_t host_eeprom_reads(void); /* since host_reset() */
+
+/* GPIO, port is 'B', 'C' or 'D' */
+extern void host_gpio_drive(char port, uint8_t bit, bool level);
+extern void host_gpio_release(char port, uint8_t bit);
+extern bool host_gpio_out(char port, uint8_t bit);
+
+/* Stream returned by the last fdevopen() */
+extern FILE *host_last_fdev;
+
+/* Abort the test program with a message */
+extern void host_fatal(const char *fmt, ...)
+    __attribute__((noreturn, format(printf, 1, 2)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_HW_H */
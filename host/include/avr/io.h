@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* <avr/io.h> for the host build.
+ *
+ * Every register access goes through host_reg8()/host_reg16(), which
+ * let the peripheral models in host/hw.c run before returning the
+ * address of the register in the simulated register file.
+ * The models themselves define HOST_HW_INTERNAL and access the
+ * register file directly.
+ */
+
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+
+#define HOST_IO_SIZE 0x100
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern uint8_t host_io[HOST_IO_SIZE];
+
+#ifdef HOST_HW_INTERNAL
+#  define _SFR_MEM8(addr) (host_io[(addr)])
+#  define _SFR_MEM16(addr) (*(uint16_t *)&host_io[(addr)])
+#else
+extern volatile uint8_t *host_reg8(uint8_t addr);
+extern volatile uint16_t *host_reg16(uint8_t addr);
+#  define _SFR_MEM8(addr) (*host_reg8(addr))
+#  define _SFR_MEM16(addr) (*host_reg16(addr))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#define _SFR_IO8(addr) _SFR_MEM8((addr) + 0x20)
+#define _SFR_IO16(addr) _SFR_MEM16((addr) + 0x20)
+
+#define _BV(bit) (1 << (bit))
+
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit) do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+#include <avr/iom328p.h>
+
+#endif /* _AVR_IO_H_ */
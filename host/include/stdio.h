@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* <stdio.h> for the host build: the C library one, plus the avr-libc
+ * fdevopen() implemented in host/hw.c on top of fopencookie().
+ * Unlike avr-libc it does not replace stdin/stdout/stderr, so that
+ * printf() still reaches the terminal.
+ */
+
+#ifndef HOST_STDIO_H
+#define HOST_STDIO_H
+
+#include_next <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern FILE *fdevopen(int (*put)(char, FILE *), int (*get)(FILE *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_STDIO_H */
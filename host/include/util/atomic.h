@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UTIL_ATOMIC_H_
+#define _UTIL_ATOMIC_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+/* Same semantics as avr-libc: SREG is saved at the start of the block
+ * and restored by a cleanup handler, including on return or break.
+ */
+
+static __inline__ uint8_t host_atomic_cli(void)
+{
+    SREG &= ~_BV(SREG_I);
+    return 1;
+}
+
+static __inline__ uint8_t host_atomic_sei(void)
+{
+    SREG |= _BV(SREG_I);
+    return 1;
+}
+
+static __inline__ void host_atomic_restore(const uint8_t *sreg_save)
+{
+    SREG = *sreg_save;
+}
+
+static __inline__ void host_atomic_forceon(const uint8_t *sreg_save)
+{
+    (void)sreg_save;
+    SREG |= _BV(SREG_I);
+}
+
+static __inline__ void host_atomic_forceoff(const uint8_t *sreg_save)
+{
+    (void)sreg_save;
+    SREG &= ~_BV(SREG_I);
+}
+
+#define ATOMIC_RESTORESTATE \
+    uint8_t sreg_save __attribute__((__cleanup__(host_atomic_restore))) = SREG
+#define ATOMIC_FORCEON \
+    uint8_t sreg_save __attribute__((__cleanup__(host_atomic_forceon))) = 0
+#define NONATOMIC_RESTORESTATE ATOMIC_RESTORESTATE
+#define NONATOMIC_FORCEOFF \
+    uint8_t sreg_save __attribute__((__cleanup__(host_atomic_forceoff))) = 0
+
+#define ATOMIC_BLOCK(type) \
+    for (type, host_atomic_done = host_atomic_cli(); \
+            host_atomic_done; host_atomic_done = 0)
+
+#define NONATOMIC_BLOCK(type) \
+    for (type, host_atomic_done = host_atomic_sei(); \
+            host_atomic_done; host_atomic_done = 0)
+
+#endif /* _UTIL_ATOMIC_H_ */
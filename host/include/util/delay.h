@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UTIL_DELAY_H_
+#define _UTIL_DELAY_H_
+
+#ifndef F_CPU
+#  error "F_CPU must be defined for <util/delay.h>"
+#endif
+
+/* Busy waits only advance the simulated time, see host/hw.h. */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void host_delay_cycles(double cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define _delay_us(us) host_delay_cycles((double)(us) * (F_CPU / 1e6))
+#define _delay_ms(ms) host_delay_cycles((double)(ms) * (F_CPU / 1e3))
+
+#endif /* _UTIL_DELAY_H_ */
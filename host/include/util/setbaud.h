@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UTIL_SETBAUD_H_
+#define _UTIL_SETBAUD_H_
+
+/* Same computation as avr-libc <util/setbaud.h>: normal speed unless
+ * the baud rate error exceeds BAUD_TOL percent, then double speed.
+ */
+
+#ifndef F_CPU
+#  error "F_CPU must be defined for <util/setbaud.h>"
+#endif
+#ifndef BAUD
+#  error "BAUD must be defined for <util/setbaud.h>"
+#endif
+#ifndef BAUD_TOL
+#  define BAUD_TOL 2
+#endif
+
+#undef UBRR_VALUE
+#undef UBRRL_VALUE
+#undef UBRRH_VALUE
+#undef USE_2X
+
+#define UBRR_VALUE (((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+
+#if (100 * (F_CPU) > (16 * ((UBRR_VALUE) + 1)) * (100 * (BAUD) + (BAUD) * (BAUD_TOL))) \
+    || (100 * (F_CPU) < (16 * ((UBRR_VALUE) + 1)) * (100 * (BAUD) - (BAUD) * (BAUD_TOL)))
+#  define USE_2X 1
+#  undef UBRR_VALUE
+#  define UBRR_VALUE (((F_CPU) + 4UL * (BAUD)) / (8UL * (BAUD)) - 1UL)
+#else
+#  define USE_2X 0
+#endif
+
+#define UBRRL_VALUE (UBRR_VALUE & 0xff)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+
+#endif /* _UTIL_SETBAUD_H_ */
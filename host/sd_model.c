@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "hw.h"
+#include "sd_model.h"
+
+#define R1_IDLE 0x01
+#define R1_ILLEGAL_COMMAND 0x04
+#define R1_ADDRESS_ERROR 0x20
+#define R1_PARAMETER_ERROR 0x40
+
+#define TOKEN_START_BLOCK 0xFE
+#define TOKEN_START_MULTI 0xFC
+#define TOKEN_STOP_TRAN 0xFD
+#define TOKEN_OUT_OF_RANGE 0x08
+
+#define DATA_ACCEPTED 0x05
+#define DATA_WRITE_ERROR 0x0D
+
+static
+uint16_t crc16_ccitt(const uint8_t *data, uint16_t len)
+{
+    uint16_t crc = 0;
+
+    while (len-- > 0)
+    {
+        uint8_t i;
+
+        crc ^= (uint16_t)*data++ << 8;
+        for (i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static
+void resp_push(struct sd_model *m, uint8_t b)
+{
+    if (m->resp_len < SD_MODEL_RESP_MAX)
+    {
+        m->resp[m->resp_len++] = b;
+    }
+}
+
+static
+uint8_t r1(const struct sd_model *m, uint8_t errors)
+{
+    return (m->idle ? R1_IDLE : 0) | errors;
+}
+
+static
+void resp_r1(struct sd_model *m, uint8_t errors)
+{
+    resp_push(m, 0xFF); /* NCR */
+    resp_push(m, r1(m, errors));
+}
+
+static
+bool cmd_lba(struct sd_model *m, uint32_t arg, uint32_t *lba)
+{
+    if (!m->high_capacity && (arg % SD_MODEL_BLOCK) != 0)
+    {
+        resp_r1(m, R1_ADDRESS_ERROR);
+        return false;
+    }
+    *lba = m->high_capacity ? arg : (arg / SD_MODEL_BLOCK);
+    resp_r1(m, 0);
+    return true;
+}
+
+/* Latency, start token, data and CRC of block lba */
+static
+void resp_block(struct sd_model *m, uint32_t lba)
+{
+    uint8_t i;
+    uint16_t crc;
+    const uint8_t *block;
+
+    for (i = 0; i < m->read_latency; i++)
+    {
+        resp_push(m, 0xFF);
+    }
+    if (lba >= m->n_blocks)
+    {
+        resp_push(m, TOKEN_OUT_OF_RANGE);
+        m->state = SD_MODEL_CMD;
+        return;
+    }
+    block = &m->image[lba * SD_MODEL_BLOCK];
+    resp_push(m, TOKEN_START_BLOCK);
+    memcpy(&m->resp[m->resp_len], block, SD_MODEL_BLOCK);
+    m->resp_len += SD_MODEL_BLOCK;
+    crc = crc16_ccitt(block, SD_MODEL_BLOCK);
+    resp_push(m, crc >> 8);
+    resp_push(m, crc & 0xFF);
+    m->n_blocks_read++;
+}
+
+static
+void busy_start(struct sd_model *m, uint32_t cycles, enum sd_model_state next)
+{
+    m->state = SD_MODEL_BUSY;
+    m->busy_next = next;
+    m->busy_until = host_cycles + cycles;
+}
+
+static
+void cmd_read_block(struct sd_model *m, uint32_t arg)
+{
+    uint32_t lba;
+
+    if (cmd_lba(m, arg, &lba))
+    {
+        resp_block(m, lba);
+    }
+}
+
+static
+void cmd_read_multi(struct sd_model *m, uint32_t arg)
+{
+    if (cmd_lba(m, arg, &m->lba))
+    {
+        m->state = SD_MODEL_READ_MULTI;
+        resp_block(m, m->lba++);
+    }
+}
+
+static
+void cmd_write(struct sd_model *m, uint32_t arg, bool multi)
+{
+    if (cmd_lba(m, arg, &m->lba))
+    {
+        m->state = SD_MODEL_WRITE;
+        m->multi = multi;
+    }
+}
+
+/* Register as a data block, after the response */
+static
+void resp_register(struct sd_model *m, const uint8_t *reg, uint8_t len)
+{
+    uint16_t crc;
+
+    resp_push(m, 0xFF);
+    resp_push(m, TOKEN_START_BLOCK);
+    memcpy(&m->resp[m->resp_len], reg, len);
+    m->resp_len += len;
+    crc = crc16_ccitt(reg, len);
+    resp_push(m, crc >> 8);
+    resp_push(m, crc & 0xFF);
+}
+
+/* Bits msb..lsb of a register of len bytes, MSB first */
+static
+void reg_set(uint8_t *reg, uint8_t len, uint16_t msb, uint16_t lsb, uint32_t v)
+{
+    uint16_t bit;
+
+    for (bit = lsb; bit <= msb; bit++, v >>= 1)
+    {
+        uint8_t *byte = &reg[len - 1 - (bit / 8)];
+
+        *byte = (*byte & ~(1U << (bit % 8))) | ((v & 1) << (bit % 8));
+    }
+}
+
+static
+void cmd_send_csd(struct sd_model *m)
+{
+    uint8_t csd[16];
+
+    memset(csd, 0, sizeof(csd));
+    if (m->high_capacity)
+    {
+        reg_set(csd, 16, 127, 126, 1); /* CSD 2.0 */
+        reg_set(csd, 16, 83, 80, 9);
+        reg_set(csd, 16, 69, 48, ((m->n_blocks + 1023) >> 10) - 1); /* 512kB units */
+    }
+    else
+    {
+        uint8_t mult;
+
+        /* n_blocks = (C_SIZE + 1) << (C_SIZE_MULT + 2) */
+        for (mult = 0; (mult < 7) && ((m->n_blocks >> (mult + 2)) > 4096); mult++)
+        {
+        }
+        reg_set(csd, 16, 83, 80, 9); /* READ_BL_LEN */
+        reg_set(csd, 16, 73, 62, (m->n_blocks >> (mult + 2)) - 1);
+        reg_set(csd, 16, 49, 47, mult);
+    }
+    reg_set(csd, 16, 0, 0, 1);
+    resp_r1(m, 0);
+    resp_register(m, csd, sizeof(csd));
+}
+
+static
+void cmd_sd_status(struct sd_model *m)
+{
+    uint8_t status[64];
+
+    memset(status, 0, sizeof(status));
+    reg_set(status, 64, 431, 428, m->au_size);
+    reg_set(status, 64, 423, 408, m->erase_size);
+    reg_set(status, 64, 407, 402, m->erase_timeout);
+    reg_set(status, 64, 401, 400, 1); /* ERASE_OFFSET */
+    resp_r1(m, 0);
+    resp_push(m, 0x00); /* R2 */
+    resp_register(m, status, sizeof(status));
+}
+
+static
+void cmd_erase(struct sd_model *m)
+{
+    uint32_t first;
+    uint32_t last;
+
+    first = m->high_capacity ? m->erase_start : (m->erase_start / SD_MODEL_BLOCK);
+    last = m->high_capacity ? m->erase_end : (m->erase_end / SD_MODEL_BLOCK);
+    if ((first > last) || (last >= m->n_blocks))
+    {
+        resp_r1(m, R1_PARAMETER_ERROR);
+        return;
+    }
+    memset(&m->image[first * SD_MODEL_BLOCK], 0x00, (last - first + 1) * SD_MODEL_BLOCK);
+    m->n_erases++;
+    m->n_blocks_erased += last - first + 1;
+    resp_r1(m, 0);
+    busy_start(m, m->erase_busy_cycles, SD_MODEL_CMD);
+}
+
+static
+void cmd_stop(struct sd_model *m)
+{
+    resp_push(m, 0xFF); /* stuff byte */
+    resp_r1(m, 0);
+    if (m->state == SD_MODEL_READ_MULTI)
+    {
+        busy_start(m, m->stop_busy_cycles, SD_MODEL_CMD);
+    }
+}
+
+/* Start token received in SD_MODEL_WRITE */
+static
+void write_token(struct sd_model *m, uint8_t token)
+{
+    if (token == (m->multi ? TOKEN_START_MULTI : TOKEN_START_BLOCK))
+    {
+        m->state = SD_MODEL_WRITE_DATA;
+        m->data_len = 0;
+    }
+    else if (m->multi && (token == TOKEN_STOP_TRAN))
+    {
+        m->resp_len = 0;
+        m->resp_pos = 0;
+        resp_push(m, 0xFF); /* busy one byte after the token */
+        busy_start(m, m->stop_busy_cycles, SD_MODEL_CMD);
+    }
+}
+
+/* Data block and CRC received: program the block */
+static
+void write_block(struct sd_model *m)
+{
+    uint32_t busy;
+
+    m->resp_len = 0;
+    m->resp_pos = 0;
+    if (m->lba >= m->n_blocks)
+    {
+        resp_push(m, DATA_WRITE_ERROR);
+        m->state = m->multi ? SD_MODEL_WRITE : SD_MODEL_CMD;
+        return;
+    }
+    memcpy(&m->image[m->lba * SD_MODEL_BLOCK], m->data, SD_MODEL_BLOCK);
+    m->lba++;
+    m->n_blocks_written++;
+    resp_push(m, DATA_ACCEPTED);
+    busy = m->write_busy_cycles;
+    if ((m->write_slow_every != 0) && ((m->n_blocks_written % m->write_slow_every) == 0))
+    {
+        busy = m->write_slow_cycles;
+    }
+    busy_start(m, busy, m->multi ? SD_MODEL_WRITE : SD_MODEL_CMD);
+}
+
+static
+void cmd_execute(struct sd_model *m)
+{
+    uint8_t cmd;
+    uint32_t arg;
+    bool app_cmd;
+
+    cmd = m->cmd[0] & 0x3F;
+    arg = ((uint32_t)m->cmd[1] << 24) | ((uint32_t)m->cmd[2] << 16)
+        | ((uint32_t)m->cmd[3] << 8) | m->cmd[4];
+    app_cmd = m->app_cmd;
+    m->app_cmd = false;
+    m->resp_len = 0;
+    m->resp_pos = 0;
+    m->n_cmds++;
+    if (m->state == SD_MODEL_READ_MULTI)
+    {
+        if (cmd == 12)
+        {
+            cmd_stop(m);
+        }
+        /* other commands are ignored while sending data */
+        return;
+    }
+
+    if (app_cmd && (cmd == 13))
+    {
+        cmd_sd_status(m);
+        return;
+    }
+    if (app_cmd && (cmd == 41))
+    {
+        if (m->init_polls > 0)
+        {
+            m->init_polls--;
+        }
+        else
+        {
+            m->idle = false;
+        }
+        resp_r1(m, 0);
+        return;
+    }
+    switch (cmd)
+    {
+        case 0:
+            m->idle = true;
+            resp_r1(m, 0);
+            break;
+        case 8:
+            resp_r1(m, 0);
+            resp_push(m, 0x00);
+            resp_push(m, 0x00);
+            resp_push(m, (arg >> 8) & 0x0F); /* voltage accepted */
+            resp_push(m, arg & 0xFF); /* check pattern */
+            break;
+        case 13:
+            resp_r1(m, 0);
+            resp_push(m, 0x00);
+            break;
+        case 9:
+            cmd_send_csd(m);
+            break;
+        case 12:
+            cmd_stop(m);
+            break;
+        case 17:
+            cmd_read_block(m, arg);
+            break;
+        case 18:
+            cmd_read_multi(m, arg);
+            break;
+        case 24:
+            cmd_write(m, arg, false);
+            break;
+        case 25:
+            m->n_write_multi++;
+            cmd_write(m, arg, true);
+            break;
+        case 32:
+            m->erase_start = arg;
+            resp_r1(m, 0);
+            break;
+        case 33:
+            m->erase_end = arg;
+            resp_r1(m, 0);
+            break;
+        case 38:
+            cmd_erase(m);
+            break;
+        case 55:
+            m->app_cmd = true;
+            resp_r1(m, 0);
+            break;
+        case 58:
+            resp_r1(m, 0);
+            resp_push(m, (m->idle ? 0x00 : 0x80) | (m->high_capacity ? 0x40 : 0x00));
+            resp_push(m, 0xFF); /* 2.7V to 3.6V */
+            resp_push(m, 0x80);
+            resp_push(m, 0x00);
+            break;
+        default:
+            resp_r1(m, R1_ILLEGAL_COMMAND);
+            break;
+    }
+}
+
+static
+uint8_t resp_next(struct sd_model *m)
+{
+    if (m->resp_pos < m->resp_len)
+    {
+        return m->resp[m->resp_pos++];
+    }
+    return 0xFF;
+}
+
+uint8_t sd_model_xfer(void *ctx, uint8_t mosi)
+{
+    struct sd_model *m = ctx;
+
+    if (host_gpio_out(m->cs_port, m->cs_bit)) /* SD_CS high: not selected */
+    {
+        m->cmd_len = 0;
+        return 0xFF;
+    }
+    if (m->state == SD_MODEL_BUSY)
+    {
+        if ((m->resp_pos < m->resp_len) || (host_cycles < m->busy_until))
+        {
+            if (m->resp_pos < m->resp_len)
+            {
+                return m->resp[m->resp_pos++];
+            }
+            m->n_busy_polls++;
+            return 0x00;
+        }
+        m->state = m->busy_next;
+    }
+    switch (m->state)
+    {
+        case SD_MODEL_WRITE:
+            if (mosi != 0xFF)
+            {
+                write_token(m, mosi);
+                return 0xFF;
+            }
+            return resp_next(m);
+        case SD_MODEL_WRITE_DATA:
+            m->data[m->data_len++] = mosi;
+            if (m->data_len == sizeof(m->data))
+            {
+                write_block(m);
+            }
+            return 0xFF;
+        default:
+            break;
+    }
+    if (m->cmd_len == 0)
+    {
+        if ((mosi & 0xC0) == 0x40)
+        {
+            /* start of a new command aborts any response */
+            if (m->state != SD_MODEL_READ_MULTI)
+            {
+                m->resp_len = 0;
+                m->resp_pos = 0;
+            }
+            m->cmd[m->cmd_len++] = mosi;
+        }
+        else if (m->resp_pos < m->resp_len)
+        {
+            return m->resp[m->resp_pos++];
+        }
+        else if (m->state == SD_MODEL_READ_MULTI)
+        {
+            m->resp_len = 0;
+            m->resp_pos = 0;
+            resp_block(m, m->lba++);
+            return resp_next(m);
+        }
+        return 0xFF;
+    }
+    m->cmd[m->cmd_len++] = mosi;
+    if (m->cmd_len == sizeof(m->cmd))
+    {
+        m->cmd_len = 0;
+        cmd_execute(m);
+    }
+    return 0xFF;
+}
+
+void sd_model_init(struct sd_model *m, void *image, uint32_t n_blocks, bool high_capacity)
+{
+    memset(m, 0, sizeof(*m));
+    m->image = image;
+    m->n_blocks = n_blocks;
+    m->high_capacity = high_capacity;
+    m->cs_port = 'D';
+    m->cs_bit = 4;
+    m->idle = true;
+    m->init_polls = 3;
+    m->read_latency = 2;
+    m->write_busy_cycles = F_CPU / 4000; /* 250us */
+    m->write_slow_cycles = F_CPU / 200; /* 5ms */
+    m->stop_busy_cycles = F_CPU / 20000; /* 50us */
+    m->erase_busy_cycles = F_CPU / 100; /* 10ms */
+    m->au_size = 1; /* 16kB */
+    m->erase_size = 2;
+    m->erase_timeout = 1;
+}
+
+void sd_model_attach(struct sd_model *m, void *image, uint32_t n_blocks, bool high_capacity)
+{
+    sd_model_init(m, image, n_blocks, high_capacity);
+    host_spi_attach(sd_model_xfer, m);
+}
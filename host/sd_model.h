@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_SD_MODEL_H
+#define HOST_SD_MODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* SD card in SPI mode, attached to the SPI model of hw.h and selected
+ * by SD_CS (PD4 by default) low. Blocks are kept in a caller-provided
+ * image.
+ *
+ * Writes keep the card busy (MISO low) for write_busy_cycles of
+ * simulated time per block, write_slow_cycles every write_slow_every
+ * blocks, like a card erasing or moving data in the background.
+ */
+
+#define SD_MODEL_BLOCK 512
+#define SD_MODEL_RESP_MAX (SD_MODEL_BLOCK + 16)
+
+enum sd_model_state {
+    SD_MODEL_CMD, /* commands and their responses */
+    SD_MODEL_READ_MULTI, /* CMD18: data blocks until CMD12 */
+    SD_MODEL_WRITE, /* CMD24/CMD25: waiting for a start token */
+    SD_MODEL_WRITE_DATA, /* receiving a data block */
+    SD_MODEL_BUSY, /* programming, then back to busy_next */
+};
+
+struct sd_model {
+    uint8_t *image;
+    uint32_t n_blocks;
+    bool high_capacity;
+    char cs_port; /* SD_CS pin */
+    uint8_t cs_bit;
+    uint16_t init_polls; /* ACMD41 answers "busy" this many times */
+    uint8_t read_latency; /* 0xFF bytes before the data token */
+    uint32_t write_busy_cycles;
+    uint32_t write_slow_cycles;
+    uint32_t write_slow_every; /* 0 for never */
+    uint32_t stop_busy_cycles; /* after CMD12 and the stop token */
+    uint32_t erase_busy_cycles; /* CMD38 */
+    uint8_t au_size; /* SD Status AU_SIZE code, 1 for 16kB */
+    uint16_t erase_size; /* SD Status ERASE_SIZE, in AUs */
+    uint8_t erase_timeout; /* SD Status ERASE_TIMEOUT, in s */
+
+    /* state */
+    bool idle;
+    bool app_cmd;
+    uint8_t cmd[6];
+    uint8_t cmd_len;
+    uint8_t resp[SD_MODEL_RESP_MAX];
+    uint16_t resp_len;
+    uint16_t resp_pos;
+    enum sd_model_state state;
+    enum sd_model_state busy_next;
+    uint64_t busy_until; /* host_cycles */
+    bool multi; /* CMD18/CMD25 in progress */
+    uint32_t lba; /* next block of the data transfer */
+    uint8_t data[SD_MODEL_BLOCK + 2]; /* with the CRC */
+    uint16_t data_len;
+    uint32_t erase_start; /* CMD32 */
+    uint32_t erase_end; /* CMD33 */
+
+    /* statistics */
+    uint32_t n_cmds;
+    uint32_t n_blocks_read;
+    uint32_t n_blocks_written;
+    uint32_t n_busy_polls; /* bytes answered while busy */
+    uint32_t n_write_multi; /* CMD25 */
+    uint32_t n_erases;
+    uint32_t n_blocks_erased;
+};
+
+extern void sd_model_init(struct sd_model *m, void *image, uint32_t n_blocks, bool high_capacity);
+
+/* host_spi_xfer_fn, ctx is the struct sd_model */
+extern uint8_t sd_model_xfer(void *ctx, uint8_t mosi);
+
+/* Initialize and attach to the SPI bus */
+extern void sd_model_attach(struct sd_model *m, void *image, uint32_t n_blocks, bool high_capacity);
+
+#endif /* HOST_SD_MODEL_H */
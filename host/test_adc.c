@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "check.h"
+#include "hw.h"
+#include "adc.h"
+
+#define MS(ms) ((uint64_t)(ms) * (F_CPU / 1000UL))
+
+#define DECIMATED(x) (((uint32_t)(x) << (2 * ADC_OVERSAMPLE_BITS)) >> ADC_OVERSAMPLE_BITS)
+
+static
+void test_triggered(void)
+{
+    host_adc_input[0] = 512;
+    sei();
+    adc_start(ADC_REF_AVCC | ADC_MUX_ADC(0), 1000);
+    CHECK_EQ(TCCR1B & _BV(WGM12), _BV(WGM12)); /* Timer1 CTC */
+    CHECK_EQ(ADCSRB & 0x07, _BV(ADTS2) | _BV(ADTS0)); /* compare B */
+    host_advance(MS(100));
+    /* 1000 conversions per second, one discarded */
+    CHECK(host_adc_conversions() >= 99);
+    CHECK(host_adc_conversions() <= 101);
+    CHECK_EQ(adc_get_seq(0), (host_adc_conversions() - 1) / (1 << (2 * ADC_OVERSAMPLE_BITS)));
+    CHECK_EQ(adc_get_latest(0), DECIMATED(512));
+    CHECK_EQ(adc_get_filtered(0), DECIMATED(512));
+    adc_stop();
+    CHECK(!(ADCSRA & _BV(ADEN)));
+    CHECK_EQ(TCCR1B & 0x07, 0);
+}
+
+static uint16_t dither;
+
+static
+uint16_t read_dithered(uint8_t mux)
+{
+    (void)mux;
+    dither ^= 1;
+    return 511 + dither; /* 511.5 on average */
+}
+
+static
+void test_oversampling_resolution(void)
+{
+    host_adc_read = read_dithered;
+    sei();
+    adc_start(ADC_MUX_ADC(0), ADC_FREE_RUNNING);
+    host_advance(MS(20));
+    CHECK_EQ(adc_get_latest(0), (5115UL << ADC_OVERSAMPLE_BITS) / 10);
+    adc_stop();
+}
+
+static
+void test_free_running_rate(void)
+{
+    uint32_t n;
+
+    sei();
+    adc_start(ADC_MUX_ADC(0), ADC_FREE_RUNNING);
+    host_advance(MS(100));
+    n = host_adc_conversions();
+    /* 125kHz / 13 = 9615 conversions per second */
+    CHECK(n >= 960);
+    CHECK(n <= 962);
+    adc_stop();
+}
+
+/* Timer1 may be someone else's when it is not the trigger */
+static
+void test_free_running_timer1(void)
+{
+    sei();
+    TCCR1A = 0;
+    OCR1B = 100;
+    TCCR1B = _BV(CS10); /* normal mode, no interrupt */
+    adc_start(ADC_MUX_ADC(0), ADC_FREE_RUNNING);
+    host_advance(MS(10));
+    CHECK(host_adc_conversions() > 10);
+    CHECK(TIFR1 & _BV(OCF1B)); /* not cleared by the ADC ISR */
+    adc_stop();
+    CHECK_EQ(TCCR1B, _BV(CS10));
+}
+
+static
+void test_filter(void)
+{
+    sei();
+    host_adc_input[0] = 0;
+    adc_start(ADC_MUX_ADC(0), ADC_FREE_RUNNING);
+    host_advance(MS(10));
+    CHECK_EQ(adc_get_filtered(0), 0);
+    host_adc_input[0] = 1000;
+    host_advance(MS(4)); /* a couple of samples: step response */
+    CHECK(adc_get_filtered(0) > 0);
+    CHECK(adc_get_filtered(0) < adc_get_latest(0));
+    host_advance(MS(200));
+    CHECK(adc_get_filtered(0) >= DECIMATED(1000) - (1 << ADC_FILTER_SHIFT));
+    adc_stop();
+}
+
+static
+void test_scan(void)
+{
+    static const struct adc_channel_cfg cfg[2] = {
+        { ADC_MUX_ADC(1), 1, 1 },
+        { ADC_MUX_ADC(3), 2, 2 },
+    };
+    struct adc_sample samples[ADC_BUF_LEN];
+    uint8_t n;
+    uint8_t i;
+    uint8_t count[2] = { 0, 0 };
+
+    host_adc_input[1] = 100;
+    host_adc_input[3] = 900;
+    sei();
+    adc_scan_start(cfg, 2, 4000);
+    host_advance(MS(60));
+    CHECK_EQ(adc_get_latest(0), DECIMATED(100));
+    CHECK_EQ(adc_get_latest(1), DECIMATED(900));
+    /* channel 1 is sampled every other round */
+    n = adc_read_samples(samples, ADC_BUF_LEN);
+    CHECK(n > 2);
+    for (i = 0; i < n; i++)
+    {
+        CHECK(samples[i].ch < 2);
+        CHECK_EQ(samples[i].value, samples[i].ch ? DECIMATED(900) : DECIMATED(100));
+        count[samples[i].ch]++;
+    }
+    CHECK(count[0] >= 2 * count[1] - 1);
+    CHECK(count[0] <= 2 * count[1] + 2);
+    adc_stop();
+}
+
+static
+void test_read_sleep(void)
+{
+    uint64_t t;
+
+    host_adc_input[5] = 700;
+    sei();
+    t = host_cycles;
+    CHECK_EQ(adc_read_sleep(ADC_REF_AVCC | ADC_MUX_ADC(5)), DECIMATED(700));
+    t = host_cycles - t;
+    /* first conversion 25 ADC clocks, then 16 of 13 */
+    CHECK(t >= (25 + 16 * 13) * 128);
+    CHECK(t < (25 + 16 * 13) * 128 + 2000);
+    CHECK(!(ADCSRA & _BV(ADEN)));
+}
+
+int main(void)
+{
+    RUN(test_triggered);
+    RUN(test_oversampling_resolution);
+    RUN(test_free_running_rate);
+    RUN(test_free_running_timer1);
+    RUN(test_filter);
+    RUN(test_scan);
+    RUN(test_read_sleep);
+
+    return check_result();
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "check.h"
+#include "cmd.h"
+#include "hw.h"
+#include "sysclock.h"
+
+#define CHAR_CYCLES (10 * 8 * 35) /* 57600 baud, U2X0 */
+
+#define CMD_ID_ADD (CMD_ID_USER + 0) /* sums the data bytes */
+#define CMD_ID_SILENT (CMD_ID_USER + 1) /* no reply */
+#define CMD_ID_SLOW (CMD_ID_USER + 2) /* takes time, streams 3 * data[0] bytes */
+
+static const uint8_t *seen_data[4];
+static uint8_t n_seen;
+static uint8_t notified;
+static uint8_t reply[640];
+
+static
+uint8_t crc8(uint8_t crc, const uint8_t *p, size_t len)
+{
+    uint8_t bit;
+
+    while (len-- > 0)
+    {
+        crc ^= *p++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static
+void run_add(const uint8_t *data, uint8_t len)
+{
+    uint8_t sum;
+    uint8_t i;
+
+    if (n_seen < 4)
+    {
+        seen_data[n_seen++] = data;
+    }
+    sum = 0;
+    for (i = 0; i < len; i++)
+    {
+        sum += data[i];
+    }
+    cmd_reply(CMD_OK, &sum, 1);
+}
+
+static
+void run_silent(const uint8_t *data, uint8_t len)
+{
+    (void)data;
+    (void)len;
+}
+
+static
+void run_slow(const uint8_t *data, uint8_t len)
+{
+    uint16_t i;
+    uint8_t b;
+
+    (void)len;
+    host_advance(5000);
+    cmd_reply_begin(CMD_OK, 3 * data[0]);
+    for (i = 0; i < 3 * data[0]; i++)
+    {
+        b = i;
+        cmd_reply_data(&b, 1);
+    }
+    cmd_reply_end();
+}
+
+static const struct cmd_handler handlers[] = {
+    { CMD_ID_ADD, run_add },
+    { CMD_ID_SILENT, run_silent },
+    { CMD_ID_SLOW, run_slow },
+};
+
+static
+void notify(void)
+{
+    notified++;
+}
+
+static
+void setup(void)
+{
+    sysclock_init();
+    cmd_init(handlers, sizeof(handlers) / sizeof(handlers[0]), notify);
+    sei();
+    n_seen = 0;
+    notified = 0;
+}
+
+/* Queue a request, corrupted if crc_xor is not 0 */
+static
+void send(uint8_t id, uint8_t seq, const void *data, uint8_t len, uint8_t crc_xor)
+{
+    uint8_t frame[4 + 255 + 1];
+
+    frame[0] = CMD_SYNC;
+    frame[1] = id;
+    frame[2] = seq;
+    frame[3] = len;
+    memcpy(&frame[4], data, len);
+    frame[4 + len] = crc8(0, &frame[1], 3 + len) ^ crc_xor;
+    host_usart_rx_push(frame, 5 + len);
+}
+
+static
+void receive_all(void)
+{
+    host_advance(CHAR_CYCLES * 64);
+}
+
+/* Returns the reply data length, -1 if no valid reply */
+static
+int take_reply(uint8_t id, uint8_t seq, uint8_t status)
+{
+    size_t n;
+    uint16_t len;
+
+    n = host_usart_tx_take(reply, sizeof(reply));
+    if (n < 7)
+    {
+        return -1;
+    }
+    len = reply[4] | (reply[5] << 8);
+    CHECK_EQ(reply[0], CMD_SYNC);
+    CHECK_EQ(reply[1], id);
+    CHECK_EQ(reply[2], seq);
+    CHECK_EQ(reply[3], status);
+    CHECK_EQ(n, 7 + len);
+    CHECK_EQ(reply[6 + len], crc8(0, &reply[1], 5 + len));
+    memmove(reply, &reply[6], len);
+    return len;
+}
+
+static
+void test_ping(void)
+{
+    setup();
+    send(CMD_ID_PING, 7, "hello", 5, 0);
+    CHECK(!cmd_poll()); /* still receiving */
+    receive_all();
+    CHECK_EQ(notified, 1);
+    CHECK(cmd_poll());
+    CHECK(!cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_PING, 7, CMD_OK), 5);
+    CHECK(memcmp(reply, "hello", 5) == 0);
+}
+
+static
+void test_handlers(void)
+{
+    static const uint8_t abc[3] = { 1, 2, 3 };
+
+    setup();
+    send(CMD_ID_ADD, 1, abc, 3, 0);
+    receive_all();
+    CHECK(cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_ADD, 1, CMD_OK), 1);
+    CHECK_EQ(reply[0], 6);
+
+    send(CMD_ID_SILENT, 2, NULL, 0, 0);
+    receive_all();
+    CHECK(cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_SILENT, 2, CMD_OK), 0);
+
+    send(0x7F, 3, NULL, 0, 0);
+    receive_all();
+    CHECK(cmd_poll());
+    CHECK_EQ(take_reply(0x7F, 3, CMD_ERR_UNKNOWN), 0);
+}
+
+/* Handlers see the RX buffers themselves, used in turn */
+static
+void test_zero_copy(void)
+{
+    uint8_t i;
+
+    setup();
+    for (i = 0; i < 3; i++)
+    {
+        send(CMD_ID_ADD, i, &i, 1, 0);
+        receive_all();
+        CHECK(cmd_poll());
+    }
+    CHECK_EQ(n_seen, 3);
+    CHECK(seen_data[0] != seen_data[1]);
+    CHECK(seen_data[0] == seen_data[2]);
+    CHECK_EQ(seen_data[2][0], 2); /* the last request, in place */
+}
+
+static
+void test_errors(void)
+{
+    struct cmd_stats stats;
+    uint8_t big[CMD_RX_MAX + 1];
+
+    setup();
+    memset(big, 0, sizeof(big));
+    send(CMD_ID_ADD, 1, "\x01", 1, 0x10); /* bad CRC */
+    send(CMD_ID_ADD, 2, big, sizeof(big), 0); /* too long */
+    host_usart_rx_push("\x00\x55", 2); /* noise */
+    send(CMD_ID_ADD, 3, "\x05", 1, 0);
+    host_advance(CHAR_CYCLES * 100);
+    CHECK(cmd_poll());
+    CHECK(!cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_ADD, 3, CMD_OK), 1);
+    CHECK_EQ(reply[0], 5);
+    cmd_get_stats(&stats);
+    CHECK_EQ(stats.requests, 1);
+    CHECK_EQ(stats.crc_errors, 1);
+    CHECK(stats.overruns >= 1);
+}
+
+/* Two requests wait while the third one finds no free buffer */
+static
+void test_overrun(void)
+{
+    struct cmd_stats stats;
+    uint8_t i;
+
+    setup();
+    for (i = 0; i < 3; i++)
+    {
+        send(CMD_ID_ADD, i, &i, 1, 0);
+    }
+    receive_all();
+    CHECK(cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_ADD, 0, CMD_OK), 1);
+    CHECK(cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_ADD, 1, CMD_OK), 1);
+    CHECK(!cmd_poll());
+    cmd_get_stats(&stats);
+    CHECK_EQ(stats.overruns, 1);
+    CHECK_EQ(notified, 2);
+}
+
+static
+void test_latency(void)
+{
+    struct cmd_stats stats;
+    uint8_t n;
+
+    setup();
+    n = 200;
+    send(CMD_ID_SLOW, 9, &n, 1, 0);
+    receive_all();
+    host_advance(20000); /* the main loop is busy */
+    CHECK(cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_SLOW, 9, CMD_OK), 600);
+    CHECK_EQ(reply[599], 599 & 0xFF);
+
+    send(CMD_ID_STATS, 10, NULL, 0, 0);
+    receive_all();
+    CHECK(cmd_poll());
+    CHECK_EQ(take_reply(CMD_ID_STATS, 10, CMD_OK), 16);
+    cmd_get_stats(&stats);
+    CHECK_EQ(reply[0] | (reply[1] << 8), 1); /* before this request */
+    CHECK_EQ(stats.requests, 2);
+    CHECK(stats.latency_max >= 20000 + CHAR_CYCLES * 64 - CHAR_CYCLES * 6);
+    CHECK(stats.latency_max <= 20000 + CHAR_CYCLES * 64 + 1024);
+    CHECK(stats.handler_max >= 5000);
+    CHECK_EQ((uint32_t)reply[8] | ((uint32_t)reply[9] << 8)
+            | ((uint32_t)reply[10] << 16) | ((uint32_t)reply[11] << 24),
+            stats.latency_max);
+    cmd_stats_reset();
+    cmd_get_stats(&stats);
+    CHECK_EQ(stats.latency_max, 0);
+}
+
+int main(void)
+{
+    RUN(test_ping);
+    RUN(test_handlers);
+    RUN(test_zero_copy);
+    RUN(test_errors);
+    RUN(test_overrun);
+    RUN(test_latency);
+
+    return check_result();
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "check.h"
+#include "hw.h"
+#include "eestore.h"
+
+#define MS(ms) ((uint64_t)(ms) * (F_CPU / 1000UL))
+
+#define RING_ADDR 0x100
+#define RING_SLOTS 8
+#define COUNTER_SLOT_SIZE EESTORE_SLOT_SIZE(sizeof(uint32_t))
+
+static
+void setup(void)
+{
+    host_eeprom_erase();
+    sei();
+}
+
+static
+uint32_t reopen(uint8_t version)
+{
+    struct eestore s;
+    uint32_t v;
+
+    v = 0xDEADBEEF;
+    eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), version, &v);
+    return v;
+}
+
+static
+void test_empty(void)
+{
+    struct eestore s;
+    uint32_t v;
+
+    setup();
+    v = 42;
+    CHECK(!eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v));
+    CHECK_EQ(v, 42);
+    CHECK(!eestore_busy());
+}
+
+static
+void test_save_background(void)
+{
+    struct eestore s;
+    uint32_t v;
+    uint64_t t0;
+
+    setup();
+    v = 0;
+    eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v);
+    v = 0x12345678;
+    t0 = host_cycles;
+    eestore_save(&s, &v);
+    CHECK(host_cycles - t0 < 1000);
+    CHECK(eestore_busy());
+    v = 0; /* the copy is saved */
+
+    t0 = host_cycles;
+    eestore_flush();
+    CHECK(!eestore_busy());
+    CHECK(host_irq_count(22) > 0); /* EE_READY */
+    /* erased cells only need writing: 1.8ms per byte, 0xFF skipped */
+    CHECK(host_cycles - t0 < MS(8 * 1.9));
+    CHECK(host_cycles - t0 > MS(5 * 1.8));
+    CHECK(!(EECR & _BV(EERIE)));
+
+    CHECK_EQ(reopen(1), 0x12345678);
+    CHECK_EQ(host_eeprom[RING_ADDR], 0x78);
+}
+
+static
+void test_newest_after_laps(void)
+{
+    struct eestore s;
+    uint32_t v;
+    uint32_t reads;
+
+    setup();
+    v = 0;
+    eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v);
+    for (v = 1; v <= 2 * RING_SLOTS + 3; v++)
+    {
+        eestore_save(&s, &v);
+        eestore_flush();
+        reads = host_eeprom_reads();
+        CHECK_EQ(reopen(1), v);
+        /* binary search on the sequence numbers, then one record */
+        CHECK(host_eeprom_reads() - reads <= 2 * 4 + COUNTER_SLOT_SIZE);
+    }
+    CHECK_EQ(s.seq, 2 * RING_SLOTS + 2);
+}
+
+static
+void test_wear_leveling(void)
+{
+    struct eestore s;
+    uint32_t v;
+    uint16_t a;
+    uint32_t max_wear;
+
+    setup();
+    v = 0;
+    eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v);
+    for (v = 1; v <= 10 * RING_SLOTS; v++)
+    {
+        eestore_save(&s, &v);
+        eestore_flush();
+    }
+    max_wear = 0;
+    for (a = 0; a < RING_SLOTS * COUNTER_SLOT_SIZE; a++)
+    {
+        if (host_eeprom_wear(RING_ADDR + a) > max_wear)
+        {
+            max_wear = host_eeprom_wear(RING_ADDR + a);
+        }
+    }
+    CHECK_EQ(max_wear, 10);
+    CHECK_EQ(host_eeprom_wear(RING_ADDR - 1), 0);
+    CHECK_EQ(host_eeprom_wear(RING_ADDR + RING_SLOTS * COUNTER_SLOT_SIZE), 0);
+    /* the MSB of the counter is programmed once, when erased */
+    CHECK_EQ(host_eeprom_wear(RING_ADDR + 3), 1);
+}
+
+static
+void test_merged_saves(void)
+{
+    struct eestore s;
+    uint32_t v;
+
+    setup();
+    v = 0;
+    eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v);
+    for (v = 1; v <= 10; v++)
+    {
+        eestore_save(&s, &v);
+        host_advance(MS(1));
+    }
+    eestore_flush();
+    CHECK_EQ(reopen(1), 10);
+    CHECK_EQ(s.seq, 1); /* the first and the last one */
+    CHECK_EQ(s.newest, 1);
+}
+
+static
+void test_cut_record(void)
+{
+    struct eestore s;
+    uint32_t v;
+
+    setup();
+    v = 0;
+    eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v);
+    for (v = 1; v <= 5; v++)
+    {
+        eestore_save(&s, &v);
+        eestore_flush();
+    }
+    /* newest record in slot 4 damaged, the previous one is used */
+    host_eeprom[RING_ADDR + 4 * COUNTER_SLOT_SIZE] ^= 0x01;
+    v = 0;
+    CHECK(eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v));
+    CHECK_EQ(v, 4);
+    CHECK_EQ(s.newest, 3);
+
+    /* and the damaged slot is the next one written */
+    v = 7;
+    eestore_save(&s, &v);
+    eestore_flush();
+    CHECK_EQ(s.newest, 4);
+    CHECK_EQ(reopen(1), 7);
+
+    /* sequence number of the next slot written partially */
+    v = 8;
+    eestore_save(&s, &v);
+    eestore_flush();
+    host_eeprom[RING_ADDR + 6 * COUNTER_SLOT_SIZE - 1] = 0xFF;
+    CHECK_EQ(reopen(1), 7);
+}
+
+static
+void test_version(void)
+{
+    struct eestore s;
+    uint32_t v;
+
+    setup();
+    v = 0;
+    eestore_open(&s, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v);
+    v = 5;
+    eestore_save(&s, &v);
+    eestore_flush();
+    CHECK_EQ(reopen(1), 5);
+    CHECK_EQ(reopen(2), 0xDEADBEEF);
+}
+
+static
+void test_two_stores(void)
+{
+    struct eestore a;
+    struct eestore b;
+    uint8_t cfg[3] = { 1, 2, 3 };
+    uint32_t v;
+
+    setup();
+    v = 0;
+    eestore_open(&a, RING_ADDR, RING_SLOTS, sizeof(v), 1, &v);
+    eestore_open(&b, 0, 4, sizeof(cfg), 1, cfg);
+    v = 99;
+    eestore_save(&a, &v);
+    eestore_save(&b, cfg);
+    cfg[0] = 4;
+    eestore_save(&b, cfg);
+    eestore_flush();
+    CHECK_EQ(reopen(1), 99);
+    memset(cfg, 0, sizeof(cfg));
+    CHECK(eestore_open(&b, 0, 4, sizeof(cfg), 1, cfg));
+    CHECK_EQ(cfg[0], 4);
+    CHECK_EQ(cfg[2], 3);
+    CHECK_EQ(b.newest, 1);
+}
+
+int main(void)
+{
+    RUN(test_empty);
+    RUN(test_save_background);
+    RUN(test_newest_after_laps);
+    RUN(test_wear_leveling);
+    RUN(test_merged_saves);
+    RUN(test_cut_record);
+    RUN(test_version);
+    RUN(test_two_stores);
+
+    return check_result();
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "check.h"
+#include "hw.h"
+#include "fade.h"
+#include "pwm.h"
+
+#define MS(ms) ((uint64_t)(ms) * (F_CPU / 1000UL))
+
+/* duty cycle in counts of the inverted output */
+static
+uint16_t duty0a(void)
+{
+    return 0xFF - OCR0A;
+}
+
+static
+void test_gamma_endpoints(void)
+{
+    pwm_init(PWM_OC0A, 8);
+    fade_init();
+    fade_set(PWM_OC0A, 0);
+    CHECK_EQ(duty0a(), 0);
+    fade_set(PWM_OC0A, FADE_LEVEL_MAX);
+    CHECK_EQ(duty0a(), 0xFF);
+    fade_set(PWM_OC0A, 128);
+    /* (128/255)^2.2 = 0.22 */
+    CHECK(duty0a() >= 54);
+    CHECK(duty0a() <= 57);
+    CHECK_EQ(fade_get(PWM_OC0A), 128);
+}
+
+static
+void test_fade_duration(void)
+{
+    pwm_init(PWM_OC0A, 8);
+    fade_init();
+    sei();
+    fade_to(PWM_OC0A, FADE_LEVEL_MAX, 100, FADE_LINEAR);
+    CHECK(fade_busy(PWM_OC0A));
+    host_advance(MS(50));
+    CHECK(fade_busy(PWM_OC0A));
+    /* linear: half way */
+    CHECK(fade_get(PWM_OC0A) >= 125);
+    CHECK(fade_get(PWM_OC0A) <= 130);
+    host_advance(MS(52));
+    CHECK(!fade_busy(PWM_OC0A));
+    CHECK_EQ(fade_get(PWM_OC0A), FADE_LEVEL_MAX);
+    CHECK_EQ(duty0a(), 0xFF);
+}
+
+static
+void test_curves(void)
+{
+    static const enum fade_curve curves[4] = {
+        FADE_LINEAR, FADE_EASE_IN, FADE_EASE_OUT, FADE_EASE_IN_OUT,
+    };
+    uint8_t at_quarter[4];
+    uint8_t i;
+
+    pwm_init(PWM_OC0B, 8);
+    sei();
+    for (i = 0; i < 4; i++)
+    {
+        fade_init();
+        fade_to(PWM_OC0B, 200, 400, curves[i]);
+        host_advance(MS(100));
+        at_quarter[i] = fade_get(PWM_OC0B);
+        host_advance(MS(310));
+        CHECK_EQ(fade_get(PWM_OC0B), 200);
+    }
+    CHECK(at_quarter[0] >= 48 && at_quarter[0] <= 52);
+    CHECK(at_quarter[1] < at_quarter[0]); /* slow start */
+    CHECK(at_quarter[2] > at_quarter[0]); /* fast start */
+    CHECK(at_quarter[3] < at_quarter[0]);
+}
+
+static
+void test_fade_down_and_stop(void)
+{
+    pwm_init(PWM_OC1A, 10);
+    fade_init();
+    sei();
+    fade_set(PWM_OC1A, 200);
+    fade_to(PWM_OC1A, 0, 200, FADE_LINEAR);
+    host_advance(MS(100));
+    fade_stop(PWM_OC1A);
+    CHECK(!fade_busy(PWM_OC1A));
+    CHECK(fade_get(PWM_OC1A) >= 95);
+    CHECK(fade_get(PWM_OC1A) <= 105);
+    host_advance(MS(200));
+    CHECK(fade_get(PWM_OC1A) >= 95);
+    CHECK(fade_get(PWM_OC1A) <= 105);
+    fade_to(PWM_OC1A, 0, 0, FADE_LINEAR);
+    CHECK_EQ(fade_get(PWM_OC1A), 0);
+    CHECK_EQ(OCR1A, 0x3FF);
+}
+
+static
+void test_timer0_started(void)
+{
+    fade_init();
+    CHECK_EQ(TCCR0B & 0x07, _BV(CS01) | _BV(CS00));
+    CHECK(TIMSK0 & _BV(TOIE0));
+    sei();
+    host_advance(MS(100));
+    /* one tick every 1.024ms */
+    CHECK_EQ(host_irq_count(16), (MS(100) + 1) / (256 * 64)); /* TIMER0_OVF */
+}
+
+int main(void)
+{
+    RUN(test_gamma_endpoints);
+    RUN(test_fade_duration);
+    RUN(test_curves);
+    RUN(test_fade_down_and_stop);
+    RUN(test_timer0_started);
+
+    return check_result();
+}
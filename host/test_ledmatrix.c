@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include "check.h"
+#include "hw.h"
+#include "ledmatrix.h"
+
+/* row i is driven on PB5 (0), PD7 (1), PD2..PD6 (2..6) */
+static
+uint8_t rows_driven(void)
+{
+    uint8_t rows;
+    uint8_t i;
+
+    rows = host_gpio_out('B', 5) ? 0x01 : 0;
+    rows |= host_gpio_out('D', 7) ? 0x02 : 0;
+    for (i = 2; i < N_ROWS; i++)
+    {
+        rows |= host_gpio_out('D', i) ? _BV(i) : 0;
+    }
+    return rows;
+}
+
+/* columns are sunk by PB0..PB4 as low outputs */
+static
+int8_t col_on(void)
+{
+    int8_t col;
+    uint8_t i;
+
+    col = -1;
+    for (i = 0; i < N_COLS; i++)
+    {
+        if (DDRB & _BV(i))
+        {
+            if (col >= 0)
+            {
+                return -2; /* more than one */
+            }
+            col = i;
+        }
+    }
+    return col;
+}
+
+static
+void test_setup(void)
+{
+    PORTB = 0xFF;
+    ledmatrix_setup();
+    CHECK_EQ(DDRB & 0x1F, 0);
+    CHECK_EQ(PORTB & 0x1F, 0);
+    CHECK_EQ(DDRD & 0xFC, 0xFC);
+    CHECK_EQ(rows_driven(), 0);
+}
+
+static
+void test_full_frame(void)
+{
+    static const struct ledmatrix_frame frame = LEDMATRIX_FRAME_INIT(
+            10001,
+            01010,
+            00100,
+            01010,
+            10001,
+            11111,
+            00000);
+    struct ledmatrix_frame seen;
+    uint8_t i;
+
+    ledmatrix_setup();
+    for (i = 0; i < N_COLS; i++)
+    {
+        seen.cols[i] = 0;
+    }
+    for (i = 0; i < N_SUBFRAMES; i++)
+    {
+        uint8_t rows;
+        int8_t col;
+
+        ledmatrix_draw_next_subframe(&frame);
+        rows = rows_driven();
+        col = col_on();
+        CHECK(col >= 0);
+        if (col < 0)
+        {
+            return;
+        }
+        /* current limit: at most N_DOTS_ON_MAX dots at a time */
+        CHECK(__builtin_popcount(rows) <= N_DOTS_ON_MAX);
+        CHECK_EQ(host_gpio_out('B', col), 0);
+        seen.cols[col] |= rows;
+    }
+    for (i = 0; i < N_COLS; i++)
+    {
+        CHECK_EQ(seen.cols[i], frame.cols[i]);
+    }
+    /* and it starts over */
+    ledmatrix_draw_next_subframe(&frame);
+    CHECK_EQ(col_on(), 0);
+}
+
+int main(void)
+{
+    RUN(test_setup);
+    RUN(test_full_frame);
+
+    return check_result();
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include "check.h"
+#include "hw.h"
+#include "pin.hpp"
+
+/* Ethernet shield: SD card and Wiznet chip selects, SPI pins */
+typedef pin::pins<pin::pd4> sd_cs;
+typedef pin::pins<pin::pb2> wiznet_ss;
+typedef pin::pins<pin::pb3, pin::pb4, pin::pb5> spi_pins;
+
+static_assert(pin::disjoint<sd_cs, wiznet_ss>::value, "chip selects apart");
+static_assert(!pin::disjoint<spi_pins, pin::pins<pin::pb5> >::value, "SCK is PB5");
+static_assert(pin::disjoint<spi_pins, pin::pins<pin::pd3, pin::pd4, pin::pd5> >::value,
+        "same bits, other port");
+
+/* Like the ledmatrix rows: in place, moved and on two ports */
+typedef pin::pins<pin::pb5, pin::pd7, pin::pd2, pin::pd3> group;
+
+static_assert(group::mask_b == 0x20, "PORTB mask");
+static_assert(group::mask_c == 0x00, "PORTC mask");
+static_assert(group::mask_d == 0x8C, "PORTD mask");
+
+typedef pin::field<0x45, 0, 3> timer0_cs; /* TCCR0B CS02:0 */
+
+static unsigned portd_accesses;
+
+static
+void count_portd(uint8_t addr)
+{
+    (void)addr;
+    portd_accesses++;
+}
+
+static
+void test_write(void)
+{
+    PORTB = 0x01;
+    PORTD = 0x41;
+    group::write(0x0D); /* rows 0, 2 and 3 */
+    CHECK_EQ(PORTB, 0x21);
+    CHECK_EQ(PORTD, 0x4D);
+    group::write(0x02); /* row 1 only */
+    CHECK_EQ(PORTB, 0x01);
+    CHECK_EQ(PORTD, 0xC1);
+    group::write(0x0F);
+    CHECK_EQ(PORTB, 0x21);
+    CHECK_EQ(PORTD, 0xCD);
+    group::write(0xF0); /* bits without a pin */
+    CHECK_EQ(PORTB, 0x01);
+    CHECK_EQ(PORTD, 0x41);
+}
+
+static
+void test_one_store_per_port(void)
+{
+    host_hook_set(0x2B, count_portd); /* PORTD */
+    PORTD = 0x00;
+    portd_accesses = 0;
+    group::write(0x0E); /* three pins of PORTD */
+    CHECK_EQ(portd_accesses, 2); /* read and write */
+    CHECK_EQ(PORTD, 0x8C);
+}
+
+static
+void test_direction(void)
+{
+    group::output();
+    CHECK_EQ(DDRB, 0x20);
+    CHECK_EQ(DDRD, 0x8C);
+    group::input();
+    CHECK_EQ(DDRB, 0x00);
+    CHECK_EQ(DDRD, 0x00);
+    DDRD = 0x01;
+    group::direction(0x06); /* rows 1 and 2 */
+    CHECK_EQ(DDRB, 0x00);
+    CHECK_EQ(DDRD, 0x85);
+    group::set();
+    CHECK_EQ(PORTB, 0x20);
+    CHECK_EQ(PORTD, 0x8C);
+    group::clear();
+    CHECK_EQ(PORTB, 0x00);
+    CHECK_EQ(PORTD, 0x00);
+}
+
+static
+void test_read(void)
+{
+    host_gpio_drive('B', 5, true);
+    host_gpio_drive('D', 7, false);
+    host_gpio_drive('D', 2, false);
+    host_gpio_drive('D', 3, true);
+    host_gpio_drive('D', 6, true); /* not in the group */
+    CHECK_EQ(group::read(), 0x09);
+    host_gpio_drive('B', 5, false);
+    host_gpio_drive('D', 7, true);
+    CHECK_EQ(group::read(), 0x0A);
+}
+
+static
+void test_field(void)
+{
+    TCCR0B = _BV(WGM02);
+    timer0_cs::write(3);
+    CHECK_EQ(TCCR0B, _BV(WGM02) | _BV(CS01) | _BV(CS00));
+    CHECK_EQ(timer0_cs::read(), 3);
+    timer0_cs::write(0x0C); /* out of the field */
+    CHECK_EQ(TCCR0B, _BV(WGM02) | _BV(CS02));
+    CHECK_EQ(timer0_cs::bits(5), 5);
+}
+
+int main(void)
+{
+    RUN(test_write);
+    RUN(test_one_store_per_port);
+    RUN(test_direction);
+    RUN(test_read);
+    RUN(test_field);
+
+    return check_result();
+}
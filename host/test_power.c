@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "adc.h"
+#include "check.h"
+#include "hw.h"
+#include "power.h"
+#include "sched.h"
+#include "sysclock.h"
+
+/* sysclock holds Timer2 from its constructor */
+#define ALL_PRR (_BV(PRADC) | _BV(PRUSART0) | _BV(PRSPI) | _BV(PRTIM1) \
+        | _BV(PRTIM0) | _BV(PRTWI))
+
+static uint64_t wake_at; /* pin change driven */
+static uint64_t isr_at;
+static bool wake_level;
+static uint8_t sleep_mode_seen;
+static uint8_t wake_task;
+
+ISR(PCINT0_vect)
+{
+    isr_at = host_cycles;
+    sched_post(wake_task);
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+}
+
+static
+void wake_on_sleep(void)
+{
+    sleep_mode_seen = SMCR & (_BV(SM2) | _BV(SM1) | _BV(SM0));
+    wake_level = !wake_level;
+    wake_at = host_cycles;
+    host_gpio_drive('B', 4, wake_level);
+}
+
+static
+void pcint_setup(void)
+{
+    PCMSK0 = _BV(PCINT4);
+    PCICR = _BV(PCIE0);
+    host_sleep_hook = wake_on_sleep;
+    sei();
+}
+
+static
+void test_refcount(void)
+{
+    power_init();
+    CHECK_EQ(PRR, ALL_PRR);
+    CHECK(ACSR & _BV(ACD));
+    power_get(POWER_ADC);
+    power_get(POWER_ADC);
+    CHECK_EQ(PRR, ALL_PRR & ~_BV(PRADC));
+    power_put(POWER_ADC);
+    CHECK_EQ(PRR, ALL_PRR & ~_BV(PRADC));
+    power_put(POWER_ADC);
+    CHECK_EQ(PRR, ALL_PRR);
+    power_put(POWER_ADC); /* unbalanced: ignored */
+    power_get(POWER_TWI);
+    CHECK_EQ(PRR, ALL_PRR & ~_BV(PRTWI));
+    power_init(); /* keeps what is held */
+    CHECK_EQ(PRR, ALL_PRR & ~_BV(PRTWI));
+    power_put(POWER_TWI);
+    CHECK_EQ(PRR, ALL_PRR);
+}
+
+static
+void test_drivers(void)
+{
+    power_init();
+    sei();
+    host_adc_input[0] = 100;
+    CHECK_EQ(adc_read_sleep(ADC_REF_AVCC | ADC_MUX_ADC(0)), 100 << ADC_OVERSAMPLE_BITS);
+    CHECK(PRR & _BV(PRADC));
+    adc_start(ADC_REF_AVCC | ADC_MUX_ADC(0), 1000); /* Timer1 trigger */
+    CHECK_EQ(PRR & (_BV(PRADC) | _BV(PRTIM1)), 0);
+    host_advance(F_CPU / 10);
+    CHECK(adc_get_seq(0) != 0);
+    adc_stop();
+    CHECK_EQ(PRR, ALL_PRR);
+}
+
+static
+void test_gated_timer(void)
+{
+    power_init();
+    TCCR0B = _BV(CS00); /* ignored on the device */
+    host_advance(1000);
+    CHECK_EQ(TCNT0, 0);
+    power_get(POWER_TIMER0);
+    host_advance(100);
+    CHECK(TCNT0 >= 100);
+    TCCR0B = 0;
+    power_put(POWER_TIMER0);
+}
+
+static
+void test_sleep_mode(void)
+{
+    power_init();
+    PCMSK0 = _BV(PCINT4);
+    PCICR = _BV(PCIE0);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_POWER_DOWN);
+    EIMSK = _BV(INT0); /* low level */
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_POWER_DOWN);
+    EICRA = _BV(ISC01); /* falling edge */
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_IDLE);
+    EIMSK = 0;
+
+    EECR = _BV(EERIE);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_ADC);
+    EECR = 0;
+
+    power_get(POWER_TIMER1);
+    TIMSK1 = _BV(OCIE1A);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_POWER_DOWN); /* no clock */
+    TCCR1B = _BV(WGM12) | _BV(CS12);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_IDLE);
+    TCCR1B = 0;
+    TIMSK1 = 0;
+    power_put(POWER_TIMER1);
+
+    power_get(POWER_TIMER2);
+    TIMSK2 = _BV(TOIE2);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_POWER_DOWN); /* sysclock */
+    ASSR = _BV(AS2);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_POWER_SAVE);
+    TIMSK2 = 0;
+    ASSR = 0;
+    power_put(POWER_TIMER2);
+
+    adc_start(ADC_REF_AVCC | ADC_MUX_ADC(0), ADC_FREE_RUNNING);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_ADC);
+    adc_start(ADC_REF_AVCC | ADC_MUX_ADC(0), 1000);
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_IDLE); /* timer trigger */
+    adc_stop();
+    CHECK_EQ(power_sleep_mode(), POWER_SLEEP_POWER_DOWN);
+
+    CHECK_EQ(power_sleep_smcr(POWER_SLEEP_ADC), SLEEP_MODE_ADC);
+    CHECK_EQ(power_sleep_smcr(POWER_SLEEP_POWER_DOWN), SLEEP_MODE_PWR_DOWN);
+    power_fast_wake(true);
+    CHECK_EQ(power_sleep_smcr(POWER_SLEEP_POWER_DOWN), SLEEP_MODE_STANDBY);
+    CHECK_EQ(power_sleep_smcr(POWER_SLEEP_POWER_SAVE), SLEEP_MODE_EXT_STANDBY);
+    power_fast_wake(false);
+}
+
+static
+void run_wake(void)
+{
+}
+
+/* sched sleeps in Idle while the Timer1 interrupt is enabled */
+static
+void test_sched_sleep(void)
+{
+    sysclock_init();
+    power_init();
+    sched_init();
+    wake_task = sched_add(run_wake, SCHED_PRIO_NORMAL);
+    pcint_setup();
+    CHECK(!sched_step());
+    CHECK_EQ(sleep_mode_seen, SLEEP_MODE_PWR_DOWN);
+    CHECK(sched_step());
+
+    power_get(POWER_TIMER1);
+    OCR1A = 0xFFFF;
+    TIMSK1 = _BV(OCIE1A);
+    TCCR1B = _BV(WGM12) | _BV(CS12) | _BV(CS10);
+    CHECK(!sched_step());
+    CHECK_EQ(sleep_mode_seen, SLEEP_MODE_IDLE);
+    CHECK(sched_step());
+    TCCR1B = 0;
+    TIMSK1 = 0;
+    power_put(POWER_TIMER1);
+    CHECK(!sched_step());
+    CHECK_EQ(sleep_mode_seen, SLEEP_MODE_PWR_DOWN);
+}
+
+static
+void test_budget(void)
+{
+    uint16_t active;
+    uint16_t idle;
+    uint16_t down;
+
+    power_init();
+    active = power_active_ua();
+    idle = power_sleep_ua(POWER_SLEEP_IDLE);
+    down = power_sleep_ua(POWER_SLEEP_POWER_DOWN);
+    CHECK(active > idle);
+    CHECK(idle > power_sleep_ua(POWER_SLEEP_ADC));
+    CHECK(power_sleep_ua(POWER_SLEEP_ADC) > down);
+    CHECK(down < 100);
+
+    power_get(POWER_ADC);
+    CHECK(power_active_ua() > active);
+    CHECK(power_sleep_ua(POWER_SLEEP_ADC) - power_sleep_ua(POWER_SLEEP_POWER_DOWN)
+            > idle - power_sleep_ua(POWER_SLEEP_IDLE) + 700);
+    CHECK_EQ(power_sleep_ua(POWER_SLEEP_POWER_DOWN), down); /* not clocked */
+    power_put(POWER_ADC);
+
+    power_fast_wake(true);
+    CHECK(power_sleep_ua(POWER_SLEEP_POWER_DOWN) > down);
+    power_fast_wake(false);
+
+    CHECK_EQ(power_budget_ua(POWER_SLEEP_POWER_DOWN, 0), active);
+    CHECK_EQ(power_budget_ua(POWER_SLEEP_POWER_DOWN, 100), down);
+    CHECK_EQ(power_budget_ua(POWER_SLEEP_POWER_DOWN, 99), (active + 99UL * down + 50) / 100);
+}
+
+/* Cycles from the pin change to the ISR */
+static
+uint32_t wake_latency(uint8_t smcr)
+{
+    set_sleep_mode(smcr);
+    sleep_enable();
+    sleep_cpu();
+    sleep_disable();
+    return isr_at - wake_at;
+}
+
+static
+void test_wake_latency(void)
+{
+    pcint_setup();
+    CHECK_EQ(wake_latency(SLEEP_MODE_IDLE), 4);
+    CHECK_EQ(wake_latency(SLEEP_MODE_ADC), 4);
+    CHECK_EQ(wake_latency(SLEEP_MODE_STANDBY), 6 + 4);
+    CHECK_EQ(wake_latency(SLEEP_MODE_EXT_STANDBY), 6 + 4);
+    CHECK_EQ(wake_latency(SLEEP_MODE_PWR_SAVE), 16384 + 4);
+    CHECK_EQ(wake_latency(SLEEP_MODE_PWR_DOWN), 16384 + 4);
+    host_startup_cycles = 1024; /* CKSEL fuses for a ceramic resonator */
+    CHECK_EQ(wake_latency(SLEEP_MODE_PWR_DOWN), 1024 + 4);
+}
+
+int main(void)
+{
+    RUN(test_refcount);
+    RUN(test_drivers);
+    RUN(test_gated_timer);
+    RUN(test_sleep_mode);
+    RUN(test_sched_sleep);
+    RUN(test_budget);
+    RUN(test_wake_latency);
+
+    return check_result();
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include "check.h"
+#include "hw.h"
+#include "prof.h"
+#include "sysclock.h"
+
+PROF_PROBE(probe_a);
+PROF_PROBE(probe_b);
+
+static
+void run_a(uint32_t cycles)
+{
+    PROF_SCOPE(probe_a);
+
+    host_advance(cycles);
+}
+
+static
+void run_b(uint32_t cycles)
+{
+    PROF_SCOPE(probe_b);
+
+    host_advance(cycles);
+}
+
+/* prof_dump() output, to be freed */
+static
+char *dump(void)
+{
+    FILE *saved;
+    char *buf;
+    size_t len;
+
+    saved = stdout;
+    stdout = open_memstream(&buf, &len);
+    prof_dump();
+    fclose(stdout);
+    stdout = saved;
+    return buf;
+}
+
+static
+void test_scope(void)
+{
+    struct prof_probe snap;
+
+    sysclock_init();
+    sei();
+    prof_reset();
+    run_a(1000);
+    run_a(3000);
+    CHECK(prof_get(0, &snap));
+    CHECK_EQ(snap.count, 2);
+    /* one tick of resolution, plus the register accesses */
+    CHECK(snap.min + SYSCLOCK_CYCLES_PER_TICK >= 1000);
+    CHECK(snap.min <= 1000 + 2 * SYSCLOCK_CYCLES_PER_TICK);
+    CHECK(snap.max + SYSCLOCK_CYCLES_PER_TICK >= 3000);
+    CHECK(snap.max <= 3000 + 2 * SYSCLOCK_CYCLES_PER_TICK);
+    CHECK(snap.total >= snap.min + snap.max);
+    CHECK(!prof_get(1, &snap)); /* probe_b never ran */
+}
+
+static
+void test_dump(void)
+{
+    char *out;
+
+    sysclock_init();
+    sei();
+    prof_reset();
+    run_a(1000);
+    run_b(2000);
+    out = dump();
+    CHECK(strstr(out, "probe_a") != NULL);
+    CHECK(strstr(out, "probe_b") != NULL);
+    CHECK(strstr(out, "%-20S") == NULL); /* %S handled */
+    free(out);
+}
+
+/* probes stay registered with no samples */
+static
+void test_reset_dump(void)
+{
+    struct prof_probe snap;
+    char *out;
+    char *line;
+
+    sysclock_init();
+    sei();
+    run_a(1000);
+    prof_reset();
+    run_b(2000);
+    out = dump();
+    line = strstr(out, "probe_a");
+    CHECK(line != NULL);
+    if (line != NULL)
+    {
+        CHECK(strncmp(line + 20, "          0          -          -          -\n", 45) == 0);
+    }
+    free(out);
+    /* registered first, so last */
+    CHECK(prof_get(1, &snap));
+    CHECK_EQ(snap.count, 0);
+}
+
+int main(void)
+{
+    RUN(test_scope);
+    RUN(test_dump);
+    RUN(test_reset_dump);
+
+    return check_result();
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include "check.h"
+#include "hw.h"
+#include "pwm.h"
+
+static
+void test_timer0(void)
+{
+    pwm_init(PWM_OC0A, 8);
+    CHECK_EQ(TCCR0A & (_BV(WGM01) | _BV(WGM00)), _BV(WGM01) | _BV(WGM00)); /* fast PWM */
+    CHECK_EQ(TCCR0A & (_BV(COM0A1) | _BV(COM0A0)), _BV(COM0A1) | _BV(COM0A0)); /* inverted */
+    CHECK_EQ(TCCR0B & 0x07, _BV(CS01) | _BV(CS00)); /* F_CPU/64 */
+    CHECK(DDRD & _BV(DDD6));
+    CHECK_EQ(pwm_get_top(PWM_OC0A), 0xFF);
+    CHECK_EQ(OCR0A, 0xFF); /* duty 0 */
+    pwm_set(PWM_OC0A, 64);
+    CHECK_EQ(OCR0A, 0xFF - 64);
+    pwm_set(PWM_OC0A, 1000); /* clamped to TOP */
+    CHECK_EQ(OCR0A, 0);
+}
+
+static
+void test_timer2_keeps_prescaler(void)
+{
+    TCCR2B = _BV(CS21); /* as set by sysclock */
+    pwm_init(PWM_OC2B, 8);
+    CHECK_EQ(TCCR2B & 0x07, _BV(CS21));
+    CHECK(DDRD & _BV(DDD3));
+}
+
+static
+void test_timer1_bits(void)
+{
+    pwm_init(PWM_OC1A, 10);
+    CHECK_EQ(ICR1, 0x3FF);
+    CHECK_EQ(pwm_get_top(PWM_OC1B), 0x3FF); /* shared TOP */
+    CHECK_EQ(TCCR1B & 0x07, _BV(CS10));
+    pwm_set(PWM_OC1A, 0x100);
+    CHECK_EQ(OCR1A, 0x3FF - 0x100);
+    pwm_init(PWM_OC1B, 1); /* clamped to 2 bits */
+    CHECK_EQ(ICR1, 3);
+}
+
+static
+void test_frac(void)
+{
+    pwm_init(PWM_OC0B, 8);
+    pwm_set_frac(PWM_OC0B, 0);
+    CHECK_EQ(OCR0B, 0xFF);
+    pwm_set_frac(PWM_OC0B, PWM_FRAC_MAX);
+    CHECK_EQ(OCR0B, 0); /* TOP/(TOP+1) */
+    pwm_set_frac(PWM_OC0B, PWM_FRAC(1, 2));
+    CHECK_EQ(OCR0B, 0xFF - 127);
+    pwm_init_top(PWM_OC1A, 999);
+    pwm_set_frac(PWM_OC1A, PWM_FRAC(1, 4));
+    CHECK_EQ(OCR1A, 999 - 249);
+}
+
+static
+void test_percent(void)
+{
+    uint8_t p;
+
+    pwm_init_top(PWM_OC1A, 0xFFFF);
+    for (p = 0; p <= 100; p++)
+    {
+        uint32_t expected;
+
+        pwm_set_percent(PWM_OC1A, p);
+        expected = (p == 100) ? 0xFFFF : ((p * 65536UL) / 100);
+        /* within one count of the exact duty */
+        CHECK((0xFFFFUL - OCR1A + 1 >= expected) && (0xFFFFUL - OCR1A <= expected + 1));
+    }
+}
+
+static
+void test_stop(void)
+{
+    pwm_init(PWM_OC2A, 8);
+    pwm_set(PWM_OC2A, 10);
+    pwm_stop(PWM_OC2A);
+    CHECK_EQ(TCCR2A & (_BV(COM2A1) | _BV(COM2A0)), 0);
+    CHECK(!host_gpio_out('B', 3));
+}
+
+int main(void)
+{
+    RUN(test_timer0);
+    RUN(test_timer2_keeps_prescaler);
+    RUN(test_timer1_bits);
+    RUN(test_frac);
+    RUN(test_percent);
+    RUN(test_stop);
+
+    return check_result();
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "check.h"
+#include "hw.h"
+#include "sched.h"
+#include "sysclock.h"
+
+#define MS(ms) ((uint64_t)(ms) * (F_CPU / 1000UL))
+
+static char order[16];
+static uint8_t n_order;
+static uint8_t task_a;
+static uint8_t task_b;
+static uint8_t task_c;
+static uint8_t a_reposts;
+static uint32_t a_work;
+
+static
+void record(char task)
+{
+    if (n_order < sizeof(order))
+    {
+        order[n_order++] = task;
+    }
+}
+
+static
+void run_a(void)
+{
+    record('a');
+    if (a_reposts > 0)
+    {
+        a_reposts--;
+        sched_post(task_a);
+    }
+    host_advance(a_work);
+}
+
+static
+void run_b(void)
+{
+    record('b');
+}
+
+static
+void run_c(void)
+{
+    record('c');
+}
+
+static
+void setup(void)
+{
+    sysclock_init();
+    sei();
+    sched_init();
+    n_order = 0;
+    a_reposts = 0;
+    a_work = 0;
+}
+
+static
+void test_priority(void)
+{
+    setup();
+    task_a = sched_add(run_a, SCHED_PRIO_LOW);
+    task_b = sched_add(run_b, SCHED_PRIO_NORMAL);
+    task_c = sched_add(run_c, SCHED_PRIO_HIGH);
+    sched_post(task_a);
+    sched_post(task_b);
+    sched_post(task_c);
+    sched_post(task_c); /* runs once per batch of posts */
+    CHECK(sched_step());
+    CHECK(sched_step());
+    CHECK(sched_step());
+    CHECK_EQ(n_order, 3);
+    CHECK(order[0] == 'c' && order[1] == 'b' && order[2] == 'a');
+}
+
+static
+void test_round_robin(void)
+{
+    setup();
+    task_a = sched_add(run_a, SCHED_PRIO_NORMAL);
+    task_b = sched_add(run_b, SCHED_PRIO_NORMAL);
+    a_reposts = 5;
+    sched_post(task_a);
+    sched_post(task_b);
+    CHECK(sched_step());
+    CHECK(sched_step());
+    CHECK(order[0] == 'a' && order[1] == 'b'); /* b not starved by a */
+}
+
+static
+void test_table_full(void)
+{
+    uint8_t i;
+
+    setup();
+    for (i = 0; i < SCHED_MAX_TASKS; i++)
+    {
+        CHECK_EQ(sched_add(run_b, SCHED_PRIO_NORMAL), i);
+    }
+    CHECK_EQ(sched_add(run_b, SCHED_PRIO_NORMAL), SCHED_NO_TASK);
+}
+
+static
+void test_periodic(void)
+{
+    uint8_t runs;
+
+    setup();
+    task_b = sched_add(run_b, SCHED_PRIO_NORMAL);
+    sched_every(task_b, 10);
+    runs = 0;
+    while (host_cycles < MS(105))
+    {
+        if (sched_step())
+        {
+            runs++;
+        }
+    }
+    CHECK_EQ(runs, 10);
+    /* noticed at the next sysclock overflow */
+    CHECK(sched_latency_max(task_b) <= SYSCLOCK_CYCLES_PER_OVF + 500);
+    sched_every(task_b, 0);
+}
+
+static uint8_t sleep_mode_seen;
+static uint8_t wake_task;
+static bool wake_level;
+
+ISR(PCINT0_vect)
+{
+    sched_post(wake_task);
+}
+
+static
+void wake_on_sleep(void)
+{
+    sleep_mode_seen = SMCR & (_BV(SM2) | _BV(SM1) | _BV(SM0));
+    wake_level = !wake_level;
+    host_gpio_drive('B', 4, wake_level); /* pin change */
+}
+
+static
+uint8_t sleep_once(void)
+{
+    sleep_mode_seen = 0xFF;
+    host_sleep_hook = wake_on_sleep;
+    CHECK(!sched_step()); /* slept */
+    CHECK(sched_step()); /* ran the woken task */
+    host_sleep_hook = NULL;
+    return sleep_mode_seen;
+}
+
+static
+void test_sleep_modes(void)
+{
+    setup();
+    PCMSK0 = _BV(PCINT4);
+    PCICR = _BV(PCIE0);
+    wake_task = sched_add(run_b, SCHED_PRIO_NORMAL);
+
+    CHECK_EQ(sleep_once(), SLEEP_MODE_PWR_DOWN);
+    sched_sleep_block(SCHED_SLEEP_ADC);
+    CHECK_EQ(sleep_once(), SLEEP_MODE_ADC);
+    sched_sleep_block(SCHED_SLEEP_IDLE);
+    CHECK_EQ(sleep_once(), SLEEP_MODE_IDLE);
+    sched_sleep_unblock(SCHED_SLEEP_IDLE);
+    sched_sleep_unblock(SCHED_SLEEP_ADC);
+    CHECK_EQ(sleep_once(), SLEEP_MODE_PWR_DOWN);
+    /* sysclock must keep running for periodic tasks */
+    task_c = sched_add(run_c, SCHED_PRIO_LOW);
+    sched_every(task_c, 1000);
+    CHECK_EQ(sleep_once(), SLEEP_MODE_IDLE);
+}
+
+static
+void test_idle_percent(void)
+{
+    setup();
+    task_a = sched_add(run_a, SCHED_PRIO_NORMAL);
+    a_work = MS(2);
+    sched_every(task_a, 10); /* 20% busy */
+    while (host_cycles < MS(2100))
+    {
+        (void)sched_step();
+    }
+    CHECK(sched_idle_percent() >= 78);
+    CHECK(sched_idle_percent() <= 80);
+}
+
+static
+void test_latency(void)
+{
+    setup();
+    task_a = sched_add(run_a, SCHED_PRIO_HIGH);
+    task_b = sched_add(run_b, SCHED_PRIO_LOW);
+    a_work = MS(3);
+    sched_post(task_b);
+    sched_post(task_a);
+    CHECK(sched_step());
+    CHECK(sched_step());
+    CHECK(sched_latency_max(task_b) >= MS(3));
+    CHECK(sched_latency_max(task_b) < MS(3) + 1000);
+    CHECK(sched_latency_max(task_a) < 1000);
+    CHECK_EQ(sched_latency_max_all(), sched_latency_max(task_b));
+    sched_stats_reset();
+    CHECK_EQ(sched_latency_max_all(), 0);
+}
+
+int main(void)
+{
+    RUN(test_priority);
+    RUN(test_round_robin);
+    RUN(test_table_full);
+    RUN(test_periodic);
+    RUN(test_sleep_modes);
+    RUN(test_idle_percent);
+    RUN(test_latency);
+
+    return check_result();
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include "check.h"
+#include "hw.h"
+#include "sd_model.h"
+#include "sd.h"
+#include "sdlog.h"
+
+#define N_BLOCKS 16
+#define LOG_BLOCKS 256 /* 8 AUs of 16kB */
+
+static uint8_t image[N_BLOCKS * SD_MODEL_BLOCK];
+static uint8_t log_image[LOG_BLOCKS * SD_MODEL_BLOCK];
+static struct sd_model card;
+
+static
+void image_fill(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(image); i++)
+    {
+        image[i] = (i * 7) ^ (i >> 9);
+    }
+}
+
+static
+void test_init_sdhc(void)
+{
+    image_fill();
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK(!card.idle);
+    CHECK(host_gpio_out('D', 4)); /* deselected */
+    CHECK(host_gpio_out('B', 2)); /* Wiznet deselected */
+    /* fast clock: F_CPU/2 */
+    CHECK_EQ(SPCR & (_BV(SPR1) | _BV(SPR0)), 0);
+    CHECK(SPSR & _BV(SPI2X));
+}
+
+static
+void test_init_timeout(void)
+{
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    card.init_polls = 0xFFFF;
+    CHECK_EQ(sd_card_init(), SD_ERR_TIMEOUT);
+}
+
+static
+void test_init_clocks(void)
+{
+    host_spi_attach(NULL, NULL); /* no card */
+    sd_init();
+    CHECK(SPCR & _BV(SPE));
+    CHECK(SPCR & _BV(MSTR));
+    CHECK_EQ(SPCR & (_BV(SPR1) | _BV(SPR0)), _BV(SPR1) | _BV(SPR0)); /* F_CPU/128 */
+    CHECK_EQ(host_spi_count(), 80); /* dummy bytes with SD_CS high */
+    CHECK(host_gpio_out('D', 4));
+}
+
+static
+void test_read_sdhc(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+    uint32_t lba;
+
+    image_fill();
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    for (lba = 0; lba < N_BLOCKS; lba += 5)
+    {
+        memset(block, 0, sizeof(block));
+        CHECK_EQ(sd_read_block(lba, block), 0);
+        CHECK(memcmp(block, &image[lba * SD_MODEL_BLOCK], SD_MODEL_BLOCK) == 0);
+    }
+    CHECK_EQ(card.n_blocks_read, 4);
+}
+
+static
+void test_read_sdsc(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+
+    image_fill();
+    sd_model_attach(&card, image, N_BLOCKS, false);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sd_read_block(3, block), 0); /* byte address 3 * 512 */
+    CHECK(memcmp(block, &image[3 * SD_MODEL_BLOCK], SD_MODEL_BLOCK) == 0);
+}
+
+static
+void test_read_out_of_range(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sd_read_block(N_BLOCKS, block), 0x08);
+}
+
+/* Card removed: every wait for the card gives up */
+static
+void test_no_card(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+    uint8_t csd[16];
+
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    host_spi_attach(NULL, NULL);
+    CHECK_EQ(sd_send_command_r1(13, 0), 0xFF);
+    CHECK_EQ(sd_read_block(0, block), 0xFF);
+    CHECK_EQ(sd_read_csd(csd), 0xFF);
+    CHECK_EQ(sd_read_multi_start(0), 0xFF);
+    CHECK_EQ(sd_write_block(0, block), 0xFF);
+    CHECK_EQ(sd_card_init(), SD_ERR_IDLE);
+}
+
+static
+void test_read_timing(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+    uint64_t t;
+
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    t = host_cycles;
+    CHECK_EQ(sd_read_block(0, block), 0);
+    t = host_cycles - t;
+    /* 525 transfers of 16 cycles, plus 400us of chip select delays */
+    CHECK(t > (525 * 16 + 400 * 16));
+    CHECK(t < (525 * 16 + 400 * 16) * 2);
+}
+
+static
+void block_fill(uint8_t *block, uint8_t seed)
+{
+    uint16_t i;
+
+    for (i = 0; i < SD_MODEL_BLOCK; i++)
+    {
+        block[i] = seed + (i * 3);
+    }
+}
+
+static
+void test_write_single(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+    uint8_t check[SD_MODEL_BLOCK];
+    uint64_t t;
+
+    image_fill();
+    sd_model_attach(&card, image, N_BLOCKS, false);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    block_fill(block, 0x40); /* data bytes looking like commands */
+    t = host_cycles;
+    CHECK_EQ(sd_write_block(5, block), 0);
+    t = host_cycles - t;
+    CHECK(t > card.write_busy_cycles); /* returns after programming */
+    CHECK_EQ(card.n_blocks_written, 1);
+    CHECK(memcmp(&image[5 * SD_MODEL_BLOCK], block, SD_MODEL_BLOCK) == 0);
+    CHECK_EQ(sd_read_block(5, check), 0);
+    CHECK(memcmp(check, block, SD_MODEL_BLOCK) == 0);
+    CHECK(host_gpio_out('D', 4));
+}
+
+static
+void test_write_out_of_range(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    block_fill(block, 0);
+    CHECK_EQ(sd_write_block(N_BLOCKS, block), 0x0D); /* write error */
+    CHECK_EQ(card.n_blocks_written, 0);
+    CHECK_EQ(sd_read_block(0, block), 0); /* still responding */
+}
+
+static
+void test_read_multi(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+    uint32_t lba;
+
+    image_fill();
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sd_read_multi_start(2), 0);
+    for (lba = 2; lba < 8; lba++)
+    {
+        CHECK_EQ(sd_read_multi_block(block), 0);
+        CHECK(memcmp(block, &image[lba * SD_MODEL_BLOCK], SD_MODEL_BLOCK) == 0);
+    }
+    CHECK(!host_gpio_out('D', 4)); /* selected until stopped */
+    CHECK_EQ(sd_read_multi_stop(), 0);
+    CHECK(host_gpio_out('D', 4));
+    CHECK_EQ(sd_read_block(9, block), 0);
+    CHECK(memcmp(block, &image[9 * SD_MODEL_BLOCK], SD_MODEL_BLOCK) == 0);
+}
+
+static
+void test_write_multi(void)
+{
+    uint8_t block[SD_MODEL_BLOCK];
+    uint32_t busy[4];
+    uint8_t i;
+
+    image_fill();
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    card.write_slow_every = 2;
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sd_write_multi_start(4), 0);
+    for (i = 0; i < 4; i++)
+    {
+        uint64_t t;
+
+        block_fill(block, i);
+        CHECK_EQ(sd_write_multi_block(block), 0);
+        t = host_cycles;
+        CHECK(sd_busy_wait());
+        busy[i] = host_cycles - t;
+    }
+    CHECK_EQ(sd_write_multi_stop(), 0);
+    CHECK(host_gpio_out('D', 4));
+    CHECK_EQ(card.n_blocks_written, 4);
+    for (i = 0; i < 4; i++)
+    {
+        block_fill(block, i);
+        CHECK(memcmp(&image[(4 + i) * SD_MODEL_BLOCK], block, SD_MODEL_BLOCK) == 0);
+    }
+    /* every other block is slow, within a poll (8 SPI clocks and overhead) */
+    CHECK(busy[0] + 64 > card.write_busy_cycles);
+    CHECK(busy[0] < card.write_busy_cycles + 64);
+    CHECK(busy[1] + 64 > card.write_slow_cycles);
+    CHECK(busy[1] < card.write_slow_cycles + 64);
+    CHECK(busy[2] < card.write_busy_cycles + 64);
+    CHECK_EQ(sd_read_block(0, block), 0); /* back to commands */
+}
+
+static
+void test_info_sdsc(void)
+{
+    struct sd_info info;
+
+    sd_model_attach(&card, image, N_BLOCKS, false);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sd_get_info(&info), SD_OK);
+    CHECK_EQ(info.n_blocks, N_BLOCKS);
+    CHECK(!info.high_capacity);
+    CHECK_EQ(info.au_blocks, 32);
+    CHECK_EQ(info.erase_aus, 2);
+    CHECK_EQ(info.erase_timeout_s, 1);
+    CHECK_EQ(info.erase_offset_s, 1);
+}
+
+static
+void test_info_sdhc(void)
+{
+    struct sd_info info;
+
+    sd_model_attach(&card, log_image, LOG_BLOCKS, true);
+    card.au_size = 9; /* 4MB */
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sd_get_info(&info), SD_OK);
+    CHECK_EQ(info.n_blocks, 1024); /* in units of 512kB */
+    CHECK(info.high_capacity);
+    CHECK_EQ(info.au_blocks, 8192);
+    card.au_size = 0x0F; /* 64MB */
+    CHECK_EQ(sd_get_info(&info), SD_OK);
+    CHECK_EQ(info.au_blocks, 131072UL);
+}
+
+static
+void test_erase(void)
+{
+    uint64_t t;
+    uint32_t lba;
+
+    image_fill();
+    sd_model_attach(&card, image, N_BLOCKS, false);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    t = host_cycles;
+    CHECK_EQ(sd_erase(2, 5, 1), 0);
+    t = host_cycles - t;
+    CHECK(t > card.erase_busy_cycles);
+    CHECK_EQ(card.n_erases, 1);
+    CHECK_EQ(card.n_blocks_erased, 4);
+    for (lba = 2; lba <= 5; lba++)
+    {
+        CHECK_EQ(image[lba * SD_MODEL_BLOCK + 1], 0x00);
+    }
+    CHECK(image[6 * SD_MODEL_BLOCK + 1] != 0x00);
+    CHECK_EQ(sd_erase(5, N_BLOCKS, 1), 0x40); /* parameter error */
+}
+
+static
+void test_log_aligned(void)
+{
+    struct sdlog l;
+    uint8_t block[SD_MODEL_BLOCK];
+    uint32_t lba;
+
+    memset(log_image, 0xAA, sizeof(log_image));
+    sd_model_attach(&card, log_image, LOG_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    /* AUs of 32 blocks, erased 2 at a time: blocks 64 to 159 */
+    CHECK_EQ(sdlog_open(&l, 40, 150), SD_OK);
+    CHECK_EQ(l.lba, 64);
+    CHECK_EQ(l.end, 160);
+    CHECK_EQ(card.n_erases, 1); /* first 2 AUs */
+    CHECK_EQ(card.n_blocks_erased, 64);
+    for (lba = 64; lba < 160; lba++)
+    {
+        block_fill(block, lba);
+        CHECK_EQ(sdlog_write(&l, block), SD_OK);
+        CHECK_EQ(sdlog_erase_ahead(&l), SD_OK);
+        if ((lba % 32) == 31)
+        {
+            CHECK(host_gpio_out('D', 4)); /* transfer stopped at the AU end */
+        }
+        else
+        {
+            CHECK_EQ(card.n_erases, (lba < 95) ? 1 : 2); /* not mid transfer */
+        }
+    }
+    CHECK_EQ(sdlog_write(&l, block), SD_ERR_FULL);
+    CHECK_EQ(sdlog_flush(&l), SD_OK);
+    CHECK_EQ(card.n_write_multi, 3);
+    CHECK_EQ(card.n_erases, 2);
+    CHECK_EQ(card.n_blocks_erased, 96);
+    CHECK_EQ(card.n_blocks_written, 96);
+    for (lba = 64; lba < 160; lba += 19)
+    {
+        block_fill(block, lba);
+        CHECK(memcmp(&log_image[lba * SD_MODEL_BLOCK], block, SD_MODEL_BLOCK) == 0);
+    }
+    CHECK_EQ(log_image[63 * SD_MODEL_BLOCK], 0xAA);
+    CHECK_EQ(log_image[160 * SD_MODEL_BLOCK], 0xAA);
+}
+
+/* Without sdlog_erase_ahead(), starting an AU erases just that AU */
+static
+void test_log_behind(void)
+{
+    struct sdlog l;
+    uint8_t block[SD_MODEL_BLOCK];
+    uint32_t lba;
+
+    sd_model_attach(&card, log_image, LOG_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sdlog_open(&l, 64, 128), SD_OK);
+    CHECK_EQ(card.n_erases, 1);
+    CHECK_EQ(card.n_blocks_erased, 64);
+    memset(block, 0x55, sizeof(block));
+    for (lba = 64; lba < 128; lba++)
+    {
+        CHECK_EQ(sdlog_write(&l, block), SD_OK);
+    }
+    CHECK_EQ(card.n_erases, 1);
+    CHECK_EQ(sdlog_write(&l, block), SD_OK);
+    CHECK_EQ(card.n_erases, 2);
+    CHECK_EQ(card.n_blocks_erased, 96);
+    CHECK_EQ(card.erase_start, 128);
+    CHECK_EQ(card.erase_end, 159);
+}
+
+static
+void test_log_too_small(void)
+{
+    struct sdlog l;
+
+    sd_model_attach(&card, log_image, LOG_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sdlog_open(&l, 1, 62), SD_ERR_FULL); /* no whole AU */
+    CHECK_EQ(sdlog_open(&l, l.info.n_blocks, 64), SD_ERR_FULL); /* past the end */
+    CHECK_EQ(sdlog_open(&l, 0xFFFFFFC0UL, 0x80), SD_ERR_FULL); /* would wrap to 64 */
+}
+
+/* n_blocks up to the end of the card, without wrapping around */
+static
+void test_log_whole_card(void)
+{
+    struct sdlog l;
+
+    sd_model_attach(&card, log_image, LOG_BLOCKS, true);
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(sdlog_open(&l, 1, UINT32_MAX), SD_OK);
+    CHECK_EQ(l.lba, 32);
+    CHECK_EQ(l.end, (l.info.n_blocks / 32) * 32);
+}
+
+int main(void)
+{
+    RUN(test_init_sdhc);
+    RUN(test_init_timeout);
+    RUN(test_init_clocks);
+    RUN(test_read_sdhc);
+    RUN(test_read_sdsc);
+    RUN(test_read_out_of_range);
+    RUN(test_no_card);
+    RUN(test_read_timing);
+    RUN(test_write_single);
+    RUN(test_write_out_of_range);
+    RUN(test_read_multi);
+    RUN(test_write_multi);
+    RUN(test_info_sdsc);
+    RUN(test_info_sdhc);
+    RUN(test_erase);
+    RUN(test_log_aligned);
+    RUN(test_log_behind);
+    RUN(test_log_too_small);
+    RUN(test_log_whole_card);
+
+    return check_result();
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <avr/io.h>
+#include "check.h"
+#include "hw.h"
+#include "spi.h"
+
+#define SPCR_ADDR 0x4C
+
+static uint32_t spcr_accesses;
+
+static
+void count_spcr(uint8_t addr)
+{
+    (void)addr;
+    spcr_accesses++;
+}
+
+static
+uint8_t echo_plus_one(void *ctx, uint8_t mosi)
+{
+    (void)ctx;
+    return mosi + 1;
+}
+
+static
+uint8_t clock_div(void)
+{
+    static const uint8_t divs[4] = { 4, 16, 64, 128 };
+
+    return divs[SPCR & 0x03] >> ((SPSR & _BV(SPI2X)) ? 1 : 0);
+}
+
+static
+void test_clock(void)
+{
+    static const struct {
+        uint32_t max_hz;
+        uint8_t div;
+    } cases[] = {
+        { 20000000UL, 2 },
+        { 8000000UL, 2 },
+        { 7999999UL, 4 },
+        { 4000000UL, 4 },
+        { 1000000UL, 16 },
+        { 300000UL, 64 },
+        { 125000UL, 128 },
+        { 10UL, 128 },
+    };
+    struct spi_device dev;
+    uint8_t i;
+
+    spi_bus_init();
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        spi_device_init(&dev, &PORTD, 4, SPI_MODE0, cases[i].max_hz);
+        spi_bus_init(); /* forget the current device */
+        spi_configure(&dev);
+        CHECK_EQ(clock_div(), cases[i].div);
+    }
+    spi_set_clock(&dev, F_CPU / 4); /* current device: applied now */
+    CHECK_EQ(clock_div(), 4);
+}
+
+static
+void test_pins(void)
+{
+    struct spi_device dev;
+
+    spi_bus_init();
+    CHECK(host_gpio_out('B', 2)); /* SS high */
+    CHECK(DDRB & _BV(DDB2));
+    CHECK_EQ(DDRB & (_BV(DDB5) | _BV(DDB4) | _BV(DDB3)), _BV(DDB5) | _BV(DDB3));
+    spi_device_init(&dev, &PORTD, 7, SPI_MODE3 | SPI_LSB_FIRST, 1000000UL);
+    CHECK(DDRD & _BV(DDD7));
+    CHECK(host_gpio_out('D', 7));
+    spi_begin(&dev);
+    CHECK(!host_gpio_out('D', 7));
+    CHECK_EQ(SPCR & (_BV(CPOL) | _BV(CPHA) | _BV(DORD)), _BV(CPOL) | _BV(CPHA) | _BV(DORD));
+    CHECK(SPCR & _BV(MSTR));
+    spi_end(&dev);
+    CHECK(host_gpio_out('D', 7));
+}
+
+static
+void test_no_redundant_setup(void)
+{
+    struct spi_device a;
+    struct spi_device b;
+
+    spi_bus_init();
+    spi_device_init(&a, &PORTD, 4, SPI_MODE0, 8000000UL);
+    spi_device_init(&b, &PORTB, 2, SPI_MODE1, 1000000UL);
+    spcr_accesses = 0;
+    host_hook_set(SPCR_ADDR, count_spcr);
+    spi_begin(&a);
+    spi_end(&a);
+    CHECK_EQ(spcr_accesses, 1);
+    spi_begin(&a);
+    spi_end(&a);
+    CHECK_EQ(spcr_accesses, 1);
+    spi_begin(&b);
+    spi_end(&b);
+    CHECK_EQ(spcr_accesses, 2);
+    host_hook_set(SPCR_ADDR, NULL);
+}
+
+static
+void test_transfer(void)
+{
+    struct spi_device dev;
+    uint8_t tx[4] = { 1, 2, 3, 4 };
+    uint8_t rx[4];
+
+    host_spi_attach(echo_plus_one, NULL);
+    spi_bus_init();
+    spi_device_init(&dev, &PORTD, 4, SPI_MODE0, 8000000UL);
+    spi_begin(&dev);
+    spi_transfer(tx, rx, sizeof(rx));
+    CHECK(rx[0] == 2 && rx[1] == 3 && rx[2] == 4 && rx[3] == 5);
+    memset(rx, 0, sizeof(rx));
+    spi_transfer(NULL, rx, sizeof(rx)); /* sends 0xFF */
+    CHECK(rx[0] == 0 && rx[3] == 0);
+    spi_transfer(tx, NULL, sizeof(tx));
+    CHECK_EQ(host_spi_count(), 12);
+    CHECK_EQ(spi_xfer(0x41), 0x42);
+    spi_end(&dev);
+}
+
+static char done_order[8];
+static uint8_t n_done;
+
+static
+void record_done(struct spi_xact *x)
+{
+    done_order[n_done++] = ((const char *)x->tx)[0];
+}
+
+static
+void test_queue_batching(void)
+{
+    struct spi_device a;
+    struct spi_device b;
+    struct spi_xact xs[5];
+    static const char names[5] = { 'a', 'B', 'b', 'C', 'c' };
+    uint8_t i;
+
+    spi_bus_init();
+    spi_device_init(&a, &PORTD, 4, SPI_MODE0, 8000000UL);
+    spi_device_init(&b, &PORTB, 2, SPI_MODE0, 1000000UL);
+    /* a B b C c: lower case on device a, upper case on b */
+    for (i = 0; i < 5; i++)
+    {
+        xs[i].dev = (names[i] >= 'a') ? &a : &b;
+        xs[i].tx = &names[i];
+        xs[i].rx = NULL;
+        xs[i].len = 1;
+        xs[i].done = record_done;
+        spi_submit(&xs[i]);
+    }
+    n_done = 0;
+    spcr_accesses = 0;
+    host_hook_set(SPCR_ADDR, count_spcr);
+    CHECK_EQ(spi_run(), 5);
+    host_hook_set(SPCR_ADDR, NULL);
+    CHECK(memcmp(done_order, "abcBC", 5) == 0);
+    CHECK_EQ(spcr_accesses, 2); /* one switch only */
+    CHECK_EQ(spi_run(), 0);
+    CHECK(host_gpio_out('D', 4));
+    CHECK(host_gpio_out('B', 2));
+}
+
+int main(void)
+{
+    RUN(test_clock);
+    RUN(test_pins);
+    RUN(test_no_redundant_setup);
+    RUN(test_transfer);
+    RUN(test_queue_batching);
+
+    return check_result();
+}
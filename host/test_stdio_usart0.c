@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "check.h"
+#include "hw.h"
+#include "stdio_usart0.h"
+
+static
+void test_init_baud(void)
+{
+    stdio_usart0_init();
+    /* 57600 baud @ 16MHz needs double speed: UBRR 34, -0.8% */
+    CHECK_EQ(UBRR0, 34);
+    CHECK(UCSR0A & _BV(U2X0));
+    CHECK_EQ(UCSR0B & (_BV(TXEN0) | _BV(RXEN0)), _BV(TXEN0) | _BV(RXEN0));
+    CHECK(host_last_fdev != NULL);
+}
+
+static
+void test_put_newline(void)
+{
+    char out[16];
+    size_t len;
+
+    stdio_usart0_init();
+    fputs("ab\nc", host_last_fdev);
+    len = host_usart_tx_take(out, sizeof(out));
+    CHECK_EQ(len, 5);
+    CHECK(memcmp(out, "ab\r\nc", 5) == 0);
+}
+
+static
+void test_printf(void)
+{
+    char out[32];
+    size_t len;
+
+    stdio_usart0_init();
+    fprintf(host_last_fdev, "x=%d", 42);
+    len = host_usart_tx_take(out, sizeof(out) - 1);
+    out[len] = '\0';
+    CHECK(strcmp(out, "x=42") == 0);
+}
+
+static
+void test_get(void)
+{
+    stdio_usart0_init();
+    host_usart_rx_push("hi", 2);
+    CHECK_EQ(fgetc(host_last_fdev), 'h');
+    CHECK_EQ(fgetc(host_last_fdev), 'i');
+    CHECK(!(UCSR0A & _BV(RXC0)));
+}
+
+static
+void test_echo(void)
+{
+    char out[4];
+    int c;
+
+    stdio_usart0_init();
+    host_usart_rx_push("xy", 2);
+    /* write while the next byte is already waiting in UDR0 */
+    c = fgetc(host_last_fdev);
+    fputc(c, host_last_fdev);
+    c = fgetc(host_last_fdev);
+    fputc(c, host_last_fdev);
+    CHECK_EQ(host_usart_tx_take(out, sizeof(out)), 2);
+    CHECK(memcmp(out, "xy", 2) == 0);
+}
+
+static
+void test_flush(void)
+{
+    stdio_usart0_init();
+    stdio_usart0_flush(); /* nothing sent yet: returns at once */
+    fputc('z', host_last_fdev);
+    stdio_usart0_flush();
+    CHECK(UCSR0A & _BV(TXC0));
+}
+
+int main(void)
+{
+    RUN(test_init_baud);
+    RUN(test_put_newline);
+    RUN(test_printf);
+    RUN(test_get);
+    RUN(test_echo);
+    RUN(test_flush);
+
+    return check_result();
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "check.h"
+#include "hw.h"
+#include "sysclock.h"
+
+static
+void test_running(void)
+{
+    sysclock_init();
+    sei();
+#if SYSCLOCK_PRESCALER == 64
+    CHECK_EQ(TCCR2B & 0x07, _BV(CS22)); /* F_CPU/64 */
+#else
+    CHECK_EQ(TCCR2B & 0x07, _BV(CS21)); /* F_CPU/8, "make PROF=1" */
+#endif
+    CHECK(TIMSK2 & _BV(TOIE2));
+    host_advance(F_CPU); /* one second */
+    CHECK_EQ(host_irq_count(9), F_CPU / SYSCLOCK_CYCLES_PER_OVF); /* TIMER2_OVF */
+    CHECK(sysclock_now_ms() >= 999);
+    CHECK(sysclock_now_ms() <= 1000); /* first test: counting from 0 */
+    CHECK(sysclock_now_us() >= 999900);
+    CHECK(sysclock_now_us() <= 1000000 + 1); /* register accesses */
+}
+
+static
+void test_ms_rounding(void)
+{
+    uint32_t i;
+    uint32_t t0;
+
+    sysclock_init();
+    sei();
+    t0 = sysclock_now_ms(); /* driver state survives the reset */
+    /* 1.024ms per overflow: the fraction is carried, not lost */
+    for (i = 0; i < 1000; i++)
+    {
+        host_advance(SYSCLOCK_CYCLES_PER_OVF);
+    }
+    CHECK_EQ(sysclock_now_ms() - t0, (1000UL * SYSCLOCK_US_PER_OVF) / 1000);
+}
+
+static
+void test_pending_overflow(void)
+{
+    uint32_t before;
+    uint32_t after;
+    uint32_t ms_before;
+    uint32_t ms_pending;
+
+    sysclock_init();
+    sei();
+    host_advance(10 * SYSCLOCK_CYCLES_PER_OVF + 100 * SYSCLOCK_CYCLES_PER_TICK);
+    cli();
+    before = sysclock_now_ticks();
+    ms_before = sysclock_now_ms();
+    /* wrap with interrupts disabled: TOV2 is pending */
+    host_advance(200 * SYSCLOCK_CYCLES_PER_TICK);
+    after = sysclock_now_ticks();
+    CHECK(TIFR2 & _BV(TOV2));
+    CHECK(after > before);
+    CHECK(after - before >= 199);
+    CHECK(after - before <= 201);
+    ms_pending = sysclock_now_ms();
+    CHECK(ms_pending - ms_before <= 1 + (SYSCLOCK_US_PER_OVF / 1000));
+    sei();
+    host_advance(1);
+    CHECK(!(TIFR2 & _BV(TOV2)));
+    CHECK_EQ(sysclock_now_ms(), ms_pending); /* same after the ISR */
+    CHECK(sysclock_now_ticks() >= after);
+}
+
+static
+void test_cycles(void)
+{
+    uint32_t t0;
+    uint32_t dt;
+
+    sysclock_init();
+    sei();
+    t0 = sysclock_now_cycles();
+    host_advance(123456);
+    dt = sysclock_now_cycles() - t0;
+    /* resolution of one Timer2 tick */
+    CHECK(dt + SYSCLOCK_CYCLES_PER_TICK >= 123456);
+    CHECK(dt <= 123456 + SYSCLOCK_CYCLES_PER_TICK);
+    CHECK_EQ(SYSCLOCK_CYCLES_TO_US(dt), dt / 16);
+}
+
+/* sysclock_now_cycles() wraps at 2^32 cycles, microseconds do not */
+static
+void test_us_wrap(void)
+{
+    uint32_t t0;
+    uint32_t dt;
+
+    sysclock_init();
+    sei();
+    host_advance((uint32_t)(0 - sysclock_now_cycles() - 10000)); /* driver state survives the reset */
+    t0 = sysclock_now_us();
+    host_advance(20000);
+    dt = sysclock_now_us() - t0;
+    /* one tick of resolution, plus the register accesses */
+    CHECK(dt + (SYSCLOCK_CYCLES_PER_TICK / SYSCLOCK_CYCLES_PER_US) + 1 >= 20000 / SYSCLOCK_CYCLES_PER_US);
+    CHECK(dt <= ((20000 + SYSCLOCK_CYCLES_PER_TICK) / SYSCLOCK_CYCLES_PER_US) + 1);
+}
+
+int main(void)
+{
+    RUN(test_running);
+    RUN(test_ms_rounding);
+    RUN(test_pending_overflow);
+    RUN(test_cycles);
+    RUN(test_us_wrap);
+
+    return check_result();
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include "board.h"
+#include "check.h"
+#include "hw.h"
+#include "sd.h"
+#include "sd_model.h"
+#include "spi.h"
+#include "uspi.h"
+
+#define N_BLOCKS 16
+
+static uint8_t log_mosi[600];
+static uint16_t n_mosi;
+
+/* answers the complement of every byte */
+static
+uint8_t dev_xfer(void *ctx, uint8_t mosi)
+{
+    (void)ctx;
+    if (n_mosi < sizeof(log_mosi))
+    {
+        log_mosi[n_mosi++] = mosi;
+    }
+    return ~mosi;
+}
+
+static
+void setup(void)
+{
+    uspi_stop(); /* driver state survives the reset */
+    n_mosi = 0;
+    host_usart_spi_attach(dev_xfer, NULL);
+}
+
+static
+void test_settings(void)
+{
+    setup();
+    uspi_init(SPI_MODE0, F_CPU / 2);
+    CHECK_EQ(UBRR0, 0);
+    CHECK_EQ(UCSR0C, _BV(UMSEL01) | _BV(UMSEL00));
+    CHECK_EQ(UCSR0B, _BV(RXEN0) | _BV(TXEN0));
+    CHECK(DDRD & _BV(DDD4));
+    uspi_set_clock(1000000UL);
+    CHECK_EQ(UBRR0, 7);
+    uspi_set_clock(1100000UL); /* not above */
+    CHECK_EQ(UBRR0, 7);
+    uspi_set_clock(100);
+    CHECK_EQ(UBRR0, 0x0FFF);
+    uspi_set_clock(0); /* the slowest, not a division by 0 */
+    CHECK_EQ(UBRR0, 0x0FFF);
+
+    uspi_init(SPI_MODE3 | SPI_LSB_FIRST, F_CPU / 2);
+    CHECK_EQ(UCSR0C, _BV(UMSEL01) | _BV(UMSEL00)
+            | _BV(UCPOL0) | _BV(UCPHA0) | _BV(UDORD0));
+}
+
+static
+void test_stop_restores(void)
+{
+    setup();
+    UBRR0 = 16;
+    UCSR0A = _BV(U2X0);
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+    uspi_init(SPI_MODE0, F_CPU / 2);
+    uspi_stop();
+    CHECK_EQ(UBRR0, 16);
+    CHECK(UCSR0A & _BV(U2X0));
+    CHECK_EQ(UCSR0B, _BV(RXEN0) | _BV(TXEN0));
+    CHECK_EQ(UCSR0C, _BV(UCSZ01) | _BV(UCSZ00));
+    CHECK(!(DDRD & _BV(DDD4)));
+}
+
+/* the settings of the first call are the ones restored */
+static
+void test_init_twice(void)
+{
+    setup();
+    UBRR0 = 16;
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+    uspi_init(SPI_MODE0, F_CPU / 2);
+    uspi_init(SPI_MODE3, F_CPU / 4);
+    uspi_stop();
+    CHECK_EQ(UBRR0, 16);
+    CHECK_EQ(UCSR0B, _BV(RXEN0) | _BV(TXEN0));
+    CHECK_EQ(UCSR0C, _BV(UCSZ01) | _BV(UCSZ00));
+    uspi_stop(); /* again: nothing to restore */
+    CHECK_EQ(UBRR0, 16);
+}
+
+static
+void test_xfer(void)
+{
+    setup();
+    uspi_init(SPI_MODE0, F_CPU / 2);
+    CHECK_EQ(uspi_xfer(0x5A), 0xA5);
+    CHECK_EQ(uspi_xfer(0xFF), 0x00); /* same value as received before */
+    CHECK_EQ(uspi_xfer(0x00), 0xFF);
+    CHECK_EQ(n_mosi, 3);
+    CHECK_EQ(log_mosi[1], 0xFF);
+    CHECK_EQ(host_usart_spi_count(), 3);
+}
+
+static
+void test_transfer_gapless(void)
+{
+    static uint8_t tx[512];
+    static uint8_t rx[512];
+    struct spi_device dev;
+    uint64_t t_uspi;
+    uint64_t t_spi;
+    uint16_t i;
+
+    setup();
+    for (i = 0; i < sizeof(tx); i++)
+    {
+        tx[i] = i * 7;
+    }
+    uspi_init(SPI_MODE0, F_CPU / 2);
+    t_uspi = host_cycles;
+    uspi_transfer(tx, rx, sizeof(tx));
+    t_uspi = host_cycles - t_uspi;
+    CHECK_EQ(n_mosi, 512);
+    CHECK(memcmp(log_mosi, tx, sizeof(tx)) == 0);
+    for (i = 0; i < sizeof(tx); i++)
+    {
+        CHECK_EQ(rx[i], (uint8_t)~tx[i]);
+    }
+    CHECK(!(UCSR0A & _BV(DOR0)));
+    /* 16 cycles per byte, plus the last byte read */
+    CHECK(t_uspi <= 512 * 16 + 8);
+
+    /* the same through SPDR has gaps */
+    host_spi_attach(dev_xfer, NULL);
+    spi_bus_init();
+    spi_device_init(&dev, &PORTD, PORTD5, SPI_MODE0, F_CPU / 2);
+    spi_configure(&dev);
+    t_spi = host_cycles;
+    spi_transfer(tx, rx, sizeof(tx));
+    t_spi = host_cycles - t_spi;
+    CHECK(t_spi > t_uspi + 512);
+}
+
+static
+void test_slow_clock(void)
+{
+    uint8_t rx[4];
+
+    setup();
+    uspi_init(SPI_MODE0, 125000UL); /* 128 cycles per bit */
+    uspi_transfer(NULL, rx, sizeof(rx));
+    CHECK_EQ(n_mosi, 4);
+    CHECK_EQ(rx[3], 0x00);
+    CHECK(host_cycles > 4 * 8 * 128);
+}
+
+static
+void test_write(void)
+{
+    static uint8_t tx[100];
+    uint64_t t;
+    uint16_t i;
+
+    setup();
+    for (i = 0; i < sizeof(tx); i++)
+    {
+        tx[i] = i;
+    }
+    uspi_init(SPI_MODE0, F_CPU / 2);
+    t = host_cycles;
+    uspi_write(tx, sizeof(tx));
+    t = host_cycles - t;
+    CHECK_EQ(n_mosi, 100);
+    CHECK(memcmp(log_mosi, tx, sizeof(tx)) == 0);
+    CHECK(t <= 100 * 16 + 8);
+    CHECK(!(UCSR0A & _BV(RXC0))); /* nothing received meanwhile */
+    CHECK(UCSR0B & _BV(RXEN0));
+    CHECK_EQ(uspi_xfer(0x0F), 0xF0);
+}
+
+static
+void test_sd_card(void)
+{
+    static uint8_t image[N_BLOCKS * SD_MODEL_BLOCK];
+    static uint8_t block[SD_MODEL_BLOCK];
+    struct sd_model card;
+    uint16_t i;
+
+    sd_model_attach(&card, image, N_BLOCKS, true);
+    card.cs_bit = BOARD_BIT(SD_USPI_CS_PIN);
+    host_usart_spi_attach(sd_model_xfer, &card);
+
+    CHECK_EQ(sd_card_init(), SD_OK);
+    CHECK_EQ(UBRR0, 0); /* fast clock */
+    for (i = 0; i < sizeof(block); i++)
+    {
+        block[i] = i ^ 0x55;
+    }
+    CHECK_EQ(sd_write_block(3, block), 0);
+    memset(block, 0, sizeof(block));
+    CHECK_EQ(sd_read_block(3, block), 0);
+    CHECK_EQ(block[0], 0x55);
+    CHECK_EQ(block[511], (uint8_t)(511 ^ 0x55));
+    CHECK(memcmp(&image[3 * SD_MODEL_BLOCK], block, sizeof(block)) == 0);
+    CHECK_EQ(host_spi_count(), 0); /* SPI bus left free */
+    CHECK(host_usart_spi_count() > 2 * SD_MODEL_BLOCK);
+}
+
+int main(void)
+{
+    RUN(test_settings);
+    RUN(test_stop_restores);
+    RUN(test_init_twice);
+    RUN(test_xfer);
+    RUN(test_transfer_gapless);
+    RUN(test_slow_clock);
+    RUN(test_write);
+    RUN(test_sd_card);
+
+    return check_result();
+}
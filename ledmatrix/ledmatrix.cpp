@@ -19,99 +19,49 @@
 #include <avr/io.h>
 #include <stdint.h>
 #include "ledmatrix.h"
+#include "pin.hpp"
+#include "prof.h"
 
-static
-const uint8_t COL_MASK =
-          _BV(DDB0)
-        | _BV(DDB1)
-        | _BV(DDB2)
-        | _BV(DDB3)
-        | _BV(DDB4);
+PROF_PROBE(ledmatrix_draw);
 
-static
-const uint8_t ROW_MASK_D = 
-          _BV(DDD2)
-        | _BV(DDD3)
-        | _BV(DDD4)
-        | _BV(DDD5)
-        | _BV(DDD6)
-        | _BV(DDD7);
+/* Column i on PB<i>, sinking current when output low */
+typedef pin::pins<pin::pb0, pin::pb1, pin::pb2, pin::pb3, pin::pb4> cols;
 
-static
-const uint8_t ROW_MASK_B = 
-          _BV(DDB5);
+/* Row 0 on PB5, row 1 on PD7, row i on PD<i> for the others */
+typedef pin::pins<pin::pb5, pin::pd7, pin::pd2, pin::pd3, pin::pd4, pin::pd5, pin::pd6> rows;
+
+static_assert(pin::disjoint<cols, rows>::value, "rows and columns share a pin");
 
 static
 void cols_off(void)
 {
-    DDRB &= ~COL_MASK;
+    cols::input();
 }
 
 static
 void col_on(int i_col)
 {
-    DDRB |= _BV(i_col);
+    cols::direction(1 << i_col); /* the others are already off */
 }
 
 static
 void cols_setup(void)
 {
     cols_off();
-    PORTB &= ~COL_MASK; /* disable pull-up */
+    cols::clear(); /* disable pull-up */
 }
 
 static
 void rows_setup(void)
 {
-    DDRD |= ROW_MASK_D;
-    PORTD &= ~ROW_MASK_D; /* everything off */
-    DDRB |= ROW_MASK_B;
-    PORTB &= ~ROW_MASK_B; /* everything off */
-}
-
-static
-uint8_t dots_portd(uint8_t dots)
-{
-    uint8_t dots_d;
-    dots_d = dots & 0x7E; /* bit 0 is on PB5 */
-    dots_d |= (dots & 0x02)?_BV(DDD7):0x00; /* bit 1 is on PD7 */
-    dots_d &= ~0x02;
-    return dots_d;
-}
-
-static
-uint8_t dots_portb(uint8_t dots)
-{
-    uint8_t dots_b;
-    dots_b = (dots & 0x01)?_BV(DDB5):0x00;
-    return dots_b;
-}
-
-static
-void draw_dots_portd(uint8_t dots)
-{
-    uint8_t dots_d = dots_portd(dots);
-    uint8_t dots_on = ROW_MASK_D & dots_d;
-    uint8_t dots_off = ROW_MASK_D & ~dots_d;
-    PORTD |= dots_on;
-    PORTD &= ~dots_off;
-}
-
-static
-void draw_dots_portb(uint8_t dots)
-{
-    uint8_t dots_b = dots_portb(dots);
-    uint8_t dots_on = ROW_MASK_B & dots_b;
-    uint8_t dots_off = ROW_MASK_B & ~dots_b;
-    PORTB |= dots_on;
-    PORTB &= ~dots_off;
+    rows::clear(); /* everything off */
+    rows::output();
 }
 
 static
 void draw_dots(uint8_t dots)
 {
-    draw_dots_portd(dots);
-    draw_dots_portb(dots);
+    rows::write(dots);
 }
 
 static
@@ -136,6 +86,8 @@ void ledmatrix_draw_next_subframe(const struct ledmatrix_frame *f)
     uint8_t dots;
     uint8_t dots_mask = (1<<N_DOTS_ON_MAX)-1;
 
+    PROF_SCOPE(ledmatrix_draw);
+
     dots = f->cols[i_next_col];
     dots_mask <<= i_next_row;
     dots &= dots_mask;
@@ -69,9 +69,17 @@ struct ledmatrix_frame {
         (f)->cols[4] = GETCOL_(4, r0,r1,r2,r3,r4,r5,r6); \
     } while(0)
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 extern void ledmatrix_setup(void);
 
 extern void ledmatrix_draw_next_subframe(const struct ledmatrix_frame *f);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* LEDMATRIX_H */
 
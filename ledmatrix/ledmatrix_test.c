@@ -16,30 +16,134 @@
  *    You should have received a copy of the GNU Lesser General Public License
  *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
+#include "bench.h"
+#include "cmd.h"
 #include "ledmatrix.h"
+#include "prof.h"
 
 #define FRAME_RATE_HZ 50
 #define SUBFRAME_RATE_HZ (FRAME_RATE_HZ * N_SUBFRAMES)
 #define SUBFRAME_DELAY_US (1000000 / SUBFRAME_RATE_HZ)
 
-int main(void)
+#define LEDMATRIX_CMD_FRAME (CMD_ID_USER + 0) /* cols[N_COLS] */
+#define LEDMATRIX_CMD_PROF (CMD_ID_USER + 1) /* index -> probe */
+
+static struct ledmatrix_frame frame =
+    LEDMATRIX_FRAME_INIT(
+        11110,
+        10001,
+        10001,
+        11110,
+        10001,
+        10001,
+        11110);
+
+/* Takes effect from the next subframe */
+static
+void cmd_frame(const uint8_t *data, uint8_t len)
 {
-    struct ledmatrix_frame fB =
+    if (len != N_COLS)
+    {
+        cmd_reply(CMD_ERR_ARGS, NULL, 0);
+        return;
+    }
+    memcpy(frame.cols, data, N_COLS);
+}
+
+/* count, min, max, total as little endian u32, then the name;
+ * no data past the last probe, or without PROF=1.
+ */
+static
+void cmd_prof(const uint8_t *data, uint8_t len)
+{
+#if PROF_ENABLE
+    struct prof_probe snap;
+    uint32_t v[4];
+    uint8_t buf[sizeof(v)];
+    uint8_t *p;
+    uint8_t i;
+    uint8_t name_len;
+
+    if (len != 1)
+    {
+        cmd_reply(CMD_ERR_ARGS, NULL, 0);
+        return;
+    }
+    if (!prof_get(data[0], &snap))
+    {
+        return;
+    }
+    v[0] = snap.count;
+    v[1] = snap.min;
+    v[2] = snap.max;
+    v[3] = snap.total;
+    p = buf;
+    for (i = 0; i < 4; i++)
+    {
+        *p++ = v[i] & 0xFF;
+        *p++ = (v[i] >> 8) & 0xFF;
+        *p++ = (v[i] >> 16) & 0xFF;
+        *p++ = v[i] >> 24;
+    }
+    name_len = strlen_P(snap.name);
+    cmd_reply_begin(CMD_OK, sizeof(buf) + name_len);
+    cmd_reply_data(buf, sizeof(buf));
+    for (i = 0; i < name_len; i++)
+    {
+        uint8_t c;
+
+        c = pgm_read_byte(&snap.name[i]);
+        cmd_reply_data(&c, 1);
+    }
+    cmd_reply_end();
+#else
+    (void)data;
+    (void)len;
+#endif
+}
+
+static const struct cmd_handler ledmatrix_cmds[] = {
+    {LEDMATRIX_CMD_FRAME, cmd_frame},
+    {LEDMATRIX_CMD_PROF, cmd_prof},
+};
+
+#if BENCH_ENABLE
+static void ledmatrix_bench(void)
+{
+    static const struct ledmatrix_frame f8 =
         LEDMATRIX_FRAME_INIT(
-            11110,
+            01110,
             10001,
             10001,
-            11110,
+            01110,
             10001,
             10001,
-            11110);
+            01110);
+
+    ledmatrix_setup();
+    /* every subframe of a frame */
+    BENCH("ledmatrix_draw_next_subframe", N_SUBFRAMES, ledmatrix_draw_next_subframe(&f8));
+}
+#endif
+
+int main(void)
+{
+    BENCH_RUN(ledmatrix_bench);
 
     ledmatrix_setup();
+    cmd_init(ledmatrix_cmds, sizeof(ledmatrix_cmds) / sizeof(ledmatrix_cmds[0]), NULL);
+    sei(); /* command RX and sysclock */
 
     while(1)
     {
-        ledmatrix_draw_next_subframe(&fB);
+        ledmatrix_draw_next_subframe(&frame);
+        cmd_poll(); /* a reply stretches the current subframe */
         _delay_us(SUBFRAME_DELAY_US);
     }
     return 0;
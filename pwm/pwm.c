@@ -16,72 +16,98 @@
  *    You should have received a copy of the GNU Lesser General Public License
  *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <avr/io.h>
-#include <util/delay.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "bench.h"
+#include "cmd.h"
+#include "pwm.h"
+#include "fade.h"
 
-#define BVV(bit, val) ((val)?_BV(bit):0)
-#define DUTY_MAX 100
+#define FADE_MS 1000
 
-static void pwm_set_duty(int8_t duty)
+#define PWM_CMD_FADE (CMD_ID_USER + 0) /* ch, level, ms_lo, ms_hi */
+#define PWM_CMD_BREATHE (CMD_ID_USER + 1) /* ch */
+
+static bool manual[PWM_N_CHANNELS]; /* set by PWM_CMD_FADE */
+
+/* Fade back and forth between off and full brightness */
+static void breathe(enum pwm_channel ch, uint16_t ms, enum fade_curve curve)
 {
-    uint8_t oc;
-    if (duty <= 0)
+    if (!manual[ch] && !fade_busy(ch))
     {
-        oc = 0;
+        fade_to(ch, (fade_get(ch) == 0) ? FADE_LEVEL_MAX : 0, ms, curve);
     }
-    else if (duty >= DUTY_MAX)
+}
+
+static bool channel_used(uint8_t ch)
+{
+    return (ch == PWM_OC0A) || (ch == PWM_OC1A);
+}
+
+/* Fade to the level and stop breathing */
+static void cmd_fade(const uint8_t *data, uint8_t len)
+{
+    if ((len != 4) || !channel_used(data[0]))
     {
-        oc = 0xFF;
+        cmd_reply(CMD_ERR_ARGS, NULL, 0);
+        return;
     }
-    else
+    manual[data[0]] = true;
+    fade_to(data[0], data[1], data[2] | ((uint16_t)data[3] << 8), FADE_LINEAR);
+}
+
+static void cmd_breathe(const uint8_t *data, uint8_t len)
+{
+    if ((len != 1) || !channel_used(data[0]))
     {
-        oc = (duty * (int16_t)0xFF) / DUTY_MAX;
+        cmd_reply(CMD_ERR_ARGS, NULL, 0);
+        return;
     }
-    OCR0A = oc;
+    manual[data[0]] = false;
 }
 
-static void pwm_init(int8_t duty)
+static const struct cmd_handler pwm_cmds[] = {
+    {PWM_CMD_FADE, cmd_fade},
+    {PWM_CMD_BREATHE, cmd_breathe},
+};
+
+#if BENCH_ENABLE
+static void pwm_bench(void)
 {
-	DDRD |= _BV(DDD6); /* set pin 6 of PORTD for output*/
-    TCCR0A = 
-          BVV(WGM00, 1) | BVV(WGM01, 1) /* Fast PWM update on OCRA */
-        | BVV(COM0A1, 1) | BVV(COM0A0, 0) /* non-inverting OC0A */
-        | BVV(COM0B1, 0) | BVV(COM0B0, 0); /* OC0B not connected */
-    pwm_set_duty(duty);
-    TCCR0B =
-          BVV(CS00, 1) | BVV(CS01, 0) | BVV(CS02, 1) /* F_CPU/1024 */
-        | BVV(WGM02, 0) /* Fast PWM update on OCRA */
-        | BVV(FOC0A, 0) | BVV(FOC0B, 0); /* ignored */
+    uint16_t frac;
+    uint8_t percent;
+
+    pwm_init(PWM_OC0A, 8);
+    frac = 0;
+    percent = 0;
+    BENCH_PREP("pwm_set_frac_8bit", 16, frac += 4099,
+            pwm_set_frac(PWM_OC0A, frac));
+    BENCH_PREP("pwm_set_percent_8bit", 16, percent += 7,
+            pwm_set_percent(PWM_OC0A, percent % 101));
+    /* OC1A: only the 16-bit math and OCR1A write, Timer1 is not set up */
+    BENCH_PREP("pwm_set_frac_16bit", 16, frac += 4099,
+            pwm_set_frac(PWM_OC1A, frac));
 }
+#endif
 
 int main (void)
 {
-    int8_t duty = 0;
-    bool rising = true;
+    BENCH_RUN(pwm_bench);
 
-    pwm_init(duty);
+    pwm_init(PWM_OC0A, 8); /* pin 6 of PORTD */
+    pwm_init(PWM_OC1A, 10); /* pin 1 of PORTB */
+    fade_init();
+    cmd_init(pwm_cmds, sizeof(pwm_cmds) / sizeof(pwm_cmds[0]), NULL);
+    sei();
 
-	while(true) {
-        if(rising)
-        {
-            duty++;
-            if(duty >= DUTY_MAX)
-            {
-                rising = false;
-            }
-        }
-        else
-        {
-            duty--;
-            if(duty <= 0)
-            {
-                rising = true;
-            }
-        }
-        pwm_set_duty(duty);
-        _delay_ms(10);
-	}
+    while(true) {
+        breathe(PWM_OC0A, FADE_MS, FADE_EASE_IN_OUT);
+        breathe(PWM_OC1A, FADE_MS / 2, FADE_LINEAR);
+        cmd_poll();
+        sleep_mode(); /* woken up by the fade or USART RX interrupt */
+    }
 }
-
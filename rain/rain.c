@@ -18,25 +18,65 @@
  */
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <avr/io.h>
-#include <util/delay.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "adc.h"
+#include "bench.h"
+#include "eestore.h"
+#include "power.h"
+#include "prof.h"
+#include "pwm.h"
+#include "stdio_usart0.h"
+#include "sysclock.h"
 
-#define BVV(bit, val) ((val)?_BV(bit):0)
+PROF_PROBE(rain_loop);
+
+#define RAIN_SAMPLE_PERIOD_MS 100
+
+/* ADC conversions per second, in the background while awake:
+ * a filtered sample every 16ms with the default oversampling.
+ */
+#define RAIN_ADC_RATE_HZ 1000
+
+/* Telemetry of the sleep/wake cycle */
+struct rain_stats {
+    uint16_t wakes; /* wake-ups from power-down */
+    uint32_t wake_ms; /* sysclock time of last wake-up */
+    uint16_t latency; /* cycles from pin change ISR to main loop */
+    uint16_t latency_max;
+    uint32_t awake_ms; /* total time out of power-down */
+};
+
+static struct rain_stats rain_stats;
+
+/* Kept in the EEPROM across resets */
+#define RAIN_EE_ADDR 0
+#define RAIN_EE_SLOTS 16
+#define RAIN_EE_VERSION 1
+
+struct rain_counters {
+    uint32_t wakes;
+};
+
+static struct rain_counters rain_counters;
+static struct eestore rain_store;
+static volatile uint32_t rain_pcint_cycles;
+
+ISR(PCINT2_vect) /* OUT pin changed */
+{
+    rain_pcint_cycles = sysclock_now_cycles();
+}
 
 static void rain_init(void)
 {
     DDRD &= ~_BV(DDD7); /* OUT pin connected to PORTD7 */
     DDRC &= ~_BV(DDC0); /* AC pin connected to PORTC0(ADC0) */
-    ADMUX =
-          BVV(MUX0, 0) | BVV(MUX1, 0) | BVV(MUX2, 0) | BVV(MUX3, 0) /* Read ADC0 */
-        | BVV(ADLAR, 1) /* Left justify */
-        | BVV(REFS0, 1) | BVV(REFS1, 0); /* AVCC as reference voltage */
-    ADCSRA =
-          BVV(ADPS0, 1) | BVV(ADPS1, 1) | BVV(ADPS2, 1) /* clk/128 */
-        | BVV(ADIE, 0) | BVV(ADIF, 0) /* No interrupt */
-        | BVV(ADATE, 0) /* No auto-update */
-        | BVV(ADSC, 0) /* Don't start conversion */
-        | BVV(ADEN, 1); /* Enable */
+    DIDR0 |= _BV(ADC0D); /* analog only: disable digital input buffer */
+    PCMSK2 |= _BV(PCINT23); /* PORTD7 is also PCINT23 */
+    PCICR |= _BV(PCIE2); /* enable Pin Change 2 interrupt */
 }
 
 static bool rain_is_raining(void)
@@ -44,57 +84,101 @@ static bool rain_is_raining(void)
     return bit_is_clear(PIND, PIND7); /* OUT = 0 means rain */
 }
 
-static uint8_t rain_get_humidity(void)
+/* Sample the AC pin in the background, until adc_stop() */
+static void rain_start_sampling(void)
 {
-    ADCSRA |= _BV(ADSC); /* Start conversion */
-    loop_until_bit_is_clear(ADCSRA, ADSC); /* Wait for end of conversion */
-    return 255 - ADCH; /* lower means more humidity */
+    adc_start(ADC_REF_AVCC | ADC_MUX_ADC(0), RAIN_ADC_RATE_HZ);
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (adc_get_seq(0) == 0)
+    {
+        sleep_mode(); /* until the first filtered sample */
+    }
 }
 
-static void pwm_set_duty_cycle(uint8_t oc)
+static uint8_t rain_get_humidity(void)
 {
-    OCR0A = oc;
+    uint16_t level;
+
+    /* oversampled and filtered by the ADC ISR */
+    level = adc_get_filtered(0) >> (ADC_RESULT_BITS - 8);
+    return 255 - level; /* lower means more humidity */
 }
 
-static void pwm_init(uint8_t oc)
+/* Power down until the comparator OUT pin changes.
+ * sysclock does not advance while powered down, and the oscillator
+ * start-up time (16K CK, ~1ms with the Arduino fuses) happens before
+ * the ISR runs, so only the ISR to main loop latency can be measured.
+ */
+static void rain_sleep_until_rain(void)
 {
-	DDRD |= _BV(DDD6); /* set pin 6 of PORTD for output*/
-    TCCR0A = 
-          BVV(WGM00, 1) | BVV(WGM01, 1) /* Fast PWM update on OCRA */
-        | BVV(COM0A1, 1) | BVV(COM0A0, 0) /* non-inverting OC0A */
-        | BVV(COM0B1, 0) | BVV(COM0B0, 0); /* OC0B not connected */
-    pwm_set_duty_cycle(oc);
-    TCCR0B =
-          BVV(CS00, 1) | BVV(CS01, 0) | BVV(CS02, 1) /* F_CPU/1024 */
-        | BVV(WGM02, 0) /* Fast PWM update on OCRA */
-        | BVV(FOC0A, 0) | BVV(FOC0B, 0); /* ignored */
-}
+    uint32_t sleep_cycles;
+    uint32_t wake_cycles;
+    uint32_t pcint_cycles;
+    uint32_t now_ms;
+    bool slept;
 
-#define BAUD 57600
-#include <util/setbaud.h>
+    now_ms = sysclock_now_ms();
+    rain_stats.awake_ms += now_ms - rain_stats.wake_ms;
+    printf("sleep: %u wakes (%lu since first boot), awake %lu ms\n",
+            rain_stats.wakes, (unsigned long)rain_counters.wakes,
+            (unsigned long)rain_stats.awake_ms);
+    printf("current: ~%u uA awake, ~%u uA powered down\n",
+            power_active_ua(), power_sleep_ua(POWER_SLEEP_POWER_DOWN));
+    stdio_usart0_flush();
+    eestore_save(&rain_store, &rain_counters);
+    eestore_flush(); /* EE_READY does not wake from Power-down */
+    adc_stop(); /* with its Timer1 trigger */
 
-static void usart_init(void)
-{
-    UBRR0H = UBRRH_VALUE;
-    UBRR0L = UBRRL_VALUE;
-#if USE_2X
-    UCSR0A |= _BV(U2X0);
-#else
-    UCSR0A &= ~_BV(U2X0);
-#endif
-    UCSR0B = BVV(TXEN0, 1) | BVV(RXEN0, 0); /* Only TX */
-}
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    slept = false;
+    sleep_cycles = sysclock_now_cycles();
+    cli();
+    if (!rain_is_raining())
+    {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        slept = true;
+    }
+    sei();
 
-static void usart_tx(char c) {
-    while(!(UCSR0A & _BV(UDRE0)));
-    UDR0 = c;
+    wake_cycles = sysclock_now_cycles();
+    rain_stats.wake_ms = sysclock_now_ms();
+    if (!slept)
+    {
+        return; /* it started raining while saving */
+    }
+    rain_stats.wakes++;
+    rain_counters.wakes++;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        pcint_cycles = rain_pcint_cycles;
+    }
+    /* woken up by something else than the pin change */
+    if ((int32_t)(pcint_cycles - sleep_cycles) < 0)
+    {
+        printf("\nwake %u\n", rain_stats.wakes);
+        return;
+    }
+    rain_stats.latency = wake_cycles - pcint_cycles;
+    if (rain_stats.latency > rain_stats.latency_max)
+    {
+        rain_stats.latency_max = rain_stats.latency;
+    }
+    printf("\nwake %u: latency %u cycles (max %u)\n",
+            rain_stats.wakes, rain_stats.latency, rain_stats.latency_max);
 }
 
-static void usart_puts(const char *s)
+/* Idle (sysclock keeps running) until the next sample is due,
+ * or until it stops raining.
+ */
+static void rain_wait_next_sample(uint32_t deadline_ms)
 {
-    while(*s != '\0')
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (((int32_t)(sysclock_now_ms() - deadline_ms) < 0) && rain_is_raining())
     {
-        usart_tx(*s++);
+        sleep_mode(); /* woken up at least by every sysclock overflow */
     }
 }
 
@@ -140,26 +224,61 @@ static void update_gauge(bool state, uint8_t lvl)
     byte2hex(pline, lvl);
     pline += 2;
     *pline++ = '\0';
-    usart_puts(line);
+    fputs(line, stdout);
+}
+
+#if BENCH_ENABLE
+static void rain_bench(void)
+{
+    char line[51 + 1];
+    uint8_t lvl;
+
+    lvl = 0;
+    BENCH_PREP("gauge", 16, lvl += 17, gauge(line, sizeof(line), lvl, 255));
+    BENCH_PREP("byte2hex", 16, lvl += 17, byte2hex(line, lvl));
+    stdio_usart0_bench();
 }
+#endif
 
 int main (void)
 {
+    uint32_t next_sample_ms;
+
+    BENCH_RUN(rain_bench);
     rain_init();
-    usart_init();
-    pwm_init(0);
-    
+    power_init(); /* ADC and Timer1 only while awake, no SPI, TWI */
+    eestore_open(&rain_store, RAIN_EE_ADDR, RAIN_EE_SLOTS,
+            sizeof(rain_counters), RAIN_EE_VERSION, &rain_counters);
+    pwm_init(PWM_OC0A, 8); /* pin 6 of PORTD */
+    sei(); /* pin change, ADC and sysclock interrupts */
+    rain_start_sampling();
+
+    next_sample_ms = sysclock_now_ms();
     while (true)
     {
-        bool raining;
-        uint8_t humidity;
+        if (rain_is_raining())
+        {
+            uint8_t humidity;
 
-        raining = rain_is_raining();
-        humidity = rain_get_humidity();
+            {
+                PROF_SCOPE(rain_loop);
 
-        pwm_set_duty_cycle(humidity);
-        update_gauge(raining, humidity);
-        _delay_ms(100);
+                humidity = rain_get_humidity();
+                pwm_set(PWM_OC0A, humidity);
+                update_gauge(true, humidity);
+            }
+            prof_poll();
+            next_sample_ms += RAIN_SAMPLE_PERIOD_MS;
+            rain_wait_next_sample(next_sample_ms);
+        }
+        else
+        {
+            pwm_set(PWM_OC0A, 0);
+            update_gauge(false, 0);
+            prof_poll();
+            rain_sleep_until_rain();
+            rain_start_sampling();
+            next_sample_ms = sysclock_now_ms();
+        }
     }
 }
-
@@ -17,200 +17,124 @@
  *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <avr/io.h>
-#include <util/delay.h>
+#include <avr/interrupt.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include "sysclock.h"
+#include "bench.h"
+#include "cmd.h"
+#include "prof.h"
+#include "sd.h"
+#include "sdperf.h"
+#include "uspi.h"
 
 static
-void sd_select(void)
-{
-    _delay_us(100);
-    PORTD &= ~_BV(PORTD4); /* SD_CS low */
-    _delay_us(100);
-}
-
-static
-void sd_deselect(void)
-{
-    _delay_us(100);
-    PORTD |= _BV(PORTD4); /* SD_CS high */
-    _delay_us(100);
-}
-
-static
-uint8_t spi_xfer(uint8_t tx)
-{
-    uint8_t rx;
-
-    /* assuming last transfer was done so SPIF is 0 */
-    SPDR = tx;
-    loop_until_bit_is_set(SPSR, SPIF);
-    rx = SPDR;
-
-    printf("tx:%02x rx:%02x\n", tx, rx); 
-
-    return rx;
-}
-
-static
-uint8_t crc7_get(uint8_t cmd, uint32_t arg)
-{
-    uint8_t crc7;
-
-    (void)arg;
-    cmd &= 0x3F;
-    if (cmd == 0)
-    {
-        /* arg should be 0 */
-        crc7 = 0x94;
-    }
-    else if (cmd == 8)
-    {
-        /* arg should be 0x1AA */
-        crc7 = 0x86;
-    }
-    else
-    {
-        /* don't care */
-        crc7 = 0xFF;
-    }
-    crc7 |= 0x01; /* end bit */
-    return crc7;
-}
-
-static
-void send_cmd(uint8_t cmd, uint32_t arg)
-{
-    uint8_t crc7;
-
-    crc7 = crc7_get(cmd, arg);
-
-    cmd |= 0x40;
-    (void)spi_xfer(cmd);
-    (void)spi_xfer((arg>>24) & 0xFF);
-    (void)spi_xfer((arg>>16) & 0xFF);
-    (void)spi_xfer((arg>> 8) & 0xFF);
-    (void)spi_xfer((arg>> 0) & 0xFF);
-    (void)spi_xfer(crc7);
-}
-
-void sd_send_command(uint8_t cmd, uint32_t arg, void *resp, size_t len)
+void print_resp(uint8_t cmd, void *resp, size_t len)
 {
+    size_t i;
     uint8_t *resp_bytes;
-    size_t i_byte;
 
-    sd_select();
-    send_cmd(cmd, arg);
+    printf("CMD%d: ", cmd);
     resp_bytes = resp;
-
-    for (i_byte = 0; i_byte < len; i_byte++)
+    for (i = 0; i < len; i++)
     {
-        uint8_t r;
-        do
-        {
-            r = spi_xfer(0xFF);
-        } while (((r & 0x80) == 0x80) && (i_byte == 0));
-
-        resp_bytes[i_byte] = r;
+        printf("%02X", (unsigned)resp_bytes[i]);
     }
-
-    sd_deselect();
-    (void)spi_xfer(0xFF);
+    printf("\n");
 }
 
-uint8_t sd_send_command_r1(uint8_t cmd, uint32_t arg)
-{
-    uint8_t r1;
+/* lba (u32 LE), count: count blocks, then the number read without
+ * error, the failed ones and those after them being zeros.
+ */
+#define SDCARD_CMD_READ (CMD_ID_USER + 0)
+#define SDCARD_READ_MAX 64
 
-    sd_send_command(cmd, arg, &r1, 1);
+static uint8_t block[512];
 
-    return r1;
-}
-
-extern
-uint8_t sd_read_single_block(uint32_t address, void *dst)
+static
+void cmd_read(const uint8_t *data, uint8_t len)
 {
-    uint8_t *dst_bytes;
-    uint8_t r1;
-    uint8_t data_ctrl;
-
-    sd_select();
-    send_cmd(17, address);
-    dst_bytes = dst;
-
-    do
-    {
-        r1 = spi_xfer(0xFF);
-    } while (r1 & 0x80);
-    
-    do
+    uint32_t lba;
+    uint8_t count;
+    uint8_t n_ok;
+    uint8_t err;
+    bool started;
+    uint8_t i;
+
+    if ((len != 5) || (data[4] == 0) || (data[4] > SDCARD_READ_MAX))
     {
-        data_ctrl = spi_xfer(0xFF);
-    } while (data_ctrl == 0xFF);
-    if (data_ctrl == 0xFE)
+        cmd_reply(CMD_ERR_ARGS, NULL, 0);
+        return;
+    }
+    lba = data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    count = data[4];
+
+    /* read a block, then transmit it: cmd_tx() polls UDRE0, so the
+     * two alternate, and the card waits between blocks of CMD18
+     */
+    cmd_reply_begin(CMD_OK, (count * (uint16_t)sizeof(block)) + 1);
+    n_ok = 0;
+    err = sd_read_multi_start(lba);
+    started = (err == 0);
+    for (i = 0; i < count; i++)
     {
-        int i_byte;
-        uint8_t crc16_hi;
-        uint8_t crc16_lo;
-
-        data_ctrl = 0x00;
-        for (i_byte = 0; i_byte < 512; i_byte++)
+        if (err == 0)
+        {
+            err = sd_read_multi_block(block);
+        }
+        if (err == 0)
+        {
+            n_ok++;
+        }
+        else
         {
-            dst_bytes[i_byte] = spi_xfer(0xFF);
+            memset(block, 0, sizeof(block));
         }
-        crc16_hi = spi_xfer(0xFF);
-        crc16_lo = spi_xfer(0xFF);
-        (void)crc16_hi;
-        (void)crc16_lo;
+        cmd_reply_data(block, sizeof(block));
     }
-
-    sd_deselect();
-    (void)spi_xfer(0xFF);
-
-    return data_ctrl;
+    if (started)
+    {
+        (void)sd_read_multi_stop();
+    }
+    cmd_reply_data(&n_ok, 1);
+    cmd_reply_end();
 }
 
+static const struct cmd_handler sdcard_cmds[] = {
+    {SDCARD_CMD_READ, cmd_read},
+};
+
 static
-void sd_init(void)
+int sdcard_serve(void)
 {
-    int i_dummy;
-
-    DDRB |=  _BV(DDB5); /* SCK */
-    DDRB &= ~_BV(DDB4); /* MISO */
-    DDRB |=  _BV(DDB3); /* MOSI */
-    DDRB |=  _BV(DDB2); /* SS (Wiznet) */
-    DDRD |=  _BV(DDD4); /* SD_CS */
+    int err;
 
-    PORTB &= ~_BV(PORTB4); /* MISO pull-up disable */
-    PORTB |=  _BV(PORTB2); /* WZ_SS high */
-    sd_deselect();
-
-    SPCR =  /* mode 0, MSB first */
-          _BV(MSTR)
-        | _BV(SPE)
-        | _BV(SPR0) | _BV(SPR0); /* 16MHz / 128 -> 125kHz */
-    
-    _delay_ms(1);
-    for (i_dummy = 0; i_dummy < 80; i_dummy++)
+    err = sd_card_init();
+    if (err != SD_OK)
+    {
+        printf("init error %d\n", err);
+        return -1;
+    }
+    printf("commands\n");
+    cmd_init(sdcard_cmds, sizeof(sdcard_cmds) / sizeof(sdcard_cmds[0]), NULL);
+    while (1)
     {
-        (void)spi_xfer(0xFF);
+        cmd_poll();
     }
+    return 0;
 }
 
+#if BENCH_ENABLE
+/* the SPDR path, then the double-buffered USART one */
 static
-void print_resp(uint8_t cmd, void *resp, size_t len)
+void sdcard_bench(void)
 {
-    size_t i;
-    uint8_t *resp_bytes;
-
-    printf("CMD%d: ", cmd);
-    resp_bytes = resp;
-    for (i = 0; i < len; i++)
-    {
-        printf("%02X", (unsigned)resp_bytes[i]);
-    }
-    printf("\n");
+    sd_bench();
+    uspi_bench();
 }
+#endif
 
 int main(void)
 {
@@ -219,13 +143,39 @@ int main(void)
     uint8_t r3[5];
     uint8_t r2[2];
     uint32_t arg_hcs;
-    uint8_t block[512];
+    uint32_t t_start;
+    uint32_t t_read;
+    struct sd_info info;
+    int key;
+
+    BENCH_RUN(sdcard_bench);
+
+    sei(); /* sysclock needs Timer2 overflow interrupt */
 
-    
-    printf("SD card SPI initialization...");
-    getchar();
+    printf("SD card SPI initialization (b for benchmark, c for commands)...");
+    key = getchar();
     printf("\n");
 
+    if (key == 'b')
+    {
+        printf("Overwrite blocks %lu to %lu? (y/n)",
+                (unsigned long)SDPERF_FIRST_LBA,
+                (unsigned long)(SDPERF_FIRST_LBA + SDPERF_BLOCKS - 1));
+        key = getchar();
+        printf("\n");
+        if (key != 'y')
+        {
+            return 1;
+        }
+        sd_set_trace(false);
+        return (sdperf_run() == 0) ? 0 : 1;
+    }
+    if (key == 'c')
+    {
+        sd_set_trace(false);
+        return (sdcard_serve() == 0) ? 0 : 1;
+    }
+
     sd_init();
 
     r1 = sd_send_command_r1(0, 0);
@@ -280,7 +230,21 @@ int main(void)
     sd_send_command(13, 0, r2, sizeof(r2));
     print_resp(13, r2, sizeof(r2));
 
+    r1 = sd_read_csd(block);
+    print_resp(9, (r1 == 0) ? block : &r1, (r1 == 0) ? 16 : 1);
+    r1 = sd_read_status(block);
+    printf("A");
+    print_resp(13, (r1 == 0) ? block : &r1, (r1 == 0) ? 64 : 1);
+    if (sd_get_info(&info) == SD_OK)
+    {
+        printf("%lu blocks, AU %lu blocks, erase %u AUs in %us+%us\n",
+                (unsigned long)info.n_blocks, (unsigned long)info.au_blocks,
+                info.erase_aus, info.erase_timeout_s, info.erase_offset_s);
+    }
+
+    t_start = sysclock_now_cycles();
     r1 = sd_read_single_block(0, block);
+    t_read = sysclock_now_cycles() - t_start;
     if (r1 == 0)
     {
         print_resp(17, block, sizeof(block));
@@ -289,6 +253,7 @@ int main(void)
     {
         print_resp(17, &r1, 1);
     }
+    printf("CMD17 took %lu us\n", (unsigned long)SYSCLOCK_CYCLES_TO_US(t_read));
 
     sd_send_command(13, 0, r2, sizeof(r2));
     print_resp(13, r2, sizeof(r2));
@@ -296,6 +261,8 @@ int main(void)
     sd_send_command(13, 0, r2, sizeof(r2));
     print_resp(13, r2, sizeof(r2));
 
+    prof_dump();
+
     return 0; 
 }
 
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include "hw.h"
+#include "sd_model.h"
+#include "sdperf.h"
+
+/* "make HOST=1": sdcard_host talks to an SDHC card model, covering the
+ * benchmark blocks, with stdio on the terminal:
+ *
+ *   echo by | ./sdcard_host
+ */
+
+#define SDCARD_HOST_BLOCKS (SDPERF_FIRST_LBA + SDPERF_BLOCKS)
+
+/* After host_init(), before the drivers' constructors */
+__attribute__((constructor(102)))
+static
+void sdcard_host_init(void)
+{
+    static struct sd_model card;
+    void *image;
+
+    image = calloc(SDCARD_HOST_BLOCKS, SD_MODEL_BLOCK); /* pages mapped on use */
+    if (image == NULL)
+    {
+        host_fatal("out of memory");
+    }
+    sd_model_attach(&card, image, SDCARD_HOST_BLOCKS, true);
+    card.write_slow_every = 16;
+    card.au_size = 9; /* 4MB */
+}
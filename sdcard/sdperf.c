@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "sd.h"
+#include "sdperf.h"
+#include "sysclock.h"
+
+#define SDPERF_HIST_BUCKETS 20 /* up to 2^19us, ~0.5s */
+
+struct sdperf_stats {
+    uint16_t n;
+    uint16_t errors;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t total_us;
+};
+
+static uint8_t sdperf_block[512];
+static uint16_t sdperf_hist[SDPERF_HIST_BUCKETS];
+
+static
+void stats_reset(struct sdperf_stats *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->min_us = UINT32_MAX;
+}
+
+static
+void stats_add(struct sdperf_stats *s, uint32_t us, uint8_t err)
+{
+    s->n++;
+    if (err != 0)
+    {
+        s->errors++;
+    }
+    if (us < s->min_us)
+    {
+        s->min_us = us;
+    }
+    if (us > s->max_us)
+    {
+        s->max_us = us;
+    }
+    s->total_us += us;
+}
+
+/* total_us is the time of the whole transfer, for the throughput */
+static
+void stats_print(uint32_t hz, const char *test, const struct sdperf_stats *s, uint32_t total_us)
+{
+    uint32_t avg_us;
+    uint32_t kb_s;
+
+    avg_us = (s->n > 0) ? (s->total_us / s->n) : 0;
+    kb_s = (total_us > 0) ? ((uint32_t)s->n * 512000UL / total_us) : 0;
+    printf("sdperf,%lu,%s,%u,%u,%lu,%lu,%lu,%lu\n",
+            (unsigned long)hz, test, s->n, s->errors,
+            (unsigned long)((s->n > 0) ? s->min_us : 0),
+            (unsigned long)avg_us, (unsigned long)s->max_us,
+            (unsigned long)kb_s);
+}
+
+static
+void hist_add(uint32_t us)
+{
+    uint8_t bucket;
+
+    /* bucket i counts [2^(i-1), 2^i) */
+    bucket = 0;
+    while ((us != 0) && (bucket < (SDPERF_HIST_BUCKETS - 1)))
+    {
+        us >>= 1;
+        bucket++;
+    }
+    sdperf_hist[bucket]++;
+}
+
+static
+void hist_print(uint32_t hz)
+{
+    uint8_t i;
+
+    for (i = 0; i < SDPERF_HIST_BUCKETS; i++)
+    {
+        if (sdperf_hist[i] != 0)
+        {
+            printf("sdperf,%lu,busy,%lu,%lu,%u\n", (unsigned long)hz,
+                    (unsigned long)((i > 0) ? (1UL << (i - 1)) : 0),
+                    (unsigned long)(1UL << i), sdperf_hist[i]);
+        }
+    }
+}
+
+/* Recognizable content, different for each block and clock */
+static
+void block_fill(uint32_t lba, uint8_t seed)
+{
+    uint16_t i;
+
+    for (i = 0; i < sizeof(sdperf_block); i++)
+    {
+        sdperf_block[i] = (uint8_t)(lba ^ seed ^ i);
+    }
+}
+
+static
+bool block_check(uint32_t lba, uint8_t seed)
+{
+    uint16_t i;
+
+    for (i = 0; i < sizeof(sdperf_block); i++)
+    {
+        if (sdperf_block[i] != (uint8_t)(lba ^ seed ^ i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static
+uint16_t sdperf_single(uint32_t hz, uint8_t seed)
+{
+    struct sdperf_stats s;
+    uint32_t lba;
+    uint16_t errors;
+
+    stats_reset(&s);
+    for (lba = SDPERF_FIRST_LBA; lba < (SDPERF_FIRST_LBA + SDPERF_SINGLE); lba++)
+    {
+        uint32_t t;
+        uint8_t err;
+
+        block_fill(lba, seed);
+        t = sysclock_now_us();
+        err = sd_write_block(lba, sdperf_block);
+        stats_add(&s, sysclock_now_us() - t, err);
+    }
+    stats_print(hz, "write1", &s, s.total_us);
+    errors = s.errors;
+
+    stats_reset(&s);
+    for (lba = SDPERF_FIRST_LBA; lba < (SDPERF_FIRST_LBA + SDPERF_SINGLE); lba++)
+    {
+        uint32_t t;
+        uint8_t err;
+
+        t = sysclock_now_us();
+        err = sd_read_block(lba, sdperf_block);
+        stats_add(&s, sysclock_now_us() - t, err);
+        if ((err == 0) && !block_check(lba, seed))
+        {
+            s.errors++;
+        }
+    }
+    stats_print(hz, "read1", &s, s.total_us);
+
+    return errors + s.errors;
+}
+
+static
+uint16_t sdperf_write_multi(uint32_t hz, uint8_t seed)
+{
+    struct sdperf_stats s;
+    uint32_t lba;
+    uint32_t t;
+    uint32_t total_us;
+    uint8_t err;
+
+    stats_reset(&s);
+    memset(sdperf_hist, 0, sizeof(sdperf_hist));
+    block_fill(SDPERF_FIRST_LBA, seed);
+    t = sysclock_now_us();
+    err = sd_write_multi_start(SDPERF_FIRST_LBA);
+    total_us = sysclock_now_us() - t;
+    if (err != 0)
+    {
+        s.errors++;
+        stats_print(hz, "writeN", &s, 0);
+        return s.errors;
+    }
+    for (lba = SDPERF_FIRST_LBA; lba < (SDPERF_FIRST_LBA + SDPERF_BLOCKS); lba++)
+    {
+        uint32_t t_sent;
+        uint32_t t_ready;
+
+        /* busy time measured apart from the data transfer */
+        t = sysclock_now_us();
+        err = sd_write_multi_block(sdperf_block);
+        t_sent = sysclock_now_us();
+        if (!sd_busy_wait())
+        {
+            err = 0xFF;
+        }
+        t_ready = sysclock_now_us();
+        stats_add(&s, t_ready - t, err);
+        hist_add(t_ready - t_sent);
+        total_us += t_ready - t;
+        block_fill(lba + 1, seed); /* not timed */
+    }
+    t = sysclock_now_us();
+    err = sd_write_multi_stop();
+    total_us += sysclock_now_us() - t;
+    if (err != 0)
+    {
+        s.errors++;
+    }
+    stats_print(hz, "writeN", &s, total_us);
+    hist_print(hz);
+
+    return s.errors;
+}
+
+static
+uint16_t sdperf_read_multi(uint32_t hz, uint8_t seed)
+{
+    struct sdperf_stats s;
+    uint32_t lba;
+    uint32_t t;
+    uint32_t total_us;
+    uint8_t err;
+
+    stats_reset(&s);
+    t = sysclock_now_us();
+    err = sd_read_multi_start(SDPERF_FIRST_LBA);
+    total_us = sysclock_now_us() - t;
+    if (err != 0)
+    {
+        s.errors++;
+        stats_print(hz, "readN", &s, 0);
+        return s.errors;
+    }
+    for (lba = SDPERF_FIRST_LBA; lba < (SDPERF_FIRST_LBA + SDPERF_BLOCKS); lba++)
+    {
+        uint32_t us;
+
+        t = sysclock_now_us();
+        err = sd_read_multi_block(sdperf_block);
+        us = sysclock_now_us() - t;
+        stats_add(&s, us, err);
+        total_us += us;
+        if ((err == 0) && !block_check(lba, seed)) /* not timed */
+        {
+            s.errors++;
+        }
+    }
+    t = sysclock_now_us();
+    err = sd_read_multi_stop();
+    total_us += sysclock_now_us() - t;
+    if (err != 0)
+    {
+        s.errors++;
+    }
+    stats_print(hz, "readN", &s, total_us);
+
+    return s.errors;
+}
+
+int sdperf_run(void)
+{
+    struct sd_info info;
+    uint32_t t;
+    int err;
+    int failures;
+    uint16_t div;
+
+    t = sysclock_now_us();
+    err = sd_card_init();
+    t = sysclock_now_us() - t;
+    if (err != SD_OK)
+    {
+        printf("sdperf,init_error,%d\n", err);
+        return -1;
+    }
+    printf("sdperf,init,%lu,%d\n", (unsigned long)t, sd_is_high_capacity());
+    if (sd_get_info(&info) == SD_OK)
+    {
+        printf("sdperf,card,%lu,%lu\n",
+                (unsigned long)info.n_blocks, (unsigned long)info.au_blocks);
+    }
+    printf("sdperf,spi_hz,test,blocks,errors,min_us,avg_us,max_us,kB/s\n");
+
+    failures = 0;
+    for (div = 2; div <= 128; div *= 2)
+    {
+        uint32_t hz;
+
+        hz = F_CPU / div;
+        sd_set_clock(hz);
+        failures += sdperf_single(hz, div);
+        failures += sdperf_write_multi(hz, div);
+        failures += sdperf_read_multi(hz, div);
+    }
+    sd_set_fast_clock();
+    printf("sdperf,end\n");
+
+    return failures;
+}
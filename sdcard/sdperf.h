@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SDPERF_H
+#define SDPERF_H
+
+#include <stdint.h>
+
+/* Card qualification: init time, latency of single and multiple block
+ * transfers, sustained throughput and busy times, at each SPI clock
+ * from F_CPU/2 down to F_CPU/128.
+ *
+ * Writes overwrite SDPERF_BLOCKS blocks from SDPERF_FIRST_LBA: use a
+ * scratch card. Results are printed on stdout, one CSV line each:
+ *
+ *   sdperf,init,<us>,<high capacity>
+ *   sdperf,card,<blocks>,<allocation unit blocks>
+ *   sdperf,<spi_hz>,<test>,<blocks>,<errors>,<min_us>,<avg_us>,<max_us>,<kB/s>
+ *   sdperf,<spi_hz>,busy,<from_us>,<to_us>,<count>
+ *   sdperf,end
+ *
+ * Tests are read1/write1 (CMD17/CMD24, chip select included) and
+ * readN/writeN (CMD18/CMD25, blocks of one transfer, stop included
+ * only in the throughput). The busy histogram has the programming time
+ * of each writeN block, in power of 2 buckets.
+ */
+
+#ifndef SDPERF_FIRST_LBA
+#  define SDPERF_FIRST_LBA 0x10000UL /* 32MB from the start */
+#endif
+
+#define SDPERF_BLOCKS 64 /* per multiple block transfer */
+#define SDPERF_SINGLE 16 /* single block transfers */
+
+/* Returns the number of failed transfers, or -1 if init failed. */
+extern int sdperf_run(void);
+
+#endif /* SDPERF_H */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2016 Francesco Balducci
+ *
+ * This file is part of arduino_c.
+ *
+ *    arduino_c is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    arduino_c is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with arduino_c.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "dds.h"
+#include "sd.h"
+
+#define SYNTH_RATE_HZ 16000
+
+/* Raw 8-bit unsigned mono PCM at SYNTH_RATE_HZ, written on the card
+ * starting at block SYNTH_PCM_LBA, for example with:
+ *   dd if=sound.raw of=/dev/sdX seek=SYNTH_PCM_LBA
+ */
+#ifndef SYNTH_PCM_LBA
+#define SYNTH_PCM_LBA 2048UL
+#endif
+#ifndef SYNTH_PCM_BLOCKS
+#define SYNTH_PCM_BLOCKS 320UL /* ~10s */
+#endif
+
+struct synth_pcm {
+    uint32_t lba;
+    uint32_t end;
+};
+
+static uint8_t synth_pcm_buf[2 * DDS_STREAM_BLOCK];
+
+static bool synth_pcm_fill(uint8_t *dst, void *ctx)
+{
+    struct synth_pcm *pcm = ctx;
+
+    if (pcm->lba == pcm->end)
+    {
+        return false;
+    }
+    return sd_read_block(pcm->lba++, dst) == 0;
+}
+
+static void synth_chord(void)
+{
+    /* A major */
+    dds_voice_set(0, dds_wave_sine, DDS_INC(440, SYNTH_RATE_HZ), 255);
+    _delay_ms(300);
+    dds_voice_set(1, dds_wave_sine, DDS_INC(554, SYNTH_RATE_HZ), 255);
+    _delay_ms(300);
+    dds_voice_set(2, dds_wave_sine, DDS_INC(659, SYNTH_RATE_HZ), 255);
+    _delay_ms(300);
+    dds_voice_set(3, dds_wave_triangle, DDS_INC(220, SYNTH_RATE_HZ), 255);
+    _delay_ms(1000);
+    dds_voice_off(0);
+    dds_voice_off(1);
+    dds_voice_off(2);
+    dds_voice_off(3);
+}
+
+static void synth_sweep(void)
+{
+    uint16_t hz;
+
+    for (hz = 100; hz < 4000; hz += 20)
+    {
+        dds_voice_set_freq(0, dds_wave_saw, hz, 128);
+        _delay_ms(5);
+    }
+    dds_voice_off(0);
+}
+
+int main(void)
+{
+    struct synth_pcm pcm;
+
+    dds_init(SYNTH_RATE_HZ);
+    sei();
+
+    synth_chord();
+    synth_sweep();
+
+    if (sd_card_init() == SD_OK)
+    {
+        pcm.lba = SYNTH_PCM_LBA;
+        pcm.end = SYNTH_PCM_LBA + SYNTH_PCM_BLOCKS;
+        dds_stream_start(synth_pcm_buf, synth_pcm_fill, &pcm, 255);
+        while (dds_stream_poll())
+        {
+            /* the main loop is free for other work */
+        }
+    }
+
+    dds_stop();
+    while (true)
+    {
+    }
+    return 0;
+}
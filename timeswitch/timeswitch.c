@@ -19,12 +19,20 @@
 #include <stdbool.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "power.h"
+#include "sched.h"
+#include "timer_solver.h"
 
-#define T1_MAX 0xFFFFUL
-#define T1_PRESCALER 1024
-#define T1_TICK_US (T1_PRESCALER/(F_CPU/1000000UL)) /* 64us @ 16MHz */
-#define T1_MAX_US (T1_TICK_US * T1_MAX) /* ~4.2s @ 16MHz */
+#define TIMEOUT_MS 2000UL /* LED stays on after button release */
+#define TIMEOUT_CYCLES TIMER_MS_CYCLES(TIMEOUT_MS)
+#define T1_CS TIMER01_CS(TIMEOUT_CYCLES, TIMER16_MAX) /* 1024 @ 16MHz */
+#define T1_TOP TIMER01_TOP(TIMEOUT_CYCLES, TIMER16_MAX)
+
+TIMER01_CHECK(TIMEOUT_CYCLES, TIMER16_MAX, 1000); /* 0.1% */
+
+static uint8_t button_task;
+static bool timer_running; /* holds Timer1, its interrupt keeps sched in Idle */
 
 static void led_on(void)
 {
@@ -44,62 +52,55 @@ static void led_init(void)
 
 static void timer_stop(void)
 {
-    TCCR1B &= ~(_BV(CS10)|_BV(CS11)|_BV(CS12)); /* stop timer clock */
-    TIMSK1 &= ~_BV(TOIE1); /* disable interrupt */
-    TIFR1 |= _BV(TOV1); /* clear interrupt flag */
-}
-
-static void timer_init(void)
-{
-    /* normal mode */
-    TCCR1A &= ~(_BV(WGM10)|_BV(WGM11));
-    TCCR1B &= ~(_BV(WGM13)|_BV(WGM12));
-    timer_stop();
-}
-
-static void timer_start(unsigned long us)
-{
-    unsigned long ticks_long;
-    unsigned short ticks;
-
-    ticks_long = us / T1_TICK_US;
-    if (ticks_long >= T1_MAX)
+    if (timer_running)
     {
-        ticks = T1_MAX;
+        TCCR1B &= ~(_BV(CS10)|_BV(CS11)|_BV(CS12)); /* stop timer clock */
+        TIMSK1 &= ~_BV(OCIE1A); /* disable interrupt */
+        TIFR1 = _BV(OCF1A); /* clear interrupt flag */
+        timer_running = false;
+        power_put(POWER_TIMER1); /* registers unreachable from now on */
     }
-    else
-    {
-        ticks = ticks_long;
-    }
-    TCNT1 = T1_MAX - ticks; /* overflow in ticks*1024 clock cycles */
-
-    TIMSK1 |= _BV(TOIE1); /* enable overflow interrupt */
-    /* start timer clock */
-    TCCR1B &= ~(_BV(CS10)|_BV(CS11)|_BV(CS12));
-    TCCR1B |= _BV(CS10)|_BV(CS12); /* prescaler: 1024 */
 }
 
-static void timer_start_ms(unsigned short ms)
+/* Prescaler and TOP are solved at compile time for TIMEOUT_MS */
+static void timer_start(void)
 {
-    timer_start(ms * 1000UL);
+    power_get(POWER_TIMER1);
+    /* CTC mode, TOP = OCR1A */
+    TCCR1A &= ~(_BV(WGM10)|_BV(WGM11));
+    TCCR1B = (TCCR1B & ~_BV(WGM13)) | _BV(WGM12);
+    OCR1A = T1_TOP;
+    TCNT1 = 0;
+    TIFR1 = _BV(OCF1A); /* clear interrupt flag */
+    TIMSK1 |= _BV(OCIE1A); /* enable compare A interrupt */
+    TCCR1B |= T1_CS; /* start timer clock */
+    timer_running = true;
 }
 
-ISR(TIMER1_OVF_vect) /* timer 1 interrupt service routine */
+ISR(TIMER1_COMPA_vect) /* timer 1 interrupt service routine */
 {
     timer_stop();
     led_off(); /* timeout expired: turn off LED */
 }
 
-ISR(PCINT0_vect) /* pin change interrupt service routine */
+static void button_run(void)
 {
-    led_on();
-    timer_stop();
-    if (bit_is_set(PINB, PINB4)) /* button released */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) /* timer is also stopped by its ISR */
     {
-        timer_start_ms(2000); /* timeout to turn off LED */
+        led_on();
+        timer_stop();
+        if (bit_is_set(PINB, PINB4)) /* button released */
+        {
+            timer_start(); /* timeout to turn off LED */
+        }
     }
 }
 
+ISR(PCINT0_vect) /* pin change interrupt service routine */
+{
+    sched_post(button_task); /* wakes up from Power-down too */
+}
+
 static void button_init(void)
 {
     DDRB &= ~_BV(DDB4); /* PORTB4 as input */
@@ -112,11 +113,10 @@ int main (void)
 {
     led_init();
     button_init();
-    timer_init();
+    sched_init();
+    power_init(); /* Timer1 only while the timeout runs */
+    button_task = sched_add(button_run, SCHED_PRIO_NORMAL);
     sei(); /* enable interrupts globally */
-    while(true)
-    {
-        sleep_mode();
-    }
+    sched_run(); /* Power-down unless the timeout is running */
 }
 